@@ -0,0 +1,373 @@
+#include "AssetBundle.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+//按扩展名确定Content-Type,未列出的按二进制下载处理
+static const char *MIME_TYPES[][2] = {
+    {".html", "text/html"},
+    {".htm", "text/html"},
+    {".css", "text/css"},
+    {".js", "application/javascript"},
+    {".json", "application/json"},
+    {".txt", "text/plain"},
+    {".xml", "application/xml"},
+    {".svg", "image/svg+xml"},
+    {".png", "image/png"},
+    {".jpg", "image/jpeg"},
+    {".jpeg", "image/jpeg"},
+    {".gif", "image/gif"},
+    {".webp", "image/webp"},
+    {".ico", "image/x-icon"},
+    {".woff", "font/woff"},
+    {".woff2", "font/woff2"},
+    {".wasm", "application/wasm"},
+    {".pdf", "application/pdf"},
+    {".mp4", "video/mp4"},
+};
+
+AssetBundle::AssetBundle() : base_(NULL), size_(0), header_(NULL), entries_(NULL), table_(NULL)
+{
+}
+
+AssetBundle::~AssetBundle()
+{
+    if (base_) {
+        munmap(base_, size_);
+    }
+}
+
+uint64_t AssetBundle::Hash(const char *data, int len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+const char* AssetBundle::MimeType(const char *path)
+{
+    const char *dot = strrchr(path, '.');
+    if (dot && !strchr(dot, '/')) {
+        for (size_t i = 0; i < sizeof(MIME_TYPES) / sizeof(MIME_TYPES[0]); i++) {
+            if (strcasecmp(dot, MIME_TYPES[i][0]) == 0) {
+                return MIME_TYPES[i][1];
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+//[off, off + len)是否在文件内
+static bool InRange(uint64_t off, uint64_t len, size_t size)
+{
+    return off <= size && len <= size - off;
+}
+
+/*
+Load()
+    MAP_POPULATE在启动时把整个包读入页缓存并建立映射,工作线程发送时不会缺页阻塞
+    逐条检查偏移,损坏或截断的包加载失败,不会在请求处理时越界
+*/
+bool AssetBundle::Load(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        printf("open %s failure, errno = %d\n", path, errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(BundleHeader)) {
+        printf("%s is not an asset bundle\n", path);
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    char *base = (char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        printf("mmap %s failure, errno = %d\n", path, errno);
+        return false;
+    }
+
+    const BundleHeader *header = (const BundleHeader *)base;
+    bool ok = memcmp(header->magic, BUNDLE_MAGIC, sizeof(header->magic)) == 0 && header->size == size &&
+              header->buckets > header->count && (header->buckets & (header->buckets - 1)) == 0 &&
+              header->entries_off % sizeof(uint64_t) == 0 && header->table_off % sizeof(uint32_t) == 0 &&
+              InRange(header->entries_off, (uint64_t)header->count * sizeof(BundleEntry), size) &&
+              InRange(header->table_off, (uint64_t)header->buckets * sizeof(uint32_t), size);
+    const BundleEntry *entries = (const BundleEntry *)(base + header->entries_off);
+    const uint32_t *table = (const uint32_t *)(base + header->table_off);
+    for (uint32_t i = 0; ok && i < header->count; i++) {
+        const BundleEntry &e = entries[i];
+        ok = InRange(e.path_off, e.path_len, size) && InRange(e.keepalive_off, e.keepalive_len, size) &&
+             InRange(e.close_off, e.close_len, size) && InRange(e.data_off, e.data_len, size) &&
+             memchr(base + e.mime_off, '\0', e.mime_off < size ? size - e.mime_off : 0) != NULL;
+    }
+    //Find在遇到空槽位时才判定未命中,槽位表中必须留有空位,否则查找不存在的路径会一直循环
+    uint32_t used = 0;
+    for (uint32_t i = 0; ok && i < header->buckets; i++) {
+        ok = table[i] <= header->count;
+        used += table[i] != 0;
+    }
+    ok = ok && used <= header->count;
+    if (!ok) {
+        printf("%s is corrupted or was built by another version\n", path);
+        munmap(base, size);
+        return false;
+    }
+
+    if (base_) {
+        munmap(base_, size_);
+    }
+    base_ = base;
+    size_ = size;
+    header_ = header;
+    entries_ = entries;
+    table_ = table;
+    return true;
+}
+
+const BundleEntry* AssetBundle::Find(const char *path, int len) const
+{
+    if (!header_ || header_->count == 0) {
+        return NULL;
+    }
+    uint64_t hash = Hash(path, len);
+    uint32_t mask = header_->buckets - 1;
+    for (uint32_t i = hash & mask; ; i = (i + 1) & mask) {
+        uint32_t slot = table_[i];
+        if (slot == 0) {
+            return NULL;
+        }
+        const BundleEntry *entry = &entries_[slot - 1];
+        if (entry->hash == hash && entry->path_len == (uint32_t)len &&
+            memcmp(base_ + entry->path_off, path, len) == 0) {
+            return entry;
+        }
+    }
+}
+
+const char* AssetBundle::Head(const BundleEntry *entry, bool linger, int *len) const
+{
+    if (linger) {
+        *len = entry->keepalive_len;
+        return base_ + entry->keepalive_off;
+    }
+    *len = entry->close_len;
+    return base_ + entry->close_off;
+}
+
+//打包时的一个条目,目录索引与对应的index.html共用一个文件
+struct PackItem
+{
+    std::string url;
+    int file;               //files中的下标
+};
+
+struct PackFile
+{
+    std::string path;       //文件系统路径
+    uint64_t size;
+    int64_t mtime;
+    uint64_t data_off;
+};
+
+static bool Walk(const std::string &dir, const std::string &url, std::vector<PackFile> &files,
+                 std::vector<PackItem> &items)
+{
+    DIR *d = opendir(dir.c_str());
+    if (!d) {
+        printf("opendir %s failure, errno = %d\n", dir.c_str(), errno);
+        return false;
+    }
+    std::vector<std::string> names;
+    while (struct dirent *ent = readdir(d)) {
+        if (ent->d_name[0] != '.') {
+            names.push_back(ent->d_name);
+        }
+    }
+    closedir(d);
+    //按名字排序,同样的目录每次打出相同的包
+    std::sort(names.begin(), names.end());
+
+    bool ok = true;
+    for (size_t i = 0; i < names.size() && ok; i++) {
+        std::string path = dir + "/" + names[i];
+        struct stat st;
+        if (stat(path.c_str(), &st) < 0) {
+            printf("stat %s failure, errno = %d\n", path.c_str(), errno);
+            return false;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            ok = Walk(path, url + names[i] + "/", files, items);
+            continue;
+        }
+        if (!S_ISREG(st.st_mode)) {
+            continue;
+        }
+        PackFile file = {path, (uint64_t)st.st_size, (int64_t)st.st_mtime, 0};
+        files.push_back(file);
+        PackItem item = {url + names[i], (int)files.size() - 1};
+        items.push_back(item);
+        if (names[i] == "index.html") {
+            PackItem index = {url, item.file};
+            items.push_back(index);
+        }
+    }
+    return ok;
+}
+
+//与ResponseCache中缓存的响应头格式一致,多了Content-Type
+static std::string FormatHead(uint64_t body_len, const char *mime, bool linger)
+{
+    char head[256];
+    snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Length:%llu\r\nContent-Type:%s\r\nConnection:%s\r\n\r\n",
+             (unsigned long long)body_len, mime, linger ? "keep-alive" : "close");
+    return head;
+}
+
+static uint64_t Align(uint64_t off)
+{
+    return (off + BUNDLE_ALIGN - 1) / BUNDLE_ALIGN * BUNDLE_ALIGN;
+}
+
+static bool CopyFile(FILE *out, const PackFile &file)
+{
+    FILE *in = fopen(file.path.c_str(), "rb");
+    if (!in) {
+        printf("open %s failure, errno = %d\n", file.path.c_str(), errno);
+        return false;
+    }
+    char buf[65536];
+    uint64_t copied = 0;
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        fwrite(buf, 1, n, out);
+        copied += n;
+    }
+    fclose(in);
+    //打包期间文件被修改,长度对不上时放弃,避免响应头与响应体不一致
+    if (copied != file.size) {
+        printf("%s changed while packing\n", file.path.c_str());
+        return false;
+    }
+    return true;
+}
+
+/*
+Pack()
+    先确定所有字符串和响应体的偏移,再按布局顺序写出,写到临时文件后rename,服务器不会读到写了一半的包
+*/
+bool AssetBundle::Pack(const char *dir, const char *out)
+{
+    std::vector<PackFile> files;
+    std::vector<PackItem> items;
+    if (!Walk(dir, "/", files, items)) {
+        return false;
+    }
+
+    BundleHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+    header.count = items.size();
+    header.buckets = 16;
+    while (header.buckets < header.count * 2) {
+        header.buckets *= 2;
+    }
+    header.entries_off = sizeof(BundleHeader);
+    header.table_off = header.entries_off + header.count * sizeof(BundleEntry);
+
+    std::vector<BundleEntry> entries(items.size());
+    std::vector<uint32_t> table(header.buckets, 0);
+    std::string strings;
+    uint64_t strings_off = header.table_off + header.buckets * sizeof(uint32_t);
+    for (size_t i = 0; i < items.size(); i++) {
+        const PackItem &item = items[i];
+        const PackFile &file = files[item.file];
+        const char *mime = MimeType(file.path.c_str());
+        BundleEntry &e = entries[i];
+        memset(&e, 0, sizeof(e));
+        e.hash = Hash(item.url.data(), item.url.size());
+        e.path_off = strings_off + strings.size();
+        e.path_len = item.url.size();
+        strings += item.url;
+        e.mime_off = strings_off + strings.size();
+        strings.append(mime, strlen(mime) + 1);
+        std::string keepalive = FormatHead(file.size, mime, true);
+        std::string closed = FormatHead(file.size, mime, false);
+        e.keepalive_off = strings_off + strings.size();
+        e.keepalive_len = keepalive.size();
+        strings += keepalive;
+        e.close_off = strings_off + strings.size();
+        e.close_len = closed.size();
+        strings += closed;
+        e.data_len = file.size;
+        e.mtime = file.mtime;
+
+        uint32_t mask = header.buckets - 1;
+        uint32_t slot = e.hash & mask;
+        while (table[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        table[slot] = i + 1;
+    }
+    if (strings_off + strings.size() > UINT32_MAX) {
+        printf("too many assets in %s\n", dir);
+        return false;
+    }
+
+    uint64_t off = Align(strings_off + strings.size());
+    for (size_t i = 0; i < files.size(); i++) {
+        files[i].data_off = off;
+        off = Align(off + files[i].size);
+    }
+    header.size = off;
+    for (size_t i = 0; i < items.size(); i++) {
+        entries[i].data_off = files[items[i].file].data_off;
+    }
+
+    std::string tmp = std::string(out) + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (!fp) {
+        printf("open %s failure, errno = %d\n", tmp.c_str(), errno);
+        return false;
+    }
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(entries.data(), sizeof(BundleEntry), entries.size(), fp);
+    fwrite(table.data(), sizeof(uint32_t), table.size(), fp);
+    fwrite(strings.data(), 1, strings.size(), fp);
+    bool ok = true;
+    for (size_t i = 0; i < files.size() && ok; i++) {
+        fseek(fp, files[i].data_off, SEEK_SET);
+        ok = CopyFile(fp, files[i]);
+    }
+    //最后一个响应体之后补齐到对齐边界,文件长度与header.size一致
+    if (ok && (uint64_t)ftell(fp) < header.size) {
+        fseek(fp, header.size - 1, SEEK_SET);
+        fputc(0, fp);
+    }
+    ok = ok && fflush(fp) == 0 && !ferror(fp);
+    fclose(fp);
+    if (!ok || rename(tmp.c_str(), out) < 0) {
+        printf("write %s failure\n", out);
+        unlink(tmp.c_str());
+        return false;
+    }
+    printf("packed %zu files (%u paths) into %s, %llu bytes\n", files.size(), header.count, out,
+           (unsigned long long)header.size);
+    return true;
+}
@@ -0,0 +1,76 @@
+#ifndef ASSET_BUNDLE_H
+#define ASSET_BUNDLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+const char BUNDLE_MAGIC[8] = "WSBNDL1";     //文件开头的标识,格式变化时改最后一位
+const int BUNDLE_ALIGN = 64;                //响应体按缓存行对齐
+
+/*
+资源包文件格式,所有偏移都相对文件开头,字节序与打包机器相同
+    BundleHeader | BundleEntry[count] | 槽位表uint32_t[buckets] | 字符串区 | 响应体
+    槽位表以路径哈希开放寻址,存条目下标加一,0表示空槽
+    字符串区存放路径、MIME类型和预先生成的两种响应头,响应体连续存放
+*/
+struct BundleHeader
+{
+    char magic[8];
+    uint32_t count;         //条目数
+    uint32_t buckets;       //槽位数,2的幂,至少是条目数的两倍
+    uint64_t entries_off;
+    uint64_t table_off;
+    uint64_t size;          //文件总长度,加载时校验,防止读到截断的包
+};
+
+struct BundleEntry
+{
+    uint64_t hash;          //请求路径的FNV-1a哈希
+    uint32_t path_off;      //请求路径,如"/images/a.jpg";目录的"/"结尾路径指向其中的index.html
+    uint32_t path_len;
+    uint32_t mime_off;      //以'\0'结尾
+    uint32_t keepalive_off; //"HTTP/1.1 200 OK"到空行的完整响应头,与ResponseCache的格式一致并多了Content-Type
+    uint32_t keepalive_len;
+    uint32_t close_off;
+    uint32_t close_len;
+    uint32_t reserved;
+    uint64_t data_off;
+    uint64_t data_len;
+    int64_t mtime;          //打包时文件的修改时间
+};
+
+/*
+静态资源包
+    由bundle_pack在构建时把resources目录打成一个文件,服务器启动时只读映射一次并预读全部页
+    查找只计算一次请求路径的哈希并比较路径,不拼接路径,也不调用stat/open/mmap
+    映射区在进程生命周期内不释放,响应头和响应体都直接作为writev的iovec发送
+*/
+class AssetBundle
+{
+public:
+    AssetBundle();
+    ~AssetBundle();
+
+    bool Load(const char *path);
+    int Count() const { return header_ ? header_->count : 0; }
+
+    //path为已解码、不含查询字符串的请求路径
+    const BundleEntry* Find(const char *path, int len) const;
+    const char* Head(const BundleEntry *entry, bool linger, int *len) const;
+    const char* Body(const BundleEntry *entry) const { return base_ + entry->data_off; }
+    const char* Mime(const BundleEntry *entry) const { return base_ + entry->mime_off; }
+
+    //构建时调用:把dir下的普通文件(不含以'.'开头的)打包写入out
+    static bool Pack(const char *dir, const char *out);
+    static uint64_t Hash(const char *data, int len);
+    static const char* MimeType(const char *path);
+
+private:
+    char *base_;
+    size_t size_;
+    const BundleHeader *header_;
+    const BundleEntry *entries_;
+    const uint32_t *table_;
+};
+
+#endif
@@ -0,0 +1,13 @@
+#include <stdio.h>
+
+#include "AssetBundle.h"
+
+//构建时把静态资源目录打成资源包: ./bundle_pack resources resources.bundle
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        printf("Usage: ./bundle_pack dir out.bundle\n");
+        return 1;
+    }
+    return AssetBundle::Pack(argv[1], argv[2]) ? 0 : 1;
+}
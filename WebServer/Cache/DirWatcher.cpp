@@ -0,0 +1,119 @@
+#include "DirWatcher.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ResponseCache:内容修改、权限变化、被替换/移走/删除,以及目录本身被删除或移走
+PathCache在此之外还需要IN_CREATE,新建的文件使负缓存失效
+*/
+static const uint32_t WATCH_MASK = IN_CREATE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE |
+                                   IN_DELETE_SELF | IN_MOVE_SELF;
+
+DirWatcher::DirWatcher() : inotify_fd_(-1), lock_("dir_watch")
+{
+}
+
+DirWatcher::~DirWatcher()
+{
+    if (inotify_fd_ != -1) {
+        close(inotify_fd_);
+    }
+}
+
+bool DirWatcher::Init()
+{
+    if (inotify_fd_ == -1) {
+        inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    }
+    return inotify_fd_ != -1;
+}
+
+bool DirWatcher::AfterFork()
+{
+    if (inotify_fd_ == -1) {
+        return true;
+    }
+    close(inotify_fd_);
+    dirs_.clear();
+    watches_.clear();
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    return inotify_fd_ != -1;
+}
+
+void DirWatcher::AddHandler(EventHandler handler, void* arg)
+{
+    handlers_.push_back(std::make_pair(handler, arg));
+}
+
+//目录不存在是扫描器请求的常态,不打印
+bool DirWatcher::Watch(const std::string& path)
+{
+    if (inotify_fd_ == -1) {
+        return false;
+    }
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos || slash == 0 ? "/" : path.substr(0, slash);
+    bool ok = true;
+    lock_.Lock();
+    if (dirs_.find(dir) == dirs_.end()) {
+        int wd = inotify_add_watch(inotify_fd_, dir.c_str(), WATCH_MASK);
+        if (wd < 0) {
+            if (errno != ENOENT && errno != ENOTDIR) {
+                printf("inotify_add_watch %s failure, errno = %d\n", dir.c_str(), errno);
+            }
+            ok = false;
+        }
+        else {
+            dirs_[dir] = wd;
+            watches_[wd] = dir;
+        }
+    }
+    lock_.UnLock();
+    return ok;
+}
+
+void DirWatcher::Dispatch(const std::string& dir, const struct inotify_event* ev)
+{
+    for (size_t i = 0; i < handlers_.size(); i++) {
+        handlers_[i].first(handlers_[i].second, dir, ev);
+    }
+}
+
+/*
+HandleEvents()
+    ET模式下读到EAGAIN为止
+    目录被删除或移走后监视自动解除(IN_IGNORED),从表中移除,下次Watch时重新监视
+*/
+void DirWatcher::HandleEvents()
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true) {
+        ssize_t n = read(inotify_fd_, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        for (char *p = buf; p < buf + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                Dispatch(std::string(), ev);
+                continue;
+            }
+            std::string dir;
+            lock_.Lock();
+            std::unordered_map<int, std::string>::iterator it = watches_.find(ev->wd);
+            if (it != watches_.end()) {
+                dir = it->second;
+                if (ev->mask & IN_IGNORED) {
+                    dirs_.erase(dir);
+                    watches_.erase(it);
+                }
+            }
+            lock_.UnLock();
+            if (!dir.empty()) {
+                Dispatch(dir, ev);
+            }
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef DIR_WATCHER_H
+#define DIR_WATCHER_H
+
+#include <stdint.h>
+#include <sys/inotify.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "../ThreadPool/Locker.h"
+
+/*
+目录监视
+    ResponseCache和PathCache共用一个inotify实例,同一目录只注册一次,掩码是两者所需事件的并集
+    主线程在inotify可读时调用HandleEvents,每个事件依次交给所有注册的处理函数
+*/
+class DirWatcher
+{
+public:
+    /*
+    事件处理函数
+        dir为事件所属的监视目录,ev->len为0时是目录本身的事件;
+        事件队列溢出时dir为空、ev->mask带IN_Q_OVERFLOW,处理函数应清空整个缓存
+    */
+    typedef void (*EventHandler)(void* arg, const std::string& dir, const struct inotify_event* ev);
+
+public:
+    DirWatcher();
+    ~DirWatcher();
+
+    bool Init();                    //第一次调用时创建inotify实例,之后直接返回
+    //多进程模式下子进程重新创建inotify实例,否则各进程共用一个事件队列,事件只被其中一个读到
+    bool AfterFork();
+    int Fd() { return inotify_fd_; }
+    void AddHandler(EventHandler handler, void* arg);
+
+    //监视path所在的目录,文件被原子替换(rename覆盖)时也能收到事件;已监视时直接返回true
+    bool Watch(const std::string& path);
+    //主线程在inotify可读时调用
+    void HandleEvents();
+
+private:
+    void Dispatch(const std::string& dir, const struct inotify_event* ev);
+
+private:
+    int inotify_fd_;
+    std::vector<std::pair<EventHandler, void*> > handlers_;
+
+    Locker lock_;                   //保护下面两张表
+    std::unordered_map<std::string, int> dirs_;     //目录 -> 监视描述符
+    std::unordered_map<int, std::string> watches_;  //监视描述符 -> 目录
+};
+
+#endif
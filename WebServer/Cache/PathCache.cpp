@@ -0,0 +1,227 @@
+#include "PathCache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "../Utils/Utils.h"
+
+PathCache::PathCache()
+    : watcher_(NULL), shard_capacity_(0), negative_ttl_(0), root_(NULL), epoch_(0)
+{
+}
+
+bool PathCache::Init(size_t max_entries, int negative_ttl_ms, DirWatcher *watcher)
+{
+    if (!watcher->Init()) {
+        return false;
+    }
+    watcher_ = watcher;
+    watcher_->AddHandler(OnDirEvent, this);
+    shard_capacity_ = max_entries / PATH_SHARD_NUMBER > 0 ? max_entries / PATH_SHARD_NUMBER : 1;
+    negative_ttl_ = negative_ttl_ms;
+    return true;
+}
+
+/*
+Normalize()
+    url是已解码的请求路径,必须以'/'开头
+    "//"合并成一个'/',"."段直接去掉,结尾的'/'保留(目录与同名文件的结果不同)
+    ".."段一律拒绝,不尝试回退到上一级,这样规范化后的路径一定落在根目录之内
+*/
+int PathCache::Normalize(const char *url, int len, char *out, int size)
+{
+    if (len <= 0 || url[0] != '/') {
+        return -1;
+    }
+    int n = 0;
+    int i = 0;
+    while (i < len) {
+        while (i < len && url[i] == '/') {
+            i++;
+        }
+        int start = i;
+        while (i < len && url[i] != '/') {
+            if (url[i] == '\0') {
+                return -1;
+            }
+            i++;
+        }
+        int seg = i - start;
+        if (seg == 0 || (seg == 1 && url[start] == '.')) {
+            continue;
+        }
+        if (seg == 2 && url[start] == '.' && url[start + 1] == '.') {
+            return -1;
+        }
+        if (n + 1 + seg >= size) {
+            return -1;
+        }
+        out[n++] = '/';
+        memcpy(out + n, url + start, seg);
+        n += seg;
+    }
+    if (n == 0 || url[len - 1] == '/') {
+        if (n + 1 >= size) {
+            return -1;
+        }
+        out[n++] = '/';
+    }
+    out[n] = '\0';
+    return n;
+}
+
+int PathCache::Join(const char *root, const char *url, int len, char *path, int size)
+{
+    int root_len = strlen(root);
+    if (root_len >= size) {
+        return PATH_INVALID;
+    }
+    memcpy(path, root, root_len);
+    if (Normalize(url, len, path + root_len, size - root_len) < 0) {
+        return PATH_INVALID;
+    }
+    return PATH_UNKNOWN;
+}
+
+//与原先DoRequest中的检查顺序相同:不存在、权限、目录
+int PathCache::Stat(const char *path, struct stat *st)
+{
+    if (stat(path, st) < 0) {
+        return PATH_MISSING;
+    }
+    if (!(st->st_mode & S_IROTH)) {
+        return PATH_FORBIDDEN;
+    }
+    if (S_ISDIR(st->st_mode)) {
+        return PATH_DIRECTORY;
+    }
+    return PATH_FILE;
+}
+
+PathCache::Shard& PathCache::GetShard(const std::string &key)
+{
+    return shards_[hasher_(key) % PATH_SHARD_NUMBER];
+}
+
+/*
+Resolve()
+    未命中时先监视父目录再stat,之后的任何变化都会产生inotify事件;失效代数在这期间变化过就不插入
+    父目录无法监视时只缓存不存在的结果,靠TTL过期
+*/
+int PathCache::Resolve(const char *root, const char *url, int len, char *path, int size, struct stat *st)
+{
+    int kind = Join(root, url, len, path, size);
+    if (kind == PATH_INVALID) {
+        return kind;
+    }
+    if (!root_) {
+        __sync_bool_compare_and_swap(&root_, (const char *)NULL, root);
+    }
+    if (root != root_ && strcmp(root, root_) != 0) {
+        return Stat(path, st);
+    }
+
+    std::string key(path + strlen(root));
+    Shard &shard = GetShard(key);
+    int64_t now = Clock::Now();
+    shard.lock.Lock();
+    std::unordered_map<std::string, Entry>::iterator it = shard.entries.find(key);
+    if (it != shard.entries.end()) {
+        if (it->second.expire > now) {
+            kind = it->second.kind;
+            if (kind == PATH_FILE) {
+                *st = it->second.st;
+            }
+            shard.lock.UnLock();
+            return kind;
+        }
+        shard.entries.erase(it);
+    }
+    shard.lock.UnLock();
+
+    unsigned epoch = __sync_add_and_fetch(&epoch_, 0);
+    bool watched = watcher_->Watch(path);
+    kind = Stat(path, st);
+    if (!watched && kind != PATH_MISSING) {
+        return kind;
+    }
+    Entry entry;
+    entry.kind = kind;
+    entry.expire = now + (kind == PATH_MISSING ? negative_ttl_ : PATH_POSITIVE_TTL);
+    if (kind == PATH_FILE) {
+        entry.st = *st;
+    }
+    Insert(shard, key, entry, epoch);
+    return kind;
+}
+
+//分片满时先清理过期条目,仍然满就淘汰任意一条,扫描器请求大量随机路径时内存不会增长
+void PathCache::Insert(Shard &shard, const std::string &key, const Entry &entry, unsigned epoch)
+{
+    shard.lock.Lock();
+    if (__sync_add_and_fetch(&epoch_, 0) != epoch) {
+        shard.lock.UnLock();
+        return;
+    }
+    if (shard.entries.size() >= shard_capacity_ && !shard.entries.count(key)) {
+        int64_t now = Clock::Now();
+        std::unordered_map<std::string, Entry>::iterator it = shard.entries.begin();
+        while (it != shard.entries.end()) {
+            if (it->second.expire <= now) {
+                it = shard.entries.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        if (shard.entries.size() >= shard_capacity_) {
+            shard.entries.erase(shard.entries.begin());
+        }
+    }
+    shard.entries[key] = entry;
+    shard.lock.UnLock();
+}
+
+void PathCache::Invalidate(const std::string &key)
+{
+    Shard &shard = GetShard(key);
+    shard.lock.Lock();
+    __sync_add_and_fetch(&epoch_, 1);
+    shard.entries.erase(key);
+    shard.lock.UnLock();
+}
+
+void PathCache::Clear()
+{
+    for (int i = 0; i < PATH_SHARD_NUMBER; i++) {
+        Shard &shard = shards_[i];
+        shard.lock.Lock();
+        __sync_add_and_fetch(&epoch_, 1);
+        shard.entries.clear();
+        shard.lock.UnLock();
+    }
+}
+
+/*
+OnDirEvent()
+    普通文件的事件只让对应的URL(以及带结尾'/'的写法)失效
+    子目录的增删改名、目录本身的事件和队列溢出会影响其下所有路径,清空整个缓存
+*/
+void PathCache::OnDirEvent(void *arg, const std::string &dir, const struct inotify_event *ev)
+{
+    PathCache *cache = (PathCache *)arg;
+    if (dir.empty() || ev->len == 0 || (ev->mask & IN_ISDIR)) {
+        cache->Clear();
+        return;
+    }
+    std::string path = dir + "/" + ev->name;
+    size_t root_len = cache->root_ ? strlen(cache->root_) : 0;
+    if (root_len == 0 || path.compare(0, root_len, cache->root_) != 0 || path.size() <= root_len) {
+        return;
+    }
+    std::string key = path.substr(root_len);
+    cache->Invalidate(key);
+    cache->Invalidate(key + "/");
+}
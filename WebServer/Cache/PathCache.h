@@ -0,0 +1,87 @@
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <string>
+#include <unordered_map>
+
+#include "../ThreadPool/Locker.h"
+#include "DirWatcher.h"
+
+const int PATH_SHARD_NUMBER = 16;               //分片数量,每个分片一把锁
+const size_t PATH_CACHE_MAX = 16384;            //默认最多缓存的路径数
+const int PATH_NEGATIVE_TTL = 2000;             //默认不存在的路径缓存多久(毫秒)
+const int PATH_POSITIVE_TTL = 60000;            //存在的文件即使没有收到inotify事件也最多缓存这么久(毫秒)
+
+//路径解析的结果
+enum PATH_KIND
+{
+    PATH_UNKNOWN = 0,   //只拼出了路径,还没有stat
+    PATH_FILE,          //其他用户可读的文件
+    PATH_MISSING,       //不存在
+    PATH_FORBIDDEN,     //其他用户不可读
+    PATH_DIRECTORY,     //目录
+    PATH_INVALID        //含".."段、NUL或过长,不访问文件系统
+};
+
+/*
+路径解析缓存
+    以规范化后的URL为键,缓存stat的结果:存在的文件记下stat,不存在的路径做短时间的负缓存
+    命中时不再拼接路径、不再stat,反复请求同一个不存在路径的扫描器也只在TTL到期后才访问一次文件系统
+    与ResponseCache共用DirWatcher监视所在目录,文件创建、修改、替换、删除或改权限时由主线程使条目失效
+    父目录本身不存在时无法监视,负缓存只靠TTL过期;子目录增删时清空整个缓存
+    条目数有上限,分片满时先清理过期条目,仍然满就随意淘汰一条
+*/
+class PathCache
+{
+public:
+    PathCache();
+
+    bool Init(size_t max_entries, int negative_ttl_ms, DirWatcher *watcher);
+    //多进程模式下子进程的监视是新建的,继承来的条目全部丢弃,见ResponseCache::AfterFork
+    void AfterFork() { Clear(); }
+
+    //root+url解析成path(size字节),返回PATH_KIND;PATH_FILE时st有效
+    int Resolve(const char *root, const char *url, int len, char *path, int size, struct stat *st);
+    //DirWatcher的事件处理函数,在主线程中调用
+    static void OnDirEvent(void *arg, const std::string &dir, const struct inotify_event *ev);
+
+    //不使用缓存时:规范化url并拼接到root之后,返回PATH_UNKNOWN或PATH_INVALID
+    static int Join(const char *root, const char *url, int len, char *path, int size);
+    //合并重复的'/',去掉"."段;含".."段或NUL时返回-1,否则返回out中的长度
+    static int Normalize(const char *url, int len, char *out, int size);
+
+private:
+    struct Entry
+    {
+        int kind;
+        int64_t expire;         //Clock毫秒
+        struct stat st;         //PATH_FILE时文件的stat,dev/ino即解析到的文件
+    };
+
+    struct Shard
+    {
+        Shard() : lock("path_shard") {}
+
+        Locker lock;
+        std::unordered_map<std::string, Entry> entries;
+    };
+
+    static int Stat(const char *path, struct stat *st);
+    Shard& GetShard(const std::string &key);
+    void Insert(Shard &shard, const std::string &key, const Entry &entry, unsigned epoch);
+    void Invalidate(const std::string &path);
+    void Clear();
+
+private:
+    Shard shards_[PATH_SHARD_NUMBER];
+    std::hash<std::string> hasher_;
+    DirWatcher *watcher_;
+    size_t shard_capacity_;
+    int negative_ttl_;
+    const char *root_;              //第一次解析时记下的根目录,根目录不同的请求不缓存
+    unsigned epoch_;                //每次失效加一,stat前后不一致说明结果可能已过期
+};
+
+#endif
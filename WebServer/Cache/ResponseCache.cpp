@@ -0,0 +1,192 @@
+#include "ResponseCache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+const char* CachedResponse::Response(bool linger, int *len)
+{
+    if (linger) {
+        *len = keepalive_len;
+        return data;
+    }
+    *len = close_len;
+    return data + keepalive_len;
+}
+
+void CachedResponse::Ref()
+{
+    __sync_add_and_fetch(&refs, 1);
+}
+
+void CachedResponse::Unref()
+{
+    if (__sync_sub_and_fetch(&refs, 1) == 0) {
+        free(this);
+    }
+}
+
+//与ProcessWrite中FILE_REQUEST生成的响应逐字节相同
+static int FormatHead(char *out, size_t len, size_t body_len, bool linger)
+{
+    return snprintf(out, len, "HTTP/1.1 200 OK\r\nContent-Length:%zu\r\nConnection:%s\r\n\r\n",
+                    body_len, linger ? "keep-alive" : "close");
+}
+
+static CachedResponse* NewResponse(const char *body, size_t body_len)
+{
+    char keepalive[128], closed[128];
+    int keepalive_head = FormatHead(keepalive, sizeof(keepalive), body_len, true);
+    int close_head = FormatHead(closed, sizeof(closed), body_len, false);
+    size_t size = sizeof(CachedResponse) + keepalive_head + close_head + body_len * 2;
+    CachedResponse *resp = (CachedResponse *)malloc(size);
+    if (!resp) {
+        return NULL;
+    }
+    resp->refs = 1;
+    resp->size = size;
+    resp->body_len = body_len;
+    resp->keepalive_len = keepalive_head + body_len;
+    resp->close_len = close_head + body_len;
+
+    char *p = resp->data;
+    memcpy(p, keepalive, keepalive_head);
+    resp->body = p + keepalive_head;
+    memcpy(resp->body, body, body_len);
+    p += resp->keepalive_len;
+    memcpy(p, closed, close_head);
+    memcpy(p + close_head, body, body_len);
+    return resp;
+}
+
+ResponseCache::ResponseCache()
+    : watcher_(NULL), max_file_size_(0), max_bytes_(0), bytes_(0), epoch_(0)
+{
+}
+
+ResponseCache::~ResponseCache()
+{
+    Clear();
+}
+
+bool ResponseCache::Init(size_t max_file_size, size_t max_bytes, DirWatcher *watcher)
+{
+    if (!watcher->Init()) {
+        return false;
+    }
+    watcher_ = watcher;
+    watcher_->AddHandler(OnDirEvent, this);
+    max_file_size_ = max_file_size;
+    max_bytes_ = max_bytes;
+    return true;
+}
+
+ResponseCache::Shard& ResponseCache::GetShard(const std::string &path)
+{
+    return shards_[hasher_(path) % CACHE_SHARD_NUMBER];
+}
+
+CachedResponse* ResponseCache::Lookup(const char *path, unsigned *epoch)
+{
+    *epoch = __sync_add_and_fetch(&epoch_, 0);
+    std::string key(path);
+    Shard &shard = GetShard(key);
+    CachedResponse *resp = NULL;
+    shard.lock.Lock();
+    std::unordered_map<std::string, CachedResponse*>::iterator it = shard.entries.find(key);
+    if (it != shard.entries.end()) {
+        resp = it->second;
+        resp->Ref();
+    }
+    shard.lock.UnLock();
+    return resp;
+}
+
+/*
+Insert()
+    先确保目录已被监视,再重新stat确认文件与读到的内容一致,之后的修改一定会产生inotify事件
+    失效代数在Lookup之后变化过(主线程已处理过某个修改事件)就放弃插入,宁可下次再读文件
+*/
+CachedResponse* ResponseCache::Insert(const char *path, const struct stat &st, const char *data, unsigned epoch)
+{
+    size_t body_len = st.st_size;
+    if (body_len == 0 || body_len > max_file_size_ || bytes_ + body_len * 2 > max_bytes_) {
+        return NULL;
+    }
+    //"//"、"/./"之类的别名不缓存,否则inotify事件拼出的路径对不上
+    std::string key(path);
+    if (key.find("//") != std::string::npos || key.find("/.") != std::string::npos || !watcher_->Watch(key)) {
+        return NULL;
+    }
+    struct stat now;
+    if (stat(path, &now) < 0 || now.st_ino != st.st_ino || now.st_size != st.st_size ||
+        now.st_mtim.tv_sec != st.st_mtim.tv_sec || now.st_mtim.tv_nsec != st.st_mtim.tv_nsec) {
+        return NULL;
+    }
+    CachedResponse *resp = NewResponse(data, body_len);
+    if (!resp) {
+        return NULL;
+    }
+
+    Shard &shard = GetShard(key);
+    shard.lock.Lock();
+    bool stale = __sync_add_and_fetch(&epoch_, 0) != epoch;
+    if (stale || shard.entries.count(key)) {
+        shard.lock.UnLock();
+        free(resp);
+        return NULL;
+    }
+    shard.entries[key] = resp;
+    __sync_add_and_fetch(&bytes_, resp->size);
+    resp->Ref();
+    shard.lock.UnLock();
+    return resp;
+}
+
+void ResponseCache::Invalidate(const std::string &path)
+{
+    Shard &shard = GetShard(path);
+    shard.lock.Lock();
+    __sync_add_and_fetch(&epoch_, 1);
+    std::unordered_map<std::string, CachedResponse*>::iterator it = shard.entries.find(path);
+    if (it != shard.entries.end()) {
+        __sync_sub_and_fetch(&bytes_, it->second->size);
+        it->second->Unref();
+        shard.entries.erase(it);
+    }
+    shard.lock.UnLock();
+}
+
+void ResponseCache::Clear()
+{
+    for (int i = 0; i < CACHE_SHARD_NUMBER; i++) {
+        Shard &shard = shards_[i];
+        shard.lock.Lock();
+        __sync_add_and_fetch(&epoch_, 1);
+        std::unordered_map<std::string, CachedResponse*>::iterator it;
+        for (it = shard.entries.begin(); it != shard.entries.end(); ++it) {
+            __sync_sub_and_fetch(&bytes_, it->second->size);
+            it->second->Unref();
+        }
+        shard.entries.clear();
+        shard.lock.UnLock();
+    }
+}
+
+/*
+OnDirEvent()
+    带文件名的事件只让该文件失效;目录本身的事件和事件队列溢出时清空整个缓存
+*/
+void ResponseCache::OnDirEvent(void *arg, const std::string &dir, const struct inotify_event *ev)
+{
+    ResponseCache *cache = (ResponseCache *)arg;
+    if (!dir.empty() && ev->len > 0) {
+        cache->Invalidate(dir + "/" + ev->name);
+    }
+    else {
+        cache->Clear();
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <sys/stat.h>
+#include <string>
+#include <unordered_map>
+
+#include "../ThreadPool/Locker.h"
+#include "DirWatcher.h"
+
+const int CACHE_SHARD_NUMBER = 16;                  //分片数量,每个分片一把锁
+const size_t CACHE_MAX_FILE_SIZE = 16384;           //默认只缓存不超过该大小的文件
+const size_t CACHE_MAX_BYTES = 8 * 1024 * 1024;     //默认缓存总字节数上限
+
+/*
+一个文件的完整响应
+    data中依次存放keep-alive和close两个版本的状态行+响应头+响应体,各自连续,命中时一次send发出
+    引用计数:缓存表持有一个引用,正在发送它的连接各持有一个,失效后最后一个引用释放内存
+*/
+struct CachedResponse
+{
+    int refs;
+    size_t size;            //分配的总字节数,计入缓存容量
+    size_t body_len;
+    size_t keepalive_len;
+    size_t close_len;
+    char *body;             //keep-alive版本中的响应体,HTTP/2直接引用
+    char data[1];
+
+    const char* Response(bool linger, int *len);
+    void Ref();
+    void Unref();
+};
+
+/*
+小文件响应缓存
+    按真实路径查找,命中时不再stat/open/mmap,也不再格式化响应头
+    缓存文件所在目录经DirWatcher监视,文件被修改、替换、删除或改权限时由主线程使条目失效
+    按路径哈希分片加锁,查找和插入只锁一个分片
+*/
+class ResponseCache
+{
+public:
+    ResponseCache();
+    ~ResponseCache();
+
+    bool Init(size_t max_file_size, size_t max_bytes, DirWatcher *watcher);
+    //多进程模式下子进程的监视是新建的,继承来的条目收不到失效事件,全部丢弃
+    void AfterFork() { Clear(); }
+    size_t MaxFileSize() { return max_file_size_; }
+
+    //命中时返回已加引用的条目;未命中时epoch记录当前失效代数,交给Insert
+    CachedResponse* Lookup(const char *path, unsigned *epoch);
+    //st/data是请求处理时stat和mmap得到的文件,成功返回已加引用的条目
+    CachedResponse* Insert(const char *path, const struct stat &st, const char *data, unsigned epoch);
+    //DirWatcher的事件处理函数,在主线程中调用
+    static void OnDirEvent(void *arg, const std::string &dir, const struct inotify_event *ev);
+
+private:
+    struct Shard
+    {
+        Shard() : lock("cache_shard") {}
+
+        Locker lock;
+        std::unordered_map<std::string, CachedResponse*> entries;
+    };
+
+    Shard& GetShard(const std::string &path);
+    void Invalidate(const std::string &path);
+    void Clear();
+
+private:
+    Shard shards_[CACHE_SHARD_NUMBER];
+    std::hash<std::string> hasher_;
+    DirWatcher *watcher_;
+    size_t max_file_size_;
+    size_t max_bytes_;
+    size_t bytes_;                  //缓存中条目的总字节数
+    unsigned epoch_;                //每次失效加一,插入前后不一致说明读到的内容可能已过期
+};
+
+#endif
@@ -0,0 +1,151 @@
+#include "Capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "../Utils/Utils.h"
+#include "../ThreadPool/Locker.h"
+
+int Capture::fd_ = -1;
+char Capture::path_[256];
+int64_t Capture::start_us_ = 0;
+unsigned Capture::last_conn_ = 0;
+char* Capture::buf_ = NULL;
+char* Capture::spare_ = NULL;
+int Capture::used_ = 0;
+long Capture::dropped_ = 0;
+
+//buf_lock保护buf_/used_;write_lock保证缓冲区按顺序写入文件,总是先取write_lock再取buf_lock
+static Locker buf_lock("capture_buf");
+static Locker write_lock("capture_write");
+
+bool Capture::OpenFile(const char *path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    CaptureHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    header.start_us = Clock::ReadUs();
+    if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+        close(fd);
+        return false;
+    }
+    start_us_ = header.start_us;
+    fd_ = fd;
+    return true;
+}
+
+bool Capture::Enable(const char *path)
+{
+    if (strlen(path) >= sizeof(path_)) {
+        return false;
+    }
+    buf_ = (char *)malloc(CAPTURE_BUFFER_SIZE);
+    spare_ = (char *)malloc(CAPTURE_BUFFER_SIZE);
+    if (!buf_ || !spare_) {
+        return false;
+    }
+    strcpy(path_, path);
+    return OpenFile(path_);
+}
+
+bool Capture::AfterFork(int worker)
+{
+    if (fd_ == -1) {
+        return true;
+    }
+    close(fd_);
+    fd_ = -1;
+    used_ = 0;
+    last_conn_ = 0;
+    char path[sizeof(path_) + 16];
+    snprintf(path, sizeof(path), "%s.%d", path_, worker);
+    return OpenFile(path);
+}
+
+unsigned Capture::Open()
+{
+    unsigned conn = __sync_add_and_fetch(&last_conn_, 1);
+    //编号回绕到0时跳过,0表示不录制
+    if (conn == 0) {
+        conn = __sync_add_and_fetch(&last_conn_, 1);
+    }
+    Record(conn, CAPTURE_OPEN, NULL, 0);
+    return conn;
+}
+
+/*
+Record()
+    时间在持锁时读取,文件中的记录时间单调不减,重放时不必排序
+    缓冲区放不下时先把它写入文件再追加
+*/
+void Capture::Record(unsigned conn, int kind, const char *data, int len)
+{
+    int size = sizeof(CaptureRecord) + len;
+    if (len > CAPTURE_MAX_DATA || size > CAPTURE_BUFFER_SIZE) {
+        __sync_add_and_fetch(&dropped_, 1);
+        return;
+    }
+    buf_lock.Lock();
+    while (used_ + size > CAPTURE_BUFFER_SIZE) {
+        buf_lock.UnLock();
+        Flush();
+        buf_lock.Lock();
+    }
+    //数据长度任意,记录头不一定对齐,整体拷贝
+    CaptureRecord rec;
+    rec.time_us = Clock::ReadUs() - start_us_;
+    rec.conn = conn;
+    rec.info = (uint32_t)kind << 24 | len;
+    memcpy(buf_ + used_, &rec, sizeof(rec));
+    if (len > 0) {
+        memcpy(buf_ + used_ + sizeof(rec), data, len);
+    }
+    used_ += size;
+    buf_lock.UnLock();
+}
+
+/*
+Flush()
+    持锁交换两个缓冲区,写文件时工作线程继续向另一个缓冲区追加
+*/
+void Capture::Flush()
+{
+    if (fd_ == -1) {
+        return;
+    }
+    write_lock.Lock();
+    buf_lock.Lock();
+    char *out = buf_;
+    int len = used_;
+    buf_ = spare_;
+    spare_ = out;
+    used_ = 0;
+    buf_lock.UnLock();
+
+    int off = 0;
+    while (off < len) {
+        ssize_t n = write(fd_, out + off, len - off);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            printf("capture write failure, errno = %d\n", errno);
+            __sync_add_and_fetch(&dropped_, 1);
+            break;
+        }
+        off += n;
+    }
+    long dropped = __sync_lock_test_and_set(&dropped_, 0);
+    write_lock.UnLock();
+    if (dropped > 0) {
+        printf("capture: %ld records dropped\n", dropped);
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+
+const char CAPTURE_MAGIC[8] = "WSCAP01";        //文件开头的标识,格式变化时改最后一位
+const int CAPTURE_BUFFER_SIZE = 1 << 20;        //内存中攒够这么多字节才写一次文件
+const int CAPTURE_MAX_DATA = (1 << 24) - 1;     //一条记录最多携带的数据字节数
+
+//记录类型,与CaptureRecord::info的高8位对应
+enum CAPTURE_KIND
+{
+    CAPTURE_OPEN = 0,   //连接建立
+    CAPTURE_DATA,       //收到一段请求数据
+    CAPTURE_RESPONSE,   //HTTP/1响应已发完,重放时之后的数据要等收到这个响应再发
+    CAPTURE_CLOSE       //连接关闭
+};
+
+/*
+录制文件格式,字节序与录制机器相同
+    CaptureHeader | (CaptureRecord | 数据)*
+    记录按加锁写入缓冲区的顺序排列,时间单调不减;DATA记录后紧跟len字节,其他记录没有数据
+    TLS连接记录的是解密后的明文,重放时应对准明文监听端口
+*/
+struct CaptureHeader
+{
+    char magic[8];
+    int64_t start_us;       //录制开始时的CLOCK_MONOTONIC微秒数,只用于对照
+};
+
+struct CaptureRecord
+{
+    uint64_t time_us;       //距录制开始的微秒数
+    uint32_t conn;          //连接编号,从1开始,同一文件内不重复
+    uint32_t info;          //高8位为CAPTURE_KIND,低24位为数据长度
+
+    int Kind() const { return info >> 24; }
+    int Length() const { return info & CAPTURE_MAX_DATA; }
+};
+
+/*
+请求录制
+    EnableCapture之后每个新连接分配一个编号,Recv读到的原始请求字节连同到达时间追加到内存缓冲区
+    缓冲区由主线程在周期性工作中写入文件,写满时由追加的线程直接写,不丢记录
+    多进程模式下每个worker写自己的path.<序号>
+    配套的capture_replay按原速或倍速把录制的连接重新发给服务器,比较不同版本的延迟和吞吐
+*/
+class Capture
+{
+public:
+    static bool Enable(const char *path);
+    static bool Enabled() { return fd_ != -1; }
+    //子进程改写path.<worker>,父进程已打开的文件留给master
+    static bool AfterFork(int worker);
+
+    //分配连接编号并写入OPEN记录
+    static unsigned Open();
+    static void Record(unsigned conn, int kind, const char *data, int len);
+    //主线程调用:把缓冲区写入文件
+    static void Flush();
+
+private:
+    static bool OpenFile(const char *path);
+
+private:
+    static int fd_;
+    static char path_[256];
+    static int64_t start_us_;
+    static unsigned last_conn_;
+    static char *buf_;          //正在追加的缓冲区
+    static char *spare_;        //正在写文件的缓冲区
+    static int used_;
+    static long dropped_;       //超过CAPTURE_MAX_DATA或写文件失败而丢弃的记录数
+};
+
+#endif
@@ -0,0 +1,355 @@
+#include "CaptureReplay.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "../Utils/Utils.h"
+
+int64_t ReplayResult::Percentile(int p) const
+{
+    if (latency.empty()) {
+        return 0;
+    }
+    size_t i = latency.size() * p / 100;
+    return latency[i < latency.size() ? i : latency.size() - 1];
+}
+
+CaptureReplay::CaptureReplay()
+    : connections_(0), addr_len_(0), epollfd_(-1)
+{
+}
+
+CaptureReplay::~CaptureReplay()
+{
+    if (epollfd_ != -1) {
+        close(epollfd_);
+    }
+}
+
+/*
+Load()
+    整个文件读入内存;录制中途被杀时最后一条记录可能不完整,丢弃它
+*/
+bool CaptureReplay::Load(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        printf("open %s failure\n", path);
+        return false;
+    }
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        data_.append(buf, n);
+    }
+    fclose(fp);
+
+    CaptureHeader header;
+    if (data_.size() < sizeof(header)) {
+        printf("%s: not a capture file\n", path);
+        return false;
+    }
+    memcpy(&header, data_.data(), sizeof(header));
+    if (memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) != 0) {
+        printf("%s: not a capture file\n", path);
+        return false;
+    }
+    size_t off = sizeof(header);
+    while (off + sizeof(CaptureRecord) <= data_.size()) {
+        Record rec;
+        memcpy(&rec.head, data_.data() + off, sizeof(rec.head));
+        rec.data_off = off + sizeof(rec.head);
+        if (rec.data_off + rec.head.Length() > data_.size()) {
+            break;
+        }
+        if (rec.head.Kind() == CAPTURE_OPEN) {
+            connections_++;
+        }
+        records_.push_back(rec);
+        off = rec.data_off + rec.head.Length();
+    }
+    return true;
+}
+
+bool CaptureReplay::Run(const char *target, double speed, int drain_ms, ReplayResult *result)
+{
+    if (!Utils::ParseAddress(target, &addr_, &addr_len_)) {
+        printf("bad target %s\n", target);
+        return false;
+    }
+    if (epollfd_ == -1) {
+        epollfd_ = epoll_create1(EPOLL_CLOEXEC);
+    }
+    result->requests = 0;
+    result->errors = 0;
+    result->timeouts = 0;
+    result->bytes_in = 0;
+    result->latency.clear();
+
+    //epoll_wait的超时以毫秒为单位并向上取整,每条记录最多晚1毫秒,不同目标之间的偏差相同
+    int64_t start = Clock::ReadUs();
+    for (size_t i = 0; i < records_.size(); i++) {
+        const Record &rec = records_[i];
+        if (speed > 0) {
+            int64_t due = start + (int64_t)(rec.head.time_us / speed);
+            for (int64_t now = Clock::ReadUs(); now < due; now = Clock::ReadUs()) {
+                Poll((due - now + 999) / 1000, result);
+            }
+        }
+        else {
+            Poll(0, result);
+        }
+
+        unsigned id = rec.head.conn;
+        if (rec.head.Kind() == CAPTURE_OPEN) {
+            Connect(id, result);
+            continue;
+        }
+        //连接失败的记录已计入errors
+        std::unordered_map<unsigned, Conn>::iterator it = conns_.find(id);
+        if (it == conns_.end()) {
+            continue;
+        }
+        Conn &conn = it->second;
+        if (rec.head.Kind() == CAPTURE_DATA) {
+            conn.held.push_back(std::make_pair(conn.expected, std::string(data_.data() + rec.data_off, rec.head.Length())));
+            Release(id, conn, result);
+        }
+        else if (rec.head.Kind() == CAPTURE_RESPONSE) {
+            conn.expected++;
+        }
+        else if (rec.head.Kind() == CAPTURE_CLOSE) {
+            conn.closing = true;
+            if (Idle(conn)) {
+                Close(id);
+            }
+        }
+    }
+
+    //录制结束时仍打开的空闲连接直接关闭,其余等待响应到齐或超时
+    std::vector<unsigned> idle;
+    for (std::unordered_map<unsigned, Conn>::iterator it = conns_.begin(); it != conns_.end(); ++it) {
+        if (Idle(it->second)) {
+            idle.push_back(it->first);
+        }
+        it->second.closing = true;
+    }
+    for (size_t i = 0; i < idle.size(); i++) {
+        Close(idle[i]);
+    }
+    //speed为0时大部分请求在这里按响应依次发出,有进展就继续等
+    int64_t deadline = Clock::ReadUs() + (int64_t)drain_ms * 1000;
+    for (int64_t now = Clock::ReadUs(); !conns_.empty() && now < deadline; now = Clock::ReadUs()) {
+        long bytes = result->bytes_in;
+        Poll((deadline - now + 999) / 1000, result);
+        if (result->bytes_in != bytes) {
+            deadline = Clock::ReadUs() + (int64_t)drain_ms * 1000;
+        }
+    }
+    result->elapsed_us = Clock::ReadUs() - start;
+    while (!conns_.empty()) {
+        if (!Idle(conns_.begin()->second)) {
+            result->timeouts++;
+        }
+        Close(conns_.begin()->first);
+    }
+    std::sort(result->latency.begin(), result->latency.end());
+    return true;
+}
+
+void CaptureReplay::Connect(unsigned id, ReplayResult *result)
+{
+    int fd = socket(addr_.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        result->errors++;
+        return;
+    }
+    if (addr_.ss_family != AF_UNIX) {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    int ret = connect(fd, (struct sockaddr *)&addr_, addr_len_);
+    if (ret < 0 && errno != EINPROGRESS) {
+        result->errors++;
+        close(fd);
+        return;
+    }
+    Conn &conn = conns_[id];
+    conn.fd = fd;
+    conn.connected = ret == 0;
+    conn.want_out = true;
+    conn.closing = false;
+    conn.sent_us = 0;
+    conn.expected = 0;
+    conn.responses = 0;
+    conn.held.clear();
+    conn.out.clear();
+    //连接完成时可写
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.u32 = id;
+    epoll_ctl(epollfd_, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void CaptureReplay::Poll(int timeout_ms, ReplayResult *result)
+{
+    struct epoll_event events[256];
+    int n = epoll_wait(epollfd_, events, 256, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        unsigned id = events[i].data.u32;
+        std::unordered_map<unsigned, Conn>::iterator it = conns_.find(id);
+        if (it == conns_.end()) {
+            continue;
+        }
+        Conn &conn = it->second;
+        if (!conn.connected) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err != 0) {
+                result->errors++;
+                Close(id);
+                continue;
+            }
+            conn.connected = true;
+        }
+        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+            Receive(id, conn, result);
+            if (conns_.find(id) == conns_.end()) {
+                continue;
+            }
+        }
+        Send(id, conn, result);
+    }
+}
+
+//收到第一个响应字节时结束当前请求的计时;对端关闭时还有未完成的请求算作错误
+void CaptureReplay::Receive(unsigned id, Conn &conn, ReplayResult *result)
+{
+    char buf[65536];
+    while (true) {
+        ssize_t n = recv(conn.fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n > 0) {
+            result->bytes_in += n;
+            if (conn.sent_us) {
+                result->latency.push_back(Clock::ReadUs() - conn.sent_us);
+                result->requests++;
+                conn.sent_us = 0;
+                conn.responses++;
+            }
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (!Idle(conn)) {
+            result->errors++;
+        }
+        Close(id);
+        return;
+    }
+    //发送失败时连接已关闭
+    Release(id, conn, result);
+    if (conns_.find(id) != conns_.end() && conn.closing && Idle(conn)) {
+        Close(id);
+    }
+}
+
+//前面的响应都已收到时发出暂存的数据,并开始计时
+void CaptureReplay::Release(unsigned id, Conn &conn, ReplayResult *result)
+{
+    if (conn.held.empty() || conn.held.front().first > conn.responses) {
+        return;
+    }
+    if (conn.sent_us == 0) {
+        conn.sent_us = Clock::ReadUs();
+    }
+    while (!conn.held.empty() && conn.held.front().first <= conn.responses) {
+        conn.out.append(conn.held.front().second);
+        conn.held.pop_front();
+    }
+    Send(id, conn, result);
+}
+
+void CaptureReplay::Send(unsigned id, Conn &conn, ReplayResult *result)
+{
+    if (!conn.connected) {
+        return;
+    }
+    while (!conn.out.empty()) {
+        ssize_t n = send(conn.fd, conn.out.data(), conn.out.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0) {
+            conn.out.erase(0, n);
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        result->errors++;
+        Close(id);
+        return;
+    }
+    Watch(id, conn, !conn.out.empty());
+}
+
+void CaptureReplay::Watch(unsigned id, Conn &conn, bool out)
+{
+    if (conn.want_out == out) {
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = out ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    ev.data.u32 = id;
+    epoll_ctl(epollfd_, EPOLL_CTL_MOD, conn.fd, &ev);
+    conn.want_out = out;
+}
+
+void CaptureReplay::Close(unsigned id)
+{
+    std::unordered_map<unsigned, Conn>::iterator it = conns_.find(id);
+    if (it == conns_.end()) {
+        return;
+    }
+    close(it->second.fd);
+    conns_.erase(it);
+}
+
+void CaptureReplay::Print(const char *target, const ReplayResult &result)
+{
+    double seconds = result.elapsed_us / 1e6;
+    printf("%s: %ld requests in %.3f s, %.1f req/s, %ld bytes in, %ld errors, %ld timeouts\n",
+           target, result.requests, seconds, seconds > 0 ? result.requests / seconds : 0.0,
+           result.bytes_in, result.errors, result.timeouts);
+    printf("    latency us: p50 %lld  p90 %lld  p99 %lld  max %lld\n",
+           (long long)result.Percentile(50), (long long)result.Percentile(90),
+           (long long)result.Percentile(99), (long long)result.Percentile(100));
+}
+
+static double Change(double base, double other)
+{
+    return base > 0 ? (other - base) * 100 / base : 0;
+}
+
+void CaptureReplay::Compare(const ReplayResult &base, const ReplayResult &other)
+{
+    double base_rate = base.elapsed_us > 0 ? base.requests * 1e6 / base.elapsed_us : 0;
+    double other_rate = other.elapsed_us > 0 ? other.requests * 1e6 / other.elapsed_us : 0;
+    printf("    vs first: req/s %+.1f%%  p50 %+.1f%%  p90 %+.1f%%  p99 %+.1f%%  errors %+ld\n",
+           Change(base_rate, other_rate),
+           Change(base.Percentile(50), other.Percentile(50)),
+           Change(base.Percentile(90), other.Percentile(90)),
+           Change(base.Percentile(99), other.Percentile(99)),
+           other.errors + other.timeouts - base.errors - base.timeouts);
+}
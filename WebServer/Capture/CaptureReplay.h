@@ -0,0 +1,92 @@
+#ifndef CAPTURE_REPLAY_H
+#define CAPTURE_REPLAY_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+
+#include "Capture.h"
+
+const int REPLAY_DRAIN_MS = 5000;       //默认在最后一条记录之后,连续这么久没有收到数据就结束
+
+//一个目标的重放结果
+struct ReplayResult
+{
+    long requests;                  //收到响应的请求数
+    long errors;                    //连接失败、发送失败,或请求还没有响应连接就断开
+    long timeouts;                  //等待结束时仍没有响应的请求
+    long bytes_in;                  //收到的响应字节数
+    int64_t elapsed_us;
+    std::vector<int64_t> latency;   //已排序,单位微秒
+
+    int64_t Percentile(int p) const;
+};
+
+/*
+录制重放
+    按录制文件中的顺序和时间间隔(除以speed)重新建立每个连接、发送每段数据、关闭连接,speed为0时不等待
+    录制时客户端等到响应才发下一个请求的,重放时同样先等到对应的响应,被测服务器较慢时不会变成流水线
+    单线程epoll驱动所有连接,连接和发送都不阻塞,未发完的数据等待可写
+    延迟是从发出请求的第一个字节到收到第一个响应字节;每个连接同一时间只计一个请求,流水线中的后续请求不单独计时
+    目标为"host:port"或"unix:/path",同一录制依次重放到不同版本的服务器上即可比较延迟和吞吐
+*/
+class CaptureReplay
+{
+public:
+    CaptureReplay();
+    ~CaptureReplay();
+
+    bool Load(const char *path);
+    int Connections() const { return connections_; }
+    size_t Records() const { return records_.size(); }
+
+    bool Run(const char *target, double speed, int drain_ms, ReplayResult *result);
+
+    static void Print(const char *target, const ReplayResult &result);
+    //other相对base的变化
+    static void Compare(const ReplayResult &base, const ReplayResult &other);
+
+private:
+    struct Record
+    {
+        CaptureRecord head;
+        size_t data_off;            //数据在data_中的偏移
+    };
+
+    struct Conn
+    {
+        int fd;
+        bool connected;
+        bool want_out;              //是否注册了EPOLLOUT
+        bool closing;               //录制中已关闭,没有待发数据和待收响应时关闭
+        int64_t sent_us;            //正在等待响应的请求的发出时间,0表示没有
+        long expected;              //录制中到目前为止服务器发完的响应数
+        long responses;             //重放中收到的响应数
+        std::deque<std::pair<long, std::string> > held;    //收到这么多个响应后才能发出的数据
+        std::string out;            //还没发出的数据
+    };
+
+    void Connect(unsigned id, ReplayResult *result);
+    void Poll(int timeout_ms, ReplayResult *result);
+    void Receive(unsigned id, Conn &conn, ReplayResult *result);
+    void Release(unsigned id, Conn &conn, ReplayResult *result);
+    void Send(unsigned id, Conn &conn, ReplayResult *result);
+    void Watch(unsigned id, Conn &conn, bool out);
+    bool Idle(const Conn &conn) { return conn.sent_us == 0 && conn.out.empty() && conn.held.empty(); }
+    void Close(unsigned id);
+
+private:
+    std::string data_;
+    std::vector<Record> records_;
+    int connections_;
+
+    struct sockaddr_storage addr_;
+    socklen_t addr_len_;
+    int epollfd_;
+    std::unordered_map<unsigned, Conn> conns_;  //录制中的连接编号 -> 重放的连接
+};
+
+#endif
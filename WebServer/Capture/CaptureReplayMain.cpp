@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "CaptureReplay.h"
+
+/*
+把CAPTURE=capture.bin ./server录下的请求重放到一个或多个服务器,后面的目标与第一个比较
+    ./capture_replay [-s speed] [-d drain_ms] capture.bin 127.0.0.1:9006 unix:/tmp/ws.sock
+    speed默认为1(原速),2为两倍速,0为不等待尽快发送
+*/
+int main(int argc, char* argv[])
+{
+    double speed = 1;
+    int drain_ms = REPLAY_DRAIN_MS;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:d:")) != -1) {
+        if (opt == 's') {
+            speed = atof(optarg);
+        }
+        else if (opt == 'd') {
+            drain_ms = atoi(optarg);
+        }
+        else {
+            optind = argc;
+            break;
+        }
+    }
+    if (argc - optind < 2) {
+        printf("Usage: ./capture_replay [-s speed] [-d drain_ms] capture.bin target [target...]\n");
+        return 1;
+    }
+
+    CaptureReplay replay;
+    if (!replay.Load(argv[optind])) {
+        return 1;
+    }
+    printf("%s: %d connections, %zu records\n", argv[optind], replay.Connections(), replay.Records());
+
+    ReplayResult base;
+    for (int i = optind + 1; i < argc; i++) {
+        ReplayResult result;
+        if (!replay.Run(argv[i], speed, drain_ms, i == optind + 1 ? &base : &result)) {
+            return 1;
+        }
+        CaptureReplay::Print(argv[i], i == optind + 1 ? base : result);
+        if (i > optind + 1) {
+            CaptureReplay::Compare(base, result);
+        }
+    }
+    return 0;
+}
@@ -1,4 +1,16 @@
 #include "HttpConn.h"
+#include "../Router/Router.h"
+#include "../Http2/Http2Session.h"
+#include "../WebSocket/WebSocket.h"
+#include "../Tls/Tls.h"
+#include "../Proxy/Proxy.h"
+#include "../Cache/ResponseCache.h"
+#include "../Cache/PathCache.h"
+#include "../ThreadPool/IoPool.h"
+#include "../Bundle/AssetBundle.h"
+#include "../Capture/Capture.h"
+
+#include <netinet/tcp.h>
 
 //定义http响应的一些状态信息
 const char *ok_200_title = "OK";
@@ -11,22 +23,102 @@ const char *error_404_form = "The requested file was not found on this server.\n
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
 
+//负载削减时直接发送,不经过ProcessWrite
+static const char SERVICE_UNAVAILABLE[] =
+    "HTTP/1.1 503 Service Unavailable\r\nContent-Length:0\r\nRetry-After:1\r\nConnection:close\r\n\r\n";
+
 int HttpConn::user_count_ = 0;  //初始化用户数为0
 int HttpConn::epollfd_ = -1;    //初始化epollfd为-1
+Router* HttpConn::router_ = NULL;
+
+int HttpConn::notifyfd_ = -1;   //初始化notifyfd为-1
+TlsContext* HttpConn::tls_ctx_ = NULL;
+ResponseCache* HttpConn::cache_ = NULL;
+PathCache* HttpConn::path_cache_ = NULL;
+AssetBundle* HttpConn::bundle_ = NULL;
+IoPool* HttpConn::io_pool_ = NULL;
+long HttpConn::write_budget_ = WRITE_BUDGET;
+
+/*
+CloseConn()
+    工作线程不能直接操作定时器链表,只把sockfd和连接代数发给主线程
+    主线程收到后删除定时器、移除监视事件并关闭fd
+*/
+void HttpConn::CloseConn()
+{
+    CloseMsg msg = {sockfd_, generation_};
+    send(notifyfd_, (char*)&msg, sizeof(msg), 0);
+}
+
+/*
+OnClose()
+    WebSocket连接订阅了频道,fd关闭后要立即退订,否则广播会继续往它的队列里追加
+    录制中的连接写入CLOSE记录,重放时在同一时刻关闭
+    分块缓冲区在同一连接的请求之间复用,连接关闭时才归还,空闲的槽位不占用它
+*/
+void HttpConn::OnClose()
+{
+#ifdef USE_TRACE
+    TraceFinish();
+#endif
+    if (capture_id_) {
+        Capture::Record(capture_id_, CAPTURE_CLOSE, NULL, 0);
+        capture_id_ = 0;
+    }
+    if (ws_) {
+        ws_->Close();
+    }
+    free(stream_buf_);
+    stream_buf_ = NULL;
+}
 
-//关闭连接,减少客户数量,关闭连接
-void HttpConn::CloseConn(bool real_close)
+/*
+TaskDone()
+    主线程在任务进行中想关闭连接时只设置close_pending_,由最后一个结束的任务补发关闭通知
+    双方都是先写自己的变量、完整屏障后再读对方的,至少有一方看到对方,不会漏掉关闭
+    代数在减计数之前读:计数归零后主线程可能已关闭fd,槽位随时被新连接复用
+*/
+void HttpConn::TaskDone()
 {
-    if (sockfd_) {
-        printf("the write_ret is false close %d\n", sockfd_);
-        //删除监视的事件
-        utils_.RemoveFd(epollfd_, sockfd_);
-        sockfd_ = -1;
-        user_count_--;
+    CloseMsg msg = {sockfd_, generation_};
+    if (__sync_sub_and_fetch(&in_flight_, 1) == 0 && close_pending_) {
+        send(notifyfd_, (char*)&msg, sizeof(msg), 0);
     }
 }
 
-void HttpConn::Init(int sockfd,  const sockaddr_in &address)
+bool HttpConn::TryClose()
+{
+    close_pending_ = true;
+    __sync_synchronize();
+    return in_flight_ == 0;
+}
+
+//只用于明文连接,见Utils::Reject
+void HttpConn::Shed()
+{
+    Utils::Reject(sockfd_, SERVICE_UNAVAILABLE, sizeof(SERVICE_UNAVAILABLE) - 1);
+}
+
+HttpConn::HttpConn()
+    : generation_(0), phase_(PHASE_IDLE), deadline_(0), in_flight_(0), close_pending_(false), read_idx_(0), io_fd_(-1), cached_(NULL),
+      stream_buf_(NULL), producer_(NULL), producer_arg_(NULL), stream_done_(false),
+      h2_(NULL), ws_(NULL), tls_(NULL), proxy_(NULL), capture_id_(0)
+{
+#ifdef USE_TRACE
+    trace_id_ = 0;
+#endif
+}
+
+HttpConn::~HttpConn()
+{
+    delete h2_;
+    delete ws_;
+    delete tls_;
+    delete proxy_;
+    free(stream_buf_);
+}
+
+void HttpConn::Init(int sockfd,  const sockaddr_storage &address, bool cork)
 {
     ///home/shang/code/WebServer/github/WebServer/resources
     doc_root_ = "/home/shang/code/WebServer/github/MyTinyWebServer/WebServer/resources";
@@ -34,18 +126,186 @@ void HttpConn::Init(int sockfd,  const sockaddr_in &address)
     // 初始化套接字和地址
     sockfd_ = sockfd;
     address_ = address;
+    cork_ = cork;
+    generation_++;
+    close_pending_ = false;     //上一个连接关闭时已没有进行中的任务
+
+    //上一个使用该槽位的连接若切换过HTTP/2或WebSocket,在这里释放会话
+    delete h2_;
+    h2_ = NULL;
+    if (ws_) {
+        ws_->Close();
+        delete ws_;
+        ws_ = NULL;
+    }
+    delete tls_;
+    tls_ = tls_ctx_ ? new TlsSession(tls_ctx_, sockfd_) : NULL;
+    //上一个连接中途断开时,正在转发的上游连接不能放回连接池
+    if (proxy_) {
+        proxy_->Reset();
+    }
 
     //向epoll对象添加监视事件,oneshoot模式保证单个线程负责
     utils_.AddFd(epollfd_, sockfd_, true);
     user_count_++;
+#ifdef USE_TRACE
+    trace_id_ = 0;
+#endif
     
     //private 版本的 init();专门用来来初始化private成员变量
     Init();
+    capture_id_ = Capture::Enabled() ? Capture::Open() : 0;
+}
+
+int HttpConn::Recv(char *buf, int len)
+{
+    int ret = tls_ ? tls_->Read(buf, len) : recv(sockfd_, buf, len, 0);
+    //HTTP/1、HTTP/2和WebSocket都从这里读,录制的是TLS解密后的字节
+    if (ret > 0 && capture_id_) {
+        Capture::Record(capture_id_, CAPTURE_DATA, buf, ret);
+    }
+    return ret;
+}
+
+/*
+Writev()
+    发送响应期间每次有进展都推迟期限:最近WRITE_TIMEOUT秒内没有进展,
+    或者超出WRITE_TIMEOUT的时间里平均速率低于WRITE_MIN_RATE,连接都会到期
+    cork:明文的一次writev本来就只有最后一个报文段可能不满,用MSG_MORE留给下一次写补满
+    用户态TLS每段iovec各写一条记录、各调用一次send,写之前置TCP_CORK,没有后续数据时解除,解除时立即发出
+*/
+int HttpConn::Writev(const struct iovec *iov, int count, bool more)
+{
+    int ret;
+    if (!cork_) {
+        ret = tls_ ? tls_->Writev(iov, count) : writev(sockfd_, iov, count);
+    }
+    else if (!tls_) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = (struct iovec *)iov;
+        msg.msg_iovlen = count;
+        ret = sendmsg(sockfd_, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+    }
+    else {
+        int on = 1;
+        setsockopt(sockfd_, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+        ret = tls_->Writev(iov, count);
+        if (!more) {
+            int off = 0;
+            setsockopt(sockfd_, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+        }
+    }
+    if (ret > 0) {
+        OnSent(ret);
+    }
+    return ret;
+}
+
+void HttpConn::OnSent(int len)
+{
+    turn_sent_ += len;
+    if (phase_ == PHASE_WRITE) {
+        write_sent_ += len;
+        int64_t stall = Clock::Read() + WRITE_TIMEOUT * 1000;
+        int64_t rate = write_start_ + WRITE_TIMEOUT * 1000 + write_sent_ * 1000 / WRITE_MIN_RATE;
+        deadline_ = stall < rate ? stall : rate;
+    }
+}
+
+#ifdef USE_TRACE
+void HttpConn::TraceQueued()
+{
+    if (h2_ || ws_ || !Trace::Enabled()) {
+        return;
+    }
+    trace_queued_ = Trace::Now();
+    if (!trace_id_) {
+        trace_id_ = Trace::NewRequest();
+        trace_start_ = trace_queued_;
+    }
+}
+
+void HttpConn::TraceDequeued()
+{
+    if (trace_id_) {
+        Trace::Span(trace_id_, TRACE_QUEUE, trace_queued_, Trace::Now());
+    }
+}
+
+void HttpConn::TraceFinish()
+{
+    if (trace_id_) {
+        Trace::Finish(trace_id_, trace_start_, Trace::Now());
+        trace_id_ = 0;
+    }
+}
+#endif
+
+void HttpConn::SetPhase(int phase, int timeout)
+{
+    int64_t now = Clock::Read();
+    deadline_ = now + timeout * 1000;
+    if (phase == PHASE_WRITE) {
+        write_start_ = now;
+        write_sent_ = 0;
+    }
+    phase_ = phase;
+}
+
+void HttpConn::ExtendDeadline(int timeout)
+{
+    int64_t deadline = Clock::Read() + timeout;
+    if (deadline > deadline_) {
+        deadline_ = deadline;
+    }
+}
+
+bool HttpConn::RecvPending()
+{
+    return tls_ && tls_->Pending();
+}
+
+/*
+Handshake()
+    非阻塞TLS握手,由读写事件驱动,握手在工作线程中进行不占用主线程
+    未完成时按OpenSSL需要的方向重新注册事件;返回false表示握手失败
+*/
+bool HttpConn::Handshake()
+{
+    int ret = tls_->Handshake();
+    if (ret < 0) {
+        return false;
+    }
+    if (ret == 0) {
+        utils_.ModFd(epollfd_, sockfd_, tls_->WantWrite() ? EPOLLOUT : EPOLLIN);
+    }
+    return true;
 }
 
 //非阻塞读客户端数据到server的读缓冲中
 bool HttpConn::ReadOnce()
 {
+    //握手完成后继续读取,客户端可能已经发出了请求
+    if (tls_ && !tls_->Established()) {
+        if (!Handshake()) {
+            return false;
+        }
+        //握手未完成,事件已重新注册,Process发现后直接返回
+        if (!tls_->Established()) {
+            return true;
+        }
+    }
+
+    if (h2_) {
+        return h2_->Read();
+    }
+    //WebSocket会话在OnEvent中自行读取
+    if (ws_) {
+        return true;
+    }
+    TRACE_SCOPE(trace_id_, TRACE_READ);
+
     //如果读取数据大于缓冲区大小,返回false
     if (read_idx_ >= READ_BUFFER_SIZE) {
         return false;
@@ -54,7 +314,7 @@ bool HttpConn::ReadOnce()
     int bytes_read = 0;
     //[ET模式]配合[非阻塞connfd]读取数据
     while (true) {
-        bytes_read = recv(sockfd_, read_buf_ + read_idx_, READ_BUFFER_SIZE - read_idx_, 0);
+        bytes_read = Recv(read_buf_ + read_idx_, READ_BUFFER_SIZE - read_idx_);
         if (bytes_read == -1) {
             // 非阻塞ET模式下，需要一次性将数据读完，下次不会通知所以循环读完
             if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -75,18 +335,61 @@ bool HttpConn::ReadOnce()
 //写将响应报文内容写入connfd中
 bool HttpConn::Write()
 {
+    turn_sent_ = 0;
+
+    //握手需要等待可写时由写事件继续,完成后改为等待请求
+    if (tls_ && !tls_->Established()) {
+        if (!Handshake()) {
+            return false;
+        }
+        if (tls_->Established()) {
+            utils_.ModFd(epollfd_, sockfd_, EPOLLIN);
+        }
+        return true;
+    }
+
+    //HTTP/2连接由会话发送
+    if (h2_) {
+        int ret = h2_->Pump();
+        if (ret >= 0) {
+            utils_.ModFd(epollfd_, sockfd_, ret == 0 ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+        }
+        return ret >= 0;
+    }
+
+    if (ws_) {
+        return ws_->OnEvent(false);
+    }
+    TRACE_SCOPE(trace_id_, TRACE_WRITE);
+
+    //反向代理的响应由ProxyExchange转发
+    if (proxy_ && proxy_->Active()) {
+        return WriteProxy();
+    }
+
+    //分块流式响应单独处理
+    if (producer_) {
+        return WriteStream();
+    }
+
     // 如果数据发送完毕,那么写事件完成,下一次注册读事件
+    //先初始化再注册读事件,否则新请求可能在另一个线程中被读入后又被Init清空
     if (bytes_to_send_ == 0) {
-        utils_.ModFd(epollfd_, sockfd_, EPOLLIN);
         //重新准备下一次读取事件,所以所有成员变量初始化为最初值
         Init();
+        utils_.ModFd(epollfd_, sockfd_, EPOLLIN);
         return true;
     }
 
     int temp;
-    //非阻塞connfd,一次循环写完
+    //非阻塞connfd,发送到EAGAIN或用完本次调度的预算
     while (true) {
-        temp = writev(sockfd_, iv_, iv_count_);
+        //大文件分片发送:重新注册EPOLLOUT,套接字仍可写所以立即产生新事件,排到请求队列末尾
+        if (TurnSpent()) {
+            utils_.ModFd(epollfd_, sockfd_, EPOLLOUT);
+            return true;
+        }
+        temp = Writev(iv_, iv_count_);
         //没有成功发送数据
         if (temp < 0) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
@@ -102,29 +405,18 @@ bool HttpConn::Write()
         bytes_to_send_ -= temp;
 
         //因为可能多次发送,所以每次都要更新发送数据的起始位置和剩余发送数据大小
-        //第一个iovec头部信息的数据已发送完，发送第二个iovec数据
-        if (bytes_to_send_ >= iv_[0].iov_len)
-        {
-            iv_[0].iov_len = 0;
-            iv_[1].iov_base = file_address_ + (bytes_have_send_ - write_idx_);
-            iv_[1].iov_len = bytes_to_send_;
-        }
-        else 
-        {
-            iv_[0].iov_base = write_buf_ + bytes_have_send_;
-            iv_[0].iov_len = iv_[0].iov_len - bytes_have_send_;
-        }
+        //第二个iovec可能是文件映射区,也可能是路由处理函数生成的响应体
+        AdvanceIov(temp);
 
         //无数据发送了
         if (bytes_to_send_ <= 0) {
             UnMap();
-            //修改为监视读事件
-            utils_.ModFd(epollfd_, sockfd_, EPOLLIN);
 
-            //如果长连接,重新初始化
+            //如果长连接,重新初始化后修改为监视读事件
             if (linger_) 
             {
                 Init();
+                utils_.ModFd(epollfd_, sockfd_, EPOLLIN);
                 return true;
             } 
             else 
@@ -135,6 +427,99 @@ bool HttpConn::Write()
     }
 }
 
+/*
+WriteStream()
+    分块模式下的发送
+    先把已编码的chunk批量writev出去,发送完毕后再调用生产函数产生下一批
+    遇到EAGAIN注册EPOLLOUT等待内核缓冲区可写,生产函数不会在对端拥塞时继续产生数据
+*/
+bool HttpConn::WriteStream()
+{
+    if (!producer_) {
+        return false;
+    }
+    int temp;
+    while (true) {
+        if (TurnSpent()) {
+            utils_.ModFd(epollfd_, sockfd_, EPOLLOUT);
+            return true;
+        }
+        if (bytes_to_send_ > 0) {
+            //分块由生产函数同步产生,最后一块之前的都可以等下一批补满报文段
+            temp = Writev(iv_, iv_count_, !stream_done_);
+            if (temp < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    utils_.ModFd(epollfd_, sockfd_, EPOLLOUT);
+                    return true;
+                }
+                return false;
+            }
+            bytes_have_send_ += temp;
+            bytes_to_send_ -= temp;
+            AdvanceIov(temp);
+            continue;
+        }
+
+        //最后一个chunk也已发出,响应结束
+        if (stream_done_) {
+            if (linger_) {
+                Init();
+                utils_.ModFd(epollfd_, sockfd_, EPOLLIN);
+                return true;
+            }
+            return false;
+        }
+
+        //缓冲区已全部发出,生产下一批chunk
+        stream_idx_ = 0;
+        if (!FillStream())
+            return false;
+        iv_[0].iov_base = stream_buf_;
+        iv_[0].iov_len = stream_idx_;
+        iv_count_ = 1;
+        bytes_to_send_ = stream_idx_;
+    }
+}
+
+/*
+WriteProxy()
+    客户端不可写时注册EPOLLOUT,上游的等待在ProxyExchange内部以poll完成
+*/
+bool HttpConn::WriteProxy()
+{
+    int ret = proxy_->Send(this);
+    if (ret == 0) {
+        utils_.ModFd(epollfd_, sockfd_, EPOLLOUT);
+        return true;
+    }
+    if (ret < 0) {
+        proxy_->Reset();
+        return false;
+    }
+    if (linger_) {
+        Init();
+        utils_.ModFd(epollfd_, sockfd_, EPOLLIN);
+        return true;
+    }
+    return false;
+}
+
+//writev发送了bytes字节后,跳过iv_中已发送的部分
+void HttpConn::AdvanceIov(int bytes)
+{
+    for (int i = 0; i < iv_count_ && bytes > 0; i++) {
+        int len = iv_[i].iov_len;
+        if (bytes >= len) {
+            iv_[i].iov_len = 0;
+            bytes -= len;
+        }
+        else {
+            iv_[i].iov_base = (char*)iv_[i].iov_base + bytes;
+            iv_[i].iov_len = len - bytes;
+            bytes = 0;
+        }
+    }
+}
 
 /*
 从状态机工作逻辑
@@ -235,10 +620,12 @@ HttpConn::HTTP_CODE HttpConn::ParseHeader(char* text)
 {
     // 遇到空行，表示头部字段解析完毕
     if( text[0] == '\0' ) {
+        headers_len_ = text - headers_;
         // 如果HTTP请求有消息体，则还需要读取m_content_length字节的消息体，
         // 状态机转移到CHECK_STATE_CONTENT状态
         if ( content_length_ != 0 ) {
             check_state_ = CHECK_STATE_CONTENT;
+            SetPhase(PHASE_BODY, BODY_TIMEOUT);
             return NO_REQUEST;
         }
         // 否则说明我们已经得到了一个完整的HTTP请求
@@ -260,6 +647,29 @@ HttpConn::HTTP_CODE HttpConn::ParseHeader(char* text)
         text += 5;
         text += strspn( text, " \t" );
         host_ = text;
+    } else if ( strncasecmp( text, "Upgrade:", 8 ) == 0 ) {
+        // 处理Upgrade头部字段,支持升级到h2c和websocket
+        text += 8;
+        text += strspn( text, " \t" );
+        if ( strcasecmp( text, "h2c" ) == 0 ) {
+            upgrade_h2c_ = true;
+        }
+        else if ( strcasecmp( text, "websocket" ) == 0 ) {
+            upgrade_ws_ = true;
+        }
+    } else if ( strncasecmp( text, "Sec-WebSocket-Key:", 18 ) == 0 ) {
+        text += 18;
+        text += strspn( text, " \t" );
+        ws_key_ = text;
+    } else if ( strncasecmp( text, "HTTP2-Settings:", 15 ) == 0 ) {
+        text += 15;
+        text += strspn( text, " \t" );
+        h2_settings_ = text;
+    } else if ( strncasecmp( text, "Content-Type:", 13 ) == 0 ) {
+        // 处理Content-Type头部字段,表单请求体需要拆分成键值对
+        text += 13;
+        text += strspn( text, " \t" );
+        content_type_ = text;
     } else {
         printf( "oop! unknow header %s\n", text );
     }
@@ -273,6 +683,7 @@ HttpConn::HTTP_CODE HttpConn::ParseContent(char* text)
     if (read_idx_ >= (content_length_ + checked_idx_))
     {
         text[content_length_] = '\0';
+        content_ = text;
         return GET_REQUEST;
     }
     return NO_REQUEST;
@@ -289,47 +700,144 @@ HttpConn::HTTP_CODE HttpConn::ParseContent(char* text)
 */
 HttpConn::HTTP_CODE HttpConn::DoRequest()
 {
-    // "/home/nowcoder/webserver/resources"
-    strcpy(read_file_, doc_root_);
-    int len = strlen(doc_root_);
-    strncpy(read_file_ + len, url_, FILENAME_LEN - len - 1);
+    TRACE_SCOPE(trace_id_, TRACE_DO_REQUEST);
+    //在read_buf_中原地分离查询字符串并解码路径
+    query_ = strchr(url_, '?');
+    if (query_) {
+        *query_++ = '\0';
+    }
+    int url_len = Router::DecodeUrl(url_, false);
 
-    printf("The HTPP request's read_file_ is %s\n", read_file_);
+    //先匹配注册的处理函数,未命中再按文件处理
+    if (router_) {
+        HttpRequest req;
+        const Route* route = router_->Match(method_, url_, url_len, &req);
+        if (route) {
+            req.method = method_;
+            req.path = url_;
+            req.host = host_;
+            req.headers = headers_;
+            req.headers_len = headers_len_;
+            req.body = content_;
+            req.body_len = content_ ? content_length_ : 0;
+            req.query_count = Router::SplitParams(query_, req.queries, MAX_QUERY_PARAMS);
+            req.form_count = 0;
+            if (content_ && content_type_ && strncasecmp(content_type_, "application/x-www-form-urlencoded", 33) == 0) {
+                req.form_count = Router::SplitParams(content_, req.forms, MAX_QUERY_PARAMS);
+            }
+            HttpResponse resp(this);
+            return route->handler(req, resp, route->arg);
+        }
+    }
 
-    // 获取m_real_file文件的相关的状态信息，-1失败，0成功
-    if ( stat( read_file_, &file_stat_ ) < 0 ) {
+    //资源包模式:用解码后的路径直接查包内的索引,不拼接路径,也不访问文件系统
+    if (bundle_) {
+        asset_ = bundle_->Find(url_, url_len);
+        return asset_ ? BUNDLE_REQUEST : NO_RESOURCE;
+    }
+
+    // "/home/nowcoder/webserver/resources"
+    //规范化路径并拼接到根目录之后,含".."段的请求在访问文件系统前就被拒绝
+    int kind = path_cache_ ? path_cache_->Resolve(doc_root_, url_, url_len, read_file_, FILENAME_LEN, &file_stat_)
+                           : PathCache::Join(doc_root_, url_, url_len, read_file_, FILENAME_LEN);
+    if (kind == PATH_INVALID || kind == PATH_DIRECTORY) {
+        return BAD_REQUEST;
+    }
+    if (kind == PATH_MISSING) {
         return NO_RESOURCE;
     }
-    // 判断访问权限
-    if ( ! ( file_stat_.st_mode & S_IROTH ) ) {
+    if (kind == PATH_FORBIDDEN) {
         return FORBIDDEN_REQUEST;
     }
 
-    // 判断是否是目录
-    if ( S_ISDIR( file_stat_.st_mode ) ) {
-        return BAD_REQUEST;
+    printf("The HTPP request's read_file_ is %s\n", read_file_);
+
+    //小文件的完整响应已缓存时直接发送,不再stat/open/mmap
+    unsigned epoch = 0;
+    if (cache_) {
+        cached_ = cache_->Lookup(read_file_, &epoch);
+        if (cached_) {
+            return CACHED_REQUEST;
+        }
     }
 
-    // 以只读方式打开文件
+    //路径缓存已给出stat结果时不再stat
+    if (kind == PATH_UNKNOWN) {
+        // 获取m_real_file文件的相关的状态信息，-1失败，0成功
+        if ( stat( read_file_, &file_stat_ ) < 0 ) {
+            return NO_RESOURCE;
+        }
+        // 判断访问权限
+        if ( ! ( file_stat_.st_mode & S_IROTH ) ) {
+            return FORBIDDEN_REQUEST;
+        }
+
+        // 判断是否是目录
+        if ( S_ISDIR( file_stat_.st_mode ) ) {
+            return BAD_REQUEST;
+        }
+    }
+
+    // 以只读方式打开文件,stat之后文件可能已被删除或改了权限
     int fd = open( read_file_, O_RDONLY );
+    if (fd < 0) {
+        return NO_RESOURCE;
+    }
+    //空文件不能映射,ProcessWrite回复空白页面
+    if (file_stat_.st_size == 0) {
+        close(fd);
+        return FILE_REQUEST;
+    }
     // 创建内存映射
     file_address_ = ( char* )mmap( 0, file_stat_.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
-    close( fd );
+    if (file_address_ == MAP_FAILED) {
+        file_address_ = 0;
+        close(fd);
+        return INTERNAL_ERROR;
+    }
+
+    //文件不在页缓存中时,工作线程发送它会阻塞在缺页上:HTTP/1交给I/O线程预读,
+    //HTTP/2的流共用连接无法单独推迟,只发起异步预读
+    bool cold = !IoPool::Resident(file_address_, file_stat_.st_size);
+    if (cold && io_pool_ && !h2_) {
+        io_fd_ = fd;
+    }
+    else {
+        if (cold) {
+            posix_fadvise(fd, 0, file_stat_.st_size, POSIX_FADV_WILLNEED);
+        }
+        close( fd );
+    }
+
+    //放入缓存成功时本次响应就从缓存发送,映射区不再需要;冷文件拷贝时同样会缺页,下次再放入
+    if (!cold && cache_ && (size_t)file_stat_.st_size <= cache_->MaxFileSize()) {
+        cached_ = cache_->Insert(read_file_, file_stat_, file_address_, epoch);
+        if (cached_) {
+            munmap(file_address_, file_stat_.st_size);
+            file_address_ = 0;
+            return CACHED_REQUEST;
+        }
+    }
     return FILE_REQUEST;
 }
 
-//释放映射区
+//释放映射区和缓存响应的引用
 void HttpConn::UnMap()
 {
     if (file_address_) {
         munmap(file_address_, file_stat_.st_size);
         file_address_ = 0;
     }
+    if (cached_) {
+        cached_->Unref();
+        cached_ = NULL;
+    }
 }
 
 //报错,因为HTTP_CODE类型是在HttpConn内的,需要带上类名
 HttpConn::HTTP_CODE HttpConn::ProcessRead()
 {
+    TRACE_SCOPE(trace_id_, TRACE_PARSE);
     // LINE_STATUS 从状态机的状态
     LINE_STATUS line_status = LINE_OK;
     // 报文解析结果默认为NO_REQUEST
@@ -352,6 +860,7 @@ HttpConn::HTTP_CODE HttpConn::ProcessRead()
                 ret = ParseRequestLine(text);
                 if (ret == BAD_REQUEST)
                     return BAD_REQUEST;
+                headers_ = read_buf_ + start_line_;
                 break;
             }
             //一次处理一个头字段,返回NO_REQUEST
@@ -455,9 +964,89 @@ bool HttpConn::AddContent(const char *content)
     return AddResponse("%s", content);
 }
 
+/*
+SetStream()
+    设置流式响应的生产函数,DoRequest返回STREAM_REQUEST时使用
+    响应体长度无需提前知道,以Transfer-Encoding: chunked发送
+*/
+void HttpConn::SetStream(ChunkProducer producer, void* arg, const char* content_type)
+{
+    producer_ = producer;
+    producer_arg_ = arg;
+    resp_type_ = content_type;
+    stream_done_ = false;
+    stream_idx_ = 0;
+    StreamBuffer();
+}
+
+/*
+StreamBuffer()
+    大多数连接只发静态文件,分块缓冲区不放在连接槽位里,第一次写入时才分配
+    响应结束后在Init中释放
+*/
+bool HttpConn::StreamBuffer()
+{
+    if (!stream_buf_) {
+        stream_buf_ = (char *)malloc(STREAM_BUFFER_SIZE);
+    }
+    return stream_buf_ != NULL;
+}
+
+/*
+AddChunk()
+    将一段数据编码成一个chunk(长度行 + 数据 + \r\n)追加到stream_buf_
+    空间不足时返回false,生产函数应返回true等待下一次调用
+*/
+bool HttpConn::AddChunk(const char* data, int len)
+{
+    if (len <= 0) {
+        return true;
+    }
+    if (len > ChunkSpace()) {
+        return false;
+    }
+    if (!chunked_) {
+        memcpy(stream_buf_ + stream_idx_, data, len);
+        stream_idx_ += len;
+        return true;
+    }
+    stream_idx_ += sprintf(stream_buf_ + stream_idx_, "%x\r\n", len);
+    memcpy(stream_buf_ + stream_idx_, data, len);
+    stream_idx_ += len;
+    stream_buf_[stream_idx_++] = '\r';
+    stream_buf_[stream_idx_++] = '\n';
+    return true;
+}
+
+//单个chunk最多还能携带的数据字节数,预留了长度行,结尾\r\n和结束块"0\r\n\r\n"
+int HttpConn::ChunkSpace()
+{
+    if (!StreamBuffer()) {
+        return 0;
+    }
+    int space = STREAM_BUFFER_SIZE - stream_idx_ - 12 - 5;
+    return space > 0 ? space : 0;
+}
+
+//调用一次生产函数填充stream_buf_,生产结束时追加结束块
+//没有生产函数时返回false,调用方按处理失败关闭连接
+bool HttpConn::FillStream()
+{
+    if (!producer_ || !stream_buf_) {
+        return false;
+    }
+    if (!producer_(this, producer_arg_)) {
+        stream_done_ = true;
+        memcpy(stream_buf_ + stream_idx_, "0\r\n\r\n", 5);
+        stream_idx_ += 5;
+    }
+    return true;
+}
+
 //写响应报文
 bool HttpConn::ProcessWrite(HTTP_CODE ret)
 {
+    TRACE_SCOPE(trace_id_, TRACE_RESPOND);
     switch (ret)
     {
         //内部错误，500
@@ -477,6 +1066,24 @@ bool HttpConn::ProcessWrite(HTTP_CODE ret)
                 return false;
             break;
         }
+        //文件不存在:404
+        case NO_RESOURCE:
+        {
+            AddStatueLine(404, error_404_title);
+            AddHeaders(strlen(error_404_form));
+            if (!AddContent(error_404_form))
+                return false;
+            break;
+        }
+        //其他用户不可读:403
+        case FORBIDDEN_REQUEST:
+        {
+            AddStatueLine(403, error_403_title);
+            AddHeaders(strlen(error_403_form));
+            if (!AddContent(error_403_form))
+                return false;
+            break;
+        }
         //文件存在:200
         case FILE_REQUEST:
         {
@@ -502,9 +1109,85 @@ bool HttpConn::ProcessWrite(HTTP_CODE ret)
                 const char *ok_string = "<html><body></body></html>";
                 AddHeaders(strlen(ok_string));
                 if (!AddContent(ok_string))
-                    return false;            
+                    return false;
+                iv_[0].iov_base = write_buf_;
+                iv_[0].iov_len = write_idx_;
+                iv_count_ = 1;
+                bytes_to_send_ = write_idx_;
+                return true;
             }
         }
+        //流式响应:响应头和第一批chunk一起发送,不必等待整个响应体生成
+        case STREAM_REQUEST:
+        {
+            AddStatueLine(resp_status_, resp_title_);
+            AddResponse("Content-Type:%s\r\n", resp_type_);
+            AddResponse("Transfer-Encoding:%s\r\n", "chunked");
+            AddLinger();
+            if (!AddBlankLine())
+                return false;
+            if (!FillStream())
+                return false;
+            iv_[0].iov_base = write_buf_;
+            iv_[0].iov_len = write_idx_;
+            iv_[1].iov_base = stream_buf_;
+            iv_[1].iov_len = stream_idx_;
+            iv_count_ = 2;
+            bytes_to_send_ = write_idx_ + stream_idx_;
+            return true;
+        }
+        //路由处理函数生成的响应,响应体已在stream_buf_中
+        case DYNAMIC_REQUEST:
+        {
+            AddStatueLine(resp_status_, resp_title_);
+            AddResponse("Content-Type:%s\r\n", resp_type_);
+            if (!AddHeaders(stream_idx_))
+                return false;
+            iv_[0].iov_base = write_buf_;
+            iv_[0].iov_len = write_idx_;
+            iv_[1].iov_base = stream_buf_;
+            iv_[1].iov_len = stream_idx_;
+            iv_count_ = 2;
+            bytes_to_send_ = write_idx_ + stream_idx_;
+            return true;
+        }
+        //缓存的响应已包含状态行和响应头,只需按linger_选择版本
+        case CACHED_REQUEST:
+        {
+            int len;
+            iv_[0].iov_base = (void*)cached_->Response(linger_, &len);
+            iv_[0].iov_len = len;
+            iv_count_ = 1;
+            bytes_to_send_ = len;
+            return true;
+        }
+        //响应头和响应体都在资源包的映射区中,发送期间只调整iv_
+        case BUNDLE_REQUEST:
+        {
+            int len;
+            iv_[0].iov_base = (void*)bundle_->Head(asset_, linger_, &len);
+            iv_[0].iov_len = len;
+            iv_[1].iov_base = (void*)bundle_->Body(asset_);
+            iv_[1].iov_len = asset_->data_len;
+            iv_count_ = 2;
+            bytes_to_send_ = len + asset_->data_len;
+            return true;
+        }
+        //101响应交给WebSocket会话,作为发送队列的第一条消息发出
+        case WEBSOCKET_REQUEST:
+        {
+            char accept[32];
+            WsSession::AcceptKey(ws_key_, accept);
+            AddStatueLine(101, "Switching Protocols");
+            AddResponse("Upgrade:%s\r\n", "websocket");
+            AddResponse("Connection:%s\r\n", "Upgrade");
+            AddResponse("Sec-WebSocket-Accept:%s\r\n", accept);
+            if (!AddBlankLine())
+                return false;
+            ws_ = new WsSession(this, ws_hub_);
+            ws_->Start(write_buf_, write_idx_);
+            return true;
+        }
         default:
             return false;
     }
@@ -523,6 +1206,37 @@ bool HttpConn::ProcessWrite(HTTP_CODE ret)
 */
 void HttpConn::Process()
 {   
+    turn_sent_ = 0;
+
+    //TLS握手还未完成,ReadOnce已重新注册事件
+    if (tls_ && !tls_->Established()) {
+        return;
+    }
+    if (h2_) {
+        ProcessHttp2();
+        return;
+    }
+    if (ws_) {
+        if (!ws_->OnEvent(true)) {
+            CloseConn();
+        }
+        return;
+    }
+
+    //客户端以prior knowledge方式直接发送HTTP/2连接前言
+    int preface = Http2Session::MatchPreface(read_buf_, read_idx_);
+    if (preface == 0) {
+        utils_.ModFd(epollfd_, sockfd_, EPOLLIN);
+        return;
+    }
+    if (preface == 1) {
+        h2_ = new Http2Session(this);
+        h2_->Start();
+        h2_->Feed(read_buf_, read_idx_);
+        ProcessHttp2();
+        return;
+    }
+
     printf("The HTTP request is \n%s", read_buf_); //测试读取到的数据
 
     HTTP_CODE read_ret = ProcessRead();
@@ -534,20 +1248,101 @@ void HttpConn::Process()
         return;
     }
 
+    //Upgrade: h2c,只升级没有请求体的请求,响应在HTTP/2的流1上发送
+    //代理的响应直接从上游转发,不能再作为流1的响应
+    if (upgrade_h2c_ && read_ret != BAD_REQUEST && read_ret != PROXY_REQUEST && content_length_ == 0) {
+        //DoRequest时还不是HTTP/2,冷文件的描述符已留给I/O线程;流1不能单独推迟,与HTTP/2一样只发起预读
+        if (io_fd_ != -1) {
+            posix_fadvise(io_fd_, 0, file_stat_.st_size, POSIX_FADV_WILLNEED);
+            close(io_fd_);
+            io_fd_ = -1;
+        }
+        h2_ = new Http2Session(this);
+        h2_->StartUpgrade(h2_settings_, read_ret);
+        if (read_idx_ > checked_idx_) {
+            h2_->Feed(read_buf_ + checked_idx_, read_idx_ - checked_idx_);
+        }
+        ProcessHttp2();
+        return;
+    }
+
+    SetPhase(PHASE_WRITE, WRITE_TIMEOUT);
+
+    /*
+    代理的响应立即发送,不等EPOLLOUT
+    上游连接多半能在取出它的同一个工作线程中放回连接池,线程池轮流派发读写事件
+    */
+    if (read_ret == PROXY_REQUEST) {
+        if (!WriteProxy()) {
+            CloseConn();
+        }
+        return;
+    }
+    //缓存命中和资源包中的文件同样立即发送,都在内存中,多数情况下一次writev就完成整个响应
+    if (read_ret == CACHED_REQUEST || read_ret == BUNDLE_REQUEST) {
+        ProcessWrite(read_ret);
+        if (!Write()) {
+            CloseConn();
+        }
+        return;
+    }
+
     //调用 ProcessWrite 完成报文响应，我们传入了读函数返回值作为判断
     bool write_ret = ProcessWrite(read_ret);
     printf("The write_buf_ response is \n %s\n", write_buf_);
+    //冷文件预读完成后由主线程注册写事件,I/O线程队列已满时照常发送
+    if (io_fd_ != -1) {
+        int fd = io_fd_;
+        io_fd_ = -1;
+        if (write_ret && io_pool_->Append(fd, file_stat_.st_size, sockfd_, generation_)) {
+            return;
+        }
+        close(fd);
+    }
     if (!write_ret) {
         CloseConn();
+        return;
+    }
+    //WebSocket会话入队101时已注册写事件
+    if (ws_) {
+        return;
     }
     //该注册写事件了
     utils_.ModFd( epollfd_, sockfd_, EPOLLOUT);
 }
 
+/*
+ProcessHttp2()
+    处理会话中已收到的帧并立即尝试发送,不必再等一次EPOLLOUT
+    仍有数据没发完时同时监视读写事件,流量控制窗口耗尽时只监视读事件等待WINDOW_UPDATE
+*/
+void HttpConn::ProcessHttp2()
+{
+    if (!h2_->Process()) {
+        //尽力发出GOAWAY后关闭连接
+        h2_->Pump();
+        CloseConn();
+        return;
+    }
+    int ret = h2_->Pump();
+    if (ret < 0) {
+        CloseConn();
+        return;
+    }
+    utils_.ModFd(epollfd_, sockfd_, ret == 0 ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+}
+
 void HttpConn::Init()
 {       
-    timer_flag_ = 0;
-    event_finish_ = 0;
+#ifdef USE_TRACE
+    TraceFinish();
+#endif
+    //响应已发完或刚建立连接,在收到下一个请求前都是空闲的
+    SetPhase(PHASE_IDLE, KEEPALIVE_TIMEOUT);
+    //长连接的响应已发完:客户端可能在等它,重放时下一个请求要在收到响应之后发出
+    if (capture_id_ && read_idx_ > 0) {
+        Capture::Record(capture_id_, CAPTURE_RESPONSE, NULL, 0);
+    }
 
     //分析报文行所需要数据
     read_idx_ = 0;      //已读数据的下一位
@@ -561,9 +1356,44 @@ void HttpConn::Init()
     method_ = GET;
     url_ = 0;
     host_ = 0;
+    query_ = 0;
+    content_type_ = 0;
+    headers_ = 0;
+    headers_len_ = 0;
+    content_ = 0;
     version_ = 0;
     content_length_ = 0;    
     linger_ = false;
+    upgrade_h2c_ = false;
+    h2_settings_ = 0;
+    upgrade_ws_ = false;
+    ws_key_ = 0;
+    ws_hub_ = NULL;
+
+    //流式响应,中途放弃的生产函数在这里释放参数
+    if (producer_ && !stream_done_) {
+        producer_(NULL, producer_arg_);
+    }
+    producer_ = NULL;
+    producer_arg_ = NULL;
+    stream_idx_ = 0;
+    stream_done_ = false;
+    chunked_ = true;
+    resp_status_ = 200;
+    resp_title_ = ok_200_title;
+    resp_type_ = "text/html";
+    file_address_ = 0;
+    //没走到交给I/O线程的那一步就结束的请求,描述符还在这里
+    if (io_fd_ != -1) {
+        close(io_fd_);
+        io_fd_ = -1;
+    }
+    asset_ = NULL;
+    //发送中途被关闭的连接还持有缓存响应的引用
+    if (cached_) {
+        cached_->Unref();
+        cached_ = NULL;
+    }
 
     // 对读、写、文件名缓冲区初始化为'\0'
     memset(read_buf_, '\0', READ_BUFFER_SIZE);
@@ -25,8 +25,30 @@
 #include <stdarg.h>
 
 #include "../Utils/Utils.h"
+#include "../Trace/Trace.h"
 
+//各阶段的期限(秒),定时器按最早的期限触发
+const int KEEPALIVE_TIMEOUT = 15;   //长连接等待下一个请求
+const int HEADER_TIMEOUT = 10;      //从请求的第一个字节起收完请求行和请求头
+const int BODY_TIMEOUT = 10;        //收完请求头后收完请求体
+const int WRITE_TIMEOUT = 10;       //发送响应时允许的最长停滞
+const int WRITE_MIN_RATE = 1024;    //发送响应的最低平均速率(字节/秒)
 
+const long WRITE_BUDGET = 256 * 1024;   //默认每次调度最多发送的字节数
+
+class Router;
+class Http2Session;
+class WsSession;
+class WebSocketHub;
+class TlsContext;
+class TlsSession;
+class ProxyExchange;
+class ResponseCache;
+class PathCache;
+class IoPool;
+class AssetBundle;
+struct CachedResponse;
+struct BundleEntry;
 
 class HttpConn 
 {
@@ -34,6 +56,7 @@ public:
     static const int FILENAME_LEN = 200;        //设置读取文件的名称m_real_file大小
     static const int READ_BUFFER_SIZE = 2048;   //设置读缓冲区m_read_buf大小
     static const int WRITE_BUFFER_SIZE = 1024;  //设置写缓冲区m_write_buf大小
+    static const int STREAM_BUFFER_SIZE = 8192; //分块响应缓冲区stream_buf_大小,用到时才分配
     //报文的请求方法，本项目只用到GET和POST
     enum METHOD 
     {
@@ -64,7 +87,13 @@ public:
         FORBIDDEN_REQUEST,
         FILE_REQUEST,       //请求资源
         INTERNAL_ERROR,     //内部错误
-        CLOSED_CONNECTION   //关闭连接
+        CLOSED_CONNECTION,  //关闭连接
+        STREAM_REQUEST,     //分块流式响应
+        DYNAMIC_REQUEST,    //路由处理函数生成的定长响应
+        WEBSOCKET_REQUEST,  //握手成功,切换到WebSocket
+        PROXY_REQUEST,      //反向代理,响应头和响应体由ProxyExchange转发
+        CACHED_REQUEST,     //命中响应缓存,cached_中是完整的响应报文
+        BUNDLE_REQUEST      //资源包中的文件,asset_指向包内预先生成的响应头和响应体
     };
     //从状态机的状态
     enum LINE_STATUS
@@ -73,17 +102,68 @@ public:
         LINE_BAD,       //语法错误
         LINE_OPEN       //未获取到一行
     };
+    //连接所处的阶段,决定定时器按哪个期限关闭连接
+    enum PHASE
+    {
+        PHASE_IDLE = 0,     //长连接等待下一个请求
+        PHASE_HEADER,       //接收请求行和请求头
+        PHASE_BODY,         //接收请求体
+        PHASE_WRITE,        //发送响应
+        PHASE_SESSION,      //HTTP/2或WebSocket会话,按最后一次活动计时
+        PHASE_NUMBER
+    };
+
+    /*
+    分块响应的生产函数
+        每次被调用时通过AddChunk()向分块缓冲区写入若干chunk
+        返回true表示还有数据,缓冲区发送完毕后会被再次调用;返回false表示响应体已生产完毕
+        响应未完成连接或流就被放弃时,以conn为NULL调用一次,生产函数借此释放arg
+    */
+    typedef bool (*ChunkProducer)(HttpConn* conn, void* arg);
+
+    //工作线程发给主线程的关闭通知
+    struct CloseMsg
+    {
+        int sockfd;
+        int generation;
+    };
 
 public:
-    HttpConn() {}
-    ~HttpConn() {}
+    //只初始化Init之前会被读到的成员,其余在Init中设置
+    HttpConn();
+    ~HttpConn();
     
 public:
-    void Init(int sockfd, const sockaddr_in &address);
+    void Init(int sockfd, const sockaddr_storage &address, bool cork = false);
     //读取浏览器端发来的数据
     bool ReadOnce();
     bool Write();
 
+    //连接上所有收发都经过这两个函数,开启TLS时由TlsSession加解密,返回值与recv/writev一致
+    //more表示本次调度内紧接着还有数据要写,开启cork的连接先不把不满一个报文段的尾部发出去
+    int Recv(char *buf, int len);
+    int Writev(const struct iovec *iov, int count, bool more = false);
+    void OnSent(int len);   //不经过Writev发出的数据(splice)也要计入期限和发送预算
+    bool RecvPending();     //TLS层还缓存有已解密的数据
+    //没有切换协议也没有TLS,主线程可以直接在套接字上发送明文响应
+    bool PlainHttp() { return !h2_ && !ws_ && !tls_; }
+    int Phase() { return (h2_ || ws_) ? PHASE_SESSION : phase_; }
+    //还没读取任何数据的新请求,可以不处理直接拒绝
+    bool Sheddable() { return PlainHttp() && phase_ == PHASE_HEADER && read_idx_ == 0; }
+    void Shed();            //读掉已到达的请求并发送503,由调用者关闭连接
+    //主线程把事件交给线程池前调用;任务进行中的连接,定时器、淘汰和异常事件都不会直接关闭
+    void TaskQueued() { __sync_add_and_fetch(&in_flight_, 1); }
+    void TaskDone();        //工作线程在任务最后一次ModFd或CloseConn之后调用
+    bool TryClose();        //主线程关闭前调用,返回false时只做了标记,由工作线程结束任务时发关闭通知
+    //进入新阶段,期限从现在起算
+    void SetPhase(int phase, int timeout);
+    //工作线程同步等待上游时调用,期限至少推后到timeout毫秒之后,会话连接同样适用
+    void ExtendDeadline(int timeout);
+#ifdef USE_TRACE
+    void TraceQueued();     //主线程把事件交给线程池前调用,没有进行中的请求时开始追踪一个新请求
+    void TraceDequeued();   //工作线程取出任务时调用,记录排队时间
+#endif
+
     //处理HTTP请求
     void Process();
     
@@ -98,7 +178,8 @@ public:
     HTTP_CODE DoRequest();
 
     void UnMap();
-    void CloseConn(bool real_close = true);
+    void CloseConn();
+    void OnClose();     //主线程关闭fd时调用,释放连接上的长期订阅
 
     bool AddResponse(const char* format, ...);
     bool AddStatueLine(int status, const char *title);
@@ -109,6 +190,10 @@ public:
     bool AddContent(const char *content);
     bool AddContentLength(int content_len);
 
+    //流式响应接口,以Transfer-Encoding: chunked发送响应体
+    void SetStream(ChunkProducer producer, void* arg, const char* content_type = "text/html");
+    bool AddChunk(const char* data, int len);
+    int ChunkSpace();
 
 
 public:
@@ -121,18 +206,38 @@ public:
 
 public:
     int sockfd_;//客户端套接字
-    struct sockaddr_in address_;//客户端地址
+    struct sockaddr_storage address_;//客户端地址,IPv4、IPv6或Unix套接字
 
 public:
     static int epollfd_;    //我们还需要监视connfd的读事件,所以也需要上树
     static int user_count_; //客户端总数
-    int event_finish_;      //读写事件是否完成标志
-    int timer_flag_;        //标志为1,代表要移除定时器和关闭fd
+    static Router* router_; //注册的处理函数,DoRequest优先匹配路由再查找文件
+    static int notifyfd_;   //工作线程通过它请求主线程关闭连接
+    static TlsContext* tls_ctx_;    //非NULL时新连接先进行TLS握手
+    static ResponseCache* cache_;   //非NULL时小文件的完整响应被缓存
+    static PathCache* path_cache_;  //非NULL时URL到文件的解析结果被缓存,包括不存在的路径
+    static IoPool* io_pool_;        //非NULL时不在页缓存中的文件先交给I/O线程预读
+    static AssetBundle* bundle_;    //非NULL时静态文件只从资源包中查找,不访问文件系统
+    static long write_budget_;      //每次调度最多发送的字节数,用完后重新注册EPOLLOUT排队,0表示不限
+    int generation_;        //连接代数,每次accept加一,防止关闭通知作用到复用了fd的新连接
+    //工作线程推进阶段;主线程在空闲连接收到数据时切换到PHASE_HEADER,只有PHASE_IDLE的连接可被淘汰
+    volatile int phase_;
+    volatile int64_t deadline_; //当前阶段的期限(Clock毫秒),PHASE_SESSION只在等待上游时由ExtendDeadline设置
+    volatile int in_flight_;    //已交给线程池还没结束的任务数
+    volatile bool close_pending_;   //主线程要关闭时连接还在处理,等任务结束再关闭
 
 public:
     Utils utils_;            //工具类
 
 private:
+    friend class HttpResponse;
+    friend class Http2Session;
+    friend class ProxyExchange;
+
+    void ProcessHttp2();
+    bool WriteProxy();
+    bool Handshake();
+
     //专门用来来初始化private成员变量
     void Init();
     char read_buf_[READ_BUFFER_SIZE];   //读缓冲区
@@ -147,8 +252,18 @@ private:
     char *url_;             //请求URL
     char *version_;         //http版本
     char *host_;            //对方IP
+    char *query_;           //查询字符串
+    char *content_type_;    //请求体类型
+    char *headers_;         //请求头块起始位置,各行以"\0\0"分隔
+    int headers_len_;       //请求头块长度,不含结尾空行
+    char *content_;         //请求体
     int content_length_;    //请求体字节数
     bool linger_;           //是否长连接
+    bool upgrade_h2c_;      //请求头中有Upgrade: h2c
+    char *h2_settings_;     //HTTP2-Settings请求头
+    bool upgrade_ws_;       //请求头中有Upgrade: websocket
+    char *ws_key_;          //Sec-WebSocket-Key请求头
+    WebSocketHub *ws_hub_;  //握手成功后要订阅的频道
 
     //存储发出的响应报文数据    
     char write_buf_[WRITE_BUFFER_SIZE];  
@@ -158,11 +273,49 @@ private:
 
     struct stat file_stat_;   //文件属性
     char *file_address_;      //内存映射区 
+    int io_fd_;               //文件不在页缓存中时DoRequest保留的描述符,由Process交给I/O线程
+    CachedResponse *cached_;  //命中的缓存响应,发送完毕后释放引用
+    const BundleEntry *asset_;  //命中的资源包条目,映射区常驻,不需要释放
 
     struct iovec iv_[2];      //io向量机制iovec
     int iv_count_;            //发送部分数
     int bytes_to_send_;       //剩余发送字节数
     int bytes_have_send_;     //已发送字节数
+    int64_t write_start_;     //进入PHASE_WRITE的时间
+    long write_sent_;         //PHASE_WRITE中已发送的字节数,按WRITE_MIN_RATE推迟期限
+    long turn_sent_;          //本次调度已发送的字节数
+    bool cork_;               //监听地址开启了cork:明文连接用MSG_MORE,TLS连接用TCP_CORK合并多次写
+    bool TurnSpent() { return write_budget_ > 0 && turn_sent_ >= write_budget_; }
+
+    //分块流式响应相关
+    bool WriteStream();
+    bool FillStream();
+    void AdvanceIov(int bytes);
+    bool StreamBuffer();                  //第一次写入前分配stream_buf_,失败返回false
+    char *stream_buf_;                    //已编码好的chunk数据,第一次用到时分配,连接关闭时释放
+    int stream_idx_;                      //stream_buf_中数据长度
+    ChunkProducer producer_;              //响应体生产函数,为NULL时不是流式响应
+    void *producer_arg_;                  //生产函数参数
+    bool stream_done_;                    //生产函数是否已结束
+    bool chunked_;                        //AddChunk是否做chunk编码,HTTP/2下直接写原始数据
+
+    //路由处理函数设置的响应状态,响应体写在stream_buf_中
+    int resp_status_;
+    const char *resp_title_;
+    const char *resp_type_;
+
+    Http2Session *h2_;      //切换到HTTP/2后由会话接管该连接
+    WsSession *ws_;         //切换到WebSocket后由会话接管该连接
+    TlsSession *tls_;       //TLS连接的加解密状态
+    ProxyExchange *proxy_;  //HTTP/1连接第一次被代理时创建,之后复用
+    unsigned capture_id_;   //EnableCapture之后连接的录制编号,0表示不录制
+
+#ifdef USE_TRACE
+    void TraceFinish();     //响应发完或连接关闭时结束当前请求
+    unsigned trace_id_;     //正在追踪的请求编号,0表示没有
+    int64_t trace_start_;   //主线程收到请求第一个事件的时间(纳秒)
+    int64_t trace_queued_;  //最近一次放入线程池队列的时间
+#endif
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,607 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <map>
+
+#include "Hpack.h"
+#include "../Utils/Utils.h"
+
+/*
+h2c测试客户端
+    ./h2c_client [-n streams] [-w window] host:port [path...]
+    依次检查:先验知识直接发送前言、HTTP/1.1 Upgrade: h2c、同一连接上多个流并发、流量控制
+    流量控制一项把SETTINGS_INITIAL_WINDOW_SIZE设为window,窗口用完后不立即补充,
+    确认服务器停下等待WINDOW_UPDATE,且任何DATA帧都不超过流窗口和连接窗口
+    任一项失败时返回1
+*/
+
+static const char H2_PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const int H2_PREFACE_LEN = 24;
+static const long H2_DEFAULT_WINDOW = 65535;
+static const int IDLE_MS = 200;         //这么久没有收到帧,认为服务器在等待窗口
+static const int TEST_TIMEOUT_MS = 10000;
+
+enum
+{
+    FRAME_DATA = 0,
+    FRAME_HEADERS = 1,
+    FRAME_RST_STREAM = 3,
+    FRAME_SETTINGS = 4,
+    FRAME_PING = 6,
+    FRAME_GOAWAY = 7,
+    FRAME_WINDOW_UPDATE = 8,
+    FRAME_CONTINUATION = 9
+};
+
+enum
+{
+    FLAG_END_STREAM = 0x1,
+    FLAG_ACK = 0x1,
+    FLAG_END_HEADERS = 0x4,
+    FLAG_PADDED = 0x8,
+    FLAG_PRIORITY = 0x20
+};
+
+struct StreamResult
+{
+    int status;
+    long content_length;    //响应头中的content-length,没有为-1
+    long received;          //收到的响应体字节数
+    long window;            //本端给该流的接收窗口
+    bool ended;
+    bool reset;
+};
+
+class H2cClient
+{
+public:
+    H2cClient() : auto_update_(true), switches_(0), fd_(-1), header_stream_(0), header_flags_(0),
+                  window_(H2_DEFAULT_WINDOW), initial_window_(H2_DEFAULT_WINDOW), failed_(false),
+                  last_data_stream_(0) {}
+    ~H2cClient() { Close(); }
+
+    bool Connect(const struct sockaddr_storage &addr, socklen_t addr_len);
+    void Close();
+
+    //发送连接前言和SETTINGS,initial_window为0时不设置SETTINGS_INITIAL_WINDOW_SIZE
+    bool Start(long initial_window);
+    //HTTP/1.1升级,收到101后再发送前言,升级请求的响应在流1上
+    bool Upgrade(const char *host, const char *path);
+    bool Request(int id, const char *host, const char *path);
+    //读取并处理帧,直到所有流结束、失败或超时;auto_update_为false时窗口用完后由这里补充
+    bool Wait(int timeout_ms, int *stalls);
+
+    std::map<int, StreamResult> streams_;
+    bool auto_update_;
+    int switches_;          //相邻两个DATA帧属于不同流的次数,用来确认响应交错发送
+
+private:
+    bool Send(const void *data, int len);
+    bool SendFrame(int type, int flags, int id, const void *payload, int len);
+    bool WindowUpdate(int id, long increment);
+    //从缓冲区取出一个完整的帧,数据不够时读套接字,超时返回0,出错返回-1
+    int ReadFrame(int timeout_ms, int *type, int *flags, int *id, std::string *payload);
+    bool OnFrame(int type, int flags, int id, const std::string &payload);
+    bool OnHeaderBlock(int id, int flags);
+    bool AllEnded();
+    bool Fail(const char *format, ...);
+
+private:
+    int fd_;
+    std::string in_;
+    std::string header_block_;  //HEADERS和后续CONTINUATION拼接的头块
+    int header_stream_;
+    int header_flags_;
+    long window_;               //本端的连接级接收窗口
+    long initial_window_;       //本端SETTINGS_INITIAL_WINDOW_SIZE
+    bool failed_;
+    int last_data_stream_;
+    HpackDecoder decoder_;
+    HpackEncoder encoder_;
+};
+
+static void WriteUint32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint32_t ReadUint32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static std::string Base64Url(const unsigned char *data, int len)
+{
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    std::string out;
+    uint32_t acc = 0;
+    int bits = 0;
+    for (int i = 0; i < len; i++) {
+        acc = (acc << 8) | data[i];
+        bits += 8;
+        while (bits >= 6) {
+            bits -= 6;
+            out.push_back(table[(acc >> bits) & 63]);
+        }
+    }
+    if (bits > 0) {
+        out.push_back(table[(acc << (6 - bits)) & 63]);
+    }
+    return out;
+}
+
+bool H2cClient::Fail(const char *format, ...)
+{
+    va_list arg_list;
+    va_start(arg_list, format);
+    printf("    ");
+    vprintf(format, arg_list);
+    printf("\n");
+    va_end(arg_list);
+    failed_ = true;
+    return false;
+}
+
+bool H2cClient::Connect(const struct sockaddr_storage &addr, socklen_t addr_len)
+{
+    fd_ = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd_ < 0) {
+        return Fail("socket failure, errno = %d", errno);
+    }
+    if (connect(fd_, (const struct sockaddr *)&addr, addr_len) < 0) {
+        return Fail("connect failure, errno = %d", errno);
+    }
+    if (addr.ss_family != AF_UNIX) {
+        int on = 1;
+        setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    return true;
+}
+
+void H2cClient::Close()
+{
+    if (fd_ != -1) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool H2cClient::Send(const void *data, int len)
+{
+    const char *p = (const char *)data;
+    while (len > 0) {
+        ssize_t n = send(fd_, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return Fail("send failure, errno = %d", errno);
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool H2cClient::SendFrame(int type, int flags, int id, const void *payload, int len)
+{
+    unsigned char head[9];
+    head[0] = len >> 16;
+    head[1] = len >> 8;
+    head[2] = len;
+    head[3] = type;
+    head[4] = flags;
+    WriteUint32(head + 5, id);
+    std::string frame((const char *)head, sizeof(head));
+    frame.append((const char *)payload, len);
+    return Send(frame.data(), frame.size());
+}
+
+bool H2cClient::WindowUpdate(int id, long increment)
+{
+    unsigned char payload[4];
+    WriteUint32(payload, increment);
+    if (id == 0) {
+        window_ += increment;
+    }
+    else {
+        streams_[id].window += increment;
+    }
+    return SendFrame(FRAME_WINDOW_UPDATE, 0, id, payload, sizeof(payload));
+}
+
+bool H2cClient::Start(long initial_window)
+{
+    initial_window_ = initial_window > 0 ? initial_window : H2_DEFAULT_WINDOW;
+    if (!Send(H2_PREFACE, H2_PREFACE_LEN)) {
+        return false;
+    }
+    unsigned char settings[6];
+    settings[0] = 0;
+    settings[1] = 4;    //SETTINGS_INITIAL_WINDOW_SIZE
+    WriteUint32(settings + 2, initial_window_);
+    return SendFrame(FRAME_SETTINGS, 0, 0, settings, initial_window > 0 ? sizeof(settings) : 0);
+}
+
+bool H2cClient::Upgrade(const char *host, const char *path)
+{
+    unsigned char settings[6];
+    settings[0] = 0;
+    settings[1] = 3;    //SETTINGS_MAX_CONCURRENT_STREAMS
+    WriteUint32(settings + 2, 100);
+    char request[1024];
+    int len = snprintf(request, sizeof(request),
+                       "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: Upgrade, HTTP2-Settings\r\n"
+                       "Upgrade: h2c\r\nHTTP2-Settings: %s\r\n\r\n",
+                       path, host, Base64Url(settings, sizeof(settings)).c_str());
+    if (!Send(request, len)) {
+        return false;
+    }
+
+    //101之后的字节已经是服务器的HTTP/2帧,留在in_中
+    size_t end;
+    while ((end = in_.find("\r\n\r\n")) == std::string::npos) {
+        char buf[4096];
+        struct pollfd pfd = {fd_, POLLIN, 0};
+        if (poll(&pfd, 1, TEST_TIMEOUT_MS) <= 0) {
+            return Fail("no response to the upgrade request");
+        }
+        ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            return Fail("connection closed before 101");
+        }
+        in_.append(buf, n);
+    }
+    if (in_.compare(0, 12, "HTTP/1.1 101") != 0) {
+        return Fail("expected 101, got \"%.*s\"", (int)in_.find("\r\n"), in_.c_str());
+    }
+    in_.erase(0, end + 4);
+
+    StreamResult &stream = streams_[1];
+    memset(&stream, 0, sizeof(stream));
+    stream.content_length = -1;
+    stream.window = H2_DEFAULT_WINDOW;
+    return Start(0);
+}
+
+bool H2cClient::Request(int id, const char *host, const char *path)
+{
+    std::string block;
+    encoder_.Encode(":method", "GET", &block);
+    encoder_.Encode(":scheme", "http", &block);
+    encoder_.Encode(":path", path, &block);
+    encoder_.Encode(":authority", host, &block);
+    StreamResult &stream = streams_[id];
+    memset(&stream, 0, sizeof(stream));
+    stream.content_length = -1;
+    stream.window = initial_window_;
+    return SendFrame(FRAME_HEADERS, FLAG_END_HEADERS | FLAG_END_STREAM, id, block.data(), block.size());
+}
+
+int H2cClient::ReadFrame(int timeout_ms, int *type, int *flags, int *id, std::string *payload)
+{
+    while (true) {
+        if (in_.size() >= 9) {
+            const unsigned char *p = (const unsigned char *)in_.data();
+            size_t len = (p[0] << 16) | (p[1] << 8) | p[2];
+            if (in_.size() >= 9 + len) {
+                *type = p[3];
+                *flags = p[4];
+                *id = ReadUint32(p + 5) & 0x7fffffff;
+                payload->assign(in_, 9, len);
+                in_.erase(0, 9 + len);
+                return 1;
+            }
+        }
+        struct pollfd pfd = {fd_, POLLIN, 0};
+        int ret = poll(&pfd, 1, timeout_ms);
+        if (ret == 0) {
+            return 0;
+        }
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        char buf[65536];
+        ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            Fail("connection closed by server");
+            return -1;
+        }
+        in_.append(buf, n);
+    }
+}
+
+bool H2cClient::OnHeaderBlock(int id, int flags)
+{
+    std::vector<HpackHeader> headers;
+    if (!decoder_.Decode((const unsigned char *)header_block_.data(), header_block_.size(), &headers)) {
+        return Fail("stream %d: bad header block", id);
+    }
+    header_block_.clear();
+    std::map<int, StreamResult>::iterator it = streams_.find(id);
+    if (it == streams_.end()) {
+        return Fail("HEADERS on unknown stream %d", id);
+    }
+    for (size_t i = 0; i < headers.size(); i++) {
+        if (headers[i].name == ":status") {
+            it->second.status = atoi(headers[i].value.c_str());
+        }
+        else if (headers[i].name == "content-length") {
+            it->second.content_length = atol(headers[i].value.c_str());
+        }
+    }
+    if (flags & FLAG_END_STREAM) {
+        it->second.ended = true;
+    }
+    return true;
+}
+
+bool H2cClient::OnFrame(int type, int flags, int id, const std::string &payload)
+{
+    const unsigned char *p = (const unsigned char *)payload.data();
+    int len = payload.size();
+    switch (type)
+    {
+        case FRAME_SETTINGS:
+            if (!(flags & FLAG_ACK)) {
+                return SendFrame(FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+            }
+            return true;
+        case FRAME_PING:
+            if (!(flags & FLAG_ACK)) {
+                return SendFrame(FRAME_PING, FLAG_ACK, 0, p, len);
+            }
+            return true;
+        case FRAME_GOAWAY:
+            return Fail("GOAWAY, error code %u", len >= 8 ? ReadUint32(p + 4) : 0);
+        case FRAME_RST_STREAM:
+            streams_[id].reset = true;
+            return Fail("stream %d reset, error code %u", id, len >= 4 ? ReadUint32(p) : 0);
+        case FRAME_HEADERS:
+        {
+            int off = 0;
+            int pad = 0;
+            if (flags & FLAG_PADDED) {
+                pad = p[0];
+                off = 1;
+            }
+            if (flags & FLAG_PRIORITY) {
+                off += 5;
+            }
+            header_block_.assign(payload, off, len - off - pad);
+            header_stream_ = id;
+            header_flags_ = flags;
+            return (flags & FLAG_END_HEADERS) ? OnHeaderBlock(id, flags) : true;
+        }
+        case FRAME_CONTINUATION:
+            if (id != header_stream_) {
+                return Fail("CONTINUATION on stream %d, expected %d", id, header_stream_);
+            }
+            header_block_.append(payload);
+            return (flags & FLAG_END_HEADERS) ? OnHeaderBlock(id, header_flags_) : true;
+        case FRAME_DATA:
+        {
+            std::map<int, StreamResult>::iterator it = streams_.find(id);
+            if (it == streams_.end()) {
+                return Fail("DATA on unknown stream %d", id);
+            }
+            StreamResult &stream = it->second;
+            //填充字节同样计入流量控制
+            if (len > stream.window || len > window_) {
+                return Fail("stream %d: %d bytes of DATA exceed the window (stream %ld, connection %ld)",
+                            id, len, stream.window, window_);
+            }
+            stream.window -= len;
+            window_ -= len;
+            int pad = (flags & FLAG_PADDED) && len > 0 ? p[0] + 1 : 0;
+            stream.received += len - pad;
+            if (last_data_stream_ && last_data_stream_ != id) {
+                switches_++;
+            }
+            last_data_stream_ = id;
+            if (flags & FLAG_END_STREAM) {
+                stream.ended = true;
+            }
+            if (auto_update_ && len > 0) {
+                if (!WindowUpdate(0, len)) {
+                    return false;
+                }
+                if (!stream.ended && !WindowUpdate(id, len)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        default:
+            //WINDOW_UPDATE、PRIORITY等,客户端只下载,不需要处理
+            return true;
+    }
+}
+
+bool H2cClient::AllEnded()
+{
+    std::map<int, StreamResult>::iterator it;
+    for (it = streams_.begin(); it != streams_.end(); ++it) {
+        if (!it->second.ended) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+Wait()
+    auto_update_为false时,IDLE_MS内没有新的帧且有流的窗口已经用完,认为服务器在等待窗口,
+    这时才补充用完的流窗口和连接窗口并计一次stall;窗口还有剩余却没有数据说明服务器卡住了
+*/
+bool H2cClient::Wait(int timeout_ms, int *stalls)
+{
+    int64_t deadline = Clock::ReadUs() + (int64_t)timeout_ms * 1000;
+    while (!AllEnded()) {
+        if (Clock::ReadUs() > deadline) {
+            return Fail("timed out waiting for responses");
+        }
+        int type, flags, id;
+        std::string payload;
+        int ret = ReadFrame(auto_update_ ? TEST_TIMEOUT_MS : IDLE_MS, &type, &flags, &id, &payload);
+        if (ret < 0) {
+            return false;
+        }
+        if (ret > 0) {
+            if (!OnFrame(type, flags, id, payload)) {
+                return false;
+            }
+            continue;
+        }
+        if (auto_update_) {
+            return Fail("timed out waiting for responses");
+        }
+
+        bool blocked = window_ <= 0;
+        std::map<int, StreamResult>::iterator it;
+        for (it = streams_.begin(); it != streams_.end(); ++it) {
+            if (!it->second.ended && it->second.window <= 0) {
+                blocked = true;
+                if (!WindowUpdate(it->first, initial_window_)) {
+                    return false;
+                }
+            }
+        }
+        if (!blocked) {
+            return Fail("server stopped sending with window left");
+        }
+        //连接窗口只在低于一个流窗口时补充,让连接级限制也起作用
+        if (window_ < initial_window_ && !WindowUpdate(0, H2_DEFAULT_WINDOW - window_)) {
+            return false;
+        }
+        if (stalls) {
+            (*stalls)++;
+        }
+    }
+    return true;
+}
+
+//检查每个流都是200且响应体长度与content-length一致
+static bool Check(H2cClient &client)
+{
+    bool ok = true;
+    std::map<int, StreamResult>::iterator it;
+    for (it = client.streams_.begin(); it != client.streams_.end(); ++it) {
+        const StreamResult &stream = it->second;
+        if (stream.status != 200 ||
+            (stream.content_length >= 0 && stream.content_length != stream.received)) {
+            printf("    stream %d: status %d, content-length %ld, received %ld\n",
+                   it->first, stream.status, stream.content_length, stream.received);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+static bool Report(const char *name, bool ok, const char *detail)
+{
+    printf("%-16s %s  %s\n", name, ok ? "PASS" : "FAIL", detail);
+    return ok;
+}
+
+int main(int argc, char* argv[])
+{
+    int streams = 10;
+    long window = 256;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:w:")) != -1) {
+        if (opt == 'n') {
+            streams = atoi(optarg);
+        }
+        else if (opt == 'w') {
+            window = atol(optarg);
+        }
+        else {
+            optind = argc;
+            break;
+        }
+    }
+    if (argc - optind < 1 || streams <= 0 || window <= 0) {
+        printf("Usage: ./h2c_client [-n streams] [-w window] host:port [path...]\n");
+        return 1;
+    }
+    const char *target = argv[optind];
+    std::vector<const char *> paths;
+    for (int i = optind + 1; i < argc; i++) {
+        paths.push_back(argv[i]);
+    }
+    if (paths.empty()) {
+        paths.push_back("/index.html");
+        paths.push_back("/favicon.ico");
+    }
+
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    if (!Utils::ParseAddress(target, &addr, &addr_len)) {
+        printf("bad target %s\n", target);
+        return 1;
+    }
+    const char *host = addr.ss_family == AF_UNIX ? "localhost" : target;
+    char detail[128];
+    int failures = 0;
+
+    //先验知识:直接发送连接前言
+    {
+        H2cClient client;
+        bool ok = client.Connect(addr, addr_len) && client.Start(0) &&
+                  client.Request(1, host, paths[0]) && client.Wait(TEST_TIMEOUT_MS, NULL) && Check(client);
+        snprintf(detail, sizeof(detail), "%s, %ld bytes", paths[0], client.streams_[1].received);
+        failures += !Report("prior-knowledge", ok, detail);
+    }
+
+    //HTTP/1.1 Upgrade: h2c,升级请求的响应在流1上,之后的请求从流3开始
+    {
+        H2cClient client;
+        bool ok = client.Connect(addr, addr_len) && client.Upgrade(host, paths[0]) &&
+                  client.Request(3, host, paths[paths.size() - 1]) &&
+                  client.Wait(TEST_TIMEOUT_MS, NULL) && Check(client);
+        snprintf(detail, sizeof(detail), "stream 1 %ld bytes, stream 3 %ld bytes",
+                 client.streams_[1].received, client.streams_[3].received);
+        failures += !Report("upgrade", ok, detail);
+    }
+
+    //多个流同时请求,响应应在同一连接上交错到达
+    {
+        H2cClient client;
+        bool ok = client.Connect(addr, addr_len) && client.Start(0);
+        for (int i = 0; ok && i < streams; i++) {
+            ok = client.Request(i * 2 + 1, host, paths[i % paths.size()]);
+        }
+        ok = ok && client.Wait(TEST_TIMEOUT_MS, NULL) && Check(client);
+        snprintf(detail, sizeof(detail), "%d streams, DATA switched streams %d times", streams, client.switches_);
+        failures += !Report("multiplex", ok, detail);
+    }
+
+    //流窗口设为window且不自动补充,服务器必须在窗口用完时停下等待
+    {
+        H2cClient client;
+        client.auto_update_ = false;
+        int stalls = 0;
+        bool ok = client.Connect(addr, addr_len) && client.Start(window);
+        for (int i = 0; ok && i < streams; i++) {
+            ok = client.Request(i * 2 + 1, host, paths[i % paths.size()]);
+        }
+        ok = ok && client.Wait(TEST_TIMEOUT_MS, &stalls) && Check(client);
+        if (ok && stalls == 0) {
+            printf("    responses fit in the window, use a larger path or a smaller -w\n");
+            ok = false;
+        }
+        snprintf(detail, sizeof(detail), "window %ld, %d stalls", window, stalls);
+        failures += !Report("flow-control", ok, detail);
+    }
+    return failures > 0 ? 1 : 0;
+}
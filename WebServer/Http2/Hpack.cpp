@@ -0,0 +1,454 @@
+#include "Hpack.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char *STATIC_TABLE[HPACK_STATIC_SIZE][2] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+//RFC 7541附录B的Huffman编码表,EOS(256)的编码为30个1
+static const uint32_t HUFFMAN_CODES[256] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+};
+
+static const uint8_t HUFFMAN_CODE_LEN[256] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+};
+
+void HpackTable::Add(const std::string &name, const std::string &value)
+{
+    size_t entry = name.size() + value.size() + 32;
+    //条目本身超过上限时清空动态表
+    if (entry > max_size_) {
+        entries_.clear();
+        size_ = 0;
+        return;
+    }
+    HpackHeader header;
+    header.name = name;
+    header.value = value;
+    entries_.push_front(header);
+    size_ += entry;
+    Evict();
+}
+
+void HpackTable::SetMaxSize(size_t max_size)
+{
+    max_size_ = max_size;
+    Evict();
+}
+
+void HpackTable::Evict()
+{
+    while (size_ > max_size_ && !entries_.empty()) {
+        const HpackHeader &last = entries_.back();
+        size_ -= last.name.size() + last.value.size() + 32;
+        entries_.pop_back();
+    }
+}
+
+bool HpackTable::Get(size_t index, const char **name, const char **value) const
+{
+    if (index == 0) {
+        return false;
+    }
+    if (index <= (size_t)HPACK_STATIC_SIZE) {
+        *name = STATIC_TABLE[index - 1][0];
+        *value = STATIC_TABLE[index - 1][1];
+        return true;
+    }
+    index -= HPACK_STATIC_SIZE + 1;
+    if (index >= entries_.size()) {
+        return false;
+    }
+    *name = entries_[index].name.c_str();
+    *value = entries_[index].value.c_str();
+    return true;
+}
+
+size_t HpackTable::Find(const char *name, const char *value, bool *value_match) const
+{
+    size_t name_index = 0;
+    *value_match = false;
+    for (int i = 0; i < HPACK_STATIC_SIZE; i++) {
+        if (strcmp(STATIC_TABLE[i][0], name) == 0) {
+            if (strcmp(STATIC_TABLE[i][1], value) == 0) {
+                *value_match = true;
+                return i + 1;
+            }
+            if (name_index == 0) {
+                name_index = i + 1;
+            }
+        }
+    }
+    for (size_t i = 0; i < entries_.size(); i++) {
+        if (entries_[i].name == name) {
+            if (entries_[i].value == value) {
+                *value_match = true;
+                return i + HPACK_STATIC_SIZE + 1;
+            }
+            if (name_index == 0) {
+                name_index = i + HPACK_STATIC_SIZE + 1;
+            }
+        }
+    }
+    return name_index;
+}
+
+/*
+Huffman解码树
+    由编码表一次性构造,节点数组下标0为根,叶子节点的sym为符号值
+    保存在HuffmanDecode的函数内静态变量中,C++11保证其初始化是线程安全的
+*/
+struct HuffmanNode
+{
+    int child[2];
+    int sym;
+};
+
+static std::vector<HuffmanNode> BuildHuffmanTree()
+{
+    std::vector<HuffmanNode> tree;
+    HuffmanNode root = {{-1, -1}, -1};
+    tree.push_back(root);
+    for (int sym = 0; sym <= 256; sym++) {
+        uint32_t code = sym < 256 ? HUFFMAN_CODES[sym] : 0x3fffffff;
+        int len = sym < 256 ? HUFFMAN_CODE_LEN[sym] : 30;
+        int cur = 0;
+        for (int i = len - 1; i >= 0; i--) {
+            int bit = (code >> i) & 1;
+            if (tree[cur].child[bit] == -1) {
+                HuffmanNode node = {{-1, -1}, -1};
+                tree.push_back(node);
+                tree[cur].child[bit] = tree.size() - 1;
+            }
+            cur = tree[cur].child[bit];
+        }
+        tree[cur].sym = sym;
+    }
+    return tree;
+}
+
+/*
+HuffmanDecode()
+    逐位沿解码树下行,到达叶子输出一个字符
+    末尾不足一个符号的填充位最多7位且必须全为1,出现EOS视为错误
+*/
+bool HuffmanDecode(const unsigned char *data, size_t len, std::string *out)
+{
+    static const std::vector<HuffmanNode> tree = BuildHuffmanTree();
+    int cur = 0;
+    int pad_bits = 0;       //自上一个符号以来读过的位数
+    bool pad_ones = true;   //这些位是否全为1
+    for (size_t i = 0; i < len; i++) {
+        for (int j = 7; j >= 0; j--) {
+            int bit = (data[i] >> j) & 1;
+            cur = tree[cur].child[bit];
+            if (cur == -1) {
+                return false;
+            }
+            pad_bits++;
+            pad_ones = pad_ones && bit;
+            if (tree[cur].sym != -1) {
+                if (tree[cur].sym == 256) {
+                    return false;
+                }
+                out->push_back((char)tree[cur].sym);
+                cur = 0;
+                pad_bits = 0;
+                pad_ones = true;
+            }
+        }
+    }
+    return pad_bits <= 7 && pad_ones;
+}
+
+//解码前缀为prefix位的整数,pos指向当前字节,成功后移动到整数之后
+static bool DecodeInt(const unsigned char *data, size_t len, size_t *pos, int prefix, size_t *value)
+{
+    if (*pos >= len) {
+        return false;
+    }
+    size_t max = (1 << prefix) - 1;
+    *value = data[(*pos)++] & max;
+    if (*value < max) {
+        return true;
+    }
+    int shift = 0;
+    while (*pos < len) {
+        unsigned char byte = data[(*pos)++];
+        *value += (size_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+        shift += 7;
+        if (shift > 28) {
+            return false;
+        }
+    }
+    return false;
+}
+
+static bool DecodeString(const unsigned char *data, size_t len, size_t *pos, std::string *out)
+{
+    if (*pos >= len) {
+        return false;
+    }
+    bool huffman = data[*pos] & 0x80;
+    size_t str_len;
+    if (!DecodeInt(data, len, pos, 7, &str_len) || str_len > len - *pos) {
+        return false;
+    }
+    out->clear();
+    if (huffman) {
+        if (!HuffmanDecode(data + *pos, str_len, out)) {
+            return false;
+        }
+    }
+    else {
+        out->assign((const char *)data + *pos, str_len);
+    }
+    *pos += str_len;
+    return true;
+}
+
+/*
+Decode()
+    按首字节区分四种表示:
+        1xxxxxxx 索引字段
+        01xxxxxx 增量索引的字面量
+        001xxxxx 动态表大小更新
+        0000xxxx/0001xxxx 不索引/永不索引的字面量
+*/
+bool HpackDecoder::Decode(const unsigned char *data, size_t len, std::vector<HpackHeader> *headers)
+{
+    size_t pos = 0;
+    while (pos < len) {
+        unsigned char byte = data[pos];
+        HpackHeader header;
+        const char *name;
+        const char *value;
+        size_t index;
+
+        if (byte & 0x80) {
+            if (!DecodeInt(data, len, &pos, 7, &index) || !table_.Get(index, &name, &value)) {
+                return false;
+            }
+            header.name = name;
+            header.value = value;
+            headers->push_back(header);
+            continue;
+        }
+        if ((byte & 0xe0) == 0x20) {
+            //不允许超过我们在SETTINGS中声明的默认大小
+            if (!DecodeInt(data, len, &pos, 5, &index) || index > (size_t)HPACK_DEFAULT_TABLE_SIZE) {
+                return false;
+            }
+            table_.SetMaxSize(index);
+            continue;
+        }
+
+        bool indexing = (byte & 0xc0) == 0x40;
+        if (!DecodeInt(data, len, &pos, indexing ? 6 : 4, &index)) {
+            return false;
+        }
+        if (index == 0) {
+            if (!DecodeString(data, len, &pos, &header.name)) {
+                return false;
+            }
+        }
+        else {
+            if (!table_.Get(index, &name, &value)) {
+                return false;
+            }
+            header.name = name;
+        }
+        if (!DecodeString(data, len, &pos, &header.value)) {
+            return false;
+        }
+        if (indexing) {
+            table_.Add(header.name, header.value);
+        }
+        headers->push_back(header);
+    }
+    return true;
+}
+
+static void EncodeInt(size_t value, int prefix, unsigned char first, std::string *out)
+{
+    size_t max = (1 << prefix) - 1;
+    if (value < max) {
+        out->push_back((char)(first | value));
+        return;
+    }
+    out->push_back((char)(first | max));
+    value -= max;
+    while (value >= 128) {
+        out->push_back((char)((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out->push_back((char)value);
+}
+
+static void EncodeString(const char *text, std::string *out)
+{
+    size_t len = strlen(text);
+    EncodeInt(len, 7, 0x00, out);
+    out->append(text, len);
+}
+
+void HpackEncoder::SetMaxTableSize(size_t max_size)
+{
+    if (max_size > (size_t)HPACK_DEFAULT_TABLE_SIZE) {
+        max_size = HPACK_DEFAULT_TABLE_SIZE;
+    }
+    if (max_size != table_.MaxSize()) {
+        table_.SetMaxSize(max_size);
+        pending_size_update_ = true;
+    }
+}
+
+//:status总是头块的第一个字段,顺便发出待通知的动态表大小更新
+void HpackEncoder::EncodeStatus(int status, std::string *out)
+{
+    if (pending_size_update_) {
+        EncodeInt(table_.MaxSize(), 5, 0x20, out);
+        pending_size_update_ = false;
+    }
+    char value[8];
+    snprintf(value, sizeof(value), "%d", status);
+    Encode(":status", value, out);
+}
+
+void HpackEncoder::Encode(const char *name, const char *value, std::string *out)
+{
+    bool value_match;
+    size_t index = table_.Find(name, value, &value_match);
+    if (value_match) {
+        EncodeInt(index, 7, 0x80, out);
+        return;
+    }
+
+    //取值在连接内基本不变的字段加入动态表,之后只需一个字节
+    bool indexing = strcmp(name, "content-type") == 0 || strcmp(name, "server") == 0;
+    if (indexing) {
+        EncodeInt(index, 6, 0x40, out);
+    }
+    else {
+        EncodeInt(index, 4, 0x00, out);
+    }
+    if (index == 0) {
+        EncodeString(name, out);
+    }
+    EncodeString(value, out);
+    if (indexing) {
+        table_.Add(name, value);
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+const int HPACK_STATIC_SIZE = 61;           //静态表条目数
+const int HPACK_DEFAULT_TABLE_SIZE = 4096;  //动态表默认大小
+
+struct HpackHeader
+{
+    std::string name;
+    std::string value;
+};
+
+/*
+HPACK索引表
+    下标1~61为静态表,62开始为动态表,动态表新条目在前
+    条目大小按RFC 7541计为 name + value + 32,超出上限时从最旧的条目开始淘汰
+*/
+class HpackTable
+{
+public:
+    HpackTable() : size_(0), max_size_(HPACK_DEFAULT_TABLE_SIZE) {}
+
+    void Add(const std::string &name, const std::string &value);
+    void SetMaxSize(size_t max_size);
+    size_t MaxSize() const { return max_size_; }
+    //按下标取条目,不存在返回false
+    bool Get(size_t index, const char **name, const char **value) const;
+    //查找条目,返回下标(0表示没有),value_match表示值是否也相同
+    size_t Find(const char *name, const char *value, bool *value_match) const;
+
+private:
+    void Evict();
+
+private:
+    std::deque<HpackHeader> entries_;
+    size_t size_;
+    size_t max_size_;
+};
+
+//请求头块解码
+class HpackDecoder
+{
+public:
+    bool Decode(const unsigned char *data, size_t len, std::vector<HpackHeader> *headers);
+
+private:
+    HpackTable table_;
+};
+
+/*
+响应头块编码
+    完全命中的条目使用索引,content-type等取值稳定的字段以增量索引方式加入动态表
+    其余字段用不索引的字面量,字符串不做Huffman编码
+*/
+class HpackEncoder
+{
+public:
+    HpackEncoder() : pending_size_update_(false) {}
+
+    void EncodeStatus(int status, std::string *out);
+    void Encode(const char *name, const char *value, std::string *out);
+    void SetMaxTableSize(size_t max_size);  //对端SETTINGS_HEADER_TABLE_SIZE
+
+private:
+    HpackTable table_;
+    bool pending_size_update_;  //动态表缩小后需要在下一个头块开头通知对端
+};
+
+bool HuffmanDecode(const unsigned char *data, size_t len, std::string *out);
+
+#endif
@@ -0,0 +1,896 @@
+#include "Http2Session.h"
+#include "../Cache/ResponseCache.h"
+#include "../Bundle/AssetBundle.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+
+//错误响应的提示文字定义在HttpConn.cpp中
+extern const char *error_400_form;
+extern const char *error_403_form;
+extern const char *error_404_form;
+extern const char *error_500_form;
+
+static const char *H2_PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+//帧标志
+static const int FLAG_END_STREAM = 0x1;
+static const int FLAG_ACK = 0x1;
+static const int FLAG_END_HEADERS = 0x4;
+static const int FLAG_PADDED = 0x8;
+static const int FLAG_PRIORITY = 0x20;
+
+static uint32_t ReadUint32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void WriteUint32(unsigned char *p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+Http2Session::Http2Session(HttpConn *conn)
+    : conn_(conn), pending_bytes_(0), last_stream_id_(0), schedule_from_(0),
+      preface_received_(false), goaway_(false), send_window_(H2_DEFAULT_WINDOW),
+      peer_initial_window_(H2_DEFAULT_WINDOW), peer_max_frame_(H2_MAX_FRAME_SIZE),
+      continuation_stream_(0), header_end_stream_(false)
+{
+}
+
+Http2Session::~Http2Session()
+{
+    std::map<int, Http2Stream*>::iterator it;
+    for (it = streams_.begin(); it != streams_.end(); ++it) {
+        closed_.push_back(it->second);
+    }
+    streams_.clear();
+    segments_.clear();
+    ReleaseClosed();
+}
+
+int Http2Session::MatchPreface(const char *data, int len)
+{
+    int n = len < H2_PREFACE_LEN ? len : H2_PREFACE_LEN;
+    if (memcmp(data, H2_PREFACE, n) != 0) {
+        return -1;
+    }
+    return n == H2_PREFACE_LEN ? 1 : 0;
+}
+
+//服务端连接前言:一个SETTINGS帧
+void Http2Session::Start()
+{
+    unsigned char settings[6];
+    settings[0] = 0;
+    settings[1] = 3;    //SETTINGS_MAX_CONCURRENT_STREAMS
+    WriteUint32(settings + 2, H2_MAX_CONCURRENT_STREAMS);
+    QueueFrame(FRAME_SETTINGS, 0, 0, settings, sizeof(settings));
+}
+
+static int Base64UrlValue(char c)
+{
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '-' || c == '+') return 62;
+    if (c == '_' || c == '/') return 63;
+    return -1;
+}
+
+/*
+StartUpgrade()
+    HTTP/1.1请求带有Upgrade: h2c时调用
+    先发送101,再发送服务端SETTINGS;HTTP2-Settings中的参数视为对端的SETTINGS
+    升级前的请求已经由DoRequest处理完毕,其结果作为流1(对端已半关闭)的响应
+*/
+void Http2Session::StartUpgrade(const char *settings, HttpConn::HTTP_CODE ret)
+{
+    static const char *switching = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+    QueueRaw(switching, strlen(switching));
+    Start();
+
+    //base64url解码HTTP2-Settings
+    if (settings) {
+        std::string payload;
+        int bits = 0;
+        uint32_t acc = 0;
+        for (const char *p = settings; *p && *p != '='; p++) {
+            int v = Base64UrlValue(*p);
+            if (v < 0) {
+                break;
+            }
+            acc = (acc << 6) | v;
+            bits += 6;
+            if (bits >= 8) {
+                bits -= 8;
+                payload.push_back((char)(acc >> bits));
+            }
+        }
+        ApplySettings((const unsigned char *)payload.data(), payload.size());
+    }
+
+    Http2Stream *stream = NewStream(1);
+    stream->end_stream_received = true;
+    last_stream_id_ = 1;
+    TakeResponse(stream, ret);
+}
+
+void Http2Session::Feed(const char *data, int len)
+{
+    in_.append(data, len);
+}
+
+//非阻塞读取到EAGAIN,对端关闭或出错返回false
+bool Http2Session::Read()
+{
+    char buf[16384];
+    //TLS层缓存的数据不会再触发epoll事件,必须读完
+    while (in_.size() < (size_t)H2_MAX_INPUT || conn_->RecvPending()) {
+        int n = conn_->Recv(buf, sizeof(buf));
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (n == 0) {
+            return false;
+        }
+        in_.append(buf, n);
+    }
+    return true;
+}
+
+/*
+Process()
+    处理in_中所有完整的帧,不完整的帧留到下次
+    连接级错误时排入GOAWAY并返回false,由调用者发出后关闭连接
+*/
+bool Http2Session::Process()
+{
+    size_t pos = 0;
+    if (!preface_received_) {
+        if (in_.size() < (size_t)H2_PREFACE_LEN) {
+            return MatchPreface(in_.data(), in_.size()) == 0;
+        }
+        if (MatchPreface(in_.data(), H2_PREFACE_LEN) != 1) {
+            QueueGoaway(PROTOCOL_ERROR);
+            return false;
+        }
+        preface_received_ = true;
+        pos = H2_PREFACE_LEN;
+    }
+
+    bool ok = true;
+    while (in_.size() - pos >= (size_t)H2_FRAME_HEADER_SIZE) {
+        const unsigned char *header = (const unsigned char *)in_.data() + pos;
+        int len = (header[0] << 16) | (header[1] << 8) | header[2];
+        int type = header[3];
+        int flags = header[4];
+        int stream_id = ReadUint32(header + 5) & 0x7fffffff;
+        if (len > H2_MAX_FRAME_SIZE) {
+            QueueGoaway(FRAME_SIZE_ERROR);
+            ok = false;
+            break;
+        }
+        if (in_.size() - pos < (size_t)(H2_FRAME_HEADER_SIZE + len)) {
+            break;
+        }
+        pos += H2_FRAME_HEADER_SIZE + len;
+        if (!OnFrame(type, flags, stream_id, header + H2_FRAME_HEADER_SIZE, len)) {
+            ok = false;
+            break;
+        }
+    }
+    in_.erase(0, pos);
+    return ok;
+}
+
+bool Http2Session::OnFrame(int type, int flags, int stream_id, const unsigned char *payload, int len)
+{
+    //头块没有结束时只允许出现同一个流的CONTINUATION
+    if (continuation_stream_ != 0 && (type != FRAME_CONTINUATION || stream_id != continuation_stream_)) {
+        QueueGoaway(PROTOCOL_ERROR);
+        return false;
+    }
+
+    switch (type)
+    {
+        case FRAME_SETTINGS:
+            return OnSettings(flags, payload, len);
+        case FRAME_HEADERS:
+            return OnHeaders(flags, stream_id, payload, len);
+        case FRAME_CONTINUATION:
+        {
+            if (continuation_stream_ == 0 || header_block_.size() + len > (size_t)H2_MAX_HEADER_BLOCK) {
+                QueueGoaway(continuation_stream_ == 0 ? PROTOCOL_ERROR : INTERNAL_ERROR);
+                return false;
+            }
+            header_block_.append((const char *)payload, len);
+            if (flags & FLAG_END_HEADERS) {
+                continuation_stream_ = 0;
+                return OnHeaderBlock(stream_id, header_end_stream_);
+            }
+            return true;
+        }
+        case FRAME_DATA:
+            return OnData(flags, stream_id, payload, len);
+        case FRAME_WINDOW_UPDATE:
+            return OnWindowUpdate(stream_id, payload, len);
+        case FRAME_PING:
+        {
+            if (stream_id != 0 || len != 8) {
+                QueueGoaway(len != 8 ? FRAME_SIZE_ERROR : PROTOCOL_ERROR);
+                return false;
+            }
+            if (!(flags & FLAG_ACK)) {
+                QueueFrame(FRAME_PING, FLAG_ACK, 0, payload, len);
+            }
+            return true;
+        }
+        case FRAME_RST_STREAM:
+        {
+            std::map<int, Http2Stream*>::iterator it = streams_.find(stream_id);
+            if (it != streams_.end()) {
+                CloseStream(it->second);
+            }
+            return true;
+        }
+        case FRAME_GOAWAY:
+        {
+            //对端不再发起新流,已有的流继续完成
+            goaway_ = true;
+            return true;
+        }
+        case FRAME_PUSH_PROMISE:
+        {
+            //客户端不允许发送PUSH_PROMISE
+            QueueGoaway(PROTOCOL_ERROR);
+            return false;
+        }
+        default:
+            //PRIORITY和未知类型直接忽略
+            return true;
+    }
+}
+
+bool Http2Session::OnSettings(int flags, const unsigned char *payload, int len)
+{
+    if (flags & FLAG_ACK) {
+        return true;
+    }
+    if (len % 6 != 0) {
+        QueueGoaway(FRAME_SIZE_ERROR);
+        return false;
+    }
+    if (!ApplySettings(payload, len)) {
+        return false;
+    }
+    QueueFrame(FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+    return true;
+}
+
+bool Http2Session::ApplySettings(const unsigned char *payload, int len)
+{
+    for (int i = 0; i + 6 <= len; i += 6) {
+        int id = (payload[i] << 8) | payload[i + 1];
+        uint32_t value = ReadUint32(payload + i + 2);
+        switch (id)
+        {
+            case 1:     //SETTINGS_HEADER_TABLE_SIZE
+                encoder_.SetMaxTableSize(value);
+                break;
+            case 4:     //SETTINGS_INITIAL_WINDOW_SIZE,差值作用到所有已有流
+            {
+                if (value > (uint32_t)H2_MAX_WINDOW) {
+                    QueueGoaway(FLOW_CONTROL_ERROR);
+                    return false;
+                }
+                long delta = (long)value - peer_initial_window_;
+                peer_initial_window_ = value;
+                std::map<int, Http2Stream*>::iterator it;
+                for (it = streams_.begin(); it != streams_.end(); ++it) {
+                    it->second->window += delta;
+                }
+                break;
+            }
+            case 5:     //SETTINGS_MAX_FRAME_SIZE
+            {
+                if (value < (uint32_t)H2_MAX_FRAME_SIZE || value > 16777215) {
+                    QueueGoaway(PROTOCOL_ERROR);
+                    return false;
+                }
+                //发送方向我们仍然使用默认大小,更大的帧对多路复用的公平性不利
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+bool Http2Session::OnHeaders(int flags, int stream_id, const unsigned char *payload, int len)
+{
+    if (stream_id == 0 || (stream_id & 1) == 0) {
+        QueueGoaway(PROTOCOL_ERROR);
+        return false;
+    }
+    //去掉填充和优先级字段
+    int pad = 0;
+    if (flags & FLAG_PADDED) {
+        if (len < 1) {
+            QueueGoaway(PROTOCOL_ERROR);
+            return false;
+        }
+        pad = payload[0];
+        payload++;
+        len--;
+    }
+    if (flags & FLAG_PRIORITY) {
+        if (len < 5) {
+            QueueGoaway(PROTOCOL_ERROR);
+            return false;
+        }
+        payload += 5;
+        len -= 5;
+    }
+    if (pad > len) {
+        QueueGoaway(PROTOCOL_ERROR);
+        return false;
+    }
+    len -= pad;
+
+    header_block_.assign((const char *)payload, len);
+    header_end_stream_ = flags & FLAG_END_STREAM;
+    if (!(flags & FLAG_END_HEADERS)) {
+        continuation_stream_ = stream_id;
+        return true;
+    }
+    return OnHeaderBlock(stream_id, header_end_stream_);
+}
+
+/*
+OnHeaderBlock()
+    头块必须解码,即使要拒绝这个流,否则双方的HPACK动态表会不一致
+*/
+bool Http2Session::OnHeaderBlock(int stream_id, bool end_stream)
+{
+    std::vector<HpackHeader> headers;
+    if (!decoder_.Decode((const unsigned char *)header_block_.data(), header_block_.size(), &headers)) {
+        QueueGoaway(COMPRESSION_ERROR);
+        return false;
+    }
+    header_block_.clear();
+
+    //已有流上的头块是请求尾部字段,只关心是否结束
+    if (stream_id <= last_stream_id_) {
+        std::map<int, Http2Stream*>::iterator it = streams_.find(stream_id);
+        if (it != streams_.end() && end_stream && !it->second->end_stream_received) {
+            it->second->end_stream_received = true;
+            Dispatch(it->second);
+        }
+        return true;
+    }
+    last_stream_id_ = stream_id;
+    if (goaway_ || streams_.size() >= (size_t)H2_MAX_CONCURRENT_STREAMS) {
+        QueueRstStream(stream_id, REFUSED_STREAM);
+        return true;
+    }
+
+    Http2Stream *stream = NewStream(stream_id);
+    bool has_method = false;
+    for (size_t i = 0; i < headers.size(); i++) {
+        const std::string &name = headers[i].name;
+        const std::string &value = headers[i].value;
+        if (name == ":method") {
+            has_method = true;
+            if (value == "GET" || value == "HEAD") {
+                stream->method = HttpConn::GET;
+                stream->head = value == "HEAD";
+            }
+            else if (value == "POST") {
+                stream->method = HttpConn::POST;
+            }
+            else {
+                stream->method = HttpConn::PATH + 1;    //不支持的方法
+            }
+        }
+        else if (name == ":path") {
+            stream->path = value;
+        }
+        else if (name == ":authority" || name == "host") {
+            stream->authority = value;
+        }
+        else if (name == "content-type") {
+            stream->content_type = value;
+        }
+    }
+    if (!has_method || stream->path.empty() || stream->path[0] != '/') {
+        QueueRstStream(stream_id, PROTOCOL_ERROR);
+        CloseStream(stream);
+        return true;
+    }
+    if (end_stream) {
+        stream->end_stream_received = true;
+        Dispatch(stream);
+    }
+    return true;
+}
+
+bool Http2Session::OnData(int flags, int stream_id, const unsigned char *payload, int len)
+{
+    if (stream_id == 0) {
+        QueueGoaway(PROTOCOL_ERROR);
+        return false;
+    }
+    //接收窗口按整帧长度(含填充)计算,处理后立即归还
+    if (len > 0) {
+        QueueWindowUpdate(0, len);
+    }
+    std::map<int, Http2Stream*>::iterator it = streams_.find(stream_id);
+    if (it == streams_.end() || it->second->end_stream_received) {
+        QueueRstStream(stream_id, STREAM_CLOSED);
+        return true;
+    }
+    Http2Stream *stream = it->second;
+
+    int frame_len = len;
+    int pad = 0;
+    if (flags & FLAG_PADDED) {
+        if (len < 1 || payload[0] >= len) {
+            QueueGoaway(PROTOCOL_ERROR);
+            return false;
+        }
+        pad = payload[0];
+        payload++;
+        len--;
+    }
+    len -= pad;
+    if (stream->body.size() + len > (size_t)H2_MAX_REQUEST_BODY) {
+        QueueRstStream(stream_id, REFUSED_STREAM);
+        CloseStream(stream);
+        return true;
+    }
+    stream->body.append((const char *)payload, len);
+
+    if (flags & FLAG_END_STREAM) {
+        stream->end_stream_received = true;
+        Dispatch(stream);
+    }
+    else if (frame_len > 0) {
+        QueueWindowUpdate(stream_id, frame_len);
+    }
+    return true;
+}
+
+bool Http2Session::OnWindowUpdate(int stream_id, const unsigned char *payload, int len)
+{
+    if (len != 4) {
+        QueueGoaway(FRAME_SIZE_ERROR);
+        return false;
+    }
+    long increment = ReadUint32(payload) & 0x7fffffff;
+    if (stream_id == 0) {
+        if (increment == 0 || send_window_ + increment > H2_MAX_WINDOW) {
+            QueueGoaway(increment == 0 ? PROTOCOL_ERROR : FLOW_CONTROL_ERROR);
+            return false;
+        }
+        send_window_ += increment;
+        return true;
+    }
+    std::map<int, Http2Stream*>::iterator it = streams_.find(stream_id);
+    if (it == streams_.end()) {
+        return true;
+    }
+    if (increment == 0 || it->second->window + increment > H2_MAX_WINDOW) {
+        QueueRstStream(stream_id, increment == 0 ? PROTOCOL_ERROR : FLOW_CONTROL_ERROR);
+        CloseStream(it->second);
+        return true;
+    }
+    it->second->window += increment;
+    return true;
+}
+
+Http2Stream* Http2Session::NewStream(int id)
+{
+    Http2Stream *stream = new Http2Stream;
+    stream->id = id;
+    stream->end_stream_received = false;
+    stream->responding = false;
+    stream->end_stream_sent = false;
+    stream->window = peer_initial_window_;
+    stream->method = HttpConn::GET;
+    stream->head = false;
+    stream->status = 200;
+    stream->type = NULL;
+    stream->data = NULL;
+    stream->size = 0;
+    stream->sent = 0;
+    stream->zero_copy = false;
+    stream->file_address = NULL;
+    stream->file_size = 0;
+    stream->cached = NULL;
+    stream->producer = NULL;
+    stream->producer_arg = NULL;
+    stream->producer_done = true;
+    streams_[id] = stream;
+    return stream;
+}
+
+/*
+Dispatch()
+    把流上的请求装入HttpConn的请求字段,复用DoRequest的路由和文件处理逻辑
+    同一连接的读写受EPOLLONESHOT保护,同一时刻只有一个线程在使用conn_
+*/
+void Http2Session::Dispatch(Http2Stream *stream)
+{
+    HttpConn *c = conn_;
+    c->method_ = (HttpConn::METHOD)stream->method;
+    c->url_ = &stream->path[0];
+    c->host_ = stream->authority.empty() ? NULL : &stream->authority[0];
+    c->content_type_ = stream->content_type.empty() ? NULL : &stream->content_type[0];
+    c->content_ = stream->body.empty() ? NULL : &stream->body[0];
+    c->content_length_ = stream->body.size();
+    c->query_ = NULL;
+    c->headers_ = NULL;
+    c->headers_len_ = 0;
+    c->resp_status_ = 200;
+    c->resp_type_ = "text/html";
+    c->stream_idx_ = 0;
+    c->producer_ = NULL;
+    c->file_address_ = 0;
+
+    HttpConn::HTTP_CODE ret = HttpConn::BAD_REQUEST;
+    if (stream->method <= HttpConn::PATH) {
+        ret = c->DoRequest();
+    }
+    TakeResponse(stream, ret);
+}
+
+//把DoRequest的结果转成流的响应来源,并排入HEADERS帧
+void Http2Session::TakeResponse(Http2Stream *stream, HttpConn::HTTP_CODE ret)
+{
+    HttpConn *c = conn_;
+    const char *form = NULL;
+    switch (ret)
+    {
+        case HttpConn::FILE_REQUEST:
+        {
+            //映射区的所有权转移给流,数据发完后由流释放
+            stream->file_address = c->file_address_;
+            stream->file_size = c->file_stat_.st_size;
+            stream->data = c->file_address_;
+            stream->size = c->file_stat_.st_size;
+            stream->zero_copy = true;
+            c->file_address_ = 0;
+            break;
+        }
+        case HttpConn::CACHED_REQUEST:
+        {
+            //缓存响应的引用转移给流,DATA帧直接引用缓存中的响应体
+            stream->cached = c->cached_;
+            stream->data = c->cached_->body;
+            stream->size = c->cached_->body_len;
+            stream->zero_copy = true;
+            c->cached_ = NULL;
+            break;
+        }
+        case HttpConn::BUNDLE_REQUEST:
+        {
+            //资源包常驻内存,DATA帧直接引用包内的响应体
+            stream->type = HttpConn::bundle_->Mime(c->asset_);
+            stream->data = HttpConn::bundle_->Body(c->asset_);
+            stream->size = c->asset_->data_len;
+            stream->zero_copy = true;
+            break;
+        }
+        case HttpConn::DYNAMIC_REQUEST:
+        {
+            stream->status = c->resp_status_;
+            stream->type = c->resp_type_;
+            stream->body.assign(c->stream_buf_, c->stream_idx_);
+            stream->data = stream->body.data();
+            stream->size = stream->body.size();
+            break;
+        }
+        case HttpConn::STREAM_REQUEST:
+        {
+            //生产函数由会话驱动,HTTP/1的分块发送不再使用
+            stream->status = c->resp_status_;
+            stream->type = c->resp_type_;
+            stream->producer = c->producer_;
+            stream->producer_arg = c->producer_arg_;
+            stream->producer_done = false;
+            stream->body.clear();
+            c->producer_ = NULL;
+            break;
+        }
+        case HttpConn::NO_RESOURCE:
+            stream->status = 404;
+            form = error_404_form;
+            break;
+        case HttpConn::FORBIDDEN_REQUEST:
+            stream->status = 403;
+            form = error_403_form;
+            break;
+        case HttpConn::BAD_REQUEST:
+            stream->status = 400;
+            form = error_400_form;
+            break;
+        default:
+            stream->status = 500;
+            form = error_500_form;
+            break;
+    }
+    if (form) {
+        stream->body = form;
+        stream->data = stream->body.data();
+        stream->size = stream->body.size();
+    }
+
+    std::string block;
+    encoder_.EncodeStatus(stream->status, &block);
+    if (stream->type) {
+        encoder_.Encode("content-type", stream->type, &block);
+    }
+    if (stream->producer == NULL) {
+        char len[32];
+        snprintf(len, sizeof(len), "%zu", stream->size);
+        encoder_.Encode("content-length", len, &block);
+    }
+    //HEAD的响应头与GET相同,HEADERS帧直接结束流,响应体和生产函数随流释放
+    bool end = stream->head || (stream->producer == NULL && stream->size == 0);
+    QueueFrame(FRAME_HEADERS, FLAG_END_HEADERS | (end ? FLAG_END_STREAM : 0), stream->id, block.data(), block.size());
+    stream->responding = true;
+    if (end) {
+        stream->end_stream_sent = true;
+        CloseStream(stream);
+    }
+}
+
+//调用一次生产函数,数据以原始字节(不带chunk编码)写到stream_buf_后取出
+void Http2Session::Produce(Http2Stream *stream)
+{
+    conn_->stream_idx_ = 0;
+    conn_->StreamBuffer();
+    conn_->chunked_ = false;
+    bool more = stream->producer(conn_, stream->producer_arg);
+    conn_->chunked_ = true;
+    stream->body.assign(conn_->stream_buf_, conn_->stream_idx_);
+    stream->data = stream->body.data();
+    stream->size = stream->body.size();
+    stream->sent = 0;
+    stream->producer_done = !more;
+}
+
+/*
+ScheduleData()
+    轮转调度:每一轮从上次的位置开始,每个流最多发一个DATA帧
+    帧长取剩余数据、对端最大帧长、流窗口、连接窗口中的最小值,窗口耗尽的流等待WINDOW_UPDATE
+    待发送数据超过水位时停止,避免把整个文件一次性排入
+*/
+void Http2Session::ScheduleData()
+{
+    while (pending_bytes_ < (size_t)H2_OUTPUT_WATERMARK) {
+        bool progress = false;
+        std::map<int, Http2Stream*>::iterator it = streams_.upper_bound(schedule_from_);
+        int count = streams_.size();
+        for (int i = 0; i < count && pending_bytes_ < (size_t)H2_OUTPUT_WATERMARK; i++) {
+            if (it == streams_.end()) {
+                it = streams_.begin();
+            }
+            Http2Stream *stream = it->second;
+            ++it;
+            if (!stream->responding || stream->end_stream_sent) {
+                continue;
+            }
+            if (stream->sent == stream->size && !stream->producer_done) {
+                Produce(stream);
+            }
+
+            size_t remain = stream->size - stream->sent;
+            bool last = stream->producer_done;
+            if (remain == 0 && !last) {
+                continue;
+            }
+            long allowed = remain;
+            if (allowed > peer_max_frame_) allowed = peer_max_frame_;
+            if (allowed > stream->window) allowed = stream->window;
+            if (allowed > send_window_) allowed = send_window_;
+            //空的结束帧不受窗口限制
+            if (allowed <= 0 && remain > 0) {
+                continue;
+            }
+            if (allowed < 0) {
+                allowed = 0;
+            }
+
+            bool end = last && (size_t)allowed == remain;
+            const char *data = stream->data + stream->sent;
+            if (stream->zero_copy) {
+                QueueFrame(FRAME_DATA, end ? FLAG_END_STREAM : 0, stream->id, NULL, allowed);
+                QueueRef(data, allowed);
+            }
+            else {
+                QueueFrame(FRAME_DATA, end ? FLAG_END_STREAM : 0, stream->id, data, allowed);
+            }
+            stream->sent += allowed;
+            stream->window -= allowed;
+            send_window_ -= allowed;
+            schedule_from_ = stream->id;
+            progress = true;
+            //it已指向下一个流,删除当前流不影响map迭代器
+            if (end) {
+                stream->end_stream_sent = true;
+                CloseStream(stream);
+            }
+        }
+        if (!progress) {
+            break;
+        }
+    }
+}
+
+//流从表中移除,映射区等到输出片段全部发出后再释放
+void Http2Session::CloseStream(Http2Stream *stream)
+{
+    streams_.erase(stream->id);
+    closed_.push_back(stream);
+}
+
+void Http2Session::ReleaseClosed()
+{
+    for (size_t i = 0; i < closed_.size(); i++) {
+        //被RST_STREAM或连接关闭打断的流,通知生产函数释放参数
+        if (closed_[i]->producer && !closed_[i]->producer_done) {
+            closed_[i]->producer(NULL, closed_[i]->producer_arg);
+        }
+        if (closed_[i]->file_address) {
+            munmap(closed_[i]->file_address, closed_[i]->file_size);
+        }
+        if (closed_[i]->cached) {
+            closed_[i]->cached->Unref();
+        }
+        delete closed_[i];
+    }
+    closed_.clear();
+}
+
+/*
+QueueFrame()
+    payload为NULL时只写帧头,负载随后通过QueueRef以引用方式追加
+*/
+void Http2Session::QueueFrame(int type, int flags, int stream_id, const void *payload, int len)
+{
+    unsigned char header[H2_FRAME_HEADER_SIZE];
+    header[0] = len >> 16;
+    header[1] = len >> 8;
+    header[2] = len;
+    header[3] = type;
+    header[4] = flags;
+    WriteUint32(header + 5, stream_id & 0x7fffffff);
+    QueueRaw(header, sizeof(header));
+    if (payload && len > 0) {
+        QueueRaw(payload, len);
+    }
+}
+
+//拷贝到out_,与上一个同样位于out_的片段相邻时直接合并
+void Http2Session::QueueRaw(const void *data, int len)
+{
+    if (!segments_.empty() && segments_.back().ptr == NULL &&
+        segments_.back().off + segments_.back().len == out_.size()) {
+        segments_.back().len += len;
+    }
+    else {
+        Segment seg = {NULL, out_.size(), (size_t)len};
+        segments_.push_back(seg);
+    }
+    out_.append((const char *)data, len);
+    pending_bytes_ += len;
+}
+
+void Http2Session::QueueRef(const char *data, int len)
+{
+    if (len <= 0) {
+        return;
+    }
+    Segment seg = {data, 0, (size_t)len};
+    segments_.push_back(seg);
+    pending_bytes_ += len;
+}
+
+void Http2Session::QueueRstStream(int stream_id, int error)
+{
+    unsigned char payload[4];
+    WriteUint32(payload, error);
+    QueueFrame(FRAME_RST_STREAM, 0, stream_id, payload, sizeof(payload));
+}
+
+void Http2Session::QueueGoaway(int error)
+{
+    unsigned char payload[8];
+    WriteUint32(payload, last_stream_id_);
+    WriteUint32(payload + 4, error);
+    QueueFrame(FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+    goaway_ = true;
+}
+
+void Http2Session::QueueWindowUpdate(int stream_id, int increment)
+{
+    unsigned char payload[4];
+    WriteUint32(payload, increment);
+    QueueFrame(FRAME_WINDOW_UPDATE, 0, stream_id, payload, sizeof(payload));
+}
+
+/*
+Flush()
+    把待发送片段合并成iovec批量writev,部分发送时调整首个片段
+    全部发出后清空out_并释放已结束的流
+*/
+int Http2Session::Flush()
+{
+    while (!segments_.empty()) {
+        struct iovec iov[H2_MAX_IOV];
+        int count = 0;
+        for (std::deque<Segment>::iterator it = segments_.begin(); it != segments_.end() && count < H2_MAX_IOV; ++it) {
+            iov[count].iov_base = (void *)(it->ptr ? it->ptr : out_.data() + it->off);
+            iov[count].iov_len = it->len;
+            count++;
+        }
+        ssize_t n = conn_->Writev(iov, count, count < (int)segments_.size());
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+        pending_bytes_ -= n;
+        while (n > 0) {
+            Segment &seg = segments_.front();
+            if ((size_t)n >= seg.len) {
+                n -= seg.len;
+                segments_.pop_front();
+            }
+            else {
+                if (seg.ptr) {
+                    seg.ptr += n;
+                }
+                else {
+                    seg.off += n;
+                }
+                seg.len -= n;
+                n = 0;
+            }
+        }
+    }
+    out_.clear();
+    ReleaseClosed();
+    return 1;
+}
+
+//交替生成DATA帧和发送,直到没有可发送的数据、内核缓冲区已满或用完本次调度的预算
+int Http2Session::Pump()
+{
+    while (true) {
+        ScheduleData();
+        if (segments_.empty()) {
+            out_.clear();
+            ReleaseClosed();
+            return 1;
+        }
+        int ret = Flush();
+        if (ret != 1) {
+            return ret;
+        }
+        //返回0由调用者注册EPOLLOUT,套接字仍可写,立即重新排队
+        if (conn_->TurnSpent()) {
+            return 0;
+        }
+    }
+}
@@ -0,0 +1,171 @@
+#ifndef HTTP2_SESSION_H
+#define HTTP2_SESSION_H
+
+#include <sys/uio.h>
+#include <string>
+#include <map>
+#include <deque>
+#include <vector>
+
+#include "Hpack.h"
+#include "../Http/HttpConn.h"
+
+const int H2_FRAME_HEADER_SIZE = 9;
+const int H2_PREFACE_LEN = 24;                  //客户端连接前言长度
+const long H2_DEFAULT_WINDOW = 65535;           //默认流量控制窗口
+const long H2_MAX_WINDOW = 0x7fffffff;
+const int H2_MAX_FRAME_SIZE = 16384;            //接收帧的上限,也是默认的发送上限
+const int H2_MAX_CONCURRENT_STREAMS = 100;      //单连接最多同时处理的流
+const int H2_MAX_HEADER_BLOCK = 16384;          //请求头块上限
+const int H2_MAX_REQUEST_BODY = 65536;          //请求体上限
+const int H2_OUTPUT_WATERMARK = 65536;          //待发送数据超过该值时暂停生成DATA帧
+const int H2_MAX_IOV = 64;                      //一次writev最多的片段数
+const int H2_MAX_INPUT = 262144;                //一次最多读入的字节数,超过后先处理
+
+/*
+HTTP/2中的一个流
+    请求头/请求体收齐后交给HttpConn::DoRequest处理,处理结果作为响应来源:
+        文件:直接引用mmap映射区,DATA帧不拷贝
+        定长响应:body保存处理函数生成的响应体
+        流式响应:每次调用生产函数把数据取到body中
+*/
+struct Http2Stream
+{
+    int id;
+    bool end_stream_received;   //请求已接收完毕
+    bool responding;            //已生成响应头
+    bool end_stream_sent;       //已发出带END_STREAM的帧
+    long window;                //发送窗口
+
+    //请求
+    int method;
+    bool head;                  //HEAD请求按GET处理,只发响应头
+    std::string path;
+    std::string authority;
+    std::string content_type;
+    std::string body;
+
+    //响应
+    int status;
+    const char *type;
+    const char *data;           //当前待发送数据
+    size_t size;
+    size_t sent;
+    bool zero_copy;             //data指向文件映射区,发送时不拷贝
+    char *file_address;         //需要释放的映射区
+    size_t file_size;
+    CachedResponse *cached;     //引用的缓存响应,流释放时解除引用
+    HttpConn::ChunkProducer producer;
+    void *producer_arg;
+    bool producer_done;
+};
+
+/*
+明文HTTP/2(h2c)会话
+    一个HttpConn切换到HTTP/2后由会话接管读写,同一连接上多个流并发
+    输出由若干片段组成:控制帧、帧头和动态响应体写在out_中(记录偏移),文件内容直接引用映射区
+    DATA帧按轮转方式在各个流之间调度,受连接和流两级发送窗口限制
+*/
+class Http2Session
+{
+public:
+    enum FRAME_TYPE
+    {
+        FRAME_DATA = 0,
+        FRAME_HEADERS,
+        FRAME_PRIORITY,
+        FRAME_RST_STREAM,
+        FRAME_SETTINGS,
+        FRAME_PUSH_PROMISE,
+        FRAME_PING,
+        FRAME_GOAWAY,
+        FRAME_WINDOW_UPDATE,
+        FRAME_CONTINUATION
+    };
+    enum ERROR_CODE
+    {
+        NO_ERROR = 0,
+        PROTOCOL_ERROR,
+        INTERNAL_ERROR,
+        FLOW_CONTROL_ERROR,
+        SETTINGS_TIMEOUT,
+        STREAM_CLOSED,
+        FRAME_SIZE_ERROR,
+        REFUSED_STREAM,
+        CANCEL,
+        COMPRESSION_ERROR
+    };
+
+public:
+    Http2Session(HttpConn *conn);
+    ~Http2Session();
+
+    //判断数据是否为连接前言:1完整匹配,0目前是前言的前缀,-1不是
+    static int MatchPreface(const char *data, int len);
+
+    void Start();                                                       //prior knowledge:直接发送SETTINGS
+    void StartUpgrade(const char *settings, HttpConn::HTTP_CODE ret);   //Upgrade:发送101,原请求作为流1
+    void Feed(const char *data, int len);
+    bool Read();
+    bool Process();
+    int Pump();             //1:全部发出 0:EAGAIN -1:出错
+
+private:
+    bool OnFrame(int type, int flags, int stream_id, const unsigned char *payload, int len);
+    bool OnSettings(int flags, const unsigned char *payload, int len);
+    bool OnHeaders(int flags, int stream_id, const unsigned char *payload, int len);
+    bool OnHeaderBlock(int stream_id, bool end_stream);
+    bool OnData(int flags, int stream_id, const unsigned char *payload, int len);
+    bool OnWindowUpdate(int stream_id, const unsigned char *payload, int len);
+    bool ApplySettings(const unsigned char *payload, int len);
+
+    void Dispatch(Http2Stream *stream);
+    void TakeResponse(Http2Stream *stream, HttpConn::HTTP_CODE ret);
+    void Produce(Http2Stream *stream);
+    void ScheduleData();
+    void CloseStream(Http2Stream *stream);
+    void ReleaseClosed();
+    Http2Stream* NewStream(int id);
+
+    void QueueFrame(int type, int flags, int stream_id, const void *payload, int len);
+    void QueueRaw(const void *data, int len);
+    void QueueRef(const char *data, int len);   //引用外部内存,不拷贝
+    void QueueRstStream(int stream_id, int error);
+    void QueueGoaway(int error);
+    void QueueWindowUpdate(int stream_id, int increment);
+    int Flush();
+
+private:
+    //输出片段,ptr为NULL时数据位于out_的off处
+    struct Segment
+    {
+        const char *ptr;
+        size_t off;
+        size_t len;
+    };
+
+    HttpConn *conn_;
+    std::string in_;                //收到但尚未处理的字节
+    std::string out_;               //输出缓冲区
+    std::deque<Segment> segments_;  //待发送的片段
+    size_t pending_bytes_;          //待发送的字节数
+
+    HpackDecoder decoder_;
+    HpackEncoder encoder_;
+    std::map<int, Http2Stream*> streams_;
+    std::vector<Http2Stream*> closed_;  //已结束但数据可能还在segments_中引用的流
+    int last_stream_id_;
+    int schedule_from_;             //下一轮DATA调度从该流id之后开始
+
+    bool preface_received_;
+    bool goaway_;
+    long send_window_;              //连接级发送窗口
+    long peer_initial_window_;      //对端SETTINGS_INITIAL_WINDOW_SIZE
+    int peer_max_frame_;            //对端SETTINGS_MAX_FRAME_SIZE
+
+    int continuation_stream_;       //正在等待CONTINUATION的流,0表示没有
+    bool header_end_stream_;
+    std::string header_block_;
+};
+
+#endif
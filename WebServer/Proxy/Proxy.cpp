@@ -0,0 +1,930 @@
+#include "Proxy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <vector>
+
+#include "../Tls/Tls.h"
+
+static const char *METHOD_NAMES[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATCH"};
+
+//逐跳头部只对单个连接有意义,代理不转发
+static bool IsHopHeader(const char *line, int len)
+{
+    static const char *hops[] = {"Connection:", "Keep-Alive:", "Proxy-Connection:", "TE:", "Trailer:",
+                                 "Transfer-Encoding:", "Upgrade:", "HTTP2-Settings:"};
+    for (size_t i = 0; i < sizeof(hops) / sizeof(hops[0]); i++) {
+        int n = strlen(hops[i]);
+        if (len >= n && strncasecmp(line, hops[i], n) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool HeaderIs(const char *line, int len, const char *name)
+{
+    int n = strlen(name);
+    return len >= n && strncasecmp(line, name, n) == 0;
+}
+
+//头部值:跳过名字和前导空白,返回值的长度
+static const char* HeaderValue(const char *line, int len, int name_len, int *value_len)
+{
+    const char *p = line + name_len;
+    const char *end = line + len;
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+    *value_len = end - p;
+    return p;
+}
+
+//在标记值列表(如"keep-alive, Upgrade")中查找token
+static bool HasToken(const char *value, int len, const char *token)
+{
+    int n = strlen(token);
+    for (int i = 0; i + n <= len; i++) {
+        if (strncasecmp(value + i, token, n) == 0 &&
+            (i == 0 || value[i - 1] == ',' || value[i - 1] == ' ') &&
+            (i + n == len || value[i + n] == ',' || value[i + n] == ' ')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//百分号编码,keep中的字符和非保留字符原样保留
+static void EncodeUrl(const char *text, const char *keep, std::string *out)
+{
+    static const char *hex = "0123456789ABCDEF";
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++) {
+        if ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') ||
+            strchr("-._~", *p) || strchr(keep, *p)) {
+            out->push_back(*p);
+        }
+        else {
+            out->push_back('%');
+            out->push_back(hex[*p >> 4]);
+            out->push_back(hex[*p & 15]);
+        }
+    }
+}
+
+static void EncodeParams(const KeyValue *kv, int count, std::string *out)
+{
+    for (int i = 0; i < count; i++) {
+        if (i > 0) {
+            out->push_back('&');
+        }
+        EncodeUrl(kv[i].key, "", out);
+        out->push_back('=');
+        EncodeUrl(kv[i].value, "", out);
+    }
+}
+
+static int64_t NowMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/*
+WaitFd()
+    在工作线程中等待上游套接字就绪,超时返回false且errno为ETIMEDOUT
+    SIGALRM可能打断poll,按剩余时间继续等待
+    等待期间客户端连接的期限至少推后到这次等待结束,定时器不会因请求头或发送阶段到期而关闭它
+*/
+static bool WaitFd(int fd, short events, int timeout, HttpConn *conn)
+{
+    if (conn) {
+        conn->ExtendDeadline(timeout);
+    }
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = events;
+    int64_t deadline = NowMs() + timeout;
+    while (true) {
+        int ret = poll(&pfd, 1, timeout);
+        if (ret > 0) {
+            return true;
+        }
+        if (ret == 0) {
+            errno = ETIMEDOUT;
+            return false;
+        }
+        if (errno != EINTR) {
+            return false;
+        }
+        timeout = deadline - NowMs();
+        if (timeout < 0) {
+            timeout = 0;
+        }
+    }
+}
+
+static bool SendAll(int fd, const char *data, size_t len, int timeout, HttpConn *conn)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n > 0) {
+            data += n;
+            len -= n;
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            return false;
+        }
+        if (!WaitFd(fd, POLLOUT, timeout, conn)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//读到数据返回字节数,上游关闭返回0,出错或超时返回-1
+static int RecvSome(int fd, char *buf, int len, int timeout, HttpConn *conn)
+{
+    while (true) {
+        int n = recv(fd, buf, len, 0);
+        if (n >= 0) {
+            return n;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            return -1;
+        }
+        if (!WaitFd(fd, POLLIN, timeout, conn)) {
+            return -1;
+        }
+    }
+}
+
+static int Connect(Upstream *up, HttpConn *conn)
+{
+    int fd = socket(up->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (up->addr.ss_family != AF_UNIX) {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    if (connect(fd, (struct sockaddr *)&up->addr, up->addr_len) < 0) {
+        if (errno != EINPROGRESS || !WaitFd(fd, POLLOUT, up->connect_timeout, conn)) {
+            int err = errno;
+            close(fd);
+            errno = err;
+            return -1;
+        }
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+            close(fd);
+            errno = err;
+            return -1;
+        }
+    }
+    return fd;
+}
+
+/*
+工作线程私有的空闲连接池
+    每个线程对每个上游一个栈,后放回的先取出,最近用过的连接最可能仍然有效
+    线程与服务器同生命周期,池不释放
+*/
+struct IdleConn
+{
+    int fd;
+    time_t since;
+};
+
+static __thread std::vector<std::vector<IdleConn> > *idle_pools = NULL;
+
+static std::vector<IdleConn>& IdlePool(int id)
+{
+    if (!idle_pools) {
+        idle_pools = new std::vector<std::vector<IdleConn> >;
+    }
+    if ((int)idle_pools->size() <= id) {
+        idle_pools->resize(id + 1);
+    }
+    return (*idle_pools)[id];
+}
+
+/*
+Checkout()
+    取出的空闲连接先用MSG_PEEK探测:可读说明上游已关闭(或发来了多余数据),都不能复用
+    没有可用的空闲连接时新建连接
+*/
+static int Checkout(Upstream *up, bool *reused, HttpConn *conn)
+{
+    std::vector<IdleConn> &idle = IdlePool(up->id);
+    time_t now = time(NULL);
+    while (!idle.empty()) {
+        IdleConn conn = idle.back();
+        idle.pop_back();
+        char c;
+        if (now - conn.since < PROXY_IDLE_TIMEOUT && recv(conn.fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0 &&
+            (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            *reused = true;
+            return conn.fd;
+        }
+        close(conn.fd);
+    }
+    *reused = false;
+    return Connect(up, conn);
+}
+
+//放回连接池,池满时淘汰最早放入的连接
+static void Checkin(Upstream *up, int fd)
+{
+    std::vector<IdleConn> &idle = IdlePool(up->id);
+    if ((int)idle.size() >= PROXY_MAX_IDLE) {
+        close(idle.front().fd);
+        idle.erase(idle.begin());
+    }
+    IdleConn conn = {fd, time(NULL)};
+    idle.push_back(conn);
+}
+
+bool Upstream::Parse(const char *spec)
+{
+    snprintf(name, sizeof(name), "%s", spec);
+    return Utils::ParseAddress(spec, &addr, &addr_len);
+}
+
+void ChunkDecoder::Reset()
+{
+    state_ = SIZE;
+    remain_ = 0;
+    digits_ = 0;
+}
+
+static int HexValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/*
+Decode()
+    逐字节驱动的状态机,数据部分整段处理
+    out与in相同时原地解码:写入位置总是不超过读取位置
+*/
+size_t ChunkDecoder::Decode(const char *in, size_t len, char *out, size_t *out_len)
+{
+    size_t i = 0;
+    *out_len = 0;
+    while (i < len && state_ != DONE && state_ != ERROR) {
+        if (state_ == DATA) {
+            size_t n = len - i;
+            if (n > remain_) {
+                n = remain_;
+            }
+            if (out) {
+                memmove(out + *out_len, in + i, n);
+            }
+            *out_len += n;
+            i += n;
+            remain_ -= n;
+            if (remain_ == 0) {
+                state_ = DATA_CR;
+            }
+            continue;
+        }
+        char c = in[i++];
+        switch (state_)
+        {
+            case SIZE:
+            {
+                int v = HexValue(c);
+                if (v >= 0 && digits_ < 15) {
+                    remain_ = remain_ * 16 + v;
+                    digits_++;
+                }
+                else if (digits_ > 0 && (c == ';' || c == ' ' || c == '\t')) {
+                    state_ = EXT;
+                }
+                else if (digits_ > 0 && c == '\r') {
+                    state_ = SIZE_LF;
+                }
+                else {
+                    state_ = ERROR;
+                }
+                break;
+            }
+            case EXT:
+                if (c == '\r') {
+                    state_ = SIZE_LF;
+                }
+                break;
+            case SIZE_LF:
+                if (c != '\n') {
+                    state_ = ERROR;
+                }
+                else {
+                    state_ = remain_ == 0 ? TRAILER : DATA;
+                }
+                break;
+            case DATA_CR:
+                state_ = c == '\r' ? DATA_LF : ERROR;
+                break;
+            case DATA_LF:
+                if (c == '\n') {
+                    state_ = SIZE;
+                    remain_ = 0;
+                    digits_ = 0;
+                }
+                else {
+                    state_ = ERROR;
+                }
+                break;
+            case TRAILER:
+                state_ = c == '\r' ? FINAL_LF : TRAILER_LINE;
+                break;
+            case TRAILER_LINE:
+                if (c == '\n') {
+                    state_ = TRAILER;
+                }
+                break;
+            case FINAL_LF:
+                state_ = c == '\n' ? DONE : ERROR;
+                break;
+        }
+    }
+    return i;
+}
+
+ProxyExchange::ProxyExchange()
+    : up_(NULL), conn_(NULL), fd_(-1), reused_(false), buf_len_(0), buf_pos_(0), head_len_(0),
+      done_(false), active_(false), iov_count_(0), splice_(false), pipe_bytes_(0)
+{
+    pipe_[0] = pipe_[1] = -1;
+}
+
+ProxyExchange::~ProxyExchange()
+{
+    Reset();
+    if (pipe_[0] >= 0) {
+        close(pipe_[0]);
+        close(pipe_[1]);
+    }
+}
+
+/*
+Handler()
+    HTTP/1连接复用挂在HttpConn上的ProxyExchange,HTTP/2每个流单独分配一个,由生产函数释放
+    上游不可用时直接返回502,超时返回504
+*/
+HttpConn::HTTP_CODE ProxyExchange::Handler(HttpRequest &req, HttpResponse &resp, void *arg)
+{
+    Upstream *up = (Upstream *)arg;
+    HttpConn *c = resp.Conn();
+    ProxyExchange *ex;
+    if (c->h2_) {
+        ex = new ProxyExchange;
+    }
+    else {
+        if (!c->proxy_) {
+            c->proxy_ = new ProxyExchange;
+        }
+        ex = c->proxy_;
+    }
+
+    int err = ex->Begin(c, up, req);
+    if (err) {
+        if (c->h2_) {
+            delete ex;
+        }
+        resp.SetStatus(err, err == 504 ? "Gateway Timeout" : "Bad Gateway");
+        resp.Printf("upstream %s %s\n", up->name, err == 504 ? "timed out" : "unavailable");
+        return resp.Send();
+    }
+
+    if (c->h2_) {
+        resp.SetStatus(ex->status_, ex->reason_);
+        resp.SetContentType(ex->content_type_[0] ? ex->content_type_ : NULL);
+        //没有响应体时直接以定长空响应结束,不占用生产函数
+        if (ex->done_) {
+            ex->Finish();
+            delete ex;
+            return resp.Send();
+        }
+        return resp.Stream(Produce, ex);
+    }
+    ex->BuildHead(c);
+    return HttpConn::PROXY_REQUEST;
+}
+
+/*
+Produce()
+    HTTP/2流的生产函数,把解码后的响应体写入分块缓冲区
+    上游暂时没有更多数据时先返回,让会话把已有数据发出去
+*/
+bool ProxyExchange::Produce(HttpConn *conn, void *arg)
+{
+    ProxyExchange *ex = (ProxyExchange *)arg;
+    if (!conn) {
+        delete ex;
+        return false;
+    }
+    int len = 0;
+    const char *data;
+    while (conn->ChunkSpace() > 0) {
+        len = ex->NextBody(&data, conn->ChunkSpace(), true);
+        if (len <= 0) {
+            break;
+        }
+        conn->AddChunk(data, len);
+        if (ex->buf_pos_ == ex->buf_len_) {
+            break;
+        }
+    }
+    if (len < 0 || ex->done_) {
+        if (len < 0) {
+            printf("proxy upstream %s body error: %s\n", ex->up_->name, strerror(errno));
+        }
+        ex->Finish();
+        delete ex;
+        return false;
+    }
+    return true;
+}
+
+/*
+Begin()
+    发送请求并读取响应头,成功返回0,否则返回要回复给客户端的状态码
+    复用的连接在收到任何响应数据前就失败时,说明上游已关闭了它,换一条新连接重试一次
+*/
+int ProxyExchange::Begin(HttpConn *conn, Upstream *up, HttpRequest &req)
+{
+    Reset();
+    up_ = up;
+    conn_ = conn;
+    std::string request;
+    BuildRequest(conn, req, &request);
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        fd_ = Checkout(up, &reused_, conn_);
+        if (fd_ < 0) {
+            break;
+        }
+        active_ = true;
+        int ret = SendAll(fd_, request.data(), request.size(), up->read_timeout, conn_) ? ReadHead() : -1;
+        if (ret == 0) {
+            if (ParseHead()) {
+                return 0;
+            }
+            errno = EPROTO;
+            ret = -1;
+        }
+        bool retry = reused_ && errno != ETIMEDOUT && buf_len_ == 0;
+        int err = errno;
+        Reset();
+        errno = err;
+        if (!retry) {
+            break;
+        }
+    }
+    printf("proxy upstream %s failure: %s\n", up->name, strerror(errno));
+    return errno == ETIMEDOUT ? 504 : 502;
+}
+
+/*
+BuildRequest()
+    请求行使用重新编码的路径和查询参数(DoRequest已原地解码)
+    转发客户端的请求头,去掉逐跳头部,追加X-Forwarded-For/X-Forwarded-Proto
+    上游连接总是长连接,请求体统一以Content-Length发送
+*/
+void ProxyExchange::BuildRequest(HttpConn *conn, HttpRequest &req, std::string *out)
+{
+    out->reserve(512 + req.headers_len + req.body_len);
+    out->append(METHOD_NAMES[req.method]);
+    out->push_back(' ');
+    EncodeUrl(req.path, "/!$&'()*+,;=:@", out);
+    if (req.query_count > 0) {
+        out->push_back('?');
+        EncodeParams(req.queries, req.query_count, out);
+    }
+    out->append(" HTTP/1.1\r\n");
+
+    char client[INET6_ADDRSTRLEN] = "";
+    Utils::AddressText(conn->address_, client, sizeof(client));
+    std::string forwarded;
+
+    const char *p = req.headers;
+    const char *end = req.headers + req.headers_len;
+    while (p && p < end) {
+        int len = strlen(p);
+        const char *line = p;
+        p += len + 2;
+        if (len == 0 || IsHopHeader(line, len) || HeaderIs(line, len, "Content-Length:")) {
+            continue;
+        }
+        if (HeaderIs(line, len, "X-Forwarded-For:")) {
+            int value_len;
+            const char *value = HeaderValue(line, len, 16, &value_len);
+            forwarded.assign(value, value_len);
+            continue;
+        }
+        //请求体已经读完,不再需要上游回复100 Continue
+        if (HeaderIs(line, len, "X-Forwarded-Proto:") || HeaderIs(line, len, "Expect:")) {
+            continue;
+        }
+        out->append(line, len);
+        out->append("\r\n");
+    }
+    //HTTP/2的请求没有原始头部块,只带上:authority和content-type
+    if (!req.headers) {
+        if (req.host) {
+            out->append("Host: ").append(req.host).append("\r\n");
+        }
+        if (conn->content_type_) {
+            out->append("Content-Type: ").append(conn->content_type_).append("\r\n");
+        }
+    }
+    if (!req.host) {
+        out->append("Host: ").append(up_->addr.ss_family == AF_UNIX ? "localhost" : up_->name).append("\r\n");
+    }
+
+    out->append("X-Forwarded-For: ");
+    if (!forwarded.empty()) {
+        out->append(forwarded).append(", ");
+    }
+    out->append(client).append("\r\n");
+    out->append("X-Forwarded-Proto: ").append(conn->tls_ ? "https" : "http").append("\r\n");
+
+    //表单请求体已被原地解码成键值对,转发前重新编码
+    std::string form;
+    const char *body = req.body;
+    int body_len = req.body_len;
+    if (req.form_count > 0) {
+        EncodeParams(req.forms, req.form_count, &form);
+        body = form.data();
+        body_len = form.size();
+    }
+    if (body_len > 0 || req.method == HttpConn::POST || req.method == HttpConn::PUT) {
+        char length[32];
+        snprintf(length, sizeof(length), "Content-Length: %d\r\n", body_len);
+        out->append(length);
+    }
+    out->append("Connection: keep-alive\r\n\r\n");
+    if (body_len > 0) {
+        out->append(body, body_len);
+    }
+}
+
+/*
+ReadHead()
+    读到空行为止,buf_中空行之后的数据是响应体的开头
+    成功返回0,否则返回-1;buf_len_为0表示上游一个字节都没有回复
+*/
+int ProxyExchange::ReadHead()
+{
+    buf_len_ = 0;
+    while (buf_len_ < PROXY_BUFFER_SIZE) {
+        int n = RecvSome(fd_, buf_ + buf_len_, PROXY_BUFFER_SIZE - buf_len_, up_->read_timeout, conn_);
+        if (n <= 0) {
+            if (n == 0) {
+                errno = ECONNRESET;
+            }
+            return -1;
+        }
+        int from = buf_len_ > 3 ? buf_len_ - 3 : 0;
+        buf_len_ += n;
+        for (int i = from; i + 3 < buf_len_; i++) {
+            if (memcmp(buf_ + i, "\r\n\r\n", 4) == 0) {
+                head_len_ = i + 4;
+                buf_pos_ = head_len_;
+                return 0;
+            }
+        }
+    }
+    errno = EMSGSIZE;
+    return -1;
+}
+
+//解析状态行和决定响应体长度的头部,确定上游连接能否复用
+bool ProxyExchange::ParseHead()
+{
+    if (head_len_ < 12 || strncmp(buf_, "HTTP/1.", 7) != 0) {
+        return false;
+    }
+    bool http10 = buf_[7] == '0';
+    status_ = atoi(buf_ + 9);
+    if (status_ < 100 || status_ > 999) {
+        return false;
+    }
+    const char *line_end = (const char *)memmem(buf_, head_len_, "\r\n", 2);
+    const char *reason = buf_ + 12;
+    int reason_len = line_end > reason ? line_end - reason : 0;
+    if (reason_len >= (int)sizeof(reason_)) {
+        reason_len = sizeof(reason_) - 1;
+    }
+    memcpy(reason_, reason, reason_len);
+    reason_[reason_len] = '\0';
+
+    content_type_[0] = '\0';
+    upstream_keepalive_ = !http10;
+    bool chunked = false;
+    int64_t length = -1;
+    const char *p = line_end + 2;
+    const char *end = buf_ + head_len_ - 2;
+    while (p < end) {
+        const char *eol = (const char *)memmem(p, end - p + 2, "\r\n", 2);
+        int len = eol - p;
+        int value_len;
+        const char *value;
+        if (HeaderIs(p, len, "Content-Length:")) {
+            value = HeaderValue(p, len, 15, &value_len);
+            length = strtoll(value, NULL, 10);
+        }
+        else if (HeaderIs(p, len, "Transfer-Encoding:")) {
+            value = HeaderValue(p, len, 18, &value_len);
+            chunked = HasToken(value, value_len, "chunked");
+        }
+        else if (HeaderIs(p, len, "Connection:")) {
+            value = HeaderValue(p, len, 11, &value_len);
+            if (HasToken(value, value_len, "close")) {
+                upstream_keepalive_ = false;
+            }
+            else if (HasToken(value, value_len, "keep-alive")) {
+                upstream_keepalive_ = true;
+            }
+        }
+        else if (HeaderIs(p, len, "Content-Type:")) {
+            value = HeaderValue(p, len, 13, &value_len);
+            if (value_len < (int)sizeof(content_type_)) {
+                memcpy(content_type_, value, value_len);
+                content_type_[value_len] = '\0';
+            }
+        }
+        p = eol + 2;
+    }
+
+    decoder_.Reset();
+    done_ = false;
+    if (status_ < 200 || status_ == 204 || status_ == 304) {
+        mode_ = BODY_NONE;
+        done_ = true;
+    }
+    else if (chunked) {
+        mode_ = BODY_CHUNKED;
+    }
+    else if (length >= 0) {
+        mode_ = BODY_LENGTH;
+        remaining_ = length;
+        done_ = length == 0;
+    }
+    else {
+        mode_ = BODY_CLOSE;
+        upstream_keepalive_ = false;
+    }
+    return true;
+}
+
+/*
+BuildHead()
+    HTTP/1客户端的响应头:上游的状态行和头部(去掉逐跳头部),加上本连接的Connection
+    上游以关闭连接结束响应体时,客户端连接也只能这样结束
+    buf_中已有的响应体和响应头一起发送
+*/
+void ProxyExchange::BuildHead(HttpConn *conn)
+{
+    if (mode_ == BODY_CLOSE) {
+        conn->linger_ = false;
+    }
+    head_.clear();
+    const char *line_end = (const char *)memmem(buf_, head_len_, "\r\n", 2);
+    head_.append("HTTP/1.1");
+    head_.append(buf_ + 8, line_end - buf_ - 8);
+    head_.append("\r\n");
+    const char *p = line_end + 2;
+    const char *end = buf_ + head_len_ - 2;
+    while (p < end) {
+        const char *eol = (const char *)memmem(p, end - p + 2, "\r\n", 2);
+        int len = eol - p;
+        if (!IsHopHeader(p, len) || (mode_ == BODY_CHUNKED && HeaderIs(p, len, "Transfer-Encoding:"))) {
+            head_.append(p, len + 2);
+        }
+        p = eol + 2;
+    }
+    head_.append(conn->linger_ ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+
+    splice_ = conn->tls_ == NULL && mode_ == BODY_LENGTH &&
+              remaining_ - (buf_len_ - buf_pos_) >= PROXY_SPLICE_MIN;
+    iov_[0].iov_base = &head_[0];
+    iov_[0].iov_len = head_.size();
+    iov_count_ = 1;
+    const char *data;
+    if (!done_ && buf_pos_ < buf_len_) {
+        int len = NextBody(&data, PROXY_BUFFER_SIZE, false);
+        if (len > 0) {
+            iov_[1].iov_base = (void *)data;
+            iov_[1].iov_len = len;
+            iov_count_ = 2;
+        }
+    }
+}
+
+/*
+NextBody()
+    取下一段响应体,返回长度并由data指向buf_中的数据;响应体结束返回0,出错返回-1
+    decode为true时去掉分块编码,否则保留上游的分帧原样转发
+    buf_中的数据处理完才会再从上游读取,调用者必须先发完上一次返回的数据
+*/
+int ProxyExchange::NextBody(const char **data, int cap, bool decode)
+{
+    while (!done_) {
+        if (buf_pos_ == buf_len_) {
+            int n = RecvSome(fd_, buf_, PROXY_BUFFER_SIZE, up_->read_timeout, conn_);
+            if (n < 0) {
+                return -1;
+            }
+            if (n == 0) {
+                if (mode_ == BODY_CLOSE) {
+                    done_ = true;
+                    return 0;
+                }
+                errno = ECONNRESET;
+                return -1;
+            }
+            buf_pos_ = 0;
+            buf_len_ = n;
+        }
+        char *src = buf_ + buf_pos_;
+        int len = buf_len_ - buf_pos_;
+        if (len > cap) {
+            len = cap;
+        }
+        if (mode_ == BODY_LENGTH) {
+            if (len > remaining_) {
+                len = remaining_;
+            }
+            remaining_ -= len;
+            buf_pos_ += len;
+            done_ = remaining_ == 0;
+        }
+        else if (mode_ == BODY_CHUNKED) {
+            size_t out_len;
+            size_t used = decoder_.Decode(src, len, decode ? src : NULL, &out_len);
+            if (decoder_.Error()) {
+                errno = EPROTO;
+                return -1;
+            }
+            buf_pos_ += used;
+            done_ = decoder_.Done();
+            len = decode ? out_len : used;
+        }
+        else {
+            buf_pos_ += len;
+        }
+        if (len > 0) {
+            *data = src;
+            return len;
+        }
+    }
+    return 0;
+}
+
+/*
+SpliceBody()
+    上游套接字 -> 管道 -> 客户端套接字,响应体不经过用户态
+    客户端暂时不可写或用完本次调度的预算时数据留在管道中,返回0等待EPOLLOUT
+*/
+int ProxyExchange::SpliceBody(HttpConn *conn)
+{
+    if (pipe_[0] < 0 && pipe2(pipe_, O_NONBLOCK | O_CLOEXEC) < 0) {
+        return -1;
+    }
+    while (remaining_ > 0 || pipe_bytes_ > 0) {
+        if (pipe_bytes_ > 0) {
+            ssize_t n = splice(pipe_[0], NULL, conn->sockfd_, NULL, pipe_bytes_, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0) {
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+            }
+            pipe_bytes_ -= n;
+            conn->OnSent(n);
+            if (conn->TurnSpent()) {
+                return 0;
+            }
+            continue;
+        }
+        size_t want = remaining_ < (1 << 20) ? remaining_ : (1 << 20);
+        ssize_t n = splice(fd_, NULL, pipe_[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            remaining_ -= n;
+            pipe_bytes_ += n;
+            continue;
+        }
+        if (n == 0) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        if ((errno != EAGAIN && errno != EWOULDBLOCK) || !WaitFd(fd_, POLLIN, up_->read_timeout, conn_)) {
+            return -1;
+        }
+    }
+    done_ = true;
+    return 1;
+}
+
+int ProxyExchange::Send(HttpConn *conn)
+{
+    while (true) {
+        if (conn->TurnSpent()) {
+            return 0;
+        }
+        if (iov_count_ > 0) {
+            int n = conn->Writev(iov_, iov_count_);
+            if (n < 0) {
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+            }
+            int i = 0;
+            while (i < iov_count_ && n >= (int)iov_[i].iov_len) {
+                n -= iov_[i].iov_len;
+                i++;
+            }
+            if (i == iov_count_) {
+                iov_count_ = 0;
+                continue;
+            }
+            iov_[i].iov_base = (char *)iov_[i].iov_base + n;
+            iov_[i].iov_len -= n;
+            if (i == 1) {
+                iov_[0] = iov_[1];
+                iov_count_ = 1;
+            }
+            continue;
+        }
+        if (done_) {
+            Finish();
+            return 1;
+        }
+        if (splice_ && buf_pos_ == buf_len_) {
+            int ret = SpliceBody(conn);
+            if (ret <= 0) {
+                return ret;
+            }
+            continue;
+        }
+        const char *data;
+        int len = NextBody(&data, PROXY_BUFFER_SIZE, false);
+        if (len < 0) {
+            printf("proxy upstream %s body error: %s\n", up_->name, strerror(errno));
+            return -1;
+        }
+        if (len > 0) {
+            iov_[0].iov_base = (void *)data;
+            iov_[0].iov_len = len;
+            iov_count_ = 1;
+        }
+    }
+}
+
+//响应体完整读完且上游允许长连接时放回连接池,否则关闭
+void ProxyExchange::Finish()
+{
+    if (fd_ >= 0) {
+        if (done_ && upstream_keepalive_ && buf_pos_ == buf_len_ && pipe_bytes_ == 0) {
+            Checkin(up_, fd_);
+        }
+        else {
+            close(fd_);
+        }
+        fd_ = -1;
+    }
+    active_ = false;
+}
+
+void ProxyExchange::Reset()
+{
+    done_ = false;
+    Finish();
+    //管道里残留的数据属于被放弃的响应
+    if (pipe_bytes_ > 0) {
+        close(pipe_[0]);
+        close(pipe_[1]);
+        pipe_[0] = pipe_[1] = -1;
+        pipe_bytes_ = 0;
+    }
+    buf_len_ = buf_pos_ = head_len_ = 0;
+    iov_count_ = 0;
+    splice_ = false;
+}
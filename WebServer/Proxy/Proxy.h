@@ -0,0 +1,119 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <sys/socket.h>
+#include <stdint.h>
+#include <string>
+
+#include "../Http/HttpConn.h"
+#include "../Router/Router.h"
+
+const int PROXY_BUFFER_SIZE = 16384;        //上游响应头和响应体的读缓冲区
+const int PROXY_MAX_IDLE = 32;              //每个工作线程对每个上游最多保留的空闲连接
+const int PROXY_IDLE_TIMEOUT = 60;          //空闲连接超过该秒数不再复用
+const int PROXY_SPLICE_MIN = 16384;         //剩余响应体不小于该值时使用splice转发
+
+/*
+上游配置
+    "127.0.0.1:8000"、"localhost:8000"或"unix:/path/to/app.sock"
+    超时均为毫秒,读超时同时用于发送请求和等待响应数据
+*/
+struct Upstream
+{
+    int id;                         //在各工作线程连接池中的下标
+    char name[108];
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    int connect_timeout;
+    int read_timeout;
+
+    bool Parse(const char *spec);
+};
+
+/*
+分块编码解析
+    out为NULL时只确定响应体的结束位置(原样转发),否则把数据部分依次写到out(可以与in相同)
+*/
+class ChunkDecoder
+{
+public:
+    ChunkDecoder() { Reset(); }
+
+    void Reset();
+    size_t Decode(const char *in, size_t len, char *out, size_t *out_len);    //返回消耗的字节数
+    bool Done() const { return state_ == DONE; }
+    bool Error() const { return state_ == ERROR; }
+
+private:
+    enum STATE { SIZE, EXT, SIZE_LF, DATA, DATA_CR, DATA_LF, TRAILER, TRAILER_LINE, FINAL_LF, DONE, ERROR };
+    int state_;
+    uint64_t remain_;
+    int digits_;
+};
+
+/*
+一次反向代理请求
+    路由处理函数在工作线程中同步完成:从本线程连接池取上游连接(或新建)、发送请求、读取响应头
+    HTTP/1客户端:响应头过滤逐跳头部后原样转发,响应体保留上游的分帧方式;
+        明文连接且响应体有Content-Length时用splice经管道从上游套接字直接搬到客户端套接字
+    HTTP/2客户端:作为分块响应的生产函数,解码上游分块后交给会话分帧,只保留状态码和Content-Type
+    响应体完整读完且上游支持长连接时,连接放回本线程的连接池
+*/
+class ProxyExchange
+{
+public:
+    ProxyExchange();
+    ~ProxyExchange();
+
+    //路由处理函数,arg为Upstream*
+    static HttpConn::HTTP_CODE Handler(HttpRequest &req, HttpResponse &resp, void *arg);
+    //HTTP/2的生产函数,conn为NULL表示流被放弃
+    static bool Produce(HttpConn *conn, void *arg);
+
+    bool Active() { return active_; }
+    int Send(HttpConn *conn);       //HTTP/1发送:1完成 0客户端EAGAIN或用完发送预算 -1出错
+    void Reset();                   //放弃进行中的转发,上游连接直接关闭
+
+private:
+    enum BODY_MODE { BODY_NONE, BODY_LENGTH, BODY_CHUNKED, BODY_CLOSE };
+
+    int Begin(HttpConn *conn, Upstream *up, HttpRequest &req);
+    void BuildRequest(HttpConn *conn, HttpRequest &req, std::string *out);
+    int ReadHead();
+    bool ParseHead();
+    void BuildHead(HttpConn *conn);
+    int NextBody(const char **data, int cap, bool decode);
+    int SpliceBody(HttpConn *conn);
+    void Finish();
+
+private:
+    Upstream *up_;
+    HttpConn *conn_;                //发起转发的客户端连接,等待上游时推后它的期限
+    int fd_;                        //上游连接
+    bool reused_;                   //上游连接来自连接池
+
+    char buf_[PROXY_BUFFER_SIZE];
+    int buf_len_;
+    int buf_pos_;                   //buf_中已处理到的位置
+    int head_len_;
+
+    int status_;
+    char reason_[64];
+    char content_type_[128];
+    int mode_;
+    int64_t remaining_;             //BODY_LENGTH剩余字节数
+    ChunkDecoder decoder_;
+    bool upstream_keepalive_;
+    bool done_;                     //响应体已全部读出
+    bool active_;
+
+    //HTTP/1发送状态,iov_指向head_或buf_中待发送的部分
+    std::string head_;
+    struct iovec iov_[2];
+    int iov_count_;
+    bool splice_;
+    int pipe_[2];
+    int pipe_bytes_;
+};
+
+#endif
@@ -0,0 +1,197 @@
+#include "RateLimiter.h"
+
+#include <string.h>
+#include <netinet/in.h>
+
+#include "../Utils/Utils.h"
+
+//分片负载超过该比例时先整理,整理后仍超过则不再插入
+static const int RATE_SHARD_LOAD = RATE_SHARD_CAPACITY * 3 / 4;
+
+//地址相近的客户端(同一网段)也要分散开,高位选分片,低位选槽位
+static uint32_t HashAddr(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x85ebca6b;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35;
+    x ^= x >> 16;
+    return x;
+}
+
+RateLimiter::RateLimiter()
+    : slots_(0), scratch_(0)
+{
+    memset(counts_, 0, sizeof(counts_));
+    memset(rate_, 0, sizeof(rate_));
+    memset(burst_, 0, sizeof(burst_));
+}
+
+RateLimiter::~RateLimiter()
+{
+    delete[] slots_;
+    delete[] scratch_;
+}
+
+bool RateLimiter::Init(int connect_rate, int connect_burst, int request_rate, int request_burst)
+{
+    if (connect_rate < 0 || request_rate < 0 || connect_burst < 1 || request_burst < 1) {
+        return false;
+    }
+    rate_[RATE_CONNECT] = connect_rate;
+    burst_[RATE_CONNECT] = connect_burst;
+    rate_[RATE_REQUEST] = request_rate;
+    burst_[RATE_REQUEST] = request_burst;
+    if (!slots_) {
+        slots_ = new Entry[RATE_SHARD_NUMBER * RATE_SHARD_CAPACITY];
+        scratch_ = new Entry[RATE_SHARD_CAPACITY];
+    }
+    memset(slots_, 0, sizeof(Entry) * RATE_SHARD_NUMBER * RATE_SHARD_CAPACITY);
+    memset(counts_, 0, sizeof(counts_));
+    return true;
+}
+
+void RateLimiter::Refill(Entry *entry, int64_t now)
+{
+    int64_t elapsed = now - entry->last;
+    if (elapsed <= 0) {
+        return;
+    }
+    entry->last = now;
+    for (int i = 0; i < RATE_KIND_NUMBER; i++) {
+        int64_t tokens = entry->tokens[i] + elapsed * rate_[i];
+        int64_t max = (int64_t)burst_[i] * RATE_TOKEN_UNIT;
+        entry->tokens[i] = tokens > max ? max : tokens;
+    }
+}
+
+bool RateLimiter::Full(const Entry &entry)
+{
+    for (int i = 0; i < RATE_KIND_NUMBER; i++) {
+        if (entry.tokens[i] < burst_[i] * RATE_TOKEN_UNIT) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+Find()
+    线性探测,找不到时插入一个令牌满的新表项
+    分片过满时先整理一次;仍然过满返回NULL,由调用者放行
+*/
+RateLimiter::Entry* RateLimiter::Find(uint32_t addr, int64_t now)
+{
+    uint32_t hash = HashAddr(addr);
+    int shard = hash >> 28;
+    Entry *slots = slots_ + shard * RATE_SHARD_CAPACITY;
+    for (int retry = 0; retry < 2; retry++) {
+        uint32_t i = hash & (RATE_SHARD_CAPACITY - 1);
+        while (slots[i].used) {
+            if (slots[i].addr == addr) {
+                return &slots[i];
+            }
+            i = (i + 1) & (RATE_SHARD_CAPACITY - 1);
+        }
+        if (counts_[shard] < RATE_SHARD_LOAD) {
+            Entry &entry = slots[i];
+            entry.addr = addr;
+            entry.used = true;
+            entry.last = now;
+            for (int k = 0; k < RATE_KIND_NUMBER; k++) {
+                entry.tokens[k] = burst_[k] * RATE_TOKEN_UNIT;
+            }
+            counts_[shard]++;
+            return &entry;
+        }
+        CompactShard(shard, now);
+    }
+    return NULL;
+}
+
+/*
+Key()
+    表项以32位整数为键:IPv4取地址本身,IPv4映射的IPv6地址取其中的IPv4地址
+    其他IPv6地址按/64前缀折叠,一个用户通常分到一整个/64,按单个地址限流很容易绕过
+    折叠后可能与别的地址碰撞,碰撞的客户端共用令牌桶,只会更严格
+*/
+bool RateLimiter::Key(const struct sockaddr_storage &addr, uint32_t *key)
+{
+    if (addr.ss_family == AF_INET) {
+        *key = ((const struct sockaddr_in *)&addr)->sin_addr.s_addr;
+        return true;
+    }
+    if (addr.ss_family == AF_INET6) {
+        const uint8_t *p = ((const struct sockaddr_in6 *)&addr)->sin6_addr.s6_addr;
+        uint32_t words[4];
+        memcpy(words, p, sizeof(words));
+        if (IN6_IS_ADDR_V4MAPPED(&((const struct sockaddr_in6 *)&addr)->sin6_addr)) {
+            *key = words[3];
+        }
+        else {
+            *key = HashAddr(words[0]) ^ words[1];
+        }
+        return true;
+    }
+    return false;
+}
+
+bool RateLimiter::Allow(const struct sockaddr_storage &addr, int kind)
+{
+    uint32_t key;
+    if (!slots_ || rate_[kind] == 0 || !Key(addr, &key)) {
+        return true;
+    }
+    int64_t now = Clock::Now();
+    Entry *entry = Find(key, now);
+    if (!entry) {
+        return true;
+    }
+    Refill(entry, now);
+    if (entry->tokens[kind] < RATE_TOKEN_UNIT) {
+        return false;
+    }
+    entry->tokens[kind] -= RATE_TOKEN_UNIT;
+    return true;
+}
+
+/*
+CompactShard()
+    开放寻址不能直接删除表项,把仍有欠账的表项取出后清空分片重新插入
+*/
+void RateLimiter::CompactShard(int shard, int64_t now)
+{
+    Entry *slots = slots_ + shard * RATE_SHARD_CAPACITY;
+    int kept = 0;
+    for (int i = 0; i < RATE_SHARD_CAPACITY; i++) {
+        if (!slots[i].used) {
+            continue;
+        }
+        Refill(&slots[i], now);
+        if (!Full(slots[i])) {
+            scratch_[kept++] = slots[i];
+        }
+    }
+    memset(slots, 0, sizeof(Entry) * RATE_SHARD_CAPACITY);
+    for (int k = 0; k < kept; k++) {
+        uint32_t i = HashAddr(scratch_[k].addr) & (RATE_SHARD_CAPACITY - 1);
+        while (slots[i].used) {
+            i = (i + 1) & (RATE_SHARD_CAPACITY - 1);
+        }
+        slots[i] = scratch_[k];
+    }
+    counts_[shard] = kept;
+}
+
+void RateLimiter::Compact()
+{
+    if (!slots_) {
+        return;
+    }
+    int64_t now = Clock::Now();
+    for (int shard = 0; shard < RATE_SHARD_NUMBER; shard++) {
+        if (counts_[shard] > 0) {
+            CompactShard(shard, now);
+        }
+    }
+}
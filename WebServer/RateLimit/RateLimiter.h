@@ -0,0 +1,63 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+const int RATE_SHARD_NUMBER = 16;       //分片数量
+const int RATE_SHARD_CAPACITY = 4096;   //每个分片的槽位数,必须是2的幂
+const int RATE_TOKEN_UNIT = 1000;       //令牌以千分之一为单位用整数表示,每毫秒补充的量恰好等于每秒速率
+
+//限流的种类,每个客户端地址对每一种各有一个令牌桶
+enum RATE_KIND
+{
+    RATE_CONNECT = 0,   //每秒新建连接数
+    RATE_REQUEST,       //每秒请求数
+    RATE_KIND_NUMBER
+};
+
+/*
+按客户端地址限流
+    每个地址一个表项,各种类一个令牌桶,速率rate个每秒,最多积攒burst个
+    令牌在访问时按上次访问以来经过的时间补充,不需要定时遍历
+    表按地址哈希分成若干个开放寻址的分片,只在主线程访问,不加锁
+    定时器周期调用Compact()删除令牌已补满的表项,与从未出现过的地址等价
+*/
+class RateLimiter
+{
+public:
+    RateLimiter();
+    ~RateLimiter();
+
+    //rate为0的种类不限流
+    bool Init(int connect_rate, int connect_burst, int request_rate, int request_burst);
+    bool Enabled() { return slots_ != 0; }
+
+    //取一个令牌,返回false表示超过限制;表满时放行,Unix套接字上的本机客户端不限流
+    bool Allow(const struct sockaddr_storage &addr, int kind);
+    void Compact();
+
+private:
+    struct Entry
+    {
+        uint32_t addr;
+        bool used;
+        int64_t last;                       //上次补充令牌的时间,毫秒
+        int tokens[RATE_KIND_NUMBER];
+    };
+
+    static bool Key(const struct sockaddr_storage &addr, uint32_t *key);
+    Entry* Find(uint32_t addr, int64_t now);
+    void Refill(Entry *entry, int64_t now);
+    bool Full(const Entry &entry);
+    void CompactShard(int shard, int64_t now);
+
+private:
+    Entry *slots_;                          //RATE_SHARD_NUMBER个分片依次存放
+    Entry *scratch_;                        //整理分片时暂存保留的表项
+    int counts_[RATE_SHARD_NUMBER];         //各分片已用的槽位数
+    int rate_[RATE_KIND_NUMBER];
+    int burst_[RATE_KIND_NUMBER];
+};
+
+#endif
@@ -0,0 +1,390 @@
+#include "Router.h"
+
+#include <ctype.h>
+
+const char* HttpRequest::Param(const char *name, int *len) const
+{
+    int name_len = strlen(name);
+    for (int i = 0; i < param_count; i++) {
+        if (params[i].name_len == name_len && strncmp(params[i].name, name, name_len) == 0) {
+            if (len) {
+                *len = params[i].value_len;
+            }
+            return params[i].value;
+        }
+    }
+    return NULL;
+}
+
+const char* HttpRequest::Query(const char *key) const
+{
+    for (int i = 0; i < query_count; i++) {
+        if (strcmp(queries[i].key, key) == 0) {
+            return queries[i].value;
+        }
+    }
+    return NULL;
+}
+
+const char* HttpRequest::Form(const char *key) const
+{
+    for (int i = 0; i < form_count; i++) {
+        if (strcmp(forms[i].key, key) == 0) {
+            return forms[i].value;
+        }
+    }
+    return NULL;
+}
+
+void HttpResponse::SetStatus(int status, const char *title)
+{
+    conn_->resp_status_ = status;
+    conn_->resp_title_ = title;
+}
+
+void HttpResponse::SetContentType(const char *type)
+{
+    conn_->resp_type_ = type;
+}
+
+bool HttpResponse::Append(const char *data, int len)
+{
+    if (!conn_->StreamBuffer() || len > HttpConn::STREAM_BUFFER_SIZE - conn_->stream_idx_) {
+        return false;
+    }
+    memcpy(conn_->stream_buf_ + conn_->stream_idx_, data, len);
+    conn_->stream_idx_ += len;
+    return true;
+}
+
+bool HttpResponse::Printf(const char *format, ...)
+{
+    if (!conn_->StreamBuffer()) {
+        return false;
+    }
+    int space = HttpConn::STREAM_BUFFER_SIZE - conn_->stream_idx_;
+    va_list arg_list;
+    va_start(arg_list, format);
+    int len = vsnprintf(conn_->stream_buf_ + conn_->stream_idx_, space, format, arg_list);
+    va_end(arg_list);
+    //写不下时不更新下标,相当于丢弃本次写入
+    if (len < 0 || len >= space) {
+        return false;
+    }
+    conn_->stream_idx_ += len;
+    return true;
+}
+
+HttpConn::HTTP_CODE HttpResponse::Send()
+{
+    return HttpConn::DYNAMIC_REQUEST;
+}
+
+HttpConn::HTTP_CODE HttpResponse::Stream(HttpConn::ChunkProducer producer, void *arg)
+{
+    conn_->SetStream(producer, arg, conn_->resp_type_);
+    return HttpConn::STREAM_REQUEST;
+}
+
+/*
+Upgrade()
+    请求带有合法的WebSocket握手头时切换协议,由ProcessWrite回复101
+    普通请求访问WebSocket路径时回复426
+*/
+HttpConn::HTTP_CODE HttpResponse::Upgrade(WebSocketHub *hub)
+{
+    if (conn_->upgrade_ws_ && conn_->ws_key_ && strlen(conn_->ws_key_) == 24 && conn_->method_ == HttpConn::GET) {
+        conn_->ws_hub_ = hub;
+        return HttpConn::WEBSOCKET_REQUEST;
+    }
+    SetStatus(426, "Upgrade Required");
+    Printf("<html><body>This resource requires a WebSocket upgrade.</body></html>");
+    return Send();
+}
+
+Router::Router()
+{
+    //根节点,标签为空
+    NewNode(0, 0);
+}
+
+int Router::NewNode(int label, int label_len)
+{
+    Node node;
+    node.label = label;
+    node.label_len = label_len;
+    node.child = -1;
+    node.sibling = -1;
+    node.param = -1;
+    node.wildcard = -1;
+    node.name = 0;
+    node.name_len = 0;
+    for (int i = 0; i < METHOD_COUNT; i++) {
+        node.route[i] = -1;
+    }
+    nodes_.push_back(node);
+    return nodes_.size() - 1;
+}
+
+/*
+Add()
+    注册路由,模式串形如 "/user/:id",通配片段"*name"只能出现在末尾
+    模式串先整体追加到labels_,节点只记录偏移,之后沿树插入各个片段
+    同一方法重复注册或同一位置参数名冲突时返回false
+*/
+bool Router::Add(int method, const char *pattern, RouteHandler handler, void *arg)
+{
+    if (method < 0 || method >= METHOD_COUNT || !pattern || pattern[0] != '/') {
+        return false;
+    }
+    int len = strlen(pattern);
+    int base = labels_.size();
+    labels_.append(pattern, len);
+
+    int cur = 0;
+    int i = 0;
+    while (i < len) {
+        char c = pattern[i];
+        if (c == ':' || c == '*') {
+            int j = i + 1;
+            while (j < len && pattern[j] != '/') {
+                j++;
+            }
+            //参数名不能为空,通配片段必须在末尾
+            if (j == i + 1 || (c == '*' && j != len)) {
+                return false;
+            }
+            cur = InsertParam(cur, base + i + 1, j - i - 1, c == '*');
+            if (cur < 0) {
+                return false;
+            }
+            i = j;
+        }
+        else {
+            int j = i;
+            while (j < len && pattern[j] != ':' && pattern[j] != '*') {
+                j++;
+            }
+            cur = InsertStatic(cur, base + i, j - i);
+            i = j;
+        }
+    }
+
+    if (nodes_[cur].route[method] != -1) {
+        return false;
+    }
+    Route route = {handler, arg};
+    nodes_[cur].route[method] = routes_.size();
+    routes_.push_back(route);
+    return true;
+}
+
+/*
+InsertStatic()
+    在cur下插入静态标签,返回标签末尾对应的节点
+    兄弟节点的首字符互不相同,与已有标签只有部分公共前缀时把已有节点一分为二
+    注意NewNode可能使nodes_扩容,这里只保存下标不保存引用
+*/
+int Router::InsertStatic(int cur, int label, int label_len)
+{
+    while (label_len > 0) {
+        int prev = -1;
+        int c = nodes_[cur].child;
+        while (c != -1 && labels_[nodes_[c].label] != labels_[label]) {
+            prev = c;
+            c = nodes_[c].sibling;
+        }
+        //没有首字符相同的子节点,直接新建
+        if (c == -1) {
+            int n = NewNode(label, label_len);
+            nodes_[n].sibling = nodes_[cur].child;
+            nodes_[cur].child = n;
+            return n;
+        }
+
+        int coff = nodes_[c].label;
+        int clen = nodes_[c].label_len;
+        int l = 0;
+        while (l < clen && l < label_len && labels_[coff + l] == labels_[label + l]) {
+            l++;
+        }
+        //分裂:mid持有公共前缀,原节点保留剩余部分并成为mid的子节点
+        if (l < clen) {
+            int mid = NewNode(coff, l);
+            nodes_[mid].sibling = nodes_[c].sibling;
+            nodes_[mid].child = c;
+            nodes_[c].sibling = -1;
+            nodes_[c].label = coff + l;
+            nodes_[c].label_len = clen - l;
+            if (prev == -1) {
+                nodes_[cur].child = mid;
+            }
+            else {
+                nodes_[prev].sibling = mid;
+            }
+            c = mid;
+        }
+        cur = c;
+        label += l;
+        label_len -= l;
+    }
+    return cur;
+}
+
+int Router::InsertParam(int cur, int name, int name_len, bool wildcard)
+{
+    int n = wildcard ? nodes_[cur].wildcard : nodes_[cur].param;
+    if (n != -1) {
+        //同一位置只允许一个参数名
+        if (nodes_[n].name_len != name_len || labels_.compare(nodes_[n].name, name_len, labels_, name, name_len) != 0) {
+            return -1;
+        }
+        return n;
+    }
+    n = NewNode(0, 0);
+    nodes_[n].name = name;
+    nodes_[n].name_len = name_len;
+    if (wildcard) {
+        nodes_[cur].wildcard = n;
+    }
+    else {
+        nodes_[cur].param = n;
+    }
+    return n;
+}
+
+/*
+Match()
+    查找method + path对应的路由,路径参数写入req->params
+    只读访问路由表,多个工作线程可以并发调用
+*/
+const Route* Router::Match(int method, const char *path, int len, HttpRequest *req) const
+{
+    if (method < 0 || method >= METHOD_COUNT) {
+        return NULL;
+    }
+    req->param_count = 0;
+    int route = -1;
+    if (!MatchNode(0, path, len, method, req, &route)) {
+        return NULL;
+    }
+    return &routes_[route];
+}
+
+//节点n的标签已经匹配完,继续匹配剩余的path
+bool Router::MatchNode(int n, const char *path, int len, int method, HttpRequest *req, int *route) const
+{
+    const Node &node = nodes_[n];
+    if (len == 0 && node.route[method] != -1) {
+        *route = node.route[method];
+        return true;
+    }
+
+    //静态子节点,首字符相同的最多只有一个
+    if (len > 0) {
+        const char *labels = labels_.data();
+        for (int c = node.child; c != -1; c = nodes_[c].sibling) {
+            const Node &child = nodes_[c];
+            if (labels[child.label] != path[0]) {
+                continue;
+            }
+            if (child.label_len <= len && memcmp(labels + child.label, path, child.label_len) == 0 &&
+                MatchNode(c, path + child.label_len, len - child.label_len, method, req, route)) {
+                return true;
+            }
+            break;
+        }
+    }
+
+    //参数子节点匹配到下一个'/'为止
+    if (node.param != -1 && len > 0 && req->param_count < MAX_ROUTE_PARAMS) {
+        int seg = 0;
+        while (seg < len && path[seg] != '/') {
+            seg++;
+        }
+        if (seg > 0) {
+            const Node &param = nodes_[node.param];
+            RouteParam &p = req->params[req->param_count++];
+            p.name = labels_.data() + param.name;
+            p.name_len = param.name_len;
+            p.value = path;
+            p.value_len = seg;
+            if (MatchNode(node.param, path + seg, len - seg, method, req, route)) {
+                return true;
+            }
+            req->param_count--;
+        }
+    }
+
+    //通配子节点吞掉剩余全部路径
+    if (node.wildcard != -1 && req->param_count < MAX_ROUTE_PARAMS) {
+        const Node &wildcard = nodes_[node.wildcard];
+        if (wildcard.route[method] != -1) {
+            RouteParam &p = req->params[req->param_count++];
+            p.name = labels_.data() + wildcard.name;
+            p.name_len = wildcard.name_len;
+            p.value = path;
+            p.value_len = len;
+            *route = wildcard.route[method];
+            return true;
+        }
+    }
+    return false;
+}
+
+static int HexValue(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    return tolower(c) - 'a' + 10;
+}
+
+int Router::DecodeUrl(char *text, bool plus_as_space)
+{
+    char *src = text;
+    char *dst = text;
+    while (*src) {
+        if (src[0] == '%' && isxdigit(src[1]) && isxdigit(src[2])) {
+            *dst++ = (char)(HexValue(src[1]) * 16 + HexValue(src[2]));
+            src += 3;
+        }
+        else if (src[0] == '+' && plus_as_space) {
+            *dst++ = ' ';
+            src++;
+        }
+        else {
+            *dst++ = *src++;
+        }
+    }
+    *dst = '\0';
+    return dst - text;
+}
+
+int Router::SplitParams(char *text, KeyValue *kv, int max)
+{
+    int count = 0;
+    char *p = text;
+    while (p && *p && count < max) {
+        char *next = strchr(p, '&');
+        if (next) {
+            *next++ = '\0';
+        }
+        char *value = strchr(p, '=');
+        if (value) {
+            *value++ = '\0';
+        }
+        else {
+            value = p + strlen(p);
+        }
+        DecodeUrl(p, true);
+        DecodeUrl(value, true);
+        if (*p) {
+            kv[count].key = p;
+            kv[count].value = value;
+            count++;
+        }
+        p = next;
+    }
+    return count;
+}
@@ -0,0 +1,137 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <vector>
+#include <string>
+#include <stdarg.h>
+
+#include "../Http/HttpConn.h"
+
+class WebSocketHub;
+
+const int MAX_ROUTE_PARAMS = 8;     //路径参数(:name, *name)最多个数
+const int MAX_QUERY_PARAMS = 16;    //查询参数和表单字段最多个数
+const int METHOD_COUNT = HttpConn::PATH + 1;
+
+//查询参数/表单字段,key和value都已在read_buf_中原地解码并以'\0'结尾
+struct KeyValue
+{
+    const char *key;
+    const char *value;
+};
+
+//路径参数,value指向read_buf_中的路径片段,不以'\0'结尾
+struct RouteParam
+{
+    const char *name;
+    int name_len;
+    const char *value;
+    int value_len;
+};
+
+/*
+请求视图
+    所有指针都指向HttpConn的read_buf_或路由表,处理请求时不做任何拷贝和内存分配
+*/
+struct HttpRequest
+{
+    int method;             //HttpConn::METHOD
+    const char *path;       //已解码的路径,不含查询字符串
+    const char *host;
+    const char *headers;    //原始请求头块,各行以"\0\0"分隔;HTTP/2请求为NULL
+    int headers_len;
+    const char *body;       //请求体
+    int body_len;
+
+    RouteParam params[MAX_ROUTE_PARAMS];
+    int param_count;
+    KeyValue queries[MAX_QUERY_PARAMS];
+    int query_count;
+    KeyValue forms[MAX_QUERY_PARAMS];   //application/x-www-form-urlencoded请求体
+    int form_count;
+
+    //按名字取路径参数,不存在返回NULL
+    const char* Param(const char *name, int *len) const;
+    //按名字取查询参数/表单字段,不存在返回NULL
+    const char* Query(const char *key) const;
+    const char* Form(const char *key) const;
+};
+
+/*
+响应构建器
+    定长响应体写入连接的stream_buf_,最终由ProcessWrite补上状态行和响应头
+    响应体超过缓冲区时应使用Stream()改为分块发送
+*/
+class HttpResponse
+{
+public:
+    HttpResponse(HttpConn *conn) : conn_(conn) {}
+
+    void SetStatus(int status, const char *title);
+    void SetContentType(const char *type);
+    bool Append(const char *data, int len);     //追加响应体,空间不足返回false
+    bool Printf(const char *format, ...);
+
+    HttpConn::HTTP_CODE Send();                                             //发送定长响应
+    HttpConn::HTTP_CODE Stream(HttpConn::ChunkProducer producer, void *arg); //发送分块响应
+    HttpConn::HTTP_CODE Upgrade(WebSocketHub *hub);                         //切换到WebSocket
+
+    HttpConn* Conn() { return conn_; }
+private:
+    HttpConn *conn_;
+};
+
+typedef HttpConn::HTTP_CODE (*RouteHandler)(HttpRequest &req, HttpResponse &resp, void *arg);
+
+struct Route
+{
+    RouteHandler handler;
+    void *arg;
+};
+
+/*
+基于压缩前缀树(radix trie)的路由表
+    模式串支持静态片段、参数片段":name"(匹配到下一个'/')和末尾的通配片段"*name"
+    所有节点存放在一块连续数组中,静态标签是labels_中的(偏移, 长度),分裂节点不需要拷贝字符串
+    匹配时静态子节点优先于参数子节点,参数子节点优先于通配子节点,查找过程不分配内存
+*/
+class Router
+{
+public:
+    Router();
+
+    bool Add(int method, const char *pattern, RouteHandler handler, void *arg);
+    const Route* Match(int method, const char *path, int len, HttpRequest *req) const;
+    int Size() const { return routes_.size(); }
+
+    //原地解码%XX,plus_as_space为true时'+'解码为空格,返回解码后的长度
+    static int DecodeUrl(char *text, bool plus_as_space);
+    //原地把"a=1&b=2"拆分成键值对并解码,返回键值对个数
+    static int SplitParams(char *text, KeyValue *kv, int max);
+
+private:
+    struct Node
+    {
+        int label;          //静态标签在labels_中的偏移
+        int label_len;      //静态标签长度
+        int child;          //第一个静态子节点
+        int sibling;        //下一个兄弟节点
+        int param;          //参数子节点
+        int wildcard;       //通配子节点
+        int name;           //参数名在labels_中的偏移
+        int name_len;       //参数名长度
+        int route[METHOD_COUNT];    //各方法对应routes_中的下标,-1表示没有
+    };
+
+    int NewNode(int label, int label_len);
+    int InsertStatic(int cur, int label, int label_len);
+    int InsertParam(int cur, int name, int name_len, bool wildcard);
+    bool MatchNode(int n, const char *path, int len, int method, HttpRequest *req, int *route) const;
+
+private:
+    std::vector<Node> nodes_;   //nodes_[0]为根节点
+    std::vector<Route> routes_;
+    std::string labels_;        //所有标签和参数名
+};
+
+#endif
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "Router.h"
+
+/*
+路由查找基准
+    ./router_bench [groups] [rounds]
+    每组注册4条路由,默认1000组共4000条,覆盖静态、参数、通配和共用参数节点后的静态片段
+    查找集合按命中类型分别计时,另有一组不存在的路径,结果为每次Match的平均纳秒数
+*/
+
+static HttpConn::HTTP_CODE Dummy(HttpRequest &req, HttpResponse &resp, void *arg)
+{
+    return HttpConn::DYNAMIC_REQUEST;
+}
+
+struct Case
+{
+    const char *name;
+    std::vector<std::string> paths;
+    bool hit;               //这一组路径都应命中
+};
+
+static void Run(const Router &router, const Case &c, int rounds)
+{
+    HttpRequest req;
+    long found = 0;
+    int64_t start = Clock::ReadUs();
+    for (int r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < c.paths.size(); i++) {
+            if (router.Match(HttpConn::GET, c.paths[i].data(), c.paths[i].size(), &req)) {
+                found++;
+            }
+        }
+    }
+    int64_t elapsed = Clock::ReadUs() - start;
+    long lookups = (long)rounds * c.paths.size();
+    printf("%-10s %8ld lookups  %7.1f ns/lookup  %s\n", c.name, lookups,
+           lookups > 0 ? elapsed * 1000.0 / lookups : 0.0,
+           found == (c.hit ? lookups : 0) ? "ok" : "WRONG");
+}
+
+int main(int argc, char* argv[])
+{
+    int groups = argc > 1 ? atoi(argv[1]) : 1000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 200;
+    if (groups <= 0 || rounds <= 0) {
+        printf("Usage: ./router_bench [groups] [rounds]\n");
+        return 1;
+    }
+
+    //Add只保存偏移,模式串用完即可释放
+    Router router;
+    char pattern[128];
+    for (int i = 0; i < groups; i++) {
+        snprintf(pattern, sizeof(pattern), "/api/v%d/res%d", i % 4, i);
+        router.Add(HttpConn::GET, pattern, Dummy, NULL);
+        snprintf(pattern, sizeof(pattern), "/api/v%d/res%d/:id", i % 4, i);
+        router.Add(HttpConn::GET, pattern, Dummy, NULL);
+        snprintf(pattern, sizeof(pattern), "/files/b%d/*path", i);
+        router.Add(HttpConn::GET, pattern, Dummy, NULL);
+        snprintf(pattern, sizeof(pattern), "/users/:uid/res%d", i);
+        router.Add(HttpConn::GET, pattern, Dummy, NULL);
+    }
+    printf("%d routes\n", router.Size());
+
+    //查找顺序打乱,避免连续访问相邻节点
+    Case cases[] = {
+        {"static", std::vector<std::string>(), true},
+        {"param", std::vector<std::string>(), true},
+        {"wildcard", std::vector<std::string>(), true},
+        {"shared", std::vector<std::string>(), true},
+        {"miss", std::vector<std::string>(), false},
+    };
+    srand(1);
+    char path[128];
+    for (int k = 0; k < groups; k++) {
+        int i = rand() % groups;
+        snprintf(path, sizeof(path), "/api/v%d/res%d", i % 4, i);
+        cases[0].paths.push_back(path);
+        snprintf(path, sizeof(path), "/api/v%d/res%d/%d", i % 4, i, rand());
+        cases[1].paths.push_back(path);
+        snprintf(path, sizeof(path), "/files/b%d/img/%d.png", i, rand());
+        cases[2].paths.push_back(path);
+        snprintf(path, sizeof(path), "/users/%d/res%d", rand(), i);
+        cases[3].paths.push_back(path);
+        snprintf(path, sizeof(path), "/api/v%d/res%d/%d/extra", i % 4, i, rand());
+        cases[4].paths.push_back(path);
+    }
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        Run(router, cases[i], rounds);
+    }
+    return 0;
+}
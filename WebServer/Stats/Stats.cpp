@@ -0,0 +1,116 @@
+#include "Stats.h"
+
+#include <sys/mman.h>
+
+#ifdef LOCK_STATS
+#include "../ThreadPool/LockStats.h"
+#endif
+
+Stats::Slot Stats::local_;
+Stats::Slot* Stats::slots_ = NULL;
+int Stats::slot_count_ = 0;
+long* Stats::counters_ = Stats::local_.counters;
+volatile long* Stats::gauges_ = Stats::local_.gauges;
+
+static const char *COUNTER_NAMES[STAT_COUNTER_NUMBER] = {
+    "accepted",
+    "rejected",
+    "expired_idle",
+    "expired_header",
+    "expired_body",
+    "expired_write",
+    "expired_session",
+    "idle_timeout",
+    "evicted",
+    "limited_connect",
+    "limited_request",
+    "cold_files",
+    "shed_admission",
+    "shed_deadline",
+    "worker_restarts",
+};
+
+static const char *GAUGE_NAMES[STAT_GAUGE_NUMBER] = {
+    "connections",
+    "capacity",
+    "idle_timeout_sec",
+};
+
+/*
+Share()
+    匿名共享映射在fork后仍指向同一块内存,各进程原子累加自己的槽位,读取时相加
+    映射区初始为0,进程Attach之后要重新设置自己的数值
+*/
+bool Stats::Share(int slots)
+{
+    void *addr = mmap(NULL, sizeof(Slot) * slots, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    slots_ = (Slot *)addr;
+    slot_count_ = slots;
+    return true;
+}
+
+void Stats::Attach(int slot)
+{
+    counters_ = slots_[slot].counters;
+    gauges_ = slots_[slot].gauges;
+}
+
+long Stats::Sum(int counter)
+{
+    if (!slots_) {
+        return Get(counter);
+    }
+    long sum = 0;
+    for (int i = 0; i < slot_count_; i++) {
+        sum += __sync_add_and_fetch(&slots_[i].counters[counter], 0);
+    }
+    return sum;
+}
+
+//连接数和容量是各进程之和;空闲超时取最短的,反映最紧张的那个进程
+long Stats::Gauge(int gauge)
+{
+    if (!slots_) {
+        return gauges_[gauge];
+    }
+    long value = 0;
+    for (int i = 0; i < slot_count_; i++) {
+        long v = slots_[i].gauges[gauge];
+        if (gauge != STAT_IDLE_TIMEOUT_SEC) {
+            value += v;
+        }
+        else if (v > 0 && (value == 0 || v < value)) {
+            value = v;
+        }
+    }
+    return value;
+}
+
+HttpConn::HTTP_CODE Stats::Handler(HttpRequest &req, HttpResponse &resp, void *arg)
+{
+    resp.SetContentType("text/plain");
+    Set(STAT_CONNECTIONS, HttpConn::user_count_);
+    for (int i = 0; i < STAT_GAUGE_NUMBER; i++) {
+        resp.Printf("%s %ld\n", GAUGE_NAMES[i], Gauge(i));
+    }
+    for (int i = 0; i < STAT_COUNTER_NUMBER; i++) {
+        resp.Printf("%s %ld\n", COUNTER_NAMES[i], Sum(i));
+    }
+#ifdef LOCK_STATS
+    //按锁名输出,时间换算成微秒
+    for (int i = 0; i < LockStats::Size(); i++) {
+        LockCounters c;
+        LockStats::Sum(i, &c);
+        const char *name = LockStats::Name(i);
+        resp.Printf("lock_%s_acquired %ld\n", name, c.acquired);
+        resp.Printf("lock_%s_contended %ld\n", name, c.contended);
+        resp.Printf("lock_%s_wait_us %ld\n", name, c.wait_ns / 1000);
+        resp.Printf("lock_%s_wait_max_us %ld\n", name, c.wait_max_ns / 1000);
+        resp.Printf("lock_%s_hold_us %ld\n", name, c.hold_ns / 1000);
+    }
+#endif
+    return resp.Send();
+}
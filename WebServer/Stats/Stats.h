@@ -0,0 +1,76 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "../Http/HttpConn.h"
+#include "../Router/Router.h"
+
+//计数器编号,新增计数器时同时在Stats.cpp的名字表中添加
+enum STAT_COUNTER
+{
+    STAT_ACCEPTED = 0,      //接受的连接
+    STAT_REJECTED,          //连接数已满被拒绝的连接
+    STAT_EXPIRED_IDLE,      //定时器到期关闭的连接,按所处阶段分别计数,与HttpConn::PHASE顺序一致
+    STAT_EXPIRED_HEADER,
+    STAT_EXPIRED_BODY,
+    STAT_EXPIRED_WRITE,
+    STAT_EXPIRED_SESSION,
+    STAT_IDLE_TIMEOUT,      //按缩短后的空闲超时关闭的长连接
+    STAT_EVICTED,           //连接数过高时按LRU淘汰的空闲长连接
+    STAT_LIMITED_CONNECT,   //新建连接超过速率限制被拒绝
+    STAT_LIMITED_REQUEST,   //请求超过速率限制被拒绝
+    STAT_COLD_FILES,        //不在页缓存中、交给I/O线程预读的文件
+    STAT_SHED_ADMISSION,    //排队时间持续超标或队列已满,入队前以503拒绝的请求
+    STAT_SHED_DEADLINE,     //排队超过期限,取出时以503拒绝的请求
+    STAT_WORKER_RESTARTS,   //多进程模式下master重启的worker进程数
+    STAT_COUNTER_NUMBER
+};
+
+//运行时数值,连接数在输出时和周期性工作中写入,其余由主线程写入
+enum STAT_GAUGE
+{
+    STAT_CONNECTIONS = 0,   //当前连接数
+    STAT_CAPACITY,          //连接数上限
+    STAT_IDLE_TIMEOUT_SEC,  //当前的空闲超时
+    STAT_GAUGE_NUMBER
+};
+
+/*
+服务器统计
+    计数器只增不减,任意线程用原子操作累加;数值由主线程设置
+    注册GET路由后以"名字 值"逐行输出
+    make LOCK_STATS=1编译时还按锁名输出获取次数、竞争次数、等待和持有时间
+    多进程模式下计数放在fork前创建的共享内存中,每个进程一个槽位,输出时汇总所有进程
+*/
+class Stats
+{
+public:
+    static void Add(int counter, long n = 1) { __sync_add_and_fetch(&counters_[counter], n); }
+    static long Get(int counter) { return __sync_add_and_fetch(&counters_[counter], 0); }
+    static void Set(int gauge, long value) { gauges_[gauge] = value; }
+
+    //fork前调用,创建slots个进程的共享计数区
+    static bool Share(int slots);
+    //进程改用第slot个槽位计数
+    static void Attach(int slot);
+
+    static HttpConn::HTTP_CODE Handler(HttpRequest &req, HttpResponse &resp, void *arg);
+
+private:
+    struct Slot
+    {
+        long counters[STAT_COUNTER_NUMBER];
+        volatile long gauges[STAT_GAUGE_NUMBER];
+    };
+
+    static long Sum(int counter);
+    static long Gauge(int gauge);
+
+private:
+    static Slot local_;             //单进程模式下使用
+    static Slot *slots_;            //共享计数区,NULL表示单进程
+    static int slot_count_;
+    static long *counters_;         //当前进程的槽位
+    static volatile long *gauges_;
+};
+
+#endif
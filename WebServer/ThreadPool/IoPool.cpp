@@ -0,0 +1,131 @@
+#include "IoPool.h"
+
+#include <exception>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "../Stats/Stats.h"
+
+IoPool::IoPool(int thread_number, int max_requests)
+    : thread_number_(thread_number), max_requests_(max_requests), threads_(NULL),
+      queuelocker_("iopool_queue"), queuestat_("iopool_idle"), stop_(false)
+{
+    if (thread_number_ <= 0 || max_requests_ <= 0) {
+        throw std::exception();
+    }
+    //写端阻塞:通知不能丢,主线程总会读走
+    if (socketpair(PF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, donefd_) == -1) {
+        throw std::exception();
+    }
+    threads_ = new pthread_t[thread_number_];
+    for (int i = 0; i < thread_number_; ++i) {
+        printf("create the %dth io thread\n", i);
+        if (pthread_create(threads_ + i, NULL, ThreadWorkFunc, this) != 0 || pthread_detach(threads_[i])) {
+            delete[] threads_;
+            throw std::exception();
+        }
+    }
+}
+
+IoPool::~IoPool()
+{
+    delete[] threads_;
+    stop_ = true;
+    close(donefd_[0]);
+    close(donefd_[1]);
+}
+
+bool IoPool::Append(int fd, size_t len, int sockfd, int generation)
+{
+    Job job = {fd, len, {sockfd, generation}};
+    queuelocker_.Lock();
+    if ((int)workqueue_.size() >= max_requests_) {
+        queuelocker_.UnLock();
+        return false;
+    }
+    workqueue_.push_back(job);
+    queuelocker_.UnLock();
+    queuestat_.Post();
+    Stats::Add(STAT_COLD_FILES);
+    return true;
+}
+
+/*
+Resident()
+    mincore按页报告映射区是否在内存中,一次查询256页,遇到第一个不在的页就返回
+    大文件只检查开头,之后的部分随发送进度由内核顺序预读
+*/
+bool IoPool::Resident(const void *addr, size_t len)
+{
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    unsigned char vec[256];
+    //映射失败的地址不能交给mincore,也不能按常驻去拷贝
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    if (len > IO_CHECK_BYTES) {
+        len = IO_CHECK_BYTES;
+    }
+    for (size_t off = 0; off < len; off += sizeof(vec) * page) {
+        size_t n = len - off < sizeof(vec) * page ? len - off : sizeof(vec) * page;
+        //无法判断时按常驻处理,退回到原来的发送方式
+        if (mincore((char *)addr + off, n, vec) < 0) {
+            return true;
+        }
+        for (size_t i = 0; i < (n + page - 1) / page; i++) {
+            if (!(vec[i] & 1)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void* IoPool::ThreadWorkFunc(void* arg)
+{
+    IoPool* pool = (IoPool*)arg;
+    pool->ThreadRun();
+    return pool;
+}
+
+void IoPool::ThreadRun()
+{
+    while (!stop_) {
+        queuestat_.Wait();
+        queuelocker_.Lock();
+        if (workqueue_.empty()) {
+            queuelocker_.UnLock();
+            continue;
+        }
+        Job job = workqueue_.front();
+        workqueue_.pop_front();
+        queuelocker_.UnLock();
+        Prefetch(job);
+    }
+}
+
+/*
+Prefetch()
+    只等与Resident检查的范围相同的开头IO_CHECK_BYTES字节:先发起异步预读让磁盘请求合并,
+    再逐页访问自己的映射,等到这些页都进入页缓存;之后的部分随发送进度由内核顺序预读
+    用自己的映射而不是连接的映射区:等待期间连接可能被关闭,连接的映射区随之解除
+*/
+void IoPool::Prefetch(const Job &job)
+{
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    size_t len = job.len < IO_CHECK_BYTES ? job.len : IO_CHECK_BYTES;
+    posix_fadvise(job.fd, 0, len, POSIX_FADV_WILLNEED);
+    char *addr = (char *)mmap(0, len, PROT_READ, MAP_PRIVATE, job.fd, 0);
+    if (addr != MAP_FAILED) {
+        volatile char sum = 0;
+        for (size_t off = 0; off < len; off += page) {
+            sum += addr[off];
+        }
+        munmap(addr, len);
+    }
+    close(job.fd);
+    send(donefd_[1], (char *)&job.done, sizeof(job.done), 0);
+}
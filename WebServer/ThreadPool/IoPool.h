@@ -0,0 +1,63 @@
+#ifndef IO_POOL_H
+#define IO_POOL_H
+
+#include <list>
+#include <pthread.h>
+#include <stddef.h>
+
+#include "Locker.h"
+
+const int IO_THREAD_NUMBER = 2;                 //I/O线程数量,只做预读,少量线程即可
+const int IO_MAX_REQUESTS = 1024;               //等待预读的文件数上限,超出时由工作线程直接发送
+const size_t IO_CHECK_BYTES = 4 * 1024 * 1024;  //只检查文件开头这么多字节是否在页缓存中
+
+/*
+冷文件预读线程池
+    工作线程发现要发送的文件不在页缓存中时,把文件描述符交给I/O线程,连接暂不注册写事件
+    I/O线程发起预读并逐页读入页缓存,然后通过数据报套接字通知主线程为连接注册写事件
+    这样工作线程发送文件时不会阻塞在磁盘读上,也不会拖慢排在它后面的请求
+*/
+class IoPool
+{
+public:
+    //预读完成的通知,主线程按代数判断连接是否还是原来那个
+    struct Done
+    {
+        int sockfd;
+        int generation;
+    };
+
+    IoPool(int thread_number = IO_THREAD_NUMBER, int max_requests = IO_MAX_REQUESTS);
+    ~IoPool();
+
+    //fd的所有权交给I/O线程,返回false时仍归调用者
+    bool Append(int fd, size_t len, int sockfd, int generation);
+    int Fd() { return donefd_[0]; }     //主线程监视的通知套接字
+
+    //映射区开头IO_CHECK_BYTES字节的页面是否都在页缓存中
+    static bool Resident(const void *addr, size_t len);
+
+private:
+    struct Job
+    {
+        int fd;
+        size_t len;
+        Done done;
+    };
+
+    static void* ThreadWorkFunc(void* arg);
+    void ThreadRun();
+    void Prefetch(const Job &job);
+
+private:
+    int thread_number_;
+    int max_requests_;
+    pthread_t *threads_;
+    std::list<Job> workqueue_;
+    Locker queuelocker_;
+    Sem queuestat_;
+    bool stop_;
+    int donefd_[2];
+};
+
+#endif
@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <vector>
+
+#include "Locker.h"
+
+/*
+futex锁与pthread锁对比
+    ./lock_bench [iterations] [max_threads]
+    mutex:  每个线程反复加锁、修改共享计数、解锁,hold为临界区内CpuRelax的次数,线程数从1翻倍到max_threads
+    handoff:两个线程用一对信号量轮流唤醒对方,相当于线程池一次入队和取出
+    queue:  一个生产者按线程池的方式(加锁入队、Post)交给若干工作线程(Wait、加锁取出)
+    调整LOCK_SPIN_MAX或SpinEstimate之后重新运行,对比同一行的futex和pthread两列
+*/
+
+struct FutexMutex
+{
+    Locker lock;
+    void Lock() { lock.Lock(); }
+    void UnLock() { lock.UnLock(); }
+};
+
+struct PthreadMutex
+{
+    pthread_mutex_t lock;
+    PthreadMutex() { pthread_mutex_init(&lock, NULL); }
+    ~PthreadMutex() { pthread_mutex_destroy(&lock); }
+    void Lock() { pthread_mutex_lock(&lock); }
+    void UnLock() { pthread_mutex_unlock(&lock); }
+};
+
+struct FutexSem
+{
+    Sem sem;
+    void Wait() { sem.Wait(); }
+    void Post() { sem.Post(); }
+};
+
+struct PthreadSem
+{
+    sem_t sem;
+    PthreadSem() { sem_init(&sem, 0, 0); }
+    ~PthreadSem() { sem_destroy(&sem); }
+    void Wait() { while (sem_wait(&sem) != 0) {} }
+    void Post() { sem_post(&sem); }
+};
+
+static int64_t NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+//--------------------------------------------------------------------------
+template <typename M>
+struct MutexArg
+{
+    M *mutex;
+    long *counter;
+    long iterations;
+    int hold;
+};
+
+template <typename M>
+static void* MutexWorker(void *p)
+{
+    MutexArg<M> *arg = (MutexArg<M> *)p;
+    for (long i = 0; i < arg->iterations; i++) {
+        arg->mutex->Lock();
+        (*arg->counter)++;
+        for (int k = 0; k < arg->hold; k++) {
+            CpuRelax();
+        }
+        arg->mutex->UnLock();
+    }
+    return NULL;
+}
+
+//返回每次加锁解锁的平均纳秒数,计数不对时返回-1
+template <typename M>
+static double MutexRun(int threads, long iterations, int hold)
+{
+    M mutex;
+    long counter = 0;
+    MutexArg<M> arg = {&mutex, &counter, iterations, hold};
+    std::vector<pthread_t> tids(threads);
+    int64_t start = NowNs();
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&tids[i], NULL, MutexWorker<M>, &arg);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    int64_t elapsed = NowNs() - start;
+    if (counter != iterations * threads) {
+        return -1;
+    }
+    return (double)elapsed / (iterations * threads);
+}
+
+//--------------------------------------------------------------------------
+template <typename S>
+struct HandoffArg
+{
+    S ping;
+    S pong;
+    long rounds;
+};
+
+template <typename S>
+static void* HandoffWorker(void *p)
+{
+    HandoffArg<S> *arg = (HandoffArg<S> *)p;
+    for (long i = 0; i < arg->rounds; i++) {
+        arg->ping.Wait();
+        arg->pong.Post();
+    }
+    return NULL;
+}
+
+//返回一次往返的平均纳秒数
+template <typename S>
+static double HandoffRun(long rounds)
+{
+    HandoffArg<S> arg;
+    arg.rounds = rounds;
+    pthread_t tid;
+    pthread_create(&tid, NULL, HandoffWorker<S>, &arg);
+    int64_t start = NowNs();
+    for (long i = 0; i < rounds; i++) {
+        arg.ping.Post();
+        arg.pong.Wait();
+    }
+    int64_t elapsed = NowNs() - start;
+    pthread_join(tid, NULL);
+    return (double)elapsed / rounds;
+}
+
+//--------------------------------------------------------------------------
+template <typename M, typename S>
+struct QueueArg
+{
+    M lock;
+    S stat;
+    std::vector<long> items;
+    size_t head;
+    long done;
+};
+
+template <typename M, typename S>
+static void* QueueWorker(void *p)
+{
+    QueueArg<M, S> *arg = (QueueArg<M, S> *)p;
+    while (true) {
+        arg->stat.Wait();
+        arg->lock.Lock();
+        long item = arg->items[arg->head++];
+        if (item >= 0) {
+            arg->done++;
+        }
+        arg->lock.UnLock();
+        //-1表示结束
+        if (item < 0) {
+            return NULL;
+        }
+    }
+}
+
+//返回每个任务从入队到被取出的平均纳秒数(按总时间均摊),计数不对时返回-1
+template <typename M, typename S>
+static double QueueRun(int threads, long tasks)
+{
+    QueueArg<M, S> arg;
+    arg.items.reserve(tasks + threads);
+    arg.head = 0;
+    arg.done = 0;
+    std::vector<pthread_t> tids(threads);
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&tids[i], NULL, QueueWorker<M, S>, &arg);
+    }
+    int64_t start = NowNs();
+    for (long i = 0; i < tasks + threads; i++) {
+        arg.lock.Lock();
+        arg.items.push_back(i < tasks ? i : -1);
+        arg.lock.UnLock();
+        arg.stat.Post();
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    int64_t elapsed = NowNs() - start;
+    if (arg.done != tasks) {
+        return -1;
+    }
+    return (double)elapsed / tasks;
+}
+
+int main(int argc, char* argv[])
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+    int max_threads = argc > 2 ? atoi(argv[2]) : 8;
+    if (iterations <= 0 || max_threads <= 0) {
+        printf("Usage: ./lock_bench [iterations] [max_threads]\n");
+        return 1;
+    }
+    printf("LOCK_SPIN_MAX %d, %ld cpus, ns per operation\n", LOCK_SPIN_MAX, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-8s %7s %5s %10s %10s\n", "test", "threads", "hold", "futex", "pthread");
+
+    static const int holds[] = {0, 50};
+    for (size_t h = 0; h < sizeof(holds) / sizeof(holds[0]); h++) {
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            long per_thread = iterations / threads;
+            printf("%-8s %7d %5d %10.1f %10.1f\n", "mutex", threads, holds[h],
+                   MutexRun<FutexMutex>(threads, per_thread, holds[h]),
+                   MutexRun<PthreadMutex>(threads, per_thread, holds[h]));
+        }
+    }
+
+    long rounds = iterations / 10;
+    printf("%-8s %7d %5s %10.1f %10.1f\n", "handoff", 2, "-",
+           HandoffRun<FutexSem>(rounds), HandoffRun<PthreadSem>(rounds));
+
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        printf("%-8s %7d %5s %10.1f %10.1f\n", "queue", threads, "-",
+               QueueRun<FutexMutex, FutexSem>(threads, iterations),
+               QueueRun<PthreadMutex, PthreadSem>(threads, iterations));
+    }
+    return 0;
+}
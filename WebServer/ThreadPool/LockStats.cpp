@@ -0,0 +1,81 @@
+#include "LockStats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+__thread LockStats::Block *LockStats::local_ = NULL;
+LockStats::Block *LockStats::blocks_ = NULL;
+
+//锁可能在main之前构造(全局对象),注册表用静态初始化的互斥锁保护
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static const char *names[LOCK_STATS_MAX] = {"other"};
+static int name_count = 1;
+
+int LockStats::Register(const char *name)
+{
+    if (!name) {
+        return 0;
+    }
+    int id = 0;
+    pthread_mutex_lock(&registry_lock);
+    int i = 0;
+    for (; i < name_count; i++) {
+        if (strcmp(names[i], name) == 0) {
+            break;
+        }
+    }
+    if (i < name_count) {
+        id = i;
+    }
+    else if (name_count < LOCK_STATS_MAX) {
+        names[name_count] = name;
+        id = name_count++;
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return id;
+}
+
+int LockStats::Size()
+{
+    pthread_mutex_lock(&registry_lock);
+    int size = name_count;
+    pthread_mutex_unlock(&registry_lock);
+    return size;
+}
+
+const char* LockStats::Name(int id)
+{
+    return names[id];
+}
+
+LockStats::Block* LockStats::Attach()
+{
+    Block *block = (Block *)calloc(1, sizeof(Block));
+    if (!block) {
+        abort();
+    }
+    pthread_mutex_lock(&registry_lock);
+    block->next = blocks_;
+    blocks_ = block;
+    pthread_mutex_unlock(&registry_lock);
+    return block;
+}
+
+//各线程的计数可能正在被修改,读到的是近似值,用于观察趋势足够
+void LockStats::Sum(int id, LockCounters *out)
+{
+    memset(out, 0, sizeof(*out));
+    pthread_mutex_lock(&registry_lock);
+    for (Block *block = blocks_; block; block = block->next) {
+        const volatile LockCounters *c = &block->counters[id];
+        out->acquired += c->acquired;
+        out->contended += c->contended;
+        out->wait_ns += c->wait_ns;
+        out->hold_ns += c->hold_ns;
+        if (c->wait_max_ns > out->wait_max_ns) {
+            out->wait_max_ns = c->wait_max_ns;
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
@@ -0,0 +1,83 @@
+#ifndef LOCK_STATS_H
+#define LOCK_STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+const int LOCK_STATS_MAX = 32;      //最多统计的锁名字数量,超出的归入"other"
+
+//一个名字下所有锁的计数,时间单位为纳秒
+struct LockCounters
+{
+    long acquired;          //获取次数
+    long contended;         //没能立即获取、需要阻塞的次数
+    long wait_ns;           //阻塞等待的总时间
+    long wait_max_ns;       //单次等待的最长时间
+    long hold_ns;           //持有锁的总时间,信号量和条件变量不统计
+};
+
+/*
+锁竞争统计
+    只在make LOCK_STATS=1时由Locker、Cond、Sem调用,默认编译下这些原语不做任何额外的事
+    同名的锁共用一组计数,例如缓存的16个分片锁都记在"cache_shard"下
+    计数按线程分开存放,线程第一次用到时分配并挂到全局链表,只有该线程写,读取时把各线程的相加
+    线程退出后计数块不释放,保留已统计的数据
+*/
+class LockStats
+{
+public:
+    //按名字取编号,name必须是常量字符串;构造锁时调用
+    static int Register(const char *name);
+    static int Size();
+    static const char* Name(int id);
+    //把所有线程的计数相加
+    static void Sum(int id, LockCounters *out);
+
+    static int64_t Now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    //wait_ns < 0表示立即获取到
+    static void Acquired(int id, int64_t wait_ns)
+    {
+        LockCounters *c = Local(id);
+        c->acquired++;
+        if (wait_ns >= 0) {
+            c->contended++;
+            c->wait_ns += wait_ns;
+            if (wait_ns > c->wait_max_ns) {
+                c->wait_max_ns = wait_ns;
+            }
+        }
+    }
+
+    static void Released(int id, int64_t hold_ns)
+    {
+        Local(id)->hold_ns += hold_ns;
+    }
+
+private:
+    struct Block
+    {
+        LockCounters counters[LOCK_STATS_MAX];
+        Block *next;
+    };
+
+    static LockCounters* Local(int id)
+    {
+        if (!local_) {
+            local_ = Attach();
+        }
+        return &local_->counters[id];
+    }
+    static Block* Attach();
+
+private:
+    static __thread Block *local_;
+    static Block *blocks_;          //所有线程的计数块,受注册表的锁保护
+};
+
+#endif
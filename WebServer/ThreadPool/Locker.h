@@ -1,79 +1,211 @@
 #ifndef Locker_H
 #define Locker_H
 
-#include <exception>
-#include <pthread.h>
-#include <semaphore.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#ifdef LOCK_STATS
+#include "LockStats.h"
+#endif
 
 // 线程同步机制封装类
+// 直接基于futex实现:没有竞争时只做一次原子操作,不进入内核;有竞争时先自旋一小段再睡眠
+// name用于make LOCK_STATS=1时按名字统计等待和持有时间,默认编译下忽略;不传名字的归入"other"
+
+const int LOCK_SPIN_MAX = 100;      //睡眠前最多自旋的次数
+
+//自旋等待时提示CPU,减少功耗并让出超线程的执行资源
+inline void CpuRelax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#else
+    __sync_synchronize();
+#endif
+}
+
+//*addr仍等于val时睡眠,abstime为CLOCK_REALTIME的绝对时间,NULL表示不超时
+inline int FutexWait(volatile int *addr, int val, const struct timespec *abstime = NULL)
+{
+    if (abstime) {
+        return syscall(SYS_futex, addr, FUTEX_WAIT_BITSET_PRIVATE | FUTEX_CLOCK_REALTIME, val, abstime,
+                       NULL, FUTEX_BITSET_MATCH_ANY);
+    }
+    return syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+inline int FutexWake(volatile int *addr, int count)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/*
+自适应自旋次数
+    按最近几次自旋成功时用掉的次数估计下一次该自旋多久,最多LOCK_SPIN_MAX次
+    自旋没等到就把估计值往下调,持有时间长的锁很快退化为只试探几次就睡眠
+    单核机器上自旋时持有者无法运行,直接睡眠
+*/
+struct SpinEstimate
+{
+    int spins;
+
+    SpinEstimate() : spins(0) {}
+    int Limit() {
+        static const bool smp = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+        if (!smp) {
+            return 0;
+        }
+        return spins * 2 + 10 < LOCK_SPIN_MAX ? spins * 2 + 10 : LOCK_SPIN_MAX;
+    }
+    void Succeeded(int used) { spins += (used - spins) / 8; }
+    void Failed() { spins -= (spins + 7) / 8; }
+};
 
-// 互斥锁类,保证线程互斥访问临界区
+/*
+互斥锁类,保证线程互斥访问临界区
+    state_: 0未加锁 1已加锁且没有等待者 2已加锁且可能有等待者
+    解锁时只有状态为2才调用FUTEX_WAKE,参见Drepper的"Futexes Are Tricky"
+*/
 class Locker {
 public:
-    Locker() {
-        //创建互斥锁
-        if(pthread_mutex_init(&mutex_, NULL) != 0) {
-            throw std::exception();
-        }
+    Locker(const char *name = NULL) : state_(0) {
+#ifdef LOCK_STATS
+        id_ = LockStats::Register(name);
+#endif
     }
 
-    ~Locker() {
-        //销毁互斥锁
-        pthread_mutex_destroy(&mutex_);
+    bool TryLock() {
+        return __sync_bool_compare_and_swap(&state_, 0, 1);
     }
 
+#ifdef LOCK_STATS
+    //TryLock失败才算一次竞争并计时;加锁时刻由持有者写入、解锁前读出
+    bool Lock() {
+        int64_t wait = -1;
+        if (!TryLock()) {
+            int64_t start = LockStats::Now();
+            LockSlow();
+            wait = LockStats::Now() - start;
+        }
+        locked_at_ = LockStats::Now();
+        LockStats::Acquired(id_, wait);
+        return true;
+    }
+
+    bool UnLock() {
+        LockStats::Released(id_, LockStats::Now() - locked_at_);
+        Release();
+        return true;
+    }
+#else
     bool Lock() {
         //上锁
-        return pthread_mutex_lock(&mutex_) == 0;
+        if (!TryLock()) {
+            LockSlow();
+        }
+        return true;
     }
 
     bool UnLock() {
         //解锁
-        return pthread_mutex_unlock(&mutex_) == 0;
+        Release();
+        return true;
+    }
+#endif
+
+private:
+    //先自旋等持有者释放,仍拿不到就把状态置为2并睡眠,醒来后同样以2的状态抢锁
+    void LockSlow() {
+        int limit = spin_.Limit();
+        int used = 0;
+        for (; used < limit; used++) {
+            CpuRelax();
+            if (state_ == 0 && TryLock()) {
+                spin_.Succeeded(used);
+                return;
+            }
+        }
+        if (limit > 0) {
+            spin_.Failed();
+        }
+        while (__sync_lock_test_and_set(&state_, 2) != 0) {
+            FutexWait(&state_, 2);
+        }
     }
 
-    //取锁
-    pthread_mutex_t *get()
-    {
-        return &mutex_;
+    void Release() {
+        if (__sync_fetch_and_sub(&state_, 1) != 1) {
+            state_ = 0;
+            FutexWake(&state_, 1);
+        }
     }
 
 private:
-    pthread_mutex_t mutex_;
+    volatile int state_;
+    SpinEstimate spin_;
+#ifdef LOCK_STATS
+    int id_;
+    int64_t locked_at_;
+#endif
 };
 
 
-// 条件变量类
+/*
+条件变量类
+    seq_每次Signal/BroadCast加一,等待者记下旧值后解锁并在seq_上睡眠,期间有通知就不会睡着
+    醒来后重新加锁,和pthread一样可能虚假唤醒,调用者需要循环检查条件
+*/
 class Cond {
 public:
-    Cond(){
-        if (pthread_cond_init(&cond_, NULL) != 0) {
-            throw std::exception();
-        }
-    }
-    ~Cond() {
-        pthread_cond_destroy(&cond_);
+    Cond(const char *name = NULL) : seq_(0) {
+#ifdef LOCK_STATS
+        id_ = LockStats::Register(name);
+#endif
     }
 
-    bool Wait(pthread_mutex_t *mutex_) {
-        int ret = 0;
-        ret = pthread_cond_wait(&cond_, mutex_);
-        return ret == 0;
+    bool Wait(Locker *locker) {
+        return TimeWait(locker, NULL);
     }
-    bool TimeWait(pthread_mutex_t *mutex_, struct timespec t) {
-        int ret = 0;
-        ret = pthread_cond_timedwait(&cond_, mutex_, &t);
-        return ret == 0;
+    //t为CLOCK_REALTIME的绝对时间,超时返回false
+    bool TimeWait(Locker *locker, struct timespec t) {
+        return TimeWait(locker, &t);
     }
     bool Signal() {
-        return pthread_cond_signal(&cond_) == 0;
+        __sync_add_and_fetch(&seq_, 1);
+        FutexWake(&seq_, 1);
+        return true;
     }
     bool BroadCast() {
-        return pthread_cond_broadcast(&cond_) == 0;
+        __sync_add_and_fetch(&seq_, 1);
+        FutexWake(&seq_, INT_MAX);
+        return true;
+    }
+
+private:
+    bool TimeWait(Locker *locker, const struct timespec *t) {
+        int seq = seq_;
+#ifdef LOCK_STATS
+        //每次等待都计为一次竞争;等待期间互斥锁被释放,但仍计入该互斥锁的持有时间
+        int64_t start = LockStats::Now();
+#endif
+        locker->UnLock();
+        bool ok = FutexWait(&seq_, seq, t) == 0 || errno != ETIMEDOUT;
+        locker->Lock();
+#ifdef LOCK_STATS
+        LockStats::Acquired(id_, LockStats::Now() - start);
+#endif
+        return ok;
     }
 
 private:
-    pthread_cond_t cond_;
+    volatile int seq_;
+#ifdef LOCK_STATS
+    int id_;
+#endif
 };
 
 
@@ -85,32 +217,93 @@ private:
         而sem <= 0 的时候是会阻塞线程的，所以设置为0一开始是阻塞线程的
         当有任务的时候，执行V操作，增加信号量值
         线程取走任务后，执行P操作，减少信号量值
+    count_为信号量值,waiters_为正在或准备在futex上睡眠的线程数
+        Post只在有睡眠者时才FUTEX_WAKE,Wait在睡眠前先自旋一小段,刚好有任务到来时不进入内核
+        两边都是"先改自己的变量,再读对方的变量",__sync操作带完整内存屏障,不会出现双方都错过的情况
 */
 class Sem {
 public:
-    Sem() {
-        if( sem_init( &sem_, 0, 0 ) != 0 ) {
-            throw std::exception();
-        }
+    Sem(const char *name = NULL) : count_(0), waiters_(0) {
+#ifdef LOCK_STATS
+        id_ = LockStats::Register(name);
+#endif
+    }
+    Sem(int num, const char *name = NULL) : count_(num), waiters_(0) {
+#ifdef LOCK_STATS
+        id_ = LockStats::Register(name);
+#endif
     }
-    Sem(int num) {
-        if( sem_init( &sem_, 0, num ) != 0 ) {
-            throw std::exception();
+
+    bool TryWait() {
+        int count = count_;
+        while (count > 0) {
+            int old = __sync_val_compare_and_swap(&count_, count, count - 1);
+            if (old == count) {
+                return true;
+            }
+            count = old;
         }
+        return false;
     }
-    ~Sem() {
-        sem_destroy( &sem_ );
+
+#ifdef LOCK_STATS
+    //线程池的信号量上等待的时间就是工作线程的空闲时间
+    bool Wait() {
+        int64_t wait = -1;
+        if (!TryWait()) {
+            int64_t start = LockStats::Now();
+            WaitSlow();
+            wait = LockStats::Now() - start;
+        }
+        LockStats::Acquired(id_, wait);
+        return true;
     }
+#else
     // 等待信号量，sem值小于等于0，则线程阻塞
     bool Wait() {
-        return sem_wait( &sem_ ) == 0;
+        if (!TryWait()) {
+            WaitSlow();
+        }
+        return true;
     }
+#endif
     // 增加信号量
     bool Post() {
-        return sem_post( &sem_ ) == 0;
+        __sync_add_and_fetch(&count_, 1);
+        if (__sync_add_and_fetch(&waiters_, 0) > 0) {
+            FutexWake(&count_, 1);
+        }
+        return true;
     }
+
+private:
+    void WaitSlow() {
+        int limit = spin_.Limit();
+        int used = 0;
+        for (; used < limit; used++) {
+            CpuRelax();
+            if (count_ > 0 && TryWait()) {
+                spin_.Succeeded(used);
+                return;
+            }
+        }
+        if (limit > 0) {
+            spin_.Failed();
+        }
+        __sync_add_and_fetch(&waiters_, 1);
+        while (!TryWait()) {
+            FutexWait(&count_, 0);
+        }
+        __sync_sub_and_fetch(&waiters_, 1);
+    }
+
 private:
-    sem_t sem_;
+    volatile int count_;
+    volatile int waiters_;
+    SpinEstimate spin_;
+#ifdef LOCK_STATS
+    int id_;
+#endif
 };
 
-#endif
\ No newline at end of file
+#endif
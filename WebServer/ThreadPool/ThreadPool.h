@@ -3,12 +3,14 @@
 
 #include <list>
 #include <cstdio>
+#include <cmath>
 #include <exception>
 #include <pthread.h>
 #include <semaphore.h>
 
 #include "Locker.h"
 #include "../Http/HttpConn.h"
+#include "../Stats/Stats.h"
 
 // 线程池类，将它定义为模板类是为了代码复用，模板参数T是任务类
 template<typename T>
@@ -19,23 +21,46 @@ public:
     ~ThreadPool();
     //插入任务函数
     bool Append(T* request, int event_flag);
+    //新请求入队前调用,排队时间持续超标时按CoDel的节奏返回false,调用者应以503拒绝
+    bool Admit();
+    //target_ms:可接受的排队时间 interval_ms:持续超标多久开始拒绝 deadline_ms:排队超过它的新请求直接拒绝
+    void SetShedding(int target_ms, int interval_ms, int deadline_ms);
+    //队列为空时先自旋spin_us微秒再睡眠,0表示直接睡眠
+    void SetSpin(int spin_us) { spin_ = spin_us; }
 
 private:
     /*工作线程运行的函数，它不断从工作队列中取出任务并执行之*/
     //线程被创建的时候被指明执行该函数,我们会将this指针传递进去,因为静态函数无法访问成员变量
     static void* ThreadWorkFunc(void* arg);
     void ThreadRun();
+    void Control(int64_t sojourn, int64_t now);    //取出任务时更新CoDel状态,持有queuelocker_
 
 private:
     
+    //请求队列中的任务,读写标志跟随任务保存,多个任务可同时在不同线程中处理
+    struct Task {
+        T* request;
+        int event_flag;            // 0:读事件  1:写事件
+        int64_t queued;            // 入队时间(微秒)
+    };
+
     int thread_number_;            // 线程的数量    
     int max_requests_;             // 请求队列中最多允许的、等待处理的请求的数量 
     pthread_t * threads_;          // 描述线程池的数组，大小为thread_number_    
-    std::list< T* > workqueue_;    // 请求队列
+    std::list< Task > workqueue_;  // 请求队列
     Locker queuelocker_;           // 保护请求队列的互斥锁
     Sem queuestat_;                // 是否有任务需要处理
     bool stop_;                    // 是否结束线程   
-    int event_flag_;               // 0:读事件  1:写事件               
+    int64_t spin_;                 // 睡眠前自旋等待任务的时间(微秒)
+
+    //负载削减,时间单位为微秒,target_为0表示未开启;以下状态受queuelocker_保护
+    int64_t target_;               // 可接受的排队时间
+    int64_t interval_;             // 排队时间持续超过target_这么久才开始拒绝
+    int64_t deadline_;             // 排队超过它的新请求在取出时直接拒绝
+    int64_t first_above_;          // 排队时间开始超标后,允许进入拒绝状态的时间,0表示未超标
+    int64_t drop_next_;            // 拒绝状态下下一次拒绝的时间
+    int drop_count_;               // 本轮拒绝状态已拒绝的次数
+    bool dropping_;                // 是否处于拒绝状态
 };
 
 /*
@@ -48,8 +73,10 @@ ThreadPool(int thread_number, int max_requests)
 */
 template< typename T >
 ThreadPool< T >::ThreadPool(int thread_number, int max_requests) : 
-        thread_number_(thread_number), max_requests_(max_requests), 
-        stop_(false), threads_(NULL) {
+        thread_number_(thread_number), max_requests_(max_requests), threads_(NULL),
+        queuelocker_("threadpool_queue"), queuestat_("threadpool_idle"),
+        stop_(false), spin_(0), target_(0), interval_(0), deadline_(0),
+        first_above_(0), drop_next_(0), drop_count_(0), dropping_(false) {
 
     //线程数或请求数小于等于0，抛出异常
     if((thread_number_ <= 0) || (max_requests_ <= 0) ) {
@@ -98,14 +125,14 @@ Append( T* request )
 template< typename T >
 bool ThreadPool< T >::Append( T* request, int event_flag)
 {
-    event_flag_ = event_flag;
+    Task task = {request, event_flag, Clock::ReadUs()};
     // 操作工作队列时一定要加锁，因为它被所有线程共享。
     queuelocker_.Lock();
     if ( workqueue_.size() > max_requests_ ) {
         queuelocker_.UnLock();
         return false;
     }
-    workqueue_.push_back(request);
+    workqueue_.push_back(task);
     queuelocker_.UnLock();
     //经过Append操作，请求队列有了元素，执行V操作，增加信号量
     //这会唤醒在queuestat_.wait()处被阻塞的工作线程
@@ -113,6 +140,65 @@ bool ThreadPool< T >::Append( T* request, int event_flag)
     return true;
 }
 
+template< typename T >
+void ThreadPool< T >::SetShedding(int target_ms, int interval_ms, int deadline_ms)
+{
+    queuelocker_.Lock();
+    target_ = (int64_t)target_ms * 1000;
+    interval_ = (int64_t)interval_ms * 1000;
+    deadline_ = (int64_t)deadline_ms * 1000;
+    first_above_ = 0;
+    dropping_ = false;
+    queuelocker_.UnLock();
+}
+
+/*
+Control()
+    CoDel:只看最小排队时间是否持续超过target_,短暂的突发不会触发拒绝
+    连续interval_内每个取出的任务都超标才进入拒绝状态;任何一个任务低于target_就退出
+    进入时若刚退出不久,沿用上一轮的拒绝次数,更快回到原来的拒绝速率
+*/
+template< typename T >
+void ThreadPool< T >::Control(int64_t sojourn, int64_t now)
+{
+    if (sojourn < target_) {
+        first_above_ = 0;
+        dropping_ = false;
+        return;
+    }
+    if (first_above_ == 0) {
+        first_above_ = now + interval_;
+        return;
+    }
+    if (!dropping_ && now >= first_above_) {
+        dropping_ = true;
+        drop_count_ = (drop_count_ > 2 && now - drop_next_ < 16 * interval_) ? drop_count_ - 2 : 0;
+        drop_next_ = now;
+    }
+}
+
+/*
+Admit()
+    拒绝状态下第n次拒绝之后隔interval_/sqrt(n)再拒绝下一个,排队时间降不下来时拒绝得越来越密
+*/
+template< typename T >
+bool ThreadPool< T >::Admit()
+{
+    if (target_ == 0) {
+        return true;
+    }
+    bool admit = true;
+    int64_t now = Clock::ReadUs();
+    queuelocker_.Lock();
+    if (dropping_ && now >= drop_next_) {
+        drop_count_++;
+        drop_next_ = now + (int64_t)(interval_ / std::sqrt((double)drop_count_));
+        admit = false;
+    }
+    queuelocker_.UnLock();
+    return admit;
+}
+
 /*
 ThreadWorkFunc( void* arg )
     创建线程时指定的线程运行函数
@@ -146,7 +232,20 @@ void ThreadPool< T >::ThreadRun() {
         经过Append操作，执行V操作，sem值大于0
         工作线程被唤醒竞争出一个线程，成功的工作现场进入，又执行P操作，导致sem值为0，其他线程被继续阻塞
         */
-        queuestat_.Wait();
+        //忙等模式下任务在自旋期间到来,Append的Post看不到睡眠者,不用进内核唤醒
+        if (spin_ > 0 && !queuestat_.TryWait()) {
+            int64_t until = Clock::ReadUs() + spin_;
+            bool got = false;
+            while (!(got = queuestat_.TryWait()) && !stop_ && Clock::ReadUs() < until) {
+                CpuRelax();
+            }
+            if (!got) {
+                queuestat_.Wait();
+            }
+        }
+        else if (spin_ == 0) {
+            queuestat_.Wait();
+        }
         //访问公共区域上锁
         queuelocker_.Lock();
         if ( workqueue_.empty() ) {
@@ -154,34 +253,48 @@ void ThreadPool< T >::ThreadRun() {
             continue;
         }
         //取出队列前面的任务
-        T* request = workqueue_.front();
+        Task task = workqueue_.front();
         workqueue_.pop_front();
+        int64_t sojourn = 0;
+        if (target_ > 0) {
+            int64_t now = Clock::ReadUs();
+            sojourn = now - task.queued;
+            Control(sojourn, now);
+        }
         queuelocker_.UnLock();
+        T* request = task.request;
         if ( !request ) {
             continue;
         }
+        //排队太久的新请求客户端多半已经放弃,直接回复503,把线程留给还来得及的请求
+        if (deadline_ > 0 && sojourn > deadline_ && 0 == task.event_flag && request->Sheddable()) {
+            request->Shed();
+            request->CloseConn();
+            request->TaskDone();
+            Stats::Add(STAT_SHED_DEADLINE);
+            continue;
+        }
+#ifdef USE_TRACE
+        request->TraceDequeued();
+#endif
         
-        if (0 == event_flag_) {
+        //处理失败或短连接发送完毕时,由CloseConn通知主线程关闭连接;任务结束前主线程不会关闭它
+        if (0 == task.event_flag) {
             if (request->ReadOnce()) {
                 //线程对HTTP请求进行处理
                 request->Process();
-                request->event_finish_ = 1;
             }
             else {
                 //读取失败
-                request->timer_flag_ = 1;
-                request->event_finish_ = 1;
+                request->CloseConn();
             }
         }
-        else if (1 == event_flag_) {            
-            if (request->Write()) { //长连接
-                request->event_finish_ = 1;
-            } else {//短连接
-                request->timer_flag_ = 1;
-                request->event_finish_ = 1;
-            }     
-                                            
+        else if (1 == task.event_flag) {            
+            if (!request->Write()) { //短连接或发送失败
+                request->CloseConn();
+            }
         }
+        request->TaskDone();
     }
 
 }
@@ -39,23 +39,28 @@ void TimerManager::AdjustTimer(TimerNode* timer)
     if (timer == NULL) {
         return;
     }
-    //如果还是小于下一个定时器,则不用移动
-    TimerNode* tmp = timer->next;
-    if (tmp == NULL || (timer->expire < tmp->expire)) {
+    //仍在前后两个定时器之间,则不用移动
+    TimerNode* prev = timer->prev;
+    TimerNode* next = timer->next;
+    if ((prev == NULL || prev->expire <= timer->expire) && (next == NULL || timer->expire < next->expire)) {
         return;
     }
-    //如果是头节点,则隔离出该节点,再重新插入
-    if (timer == head) {
-        head = head->next;
-        head->prev = NULL;
-        timer->next = NULL;
-        AddTimerNode(timer, head);
+    //隔离出该节点再重新插入,进入请求头阶段时期限会提前
+    if (prev) {
+        prev->next = next;
+    }
+    else {
+        head = next;
+    }
+    if (next) {
+        next->prev = prev;
     }
     else {
-        timer->prev->next = timer->next;
-        timer->next->prev = timer->prev;
-        AddTimerNode(timer, head);
+        tail = prev;
     }
+    timer->prev = NULL;
+    timer->next = NULL;
+    AddTimerNode(timer);
 }
 
 void TimerManager::DelTimer(TimerNode* timer)
@@ -75,6 +80,7 @@ void TimerManager::DelTimer(TimerNode* timer)
         head = head->next;
         head->prev = NULL;
         delete timer;
+        return;
     }
     //如果是最后一个定时器
     if (timer == tail) {
@@ -83,39 +89,77 @@ void TimerManager::DelTimer(TimerNode* timer)
         delete timer;
         return;
     }
-    if (!timer || timer->prev || timer->next) {
-        return;
-    }
     //如果是中间节点
     timer->prev->next = timer->next;
     timer->next->prev = timer->prev;
     delete timer;    
 }
 
-//检查是否有定时器超时,有则移除
-void TimerManager::Tick()
+/*
+Tick()
+    节点的expire只是检查时间,不晚于连接当前阶段的期限
+    工作线程推进阶段后期限可能已推后,这时按新期限重新排队;真正到期的连接关闭后按阶段计数
+    会话连接按最后一次活动计时,只有工作线程等待上游时推后的期限需要在这里遵守
+*/
+void TimerManager::Tick(int *expired)
 {
-    if (head == NULL) {
-        return;
-    }
-    
-    time_t cur = time(NULL);
-    TimerNode* tmp = head;
-    while (tmp) {
-        //当前时间小于某定时器则退出
-        if (cur < tmp->expire) {
-            break;
+    int64_t cur = Clock::Now();
+    while (head && head->expire <= cur) {
+        TimerNode* tmp = head;
+        HttpConn* conn = tmp->user_data_->conn;
+        int phase = conn ? conn->Phase() : HttpConn::PHASE_SESSION;
+        if (conn && conn->deadline_ > cur) {
+            tmp->expire = conn->deadline_;
+            AdjustTimer(tmp);
+            continue;
+        }
+        //工作线程还在处理:标记后由它结束任务时发关闭通知,节点推后作为兜底;同一连接只计数一次
+        bool marked = conn && conn->close_pending_;
+        if (!marked) {
+            expired[phase]++;
+        }
+        if (conn && !conn->TryClose()) {
+            tmp->expire = cur + TIMER_BUSY_RETRY;
+            AdjustTimer(tmp);
+            continue;
         }
         tmp->cb_func(tmp->user_data_);//调用该定时器回调函数,关闭该客户连接
         head = tmp->next;
         if (head != NULL) {
             head->prev = NULL;
         }
+        else {
+            tail = NULL;
+        }
         delete tmp;
-        tmp = head;
     }
 }
 
+/*
+EvictIdle()
+    空闲连接的期限是最后一次活动加KEEPALIVE_TIMEOUT,节点的expire不晚于期限,按链表顺序近似LRU
+    从表头开始,只关闭正在等待下一个请求的长连接,处理中的连接保留
+    刚回到空闲、任务还没结束的连接只做标记,由工作线程发关闭通知,已标记的不再重复计数
+*/
+int TimerManager::EvictIdle(int64_t limit, int max)
+{
+    int count = 0;
+    TimerNode* tmp = head;
+    while (tmp && count < max && tmp->expire <= limit) {
+        TimerNode* next = tmp->next;
+        HttpConn* conn = tmp->user_data_->conn;
+        if (conn && conn->Phase() == HttpConn::PHASE_IDLE && conn->deadline_ <= limit && !conn->close_pending_) {
+            if (conn->TryClose()) {
+                tmp->cb_func(tmp->user_data_);
+                DelTimer(tmp);
+            }
+            count++;
+        }
+        tmp = next;
+    }
+    return count;
+}
+
 void TimerManager::AddTimerNode(TimerNode* timer, TimerNode* head)
 {
     TimerNode* prev = head;
@@ -147,5 +191,9 @@ void CbFunc(ClientData *user_data)
     epoll_ctl(Utils::epollfd_, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
     close(user_data->sockfd);
+    if (user_data->conn) {
+        user_data->conn->OnClose();
+    }
+    user_data->timer = NULL;    //定时器随后被释放,避免再次使用
     HttpConn::user_count_--;
 }
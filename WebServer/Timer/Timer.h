@@ -20,11 +20,14 @@
 #include "../Http/HttpConn.h"
 class TimerNode;
 
+const int TIMER_BUSY_RETRY = 1000;  //到期时连接还在处理,多久之后再检查(毫秒)
+
 struct ClientData
 {
-    sockaddr_in address;
+    sockaddr_storage address;
     int sockfd;
     TimerNode *timer;
+    HttpConn *conn;     //关闭fd时通知连接释放长期订阅
 };
 
 //定时器结构
@@ -34,7 +37,7 @@ public:
     TimerNode() : prev(NULL), next(NULL) {}
 
 public:
-    time_t expire;//定时器时间(绝对时间)
+    int64_t expire;//定时器时间(Clock毫秒)
 
     void (*cb_func)(struct ClientData*);   //回调函数
     ClientData *user_data_;         //定时器维护的用户
@@ -54,7 +57,9 @@ public:
     void AddTimerNode(TimerNode* timer);    //插入定时器
     void AdjustTimer(TimerNode* timer);     //调整定时器
     void DelTimer(TimerNode* timer);        //删除定时器
-    void Tick();                            //定时器检查函数
+    void Tick(int *expired);                //定时器检查函数,expired按阶段累加到期关闭的连接数
+    int EvictIdle(int64_t limit, int max);  //关闭期限不晚于limit的空闲连接,最多max个
+    int64_t NextExpire() { return head ? head->expire : -1; }   //最早的检查时间,没有定时器时为-1
 
 private:
     void AddTimerNode(TimerNode* timer, TimerNode* head);
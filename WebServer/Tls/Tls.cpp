@@ -0,0 +1,242 @@
+#include "Tls.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef USE_TLS
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+//ALPN协商:优先h2,HTTP/2会话和HTTP/1.1一样通过连接的Recv/Writev收发
+static const unsigned char ALPN_PROTOS[] = "\x02h2\x08http/1.1";
+
+static int SelectAlpn(SSL *ssl, const unsigned char **out, unsigned char *outlen,
+                      const unsigned char *in, unsigned int inlen, void *arg)
+{
+    unsigned char *selected;
+    if (SSL_select_next_proto(&selected, outlen, ALPN_PROTOS, sizeof(ALPN_PROTOS) - 1, in, inlen) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+TlsContext::TlsContext() : ctx_(NULL)
+{
+}
+
+TlsContext::~TlsContext()
+{
+    if (ctx_) {
+        SSL_CTX_free(ctx_);
+    }
+}
+
+bool TlsContext::Init(const char *cert_file, const char *key_file)
+{
+    ctx_ = SSL_CTX_new(TLS_server_method());
+    if (!ctx_) {
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(ctx_, TLS1_2_VERSION);
+    if (SSL_CTX_use_certificate_chain_file(ctx_, cert_file) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx_, key_file, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx_) != 1) {
+        ERR_print_errors_fp(stdout);
+        SSL_CTX_free(ctx_);
+        ctx_ = NULL;
+        return false;
+    }
+
+    //会话恢复:TLS1.3和TLS1.2都发放无状态票据,TLS1.2的会话ID由服务端缓存
+    SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(ctx_, (const unsigned char*)"MyTinyWebServer", 15);
+    SSL_CTX_set_num_tickets(ctx_, 2);
+
+    /*
+    部分写入:SSL_write像writev一样返回已发送的字节数
+    移动写缓冲:重试时iovec已经前移,只要数据相同就允许
+    关闭连接时不发close_notify,主线程直接close(fd),会话也不会因此被标记为不可恢复
+    */
+    SSL_CTX_set_mode(ctx_, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+    SSL_CTX_set_quiet_shutdown(ctx_, 1);
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(ctx_, SSL_OP_ENABLE_KTLS);
+#endif
+    SSL_CTX_set_alpn_select_cb(ctx_, SelectAlpn, NULL);
+    return true;
+}
+
+TlsSession::TlsSession(TlsContext *ctx, int sockfd)
+    : sockfd_(sockfd), established_(false), want_write_(false), ktls_send_(false)
+{
+    ssl_ = SSL_new(ctx->Get());
+    if (ssl_) {
+        SSL_set_fd(ssl_, sockfd);
+        SSL_set_accept_state(ssl_);
+    }
+}
+
+TlsSession::~TlsSession()
+{
+    if (ssl_) {
+        SSL_free(ssl_);
+    }
+}
+
+int TlsSession::Handshake()
+{
+    if (!ssl_) {
+        return -1;
+    }
+    ERR_clear_error();
+    int ret = SSL_do_handshake(ssl_);
+    if (ret == 1) {
+        established_ = true;
+#ifdef SSL_OP_ENABLE_KTLS
+        ktls_send_ = BIO_get_ktls_send(SSL_get_wbio(ssl_));
+#endif
+        printf("TLS握手完成 fd %d, %s, 会话复用 %d, kTLS发送 %d\n", sockfd_, SSL_get_version(ssl_),
+               (int)SSL_session_reused(ssl_), (int)ktls_send_);
+        return 1;
+    }
+    switch (SSL_get_error(ssl_, ret))
+    {
+        case SSL_ERROR_WANT_READ:
+            want_write_ = false;
+            return 0;
+        case SSL_ERROR_WANT_WRITE:
+            want_write_ = true;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+int TlsSession::Read(char *buf, int len)
+{
+    ERR_clear_error();
+    int ret = SSL_read(ssl_, buf, len);
+    if (ret > 0) {
+        return ret;
+    }
+    switch (SSL_get_error(ssl_, ret))
+    {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;
+        case SSL_ERROR_SYSCALL:
+            //对端没有发close_notify就关闭了连接
+            if (errno == 0) {
+                return 0;
+            }
+            return -1;
+        default:
+            errno = EIO;
+            return -1;
+    }
+}
+
+/*
+Writev()
+    kTLS已开启时直接writev,映射区由内核加密发送
+    否则逐段SSL_write,遇到阻塞时返回已发送的字节数,一个字节都没发出时返回-1/EAGAIN
+*/
+int TlsSession::Writev(const struct iovec *iov, int count)
+{
+    if (ktls_send_) {
+        return writev(sockfd_, iov, count);
+    }
+    int total = 0;
+    for (int i = 0; i < count; i++) {
+        if (iov[i].iov_len == 0) {
+            continue;
+        }
+        ERR_clear_error();
+        int ret = SSL_write(ssl_, iov[i].iov_base, iov[i].iov_len);
+        if (ret > 0) {
+            total += ret;
+            if ((size_t)ret < iov[i].iov_len) {
+                break;
+            }
+            continue;
+        }
+        if (total > 0) {
+            break;
+        }
+        switch (SSL_get_error(ssl_, ret))
+        {
+            case SSL_ERROR_WANT_READ:
+            case SSL_ERROR_WANT_WRITE:
+                errno = EAGAIN;
+                return -1;
+            case SSL_ERROR_SYSCALL:
+                return -1;
+            default:
+                errno = EIO;
+                return -1;
+        }
+    }
+    return total;
+}
+
+bool TlsSession::Pending()
+{
+    return SSL_pending(ssl_) > 0;
+}
+
+#else
+
+//未开启TLS时的空实现,HttpConn不会创建TlsSession
+
+TlsContext::TlsContext() : ctx_(NULL)
+{
+}
+
+TlsContext::~TlsContext()
+{
+}
+
+bool TlsContext::Init(const char *cert_file, const char *key_file)
+{
+    printf("TLS未编译进服务器,请使用make TLS=1重新编译\n");
+    return false;
+}
+
+TlsSession::TlsSession(TlsContext *ctx, int sockfd)
+    : ssl_(NULL), sockfd_(sockfd), established_(false), want_write_(false), ktls_send_(false)
+{
+}
+
+TlsSession::~TlsSession()
+{
+}
+
+int TlsSession::Handshake()
+{
+    return -1;
+}
+
+int TlsSession::Read(char *buf, int len)
+{
+    errno = EIO;
+    return -1;
+}
+
+int TlsSession::Writev(const struct iovec *iov, int count)
+{
+    errno = EIO;
+    return -1;
+}
+
+bool TlsSession::Pending()
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <sys/uio.h>
+
+/*
+TLS支持
+    编译时需要make TLS=1(定义USE_TLS并链接OpenSSL),否则TlsContext::Init总是失败,连接保持明文
+    头文件不包含OpenSSL,未开启TLS时其余模块不依赖OpenSSL
+*/
+struct ssl_st;
+struct ssl_ctx_st;
+
+/*
+监听套接字的TLS配置
+    开启会话票据和服务端会话缓存,断线重连的客户端可以跳过完整握手
+    内核支持时开启kTLS,加密由内核完成,writev发送映射区时不需要先拷贝到用户态加密
+*/
+class TlsContext
+{
+public:
+    TlsContext();
+    ~TlsContext();
+
+    bool Init(const char *cert_file, const char *key_file);
+    ssl_ctx_st* Get() { return ctx_; }
+
+private:
+    ssl_ctx_st *ctx_;
+};
+
+/*
+单个连接的TLS状态
+    套接字是非阻塞的,Handshake/Read/Writev都不会阻塞,需要等待时返回并由调用者注册epoll事件
+    Read/Writev的返回值与recv/writev一致,需要等待时返回-1且errno为EAGAIN
+*/
+class TlsSession
+{
+public:
+    TlsSession(TlsContext *ctx, int sockfd);
+    ~TlsSession();
+
+    int Handshake();            //1:完成 0:需要等待(WantWrite()给出等待的事件) -1:失败
+    bool Established() { return established_; }
+    bool WantWrite() { return want_write_; }
+
+    int Read(char *buf, int len);
+    int Writev(const struct iovec *iov, int count);
+    bool Pending();             //SSL内部还有已解密但未读出的数据
+
+private:
+    ssl_st *ssl_;
+    int sockfd_;
+    bool established_;
+    bool want_write_;
+    bool ktls_send_;            //发送方向已由内核加密,直接writev
+};
+
+#endif
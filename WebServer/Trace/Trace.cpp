@@ -0,0 +1,225 @@
+#include "Trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+bool Trace::enabled_ = false;
+int64_t Trace::slow_ns_ = 0;
+char Trace::dir_[256];
+unsigned Trace::last_id_ = 0;
+__thread Trace::Ring *Trace::local_ = NULL;
+Trace::Ring *Trace::rings_ = NULL;
+
+#ifdef USE_TRACE
+
+static const char *SPAN_NAMES[TRACE_SPAN_NUMBER] = {
+    "queue",
+    "read",
+    "parse",
+    "do_request",
+    "respond",
+    "write",
+    "request",
+};
+
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+//慢请求的编号由工作线程记下,主线程写文件
+static pthread_mutex_t slow_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned slow_ids[TRACE_SLOW_PENDING];
+static int slow_count = 0;
+static int dump_count = 0;
+
+bool Trace::Enable(const char *dir, int slow_ms)
+{
+    if (strlen(dir) >= sizeof(dir_)) {
+        return false;
+    }
+    strcpy(dir_, dir);
+    slow_ns_ = (int64_t)slow_ms * 1000000;
+    enabled_ = true;
+    return true;
+}
+
+unsigned Trace::NewRequest()
+{
+    unsigned id = __sync_add_and_fetch(&last_id_, 1);
+    //编号回绕到0时跳过,0表示不追踪
+    return id ? id : __sync_add_and_fetch(&last_id_, 1);
+}
+
+//线程第一次记录时分配环并挂到全局链表,线程退出后不释放
+Trace::Ring* Trace::Local()
+{
+    if (!local_) {
+        Ring *ring = (Ring *)calloc(1, sizeof(Ring));
+        if (!ring) {
+            abort();
+        }
+        ring->tid = syscall(SYS_gettid);
+        pthread_mutex_lock(&rings_lock);
+        ring->next_ring = rings_;
+        rings_ = ring;
+        pthread_mutex_unlock(&rings_lock);
+        local_ = ring;
+    }
+    return local_;
+}
+
+void Trace::Span(unsigned id, int span, int64_t start, int64_t end)
+{
+    Ring *ring = Local();
+    unsigned n = ring->next++;
+    Event &ev = ring->events[n % TRACE_RING_SIZE];
+    ev.seq = 0;
+    __sync_synchronize();
+    ev.id = id;
+    ev.span = span;
+    ev.start = start;
+    ev.end = end;
+    __sync_synchronize();
+    ev.seq = n + 1;
+}
+
+void Trace::Finish(unsigned id, int64_t start, int64_t end)
+{
+    Span(id, TRACE_REQUEST, start, end);
+    if (end - start < slow_ns_) {
+        return;
+    }
+    pthread_mutex_lock(&slow_lock);
+    if (slow_count < TRACE_SLOW_PENDING) {
+        slow_ids[slow_count++] = id;
+    }
+    pthread_mutex_unlock(&slow_lock);
+}
+
+/*
+Collect()
+    ids不为NULL时只输出这些请求,否则输出编号大于min_id的请求
+    环可能正在被写,复制一条记录前后seq不一致就跳过
+*/
+int Trace::Collect(void *out, unsigned min_id, const unsigned *ids, int id_count, bool first)
+{
+    FILE *fp = (FILE *)out;
+    int count = 0;
+    int pid = getpid();
+    pthread_mutex_lock(&rings_lock);
+    for (Ring *ring = rings_; ring; ring = ring->next_ring) {
+        for (int i = 0; i < TRACE_RING_SIZE; i++) {
+            Event *slot = &ring->events[i];
+            unsigned seq = slot->seq;
+            __sync_synchronize();
+            Event ev = *slot;
+            __sync_synchronize();
+            if (seq == 0 || seq != slot->seq) {
+                continue;
+            }
+            bool match = false;
+            if (ids) {
+                for (int j = 0; j < id_count && !match; j++) {
+                    match = ev.id == ids[j];
+                }
+            }
+            else {
+                match = (int)(ev.id - min_id) > 0;
+            }
+            if (!match) {
+                continue;
+            }
+            fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"req\":%u}}",
+                    first && count == 0 ? "" : ",\n", SPAN_NAMES[ev.span], ev.start / 1000.0,
+                    (ev.end - ev.start) / 1000.0, pid, ring->tid, ev.id);
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&rings_lock);
+    return count;
+}
+
+/*
+FlushSlow()
+    trace_slow.json使用JSON数组格式,文件创建时写入"[",之后只追加以逗号开头的事件,不写结尾的"]"
+    Chrome和Perfetto都接受缺少结尾的数组,服务器运行中也可以直接打开
+*/
+void Trace::FlushSlow()
+{
+    unsigned ids[TRACE_SLOW_PENDING];
+    pthread_mutex_lock(&slow_lock);
+    int count = slow_count;
+    memcpy(ids, slow_ids, count * sizeof(unsigned));
+    slow_count = 0;
+    pthread_mutex_unlock(&slow_lock);
+    if (count == 0) {
+        return;
+    }
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/trace_slow.json", dir_);
+    FILE *fp = fopen(path, "a");
+    if (!fp) {
+        printf("open %s failure\n", path);
+        return;
+    }
+    fseek(fp, 0, SEEK_END);
+    bool first = ftell(fp) == 0;
+    if (first) {
+        fputs("[\n", fp);
+    }
+    Collect(fp, 0, ids, count, first);
+    fclose(fp);
+}
+
+bool Trace::DumpRecent()
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/trace_%d_%d.json", dir_, (int)getpid(), ++dump_count);
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        printf("open %s failure\n", path);
+        return false;
+    }
+    unsigned last = __sync_add_and_fetch(&last_id_, 0);
+    fputs("{\"traceEvents\":[\n", fp);
+    int count = Collect(fp, last - TRACE_DUMP_REQUESTS, NULL, 0, true);
+    fputs("\n]}\n", fp);
+    fclose(fp);
+    printf("trace: %d spans written to %s\n", count, path);
+    return true;
+}
+
+#else
+
+//未开启追踪时的空实现,HttpConn中的埋点已展开为空
+bool Trace::Enable(const char *dir, int slow_ms)
+{
+    printf("追踪未编译进服务器,请使用make TRACE=1重新编译\n");
+    return false;
+}
+
+unsigned Trace::NewRequest()
+{
+    return 0;
+}
+
+void Trace::Span(unsigned id, int span, int64_t start, int64_t end)
+{
+}
+
+void Trace::Finish(unsigned id, int64_t start, int64_t end)
+{
+}
+
+void Trace::FlushSlow()
+{
+}
+
+bool Trace::DumpRecent()
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <time.h>
+
+const int TRACE_RING_SIZE = 8192;       //每个线程保留最近的span数
+const int TRACE_SLOW_PENDING = 64;      //等待写入的慢请求数上限,超出的丢弃
+const int TRACE_DUMP_REQUESTS = 1024;   //SIGUSR1导出最近这么多个请求
+
+//请求的各个阶段,与Trace.cpp中的名字表顺序一致
+enum TRACE_SPAN
+{
+    TRACE_QUEUE = 0,    //在线程池队列中等待
+    TRACE_READ,         //ReadOnce
+    TRACE_PARSE,        //ProcessRead,包含DoRequest
+    TRACE_DO_REQUEST,   //路由处理函数或stat/open/mmap
+    TRACE_RESPOND,      //ProcessWrite生成响应头
+    TRACE_WRITE,        //Write发送响应
+    TRACE_REQUEST,      //从主线程收到第一个字节到响应发完或连接关闭
+    TRACE_SPAN_NUMBER
+};
+
+/*
+请求追踪
+    make TRACE=1时编译(定义USE_TRACE),默认编译下HttpConn和线程池中的埋点全部展开为空
+    EnableTrace之后每个HTTP/1请求分配一个编号,各阶段的span记入所在线程的环形缓冲区,不加锁
+    总耗时超过阈值的请求在下一次周期性工作时由主线程追加到slow文件;收到SIGUSR1时导出最近的请求
+    输出Chrome trace-event JSON,可直接用chrome://tracing或Perfetto打开
+    HTTP/2和WebSocket会话上的请求不追踪
+*/
+class Trace
+{
+public:
+    //dir为输出目录,slow_ms为慢请求阈值(毫秒)
+    static bool Enable(const char *dir, int slow_ms);
+    static bool Enabled() { return enabled_; }
+
+    static unsigned NewRequest();
+    static void Span(unsigned id, int span, int64_t start, int64_t end);
+    //请求结束,总耗时超过阈值时记下编号
+    static void Finish(unsigned id, int64_t start, int64_t end);
+
+    //主线程调用:把记下的慢请求写入trace_slow.json
+    static void FlushSlow();
+    //主线程调用:把最近TRACE_DUMP_REQUESTS个请求写入新的trace_<pid>_<序号>.json
+    static bool DumpRecent();
+
+    static int64_t Now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+private:
+    /*
+    环中的一条记录
+        只有所属线程写:先把seq清零,写完各字段后再设为序号加一,读取前后seq一致才算有效
+    */
+    struct Event
+    {
+        volatile unsigned seq;
+        unsigned id;
+        int span;
+        int64_t start;
+        int64_t end;
+    };
+
+    struct Ring
+    {
+        Event events[TRACE_RING_SIZE];
+        unsigned next;
+        int tid;
+        Ring *next_ring;
+    };
+
+    static Ring* Local();
+    //把所有线程中满足条件的记录以逗号分隔写到fp,返回写出的条数
+    static int Collect(void *fp, unsigned min_id, const unsigned *ids, int id_count, bool first);
+
+private:
+    static bool enabled_;
+    static int64_t slow_ns_;
+    static char dir_[256];
+    static unsigned last_id_;
+    static __thread Ring *local_;
+    static Ring *rings_;            //所有线程的环,受Trace.cpp中的锁保护
+};
+
+#ifdef USE_TRACE
+//作用域内的代码记为一个span,id为0(未开启或不追踪的请求)时不记录
+class TraceScope
+{
+public:
+    TraceScope(unsigned id, int span) : id_(id), span_(span), start_(id ? Trace::Now() : 0) {}
+    ~TraceScope()
+    {
+        if (id_) {
+            Trace::Span(id_, span_, start_, Trace::Now());
+        }
+    }
+
+private:
+    unsigned id_;
+    int span_;
+    int64_t start_;
+};
+
+#define TRACE_SCOPE(id, span) TraceScope trace_scope_(id, span)
+#else
+#define TRACE_SCOPE(id, span)
+#endif
+
+#endif
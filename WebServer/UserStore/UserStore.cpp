@@ -0,0 +1,245 @@
+#include "UserStore.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/random.h>
+
+UserStore::UserStore() : log_lock_("userstore_log"), log_fd_(-1)
+{
+}
+
+UserStore::~UserStore()
+{
+    if (log_fd_ != -1) {
+        close(log_fd_);
+    }
+}
+
+UserStore::Shard& UserStore::GetShard(const std::string &user)
+{
+    return shards_[hasher_(user) % USER_SHARD_NUMBER];
+}
+
+//用户名写进日志行,不允许为空,过长或含有空白和控制字符
+bool UserStore::ValidName(const char *user)
+{
+    int len = strlen(user);
+    if (len == 0 || len > MAX_USER_NAME) {
+        return false;
+    }
+    for (int i = 0; i < len; i++) {
+        if ((unsigned char)user[i] <= ' ' || user[i] == 0x7f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void ToHex(const unsigned char *data, int len, char *out)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < len; i++) {
+        out[i * 2] = digits[data[i] >> 4];
+        out[i * 2 + 1] = digits[data[i] & 0xf];
+    }
+    out[len * 2] = '\0';
+}
+
+static bool FromHex(const char *text, unsigned char *out, int len)
+{
+    for (int i = 0; i < len; i++) {
+        unsigned int byte;
+        if (sscanf(text + i * 2, "%2x", &byte) != 1) {
+            return false;
+        }
+        out[i] = (unsigned char)byte;
+    }
+    return true;
+}
+
+/*
+Open()
+    回放日志重建内存表,随后立即压缩成快照,再以O_APPEND打开供注册时追加
+    日志每行格式为 "R 用户名 盐值hex 哈希hex"
+*/
+bool UserStore::Open(const char *path)
+{
+    path_ = path;
+    if (!Load(path)) {
+        return false;
+    }
+    return Snapshot();
+}
+
+bool UserStore::Load(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        //日志不存在视为空表
+        return errno == ENOENT;
+    }
+    char line[512];
+    char user[MAX_USER_NAME + 1];
+    char salt[SALT_SIZE * 2 + 1];
+    char hash[Sha256::DIGEST_SIZE * 2 + 1];
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "R %64s %32s %64s", user, salt, hash) != 3) {
+            continue;
+        }
+        UserRecord record;
+        if (!FromHex(salt, record.salt, SALT_SIZE) || !FromHex(hash, record.hash, Sha256::DIGEST_SIZE)) {
+            continue;
+        }
+        //重复记录以后出现的为准
+        GetShard(user).users[user] = record;
+    }
+    fclose(fp);
+    return true;
+}
+
+bool UserStore::AppendLog(const std::string &user, const UserRecord &record)
+{
+    char salt[SALT_SIZE * 2 + 1];
+    char hash[Sha256::DIGEST_SIZE * 2 + 1];
+    char line[512];
+    ToHex(record.salt, SALT_SIZE, salt);
+    ToHex(record.hash, Sha256::DIGEST_SIZE, hash);
+    int len = snprintf(line, sizeof(line), "R %s %s %s\n", user.c_str(), salt, hash);
+
+    //一次write写入整行,O_APPEND保证多个线程的记录不会交错
+    log_lock_.Lock();
+    bool ret = log_fd_ != -1 && write(log_fd_, line, len) == len;
+    log_lock_.UnLock();
+    return ret;
+}
+
+/*
+Snapshot()
+    持有log_lock_期间新注册的用户会等待,快照写完后再追加到新日志
+    先写临时文件再rename,中途失败不会破坏原有日志
+*/
+bool UserStore::Snapshot()
+{
+    std::string tmp = path_ + ".tmp";
+    log_lock_.Lock();
+    FILE *fp = fopen(tmp.c_str(), "w");
+    if (fp == NULL) {
+        log_lock_.UnLock();
+        return false;
+    }
+
+    char salt[SALT_SIZE * 2 + 1];
+    char hash[Sha256::DIGEST_SIZE * 2 + 1];
+    for (int i = 0; i < USER_SHARD_NUMBER; i++) {
+        shards_[i].lock.Lock();
+        std::unordered_map<std::string, UserRecord>::iterator it;
+        for (it = shards_[i].users.begin(); it != shards_[i].users.end(); ++it) {
+            ToHex(it->second.salt, SALT_SIZE, salt);
+            ToHex(it->second.hash, Sha256::DIGEST_SIZE, hash);
+            fprintf(fp, "R %s %s %s\n", it->first.c_str(), salt, hash);
+        }
+        shards_[i].lock.UnLock();
+    }
+
+    bool ret = fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    fclose(fp);
+    if (ret) {
+        ret = rename(tmp.c_str(), path_.c_str()) == 0;
+    }
+    if (log_fd_ != -1) {
+        close(log_fd_);
+    }
+    log_fd_ = open(path_.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0600);
+    log_lock_.UnLock();
+    return ret && log_fd_ != -1;
+}
+
+/*
+Register()
+    先在分片锁内确认用户不存在,锁外生成盐值并计算慢哈希
+    插入前再检查一次,两个线程同时注册同名用户时只有一个成功
+*/
+UserStore::RESULT UserStore::Register(const char *user, const char *password)
+{
+    if (user == NULL || password == NULL || !ValidName(user) || password[0] == '\0') {
+        return USER_INVALID;
+    }
+    std::string name(user);
+    Shard &shard = GetShard(name);
+
+    shard.lock.Lock();
+    bool exists = shard.users.count(name) != 0;
+    shard.lock.UnLock();
+    if (exists) {
+        return USER_EXISTS;
+    }
+
+    UserRecord record;
+    if (getrandom(record.salt, SALT_SIZE, 0) != SALT_SIZE) {
+        return USER_IO_ERROR;
+    }
+    Pbkdf2Sha256(password, strlen(password), record.salt, SALT_SIZE,
+                 PASSWORD_ITERATIONS, record.hash, Sha256::DIGEST_SIZE);
+
+    shard.lock.Lock();
+    if (!shard.users.insert(std::make_pair(name, record)).second) {
+        shard.lock.UnLock();
+        return USER_EXISTS;
+    }
+    shard.lock.UnLock();
+
+    if (!AppendLog(name, record)) {
+        return USER_IO_ERROR;
+    }
+    return USER_OK;
+}
+
+/*
+Login()
+    锁内只拷贝出口令记录,慢哈希在锁外计算
+    用户不存在时同样对固定的盐值和哈希算一次慢哈希,耗时与口令错误相同,不能靠响应时间探测用户名
+*/
+UserStore::RESULT UserStore::Login(const char *user, const char *password)
+{
+    if (user == NULL || password == NULL || !ValidName(user)) {
+        return USER_INVALID;
+    }
+    std::string name(user);
+    Shard &shard = GetShard(name);
+
+    static const UserRecord dummy = {};
+    UserRecord record = dummy;
+    shard.lock.Lock();
+    std::unordered_map<std::string, UserRecord>::iterator it = shard.users.find(name);
+    bool found = it != shard.users.end();
+    if (found) {
+        record = it->second;
+    }
+    shard.lock.UnLock();
+
+    unsigned char hash[Sha256::DIGEST_SIZE];
+    Pbkdf2Sha256(password, strlen(password), record.salt, SALT_SIZE,
+                 PASSWORD_ITERATIONS, hash, Sha256::DIGEST_SIZE);
+    bool match = ConstantTimeEqual(hash, record.hash, Sha256::DIGEST_SIZE);
+    if (!found) {
+        return USER_NOT_FOUND;
+    }
+    if (!match) {
+        return USER_BAD_PASSWORD;
+    }
+    return USER_OK;
+}
+
+int UserStore::Size()
+{
+    int size = 0;
+    for (int i = 0; i < USER_SHARD_NUMBER; i++) {
+        shards_[i].lock.Lock();
+        size += shards_[i].users.size();
+        shards_[i].lock.UnLock();
+    }
+    return size;
+}
@@ -0,0 +1,75 @@
+#ifndef USER_STORE_H
+#define USER_STORE_H
+
+#include <string>
+#include <unordered_map>
+
+#include "../ThreadPool/Locker.h"
+#include "../Utils/Hash.h"
+
+const int USER_SHARD_NUMBER = 64;       //分片数量,每个分片一把锁
+const int PASSWORD_ITERATIONS = 10000;  //PBKDF2迭代次数
+const int SALT_SIZE = 16;
+const int MAX_USER_NAME = 64;
+
+//一个用户的口令记录,只保存盐值和慢哈希结果
+struct UserRecord
+{
+    unsigned char salt[SALT_SIZE];
+    unsigned char hash[Sha256::DIGEST_SIZE];
+};
+
+/*
+内存用户表
+    按用户名哈希分成USER_SHARD_NUMBER个分片,锁分段,不同分片的注册/登录互不阻塞
+    口令慢哈希在锁外计算,锁内只做查找和插入
+    新注册的用户以追加写的方式记录到日志文件,启动时回放日志并压缩成快照
+    所有接口都在工作线程中调用,主线程不会执行慢哈希
+*/
+class UserStore
+{
+public:
+    enum RESULT
+    {
+        USER_OK = 0,
+        USER_EXISTS,        //注册时用户已存在
+        USER_NOT_FOUND,     //登录时用户不存在
+        USER_BAD_PASSWORD,  //口令错误
+        USER_INVALID,       //用户名或口令不合法
+        USER_IO_ERROR       //写日志失败
+    };
+
+public:
+    UserStore();
+    ~UserStore();
+
+    bool Open(const char *path);    //回放日志并打开追加写
+    RESULT Register(const char *user, const char *password);
+    RESULT Login(const char *user, const char *password);
+    bool Snapshot();                //把当前全部用户重写成新日志,去掉重复记录
+    int Size();
+    bool Opened() { return log_fd_ >= 0; }
+
+private:
+    struct Shard
+    {
+        Shard() : lock("userstore_shard") {}
+
+        Locker lock;
+        std::unordered_map<std::string, UserRecord> users;
+    };
+
+    Shard& GetShard(const std::string &user);
+    bool Load(const char *path);
+    bool AppendLog(const std::string &user, const UserRecord &record);
+    static bool ValidName(const char *user);
+
+private:
+    Shard shards_[USER_SHARD_NUMBER];
+    std::hash<std::string> hasher_;
+    Locker log_lock_;       //保护log_fd_,保证每条日志整行写入
+    int log_fd_;
+    std::string path_;
+};
+
+#endif
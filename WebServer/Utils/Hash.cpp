@@ -0,0 +1,331 @@
+#include "Hash.h"
+
+#include <string.h>
+
+static const uint32_t K256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t Rotr(uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+void Sha256::Reset()
+{
+    state_[0] = 0x6a09e667;
+    state_[1] = 0xbb67ae85;
+    state_[2] = 0x3c6ef372;
+    state_[3] = 0xa54ff53a;
+    state_[4] = 0x510e527f;
+    state_[5] = 0x9b05688c;
+    state_[6] = 0x1f83d9ab;
+    state_[7] = 0x5be0cd19;
+    length_ = 0;
+    buf_len_ = 0;
+}
+
+void Sha256::Transform(const unsigned char *block)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+    uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t s1 = Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + K256[i] + w[i];
+        uint32_t s0 = Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state_[0] += a;
+    state_[1] += b;
+    state_[2] += c;
+    state_[3] += d;
+    state_[4] += e;
+    state_[5] += f;
+    state_[6] += g;
+    state_[7] += h;
+}
+
+void Sha256::Update(const void *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    length_ += len;
+    //先补齐缓存中的分组
+    if (buf_len_ > 0) {
+        size_t n = BLOCK_SIZE - buf_len_;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(buf_ + buf_len_, p, n);
+        buf_len_ += n;
+        p += n;
+        len -= n;
+        if (buf_len_ < (size_t)BLOCK_SIZE) {
+            return;
+        }
+        Transform(buf_);
+        buf_len_ = 0;
+    }
+    //整块数据直接处理,不经过缓存
+    while (len >= (size_t)BLOCK_SIZE) {
+        Transform(p);
+        p += BLOCK_SIZE;
+        len -= BLOCK_SIZE;
+    }
+    memcpy(buf_, p, len);
+    buf_len_ = len;
+}
+
+void Sha256::Final(unsigned char digest[DIGEST_SIZE])
+{
+    uint64_t bits = length_ * 8;
+    //填充0x80,再补0直到剩余8字节存放消息长度
+    buf_[buf_len_++] = 0x80;
+    if (buf_len_ > 56) {
+        memset(buf_ + buf_len_, 0, BLOCK_SIZE - buf_len_);
+        Transform(buf_);
+        buf_len_ = 0;
+    }
+    memset(buf_ + buf_len_, 0, 56 - buf_len_);
+    for (int i = 0; i < 8; i++) {
+        buf_[56 + i] = (unsigned char)(bits >> (56 - i * 8));
+    }
+    Transform(buf_);
+
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = (unsigned char)(state_[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(state_[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(state_[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)state_[i];
+    }
+    Reset();
+}
+
+void Sha256::Hash(const void *data, size_t len, unsigned char digest[DIGEST_SIZE])
+{
+    Sha256 ctx;
+    ctx.Update(data, len);
+    ctx.Final(digest);
+}
+
+/*
+HmacInit()
+    预先计算好内外两层填充密钥后的上下文,PBKDF2每轮迭代直接拷贝,不必重复处理密钥
+*/
+static void HmacInit(const void *key, size_t key_len, Sha256 *inner, Sha256 *outer)
+{
+    unsigned char k[Sha256::BLOCK_SIZE];
+    unsigned char pad[Sha256::BLOCK_SIZE];
+    memset(k, 0, sizeof(k));
+    if (key_len > (size_t)Sha256::BLOCK_SIZE) {
+        Sha256::Hash(key, key_len, k);
+    }
+    else {
+        memcpy(k, key, key_len);
+    }
+
+    for (int i = 0; i < Sha256::BLOCK_SIZE; i++) {
+        pad[i] = k[i] ^ 0x36;
+    }
+    inner->Reset();
+    inner->Update(pad, sizeof(pad));
+    for (int i = 0; i < Sha256::BLOCK_SIZE; i++) {
+        pad[i] = k[i] ^ 0x5c;
+    }
+    outer->Reset();
+    outer->Update(pad, sizeof(pad));
+}
+
+static void HmacFinal(Sha256 inner, Sha256 outer, const void *data, size_t len, unsigned char out[Sha256::DIGEST_SIZE])
+{
+    unsigned char digest[Sha256::DIGEST_SIZE];
+    inner.Update(data, len);
+    inner.Final(digest);
+    outer.Update(digest, sizeof(digest));
+    outer.Final(out);
+}
+
+void HmacSha256(const void *key, size_t key_len, const void *data, size_t len, unsigned char out[Sha256::DIGEST_SIZE])
+{
+    Sha256 inner, outer;
+    HmacInit(key, key_len, &inner, &outer);
+    HmacFinal(inner, outer, data, len, out);
+}
+
+void Pbkdf2Sha256(const void *password, size_t password_len, const void *salt, size_t salt_len,
+                  int iterations, unsigned char *out, size_t out_len)
+{
+    Sha256 inner, outer;
+    HmacInit(password, password_len, &inner, &outer);
+
+    unsigned char u[Sha256::DIGEST_SIZE];
+    unsigned char t[Sha256::DIGEST_SIZE];
+    for (uint32_t block = 1; out_len > 0; block++) {
+        //U1 = HMAC(P, S || INT(block))
+        unsigned char counter[4] = {
+            (unsigned char)(block >> 24), (unsigned char)(block >> 16),
+            (unsigned char)(block >> 8), (unsigned char)block
+        };
+        Sha256 first = inner;
+        first.Update(salt, salt_len);
+        HmacFinal(first, outer, counter, sizeof(counter), u);
+        memcpy(t, u, sizeof(t));
+
+        //Ui = HMAC(P, Ui-1),结果逐轮异或
+        for (int i = 1; i < iterations; i++) {
+            HmacFinal(inner, outer, u, sizeof(u), u);
+            for (int j = 0; j < Sha256::DIGEST_SIZE; j++) {
+                t[j] ^= u[j];
+            }
+        }
+
+        size_t n = out_len < sizeof(t) ? out_len : sizeof(t);
+        memcpy(out, t, n);
+        out += n;
+        out_len -= n;
+    }
+}
+
+bool ConstantTimeEqual(const unsigned char *a, const unsigned char *b, size_t len)
+{
+    unsigned char diff = 0;
+    for (size_t i = 0; i < len; i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+static inline uint32_t Rotl(uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+static void Sha1Transform(uint32_t state[5], const unsigned char *block)
+{
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; i++) {
+        w[i] = Rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        }
+        else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        }
+        else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        }
+        else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        uint32_t t = Rotl(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = Rotl(b, 30);
+        b = a;
+        a = t;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+void Sha1(const void *data, size_t len, unsigned char digest[SHA1_DIGEST_SIZE])
+{
+    uint32_t state[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t bits = (uint64_t)len * 8;
+    while (len >= 64) {
+        Sha1Transform(state, p);
+        p += 64;
+        len -= 64;
+    }
+
+    //最后不满一个分组的数据加上填充和长度,可能占一到两个分组
+    unsigned char block[128];
+    memset(block, 0, sizeof(block));
+    memcpy(block, p, len);
+    block[len] = 0x80;
+    size_t total = len + 1 + 8 > 64 ? 128 : 64;
+    for (int i = 0; i < 8; i++) {
+        block[total - 1 - i] = (unsigned char)(bits >> (i * 8));
+    }
+    Sha1Transform(state, block);
+    if (total == 128) {
+        Sha1Transform(state, block + 64);
+    }
+
+    for (int i = 0; i < 5; i++) {
+        digest[i * 4] = (unsigned char)(state[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(state[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(state[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)state[i];
+    }
+}
+
+int Base64Encode(const unsigned char *data, size_t len, char *out)
+{
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char *p = out;
+    size_t i = 0;
+    for (; i + 3 <= len; i += 3) {
+        uint32_t v = ((uint32_t)data[i] << 16) | ((uint32_t)data[i + 1] << 8) | data[i + 2];
+        *p++ = table[(v >> 18) & 0x3f];
+        *p++ = table[(v >> 12) & 0x3f];
+        *p++ = table[(v >> 6) & 0x3f];
+        *p++ = table[v & 0x3f];
+    }
+    if (i < len) {
+        uint32_t v = (uint32_t)data[i] << 16;
+        if (i + 1 < len) {
+            v |= (uint32_t)data[i + 1] << 8;
+        }
+        *p++ = table[(v >> 18) & 0x3f];
+        *p++ = table[(v >> 12) & 0x3f];
+        *p++ = i + 1 < len ? table[(v >> 6) & 0x3f] : '=';
+        *p++ = '=';
+    }
+    *p = '\0';
+    return p - out;
+}
@@ -0,0 +1,52 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+SHA-256
+    用于口令哈希,增量计算:Update()可多次调用,最后Final()取摘要
+*/
+class Sha256
+{
+public:
+    static const int DIGEST_SIZE = 32;
+    static const int BLOCK_SIZE = 64;
+
+    Sha256() { Reset(); }
+
+    void Reset();
+    void Update(const void *data, size_t len);
+    void Final(unsigned char digest[DIGEST_SIZE]);
+
+    static void Hash(const void *data, size_t len, unsigned char digest[DIGEST_SIZE]);
+
+private:
+    void Transform(const unsigned char *block);
+
+private:
+    uint32_t state_[8];
+    uint64_t length_;                   //已处理的字节数
+    unsigned char buf_[BLOCK_SIZE];     //未满一个分组的数据
+    size_t buf_len_;
+};
+
+//HMAC-SHA256
+void HmacSha256(const void *key, size_t key_len, const void *data, size_t len, unsigned char out[Sha256::DIGEST_SIZE]);
+
+//PBKDF2-HMAC-SHA256慢哈希,iterations越大越慢
+void Pbkdf2Sha256(const void *password, size_t password_len, const void *salt, size_t salt_len,
+                  int iterations, unsigned char *out, size_t out_len);
+
+//SHA-1,只用于WebSocket握手计算Sec-WebSocket-Accept,不要用于口令
+const int SHA1_DIGEST_SIZE = 20;
+void Sha1(const void *data, size_t len, unsigned char digest[SHA1_DIGEST_SIZE]);
+
+//标准base64编码(带'='填充),out至少(len + 2) / 3 * 4 + 1字节,返回编码长度
+int Base64Encode(const unsigned char *data, size_t len, char *out);
+
+//常数时间比较,避免通过比较耗时猜测哈希值
+bool ConstantTimeEqual(const unsigned char *a, const unsigned char *b, size_t len);
+
+#endif
@@ -1,7 +1,26 @@
 #include "Utils.h"
 
-int* Utils::pipefd_ = nullptr;
+#include <stddef.h>
+#include <netdb.h>
+#include <sys/un.h>
+#include <string>
+
 int Utils::epollfd_ = -1;
+volatile int64_t Clock::now_ = 0;
+
+int64_t Clock::Read()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int64_t Clock::ReadUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
 /*
 SetNonBlocking()
@@ -55,26 +74,82 @@ void Utils::ModFd(int epollfd, int fd, int ev) {
 }
 
 
-/*SigHandler(int sig)
-    设置信号处理函数,统一信号源
-    只向本地管道发送信号值,信号处理在事件循环中
-*/
-void Utils::SigHandler(int sig) {
-    //为保证函数的可重入性，保留原来的errno
-    int save_errno = errno;
-    int msg = sig;
-    send(Utils::pipefd_[1], (char *)&msg, 1, 0);
-    errno = save_errno;
-}
-
 /*
 AddSig(int sig, void(handler)(int))
     向内核注册信号及其信号处理函数
 */
 void Utils::AddSig(int sig, void(handler)(int)) {
     struct sigaction sa;
-    bzero(&sa, sizeof(sig));
+    bzero(&sa, sizeof(sa));
     sa.sa_handler = handler;
     sigfillset(&sa.sa_mask);
     assert(sigaction(sig, &sa, NULL) != -1);
 }
+
+bool Utils::ParseAddress(const char *spec, struct sockaddr_storage *addr, socklen_t *len)
+{
+    memset(addr, 0, sizeof(*addr));
+    if (strncmp(spec, "unix:", 5) == 0) {
+        struct sockaddr_un *un = (struct sockaddr_un *)addr;
+        const char *path = spec + 5;
+        size_t path_len = strlen(path);
+        if (path_len == 0 || path_len >= sizeof(un->sun_path)) {
+            return false;
+        }
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, path, path_len + 1);
+        *len = offsetof(struct sockaddr_un, sun_path) + path_len + 1;
+        return true;
+    }
+
+    //IPv6地址写成[::1]:8000
+    const char *colon = strrchr(spec, ':');
+    if (!colon || colon == spec) {
+        return false;
+    }
+    std::string host(spec, colon - spec);
+    if (host.size() > 2 && host[0] == '[' && host[host.size() - 1] == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), colon + 1, &hints, &res) != 0) {
+        return false;
+    }
+    memcpy(addr, res->ai_addr, res->ai_addrlen);
+    *len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+const char* Utils::AddressText(const struct sockaddr_storage &addr, char *buf, int size)
+{
+    if (addr.ss_family == AF_INET) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)&addr;
+        return inet_ntop(AF_INET, &in->sin_addr, buf, size);
+    }
+    if (addr.ss_family == AF_INET6) {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)&addr;
+        if (IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)) {
+            return inet_ntop(AF_INET, in6->sin6_addr.s6_addr + 12, buf, size);
+        }
+        return inet_ntop(AF_INET6, &in6->sin6_addr, buf, size);
+    }
+    snprintf(buf, size, "unknown");
+    return buf;
+}
+
+/*
+Reject()
+    先读掉已到达的请求,否则带着未读数据关闭会发RST,客户端可能收不到响应
+    套接字是非阻塞的,发送缓冲区刚建立或已空,一次send就能发完
+*/
+void Utils::Reject(int sockfd, const char *response, int len)
+{
+    char buf[4096];
+    for (int i = 0; i < 16 && recv(sockfd, buf, sizeof(buf), MSG_DONTWAIT) > 0; i++) {
+    }
+    send(sockfd, response, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
@@ -20,6 +20,8 @@
 #include <errno.h>
 #include <sys/wait.h>
 #include <sys/uio.h>
+#include <stdint.h>
+#include <time.h>
 #include <map>
 
 class Utils
@@ -31,9 +33,6 @@ public:
     //设置非阻塞函数
     int SetNonBlocking(int fd);
     
-    //信号处理函数,统一信号源
-    static void SigHandler(int sig);
-
     //设置信号函数
     void AddSig(int sig, void(handler)(int));
 
@@ -44,9 +43,33 @@ public:
 
     void ModFd(int epollfd, int fd, int ev);
 
+    //解析"host:port"、"[::1]:8000"或"unix:/path"形式的地址,host可以是主机名
+    static bool ParseAddress(const char *spec, struct sockaddr_storage *addr, socklen_t *len);
+    //客户端地址转成文本,IPv4映射的IPv6地址按IPv4输出;Unix套接字上的客户端没有地址,输出"unknown"
+    static const char* AddressText(const struct sockaddr_storage &addr, char *buf, int size);
+    //读掉已到达的请求后发送一段固定的明文响应(429、503等),由调用者关闭连接
+    static void Reject(int sockfd, const char *response, int len);
+
 public:
-    static int *pipefd_;    //信号的管道
     static int epollfd_;    //epoll文件描述符
 };
 
+/*
+单调时钟,单位毫秒
+    主线程每轮事件循环Update()一次,定时器相关代码读缓存的Now(),不再每个事件取一次时间
+    主线程可能长时间阻塞在epoll_wait中,工作线程用Read()直接读取;粗粒度时钟走vDSO,不陷入内核
+*/
+class Clock
+{
+public:
+    static int64_t Read();
+    static int64_t Update() { now_ = Read(); return now_; }
+    static int64_t Now() { return now_; }
+    //精确时钟,单位微秒,用于测量排队时间
+    static int64_t ReadUs();
+
+private:
+    static volatile int64_t now_;
+};
+
 #endif
\ No newline at end of file
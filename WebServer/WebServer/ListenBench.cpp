@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <netinet/tcp.h>
+#include <string>
+
+#include "WebServer.h"
+#include "../Router/Router.h"
+
+/*
+监听选项基准
+    ./listen_bench [port] [requests]
+    子进程启动一个服务器,从port开始每个端口一种ListenOptions组合,父进程作为客户端依次测量:
+        small:  长连接上顺序请求200字节的定长响应
+        stream: 长连接上顺序请求20个600字节chunk的分块响应,多次写出,cork和nodelay的差别在这里
+        connect:每个请求新建连接,defer-accept和fastopen的差别在这里;fastopen端口用TCP_FASTOPEN_CONNECT连接
+    每项给出平均微秒数和每个请求的TCP报文段数(/proc/net/snmp中OutSegs的增量,回环上包含两端)
+    客户端始终开启TCP_NODELAY,差别只来自服务器一侧的选项
+    syn_data为SYN携带了请求的连接数,需要net.ipv4.tcp_fastopen同时开启客户端(1)和服务端(2)
+*/
+
+static const int STREAM_CHUNKS = 20;
+static const int STREAM_CHUNK_SIZE = 600;
+static const int SMALL_SIZE = 200;
+
+struct BenchConfig
+{
+    const char *name;
+    ListenOptions options;
+};
+
+static bool StreamProducer(HttpConn *conn, void *arg)
+{
+    int *sent = (int *)arg;
+    if (!conn) {
+        delete sent;
+        return false;
+    }
+    //每次只产生一个chunk,使响应分成多次写出
+    static char chunk[STREAM_CHUNK_SIZE];
+    memset(chunk, 'x', sizeof(chunk));
+    if (*sent < STREAM_CHUNKS && conn->AddChunk(chunk, sizeof(chunk))) {
+        (*sent)++;
+    }
+    if (*sent < STREAM_CHUNKS) {
+        return true;
+    }
+    delete sent;
+    return false;
+}
+
+static HttpConn::HTTP_CODE StreamHandler(HttpRequest &req, HttpResponse &resp, void *arg)
+{
+    return resp.Stream(StreamProducer, new int(0));
+}
+
+static HttpConn::HTTP_CODE SmallHandler(HttpRequest &req, HttpResponse &resp, void *arg)
+{
+    char body[SMALL_SIZE];
+    memset(body, 'x', sizeof(body));
+    resp.Append(body, sizeof(body));
+    return resp.Send();
+}
+
+static void RunServer(int port, const BenchConfig *configs, int count)
+{
+    //请求处理中的调试输出不计入测量
+    if (!freopen("/dev/null", "w", stdout)) {
+        exit(1);
+    }
+    WebServer server(port, 4);
+    server.SetListenOptions(configs[0].options);
+    for (int i = 1; i < count; i++) {
+        char spec[32];
+        snprintf(spec, sizeof(spec), "127.0.0.1:%d", port + i);
+        server.AddListener(spec, configs[i].options);
+    }
+    server.AddRoute(HttpConn::GET, "/small", SmallHandler);
+    server.AddRoute(HttpConn::GET, "/stream", StreamHandler);
+    server.CreateThreadPool();
+    server.ListenEvents();
+    server.LoopEvents();
+    exit(0);
+}
+
+//回环上两端发出的报文段总数
+static long OutSegs()
+{
+    FILE *fp = fopen("/proc/net/snmp", "r");
+    if (!fp) {
+        return 0;
+    }
+    char names[1024], values[1024];
+    long segs = 0;
+    while (fgets(names, sizeof(names), fp) && fgets(values, sizeof(values), fp)) {
+        if (strncmp(names, "Tcp:", 4) != 0) {
+            continue;
+        }
+        char *name_save, *value_save;
+        char *name = strtok_r(names, " \n", &name_save);
+        char *value = strtok_r(values, " \n", &value_save);
+        while (name && value) {
+            if (strcmp(name, "OutSegs") == 0) {
+                segs = atol(value);
+            }
+            name = strtok_r(NULL, " \n", &name_save);
+            value = strtok_r(NULL, " \n", &value_save);
+        }
+        break;
+    }
+    fclose(fp);
+    return segs;
+}
+
+static int Connect(int port, bool fastopen)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    //connect立即返回,请求随SYN发出
+    if (fastopen) {
+        setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof(on));
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//发送请求并读完一个响应,定长响应按Content-Length,分块响应到结束块为止
+static bool Exchange(int fd, const char *path, bool keep_alive)
+{
+    char request[256];
+    int len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: bench\r\n%s\r\n",
+                       path, keep_alive ? "Connection: keep-alive\r\n" : "");
+    if (send(fd, request, len, MSG_NOSIGNAL) != len) {
+        return false;
+    }
+    std::string buf;
+    size_t head_end = std::string::npos;
+    long body_len = -1;
+    bool chunked = false;
+    char tmp[16384];
+    while (true) {
+        if (head_end == std::string::npos && (head_end = buf.find("\r\n\r\n")) != std::string::npos) {
+            std::string head = buf.substr(0, head_end);
+            size_t pos = head.find("Content-Length:");
+            if (pos != std::string::npos) {
+                body_len = atol(head.c_str() + pos + 15);
+            }
+            chunked = head.find("Transfer-Encoding:chunked") != std::string::npos;
+        }
+        if (head_end != std::string::npos) {
+            if (chunked && buf.size() >= head_end + 9 && buf.compare(buf.size() - 5, 5, "0\r\n\r\n") == 0) {
+                return true;
+            }
+            if (!chunked && body_len >= 0 && buf.size() >= head_end + 4 + body_len) {
+                return true;
+            }
+        }
+        ssize_t n = recv(fd, tmp, sizeof(tmp), 0);
+        if (n <= 0) {
+            return false;
+        }
+        buf.append(tmp, n);
+    }
+}
+
+struct Result
+{
+    double us;
+    double segs;
+    bool ok;
+};
+
+static Result KeepAlive(int port, const char *path, int requests)
+{
+    Result result = {0, 0, false};
+    int fd = Connect(port, false);
+    if (fd < 0) {
+        return result;
+    }
+    //第一个请求不计入,排除建立连接和慢启动
+    if (!Exchange(fd, path, true)) {
+        close(fd);
+        return result;
+    }
+    long segs = OutSegs();
+    int64_t start = Clock::ReadUs();
+    for (int i = 0; i < requests; i++) {
+        if (!Exchange(fd, path, true)) {
+            close(fd);
+            return result;
+        }
+    }
+    result.us = (double)(Clock::ReadUs() - start) / requests;
+    result.segs = (double)(OutSegs() - segs) / requests;
+    result.ok = true;
+    close(fd);
+    return result;
+}
+
+static Result NewConnection(int port, bool fastopen, int requests, int *syn_data)
+{
+    Result result = {0, 0, false};
+    long segs = OutSegs();
+    int64_t start = Clock::ReadUs();
+    for (int i = 0; i < requests; i++) {
+        int fd = Connect(port, fastopen);
+        if (fd < 0 || !Exchange(fd, "/small", false)) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return result;
+        }
+        struct tcp_info info;
+        socklen_t len = sizeof(info);
+        if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 && (info.tcpi_options & TCPI_OPT_SYN_DATA)) {
+            (*syn_data)++;
+        }
+        close(fd);
+    }
+    result.us = (double)(Clock::ReadUs() - start) / requests;
+    result.segs = (double)(OutSegs() - segs) / requests;
+    result.ok = true;
+    return result;
+}
+
+static void PrintResult(const Result &result)
+{
+    if (result.ok) {
+        printf(" %9.1f %5.1f", result.us, result.segs);
+    }
+    else {
+        printf(" %9s %5s", "failed", "-");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int port = argc > 1 ? atoi(argv[1]) : 9100;
+    int requests = argc > 2 ? atoi(argv[2]) : 1000;
+    if (port <= 0 || requests <= 0) {
+        printf("Usage: ./listen_bench [port] [requests]\n");
+        return 1;
+    }
+
+    BenchConfig configs[5];
+    configs[0].name = "default";
+    configs[1].name = "nodelay";
+    configs[1].options.nodelay = true;
+    configs[2].name = "nodelay+cork";
+    configs[2].options.nodelay = true;
+    configs[2].options.cork = true;
+    configs[3].name = "defer-accept";
+    configs[3].options.nodelay = true;
+    configs[3].options.defer_accept = 1;
+    configs[4].name = "fastopen";
+    configs[4].options.nodelay = true;
+    configs[4].options.fastopen = 256;
+    int count = sizeof(configs) / sizeof(configs[0]);
+    for (int i = 0; i < count; i++) {
+        configs[i].options.backlog = 1024;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        printf("fork failure\n");
+        return 1;
+    }
+    if (pid == 0) {
+        RunServer(port, configs, count);
+    }
+
+    //等到最后一个端口开始监听
+    bool ready = false;
+    for (int i = 0; i < 100 && !ready; i++) {
+        int fd = Connect(port + count - 1, false);
+        if (fd >= 0) {
+            close(fd);
+            ready = true;
+        }
+        else {
+            usleep(50000);
+        }
+    }
+    if (!ready) {
+        printf("server did not start\n");
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        return 1;
+    }
+
+    //分块响应在默认配置下每个要等延迟ACK,请求数少一些
+    int stream_requests = requests / 20 > 0 ? requests / 20 : 1;
+    int connect_requests = requests / 2 > 0 ? requests / 2 : 1;
+    printf("us per request and TCP segments per request (both ends)\n");
+    printf("%-14s %9s %5s %9s %5s %9s %5s %8s\n", "listener", "small", "segs", "stream", "segs",
+           "connect", "segs", "syn_data");
+    for (int i = 0; i < count; i++) {
+        int syn_data = 0;
+        printf("%-14s", configs[i].name);
+        PrintResult(KeepAlive(port + i, "/small", requests));
+        PrintResult(KeepAlive(port + i, "/stream", stream_requests));
+        PrintResult(NewConnection(port + i, configs[i].options.fastopen > 0, connect_requests, &syn_data));
+        printf(" %8d\n", syn_data);
+    }
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return 0;
+}
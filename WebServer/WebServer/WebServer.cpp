@@ -1,5 +1,14 @@
 #include "WebServer.h"
 
+#include <sys/resource.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <netinet/tcp.h>
+
+//限流拒绝时由主线程直接发送,不经过线程池
+static const char TOO_MANY_REQUESTS[] =
+    "HTTP/1.1 429 Too Many Requests\r\nContent-Length:0\r\nRetry-After:1\r\nConnection:close\r\n\r\n";
+
 /*
 构造函数
     传入基本参数,端口号,线程数,最大请求数
@@ -7,16 +16,45 @@
     为定时器数组分配内存
 */
 WebServer::WebServer(int port, int thread_nums, int max_queue_nums)
-    : port_(port), thread_nums_(thread_nums), max_queue_nums_(max_queue_nums)
+    : worker_(-1), port_(port), thread_nums_(thread_nums), max_queue_nums_(max_queue_nums),
+      shed_target_(0), shed_interval_(0), shed_deadline_(0), busy_poll_(0), worker_spin_(0)
 {
-    //储存客户端连接情况
-    users_ = new HttpConn[MAX_FD_NUMBER];
+    //在创建工作线程之前屏蔽SIGTERM,新线程继承信号屏蔽字,信号只会通过signalfd送达
+    sigemptyset(&sigmask_);
+    sigaddset(&sigmask_, SIGTERM);
+#ifdef USE_TRACE
+    sigaddset(&sigmask_, SIGUSR1);
+#endif
+    pthread_sigmask(SIG_BLOCK, &sigmask_, NULL);
+
+    //储存客户端连接情况:大块calloc直接取mmap的零页,只有用到的槽位才构造、才占用物理页
+    users_ = (HttpConn*)calloc(MAX_FD_NUMBER, sizeof(HttpConn));
+    if (!users_) {
+        throw std::bad_alloc();
+    }
+    users_built_ = new bool[MAX_FD_NUMBER]();
 
     //定时器相关结构
     users_timer_ = new ClientData[MAX_FD_NUMBER];
     
     //为定时器分配内存
     timer_manager_ = new TimerManager;
+
+    //进程的描述符上限可能远小于MAX_FD_NUMBER,以实际能打开的数量作为容量
+    capacity_ = MAX_FD_NUMBER;
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY &&
+        limit.rlim_cur < (rlim_t)MAX_FD_NUMBER + FD_RESERVED) {
+        capacity_ = limit.rlim_cur > (rlim_t)FD_RESERVED * 2 ? limit.rlim_cur - FD_RESERVED : limit.rlim_cur / 2;
+    }
+    low_water_ = capacity_ / 2;
+    high_water_ = capacity_ * 9 / 10;
+    Stats::Set(STAT_CAPACITY, capacity_);
+    Stats::Set(STAT_IDLE_TIMEOUT_SEC, IDLE_TIMEOUT_MAX);
+
+    char spec[32];
+    snprintf(spec, sizeof(spec), "0.0.0.0:%d", port_);
+    AddListener(spec);
 }
 
 /*
@@ -29,13 +67,153 @@ WebServer::WebServer(int port, int thread_nums, int max_queue_nums)
 WebServer::~WebServer() 
 {
     close(epollfd_);
-    close(listenfd_);
-    close(pipefd_[0]);
-    close(pipefd_[1]);
-    delete[] users_;
+    for (size_t i = 0; i < listeners_.size(); i++) {
+        close(listeners_[i].fd);
+        //多进程模式下master不会走到这里,套接字文件留到下次启动时清理
+        if (listeners_[i].addr.ss_family == AF_UNIX && worker_ < 0) {
+            unlink(((struct sockaddr_un *)&listeners_[i].addr)->sun_path);
+        }
+    }
+    close(signalfd_);
+    close(timerfd_);
+    close(notifyfd_[0]);
+    close(notifyfd_[1]);
+    for (int i = 0; i < MAX_FD_NUMBER; i++) {
+        if (users_built_[i]) {
+            users_[i].~HttpConn();
+        }
+    }
+    free(users_);
+    delete[] users_built_;
     delete[] users_timer_;
     delete timer_manager_;
     delete thread_pool_;
+    delete io_pool_;
+    //工作线程已退出,不会再有新的录制记录
+    Capture::Flush();
+    for (size_t i = 0; i < hubs_.size(); i++) {
+        delete hubs_[i];
+    }
+    for (size_t i = 0; i < upstreams_.size(); i++) {
+        delete upstreams_[i];
+    }
+}
+
+/*
+Prefork()
+    master创建监听套接字和共享统计区,fork出workers个进程,各自运行完整的事件循环
+    worker共用同一个监听套接字,以EPOLLEXCLUSIVE注册,新连接只唤醒其中一个进程
+    master不处理连接,用sigwaitinfo等待信号:worker退出时重启,SIGTERM转发给所有worker,
+    等它们退出后master自己退出,其余信号(如SIGUSR1)原样转发
+    用户表和WebSocket频道的订阅者都在进程内存中,分到不同worker的请求会看到不同的用户和订阅者,这时不能分进程
+*/
+bool WebServer::Prefork(int workers)
+{
+    if (user_store_.Opened() || !hubs_.empty()) {
+        printf("prefork failure: user store and websocket hubs are per process\n");
+        return false;
+    }
+    if (workers <= 0 || !Stats::Share(workers + 1)) {
+        printf("prefork failure\n");
+        return false;
+    }
+    OpenListenSockets();
+
+    sigset_t mask = sigmask_;
+    sigaddset(&mask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    std::vector<pid_t> pids(workers, -1);
+    std::vector<int64_t> started(workers, 0);
+    for (int i = 0; i < workers; i++) {
+        if (SpawnWorker(i, pids, started)) {
+            return true;
+        }
+    }
+    Stats::Attach(workers);
+
+    bool stopping = false;
+    while (true) {
+        int alive = 0;
+        for (int i = 0; i < workers; i++) {
+            alive += pids[i] > 0;
+        }
+        if (alive == 0) {
+            break;
+        }
+        siginfo_t info;
+        if (sigwaitinfo(&mask, &info) < 0) {
+            continue;
+        }
+        if (info.si_signo == SIGCHLD) {
+            int status;
+            pid_t pid;
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+                for (int i = 0; i < workers; i++) {
+                    if (pids[i] != pid) {
+                        continue;
+                    }
+                    pids[i] = -1;
+                    if (stopping) {
+                        break;
+                    }
+                    printf("worker %d (pid %d) exited with status %d, restarting\n", i, pid, status);
+                    Stats::Add(STAT_WORKER_RESTARTS);
+                    //启动后很快又退出的worker隔一秒再重启,避免不停地fork
+                    if (Clock::Read() - started[i] < 1000) {
+                        sleep(1);
+                    }
+                    if (SpawnWorker(i, pids, started)) {
+                        return true;
+                    }
+                    break;
+                }
+            }
+            continue;
+        }
+        if (info.si_signo == SIGTERM) {
+            stopping = true;
+        }
+        for (int i = 0; i < workers; i++) {
+            if (pids[i] > 0) {
+                kill(pids[i], info.si_signo);
+            }
+        }
+    }
+    exit(0);
+}
+
+/*
+SpawnWorker()
+    子进程恢复信号屏蔽字,master退出时收到SIGTERM,经signalfd正常停止;返回true表示当前是子进程
+*/
+bool WebServer::SpawnWorker(int index, std::vector<pid_t> &pids, std::vector<int64_t> &started)
+{
+    started[index] = Clock::Read();
+    pid_t pid = fork();
+    if (pid < 0) {
+        printf("fork worker %d failure, errno = %d\n", index, errno);
+        return false;
+    }
+    if (pid > 0) {
+        pids[index] = pid;
+        return false;
+    }
+    worker_ = index;
+    pthread_sigmask(SIG_SETMASK, &sigmask_, NULL);
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    Stats::Attach(index);
+    Stats::Set(STAT_CAPACITY, capacity_);
+    Stats::Set(STAT_IDLE_TIMEOUT_SEC, IDLE_TIMEOUT_MAX);
+    if (!dir_watcher_.AfterFork()) {
+        printf("worker %d: file watching disabled, caches only keep unwatched results\n", index);
+    }
+    cache_.AfterFork();
+    path_cache_.AfterFork();
+    if (!Capture::AfterFork(index)) {
+        printf("worker %d: capture disabled\n", index);
+    }
+    return true;
 }
 
 /*
@@ -45,6 +223,12 @@ CreateThreadPool()
 void WebServer::CreateThreadPool() 
 {
     thread_pool_ = new ThreadPool<HttpConn>(thread_nums_, max_queue_nums_);
+    if (shed_target_ > 0) {
+        thread_pool_->SetShedding(shed_target_, shed_interval_, shed_deadline_);
+    }
+    thread_pool_->SetSpin(worker_spin_);
+    io_pool_ = new IoPool;
+    HttpConn::io_pool_ = io_pool_;
 }
 
 /*
@@ -59,29 +243,8 @@ void WebServer::ListenEvents()
 {
     //注册信号
     utils_.AddSig(SIGPIPE, SIG_IGN);
-    utils_.AddSig(SIGALRM, utils_.SigHandler);
-    utils_.AddSig(SIGTERM, utils_.SigHandler);
-
-    listenfd_ = socket(AF_INET, SOCK_STREAM, 0);
-    assert(listenfd_ != -1);
 
-    struct sockaddr_in address;
-    bzero(&address, sizeof(address));
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = htonl(INADDR_ANY);
-    address.sin_port = htons(port_);
-
-    int reuse_flag = 1;
-    //允许重用本地地址和端口
-    setsockopt(listenfd_, SOL_SOCKET, SO_REUSEADDR, &reuse_flag, sizeof(reuse_flag));
-    
-    // 给套接字绑定地址
-    int ret = bind(listenfd_, (struct sockaddr *)&address, sizeof(address));
-    assert(ret != -1);
-    
-    // 监听套接字
-    ret = listen(listenfd_, 5);
-    assert(ret != -1);
+    OpenListenSockets();
 
     // 这里是为了监听套接字以此来监听客户连接情况
     //epoll创建内核事件表
@@ -89,47 +252,484 @@ void WebServer::ListenEvents()
     assert(epollfd_ != -1);
 
     /*
-    监视listenfd_上的事件,因为只有主线程负责监听事件,所以不担心别的线程竞争,不需要使用EPOLLONESHOT
-    listenfd_设置成非阻塞更好,虽然因为IO复用的原因不需要非阻塞,但是如果并发量上来了,处理事件可能效率不够,详细可以查看事件循环的
+    监视各监听套接字上的事件,因为只有主线程负责监听事件,所以不担心别的线程竞争,不需要使用EPOLLONESHOT
+    监听套接字设置成非阻塞更好,虽然因为IO复用的原因不需要非阻塞,但是如果并发量上来了,处理事件可能效率不够,详细可以查看事件循环的
+    多进程模式下各worker共用监听套接字,EPOLLEXCLUSIVE避免每个新连接唤醒所有进程(不能与EPOLLRDHUP同用)
     */
-    utils_.AddFd(epollfd_, listenfd_, false);
+    for (size_t i = 0; i < listeners_.size(); i++) {
+        int fd = listeners_[i].fd;
+        if (worker_ >= 0) {
+            epoll_event event;
+            event.data.fd = fd;
+            event.events = EPOLLIN | EPOLLET | EPOLLEXCLUSIVE;
+            epoll_ctl(epollfd_, EPOLL_CTL_ADD, fd, &event);
+            utils_.SetNonBlocking(fd);
+        }
+        else {
+            utils_.AddFd(epollfd_, fd, false);
+        }
+    }
+
+    //信号和定时器都作为普通的可读事件,epoll_wait不再被信号中断
+    signalfd_ = signalfd(-1, &sigmask_, SFD_NONBLOCK | SFD_CLOEXEC);
+    assert(signalfd_ != -1);
+    utils_.AddFd(epollfd_, signalfd_, false);
+    timerfd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    assert(timerfd_ != -1);
+    utils_.AddFd(epollfd_, timerfd_, false);
+
+    //工作线程的关闭通知,使用数据报保证每条通知完整送达
+    int ret = socketpair(PF_UNIX, SOCK_DGRAM, 0, notifyfd_);
+    assert(ret != -1);
+    utils_.AddFd(epollfd_, notifyfd_[0], false);
+    HttpConn::notifyfd_ = notifyfd_[1];
 
-    //创建管道套接字
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, WebServer::pipefd_);
-    utils_.AddFd(epollfd_, pipefd_[0], false);
-    
-    //犯了一个错误,我直接将数组进行了赋值,这赋值的是地址而不是数组
-    //所以把Utils::pipefd设置为指针比较好，毕竟数组名就是地址
-    Utils::pipefd_ = pipefd_;
     Utils::epollfd_ = epollfd_;    
     //HttpConn代表客户端信息,并且会有一个初始化函数,客户端也需要监视是否有数据,所以也要上树
     HttpConn::epollfd_ = epollfd_;  
+    HttpConn::router_ = &router_;
+
+    utils_.AddFd(epollfd_, io_pool_->Fd(), false);
+
+    //两个缓存的inotify事件由主线程处理
+    if (dir_watcher_.Fd() != -1) {
+        utils_.AddFd(epollfd_, dir_watcher_.Fd(), false);
+    }
+
+    //第一次周期性工作在TIMESLOT之后
+    timer_armed_ = INT64_MAX;
+    next_tick_ = Clock::Update() + TIMESLOT * 1000;
+    ArmTimer();
+}
+
+/*
+AddListener()
+    地址在注册时解析,套接字在OpenListenSockets()中统一创建
+*/
+bool WebServer::AddListener(const char* spec, const ListenOptions& options)
+{
+    Listener listener;
+    listener.options = options;
+    snprintf(listener.spec, sizeof(listener.spec), "%s", spec);
+    if (!Utils::ParseAddress(spec, &listener.addr, &listener.addr_len)) {
+        printf("invalid listen address %s\n", spec);
+        return false;
+    }
+    listener.fd = -1;
+    listeners_.push_back(listener);
+    return true;
+}
+
+bool WebServer::SetListenOptions(const ListenOptions& options, const char* spec)
+{
+    for (size_t i = 0; i < listeners_.size(); i++) {
+        if (spec ? strcmp(listeners_[i].spec, spec) == 0 : i == 0) {
+            listeners_[i].options = options;
+            return true;
+        }
+    }
+    printf("listen address %s not found\n", spec);
+    return false;
+}
+
+//上次运行留下的套接字文件:连不上说明已经没有进程在监听,删除后才能重新绑定
+static void RemoveStaleSocket(const Listener &listener)
+{
+    const char *path = ((const struct sockaddr_un *)&listener.addr)->sun_path;
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISSOCK(st.st_mode)) {
+        return;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return;
+    }
+    if (connect(fd, (const struct sockaddr *)&listener.addr, listener.addr_len) < 0 && errno == ECONNREFUSED) {
+        unlink(path);
+    }
+    close(fd);
+}
+
+//选项设置失败只打印,不影响监听
+static void SetListenSocketOptions(const Listener &listener)
+{
+    const ListenOptions &options = listener.options;
+    int fd = listener.fd;
+    if (options.sndbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &options.sndbuf, sizeof(int)) < 0) {
+        printf("%s: SO_SNDBUF failure, errno = %d\n", listener.spec, errno);
+    }
+    if (options.rcvbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &options.rcvbuf, sizeof(int)) < 0) {
+        printf("%s: SO_RCVBUF failure, errno = %d\n", listener.spec, errno);
+    }
+    if (listener.addr.ss_family == AF_UNIX) {
+        return;
+    }
+    int on = 1;
+    if (options.nodelay && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0) {
+        printf("%s: TCP_NODELAY failure, errno = %d\n", listener.spec, errno);
+    }
+    if (options.defer_accept > 0 &&
+        setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &options.defer_accept, sizeof(int)) < 0) {
+        printf("%s: TCP_DEFER_ACCEPT failure, errno = %d\n", listener.spec, errno);
+    }
+    if (options.busy_poll > 0 && setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &options.busy_poll, sizeof(int)) < 0) {
+        printf("%s: SO_BUSY_POLL failure, errno = %d\n", listener.spec, errno);
+    }
+    if (options.fastopen > 0 && setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &options.fastopen, sizeof(int)) < 0) {
+        printf("%s: TCP_FASTOPEN failure, errno = %d\n", listener.spec, errno);
+    }
+}
+
+/*
+OpenListenSockets()
+    创建各监听套接字
+    TCP套接字设置端口复用;IPv6与IPv4同端口时设置IPV6_V6ONLY,否则两个套接字会争同一个端口
+    缓冲区大小要在listen之前设置,TCP窗口扩大因子在握手时就确定了
+*/
+void WebServer::OpenListenSockets()
+{
+    for (size_t i = 0; i < listeners_.size(); i++) {
+        Listener &listener = listeners_[i];
+        if (listener.fd != -1) {
+            continue;
+        }
+        int family = listener.addr.ss_family;
+        listener.fd = socket(family, SOCK_STREAM, 0);
+        assert(listener.fd != -1);
+
+        if (family == AF_UNIX) {
+            RemoveStaleSocket(listener);
+        }
+        else {
+            int reuse_flag = 1;
+            //允许重用本地地址和端口
+            setsockopt(listener.fd, SOL_SOCKET, SO_REUSEADDR, &reuse_flag, sizeof(reuse_flag));
+        }
+        if (family == AF_INET6) {
+            int v6only = ntohs(((struct sockaddr_in6 *)&listener.addr)->sin6_port) == port_;
+            setsockopt(listener.fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+        }
+        SetListenSocketOptions(listener);
+
+        // 给套接字绑定地址
+        int ret = bind(listener.fd, (struct sockaddr *)&listener.addr, listener.addr_len);
+        if (ret == -1) {
+            printf("bind %s failure, errno = %d\n", listener.spec, errno);
+            exit(1);
+        }
+
+        // 监听套接字
+        ret = listen(listener.fd, listener.options.backlog);
+        assert(ret != -1);
+    }
+}
+
+
+/*
+AddRoute()
+    注册处理函数,pattern支持":name"参数和末尾的"*name"通配
+    路由表在事件循环开始后只读,因此工作线程匹配时无需加锁
+*/
+bool WebServer::AddRoute(int method, const char* pattern, RouteHandler handler, void* arg)
+{
+    bool ret = router_.Add(method, pattern, handler, arg);
+    if (!ret) {
+        printf("AddRoute failure: %s\n", pattern);
+    }
+    return ret;
+}
+
+//注册/登录结果对应的响应状态和提示
+static HttpConn::HTTP_CODE UserResult(HttpResponse& resp, UserStore::RESULT ret, const char* action)
+{
+    switch (ret)
+    {
+        case UserStore::USER_OK:
+            resp.SetStatus(200, "OK");
+            resp.Printf("<html><body>%s成功</body></html>", action);
+            break;
+        case UserStore::USER_EXISTS:
+            resp.SetStatus(409, "Conflict");
+            resp.Printf("<html><body>用户名已存在</body></html>");
+            break;
+        case UserStore::USER_NOT_FOUND:
+        case UserStore::USER_BAD_PASSWORD:
+            resp.SetStatus(401, "Unauthorized");
+            resp.Printf("<html><body>用户名或密码错误</body></html>");
+            break;
+        case UserStore::USER_INVALID:
+            resp.SetStatus(400, "Bad Request");
+            resp.Printf("<html><body>用户名或密码不合法</body></html>");
+            break;
+        default:
+            resp.SetStatus(500, "Internal Error");
+            resp.Printf("<html><body>%s失败</body></html>", action);
+            break;
+    }
+    return resp.Send();
+}
+
+//处理函数运行在工作线程中,慢哈希不会阻塞主线程
+static HttpConn::HTTP_CODE RegisterHandler(HttpRequest& req, HttpResponse& resp, void* arg)
+{
+    UserStore* store = (UserStore*)arg;
+    return UserResult(resp, store->Register(req.Form("user"), req.Form("password")), "注册");
+}
+
+static HttpConn::HTTP_CODE LoginHandler(HttpRequest& req, HttpResponse& resp, void* arg)
+{
+    UserStore* store = (UserStore*)arg;
+    return UserResult(resp, store->Login(req.Form("user"), req.Form("password")), "登录");
+}
+
+/*
+EnableUserStore()
+    回放用户日志,并注册/register和/login两个表单处理函数
+*/
+bool WebServer::EnableUserStore(const char* path)
+{
+    if (!user_store_.Open(path)) {
+        printf("open user store %s failure\n", path);
+        return false;
+    }
+    printf("user store loaded %d users\n", user_store_.Size());
+    return AddRoute(HttpConn::POST, "/register", RegisterHandler, &user_store_) &&
+           AddRoute(HttpConn::POST, "/login", LoginHandler, &user_store_);
+}
+
+/*
+AddWebSocket()
+    每个路径一个频道,GET该路径并带有握手头的连接切换为WebSocket并订阅频道
+*/
+WebSocketHub* WebServer::AddWebSocket(const char* path, WsHandler handler, void* arg)
+{
+    WebSocketHub* hub = new WebSocketHub(handler, arg);
+    if (!AddRoute(HttpConn::GET, path, WebSocketHub::Handshake, hub)) {
+        delete hub;
+        return NULL;
+    }
+    hubs_.push_back(hub);
+    return hub;
+}
+
+/*
+EnableStats()
+    统计输出很短,作为定长响应发送
+*/
+bool WebServer::EnableStats(const char* path)
+{
+    return AddRoute(HttpConn::GET, path, Stats::Handler);
+}
+
+/*
+EnableTrace()
+    追踪数据写到dir下,总耗时不少于slow_ms毫秒的请求自动写入trace_slow.json
+*/
+bool WebServer::EnableTrace(const char* dir, int slow_ms)
+{
+    if (!Trace::Enable(dir, slow_ms)) {
+        printf("enable trace failure: %s\n", dir);
+        return false;
+    }
+    return true;
+}
+
+/*
+EnableCapture()
+    录制在周期性工作中写入文件,服务器退出时写完剩余部分
+*/
+bool WebServer::EnableCapture(const char* path)
+{
+    if (!Capture::Enable(path)) {
+        printf("enable capture failure: %s, errno = %d\n", path, errno);
+        return false;
+    }
+    return true;
+}
+
+/*
+EnableTls()
+    加载证书和私钥,之后accept的连接先在工作线程中完成非阻塞握手
+*/
+bool WebServer::EnableTls(const char* cert_file, const char* key_file)
+{
+    if (!tls_ctx_.Init(cert_file, key_file)) {
+        printf("enable tls failure: %s %s\n", cert_file, key_file);
+        return false;
+    }
+    HttpConn::tls_ctx_ = &tls_ctx_;
+    return true;
+}
+
+/*
+AddProxy()
+    上游地址在注册时解析一次,各工作线程按upstreams_中的下标维护自己的空闲连接池
+*/
+bool WebServer::AddProxy(const char* pattern, const char* upstream, int connect_timeout, int read_timeout)
+{
+    Upstream* up = new Upstream;
+    if (!up->Parse(upstream)) {
+        printf("invalid upstream %s\n", upstream);
+        delete up;
+        return false;
+    }
+    //工作线程每次等待上游前都把连接的期限推后到等待结束之后,读超时不受连接各阶段期限的限制
+    up->id = upstreams_.size();
+    up->connect_timeout = connect_timeout;
+    up->read_timeout = read_timeout;
+    upstreams_.push_back(up);
+    return AddRoute(HttpConn::GET, pattern, ProxyExchange::Handler, up) &&
+           AddRoute(HttpConn::POST, pattern, ProxyExchange::Handler, up);
+}
 
-    //每隔TIMESLOT时间触发SIGALRM信号
-    alarm(TIMESLOT);
+/*
+EnableResponseCache()
+    命中时一次writev发出预先拼好的完整响应
+*/
+bool WebServer::EnableResponseCache(size_t max_file_size, size_t max_bytes)
+{
+    if (!cache_.Init(max_file_size, max_bytes, &dir_watcher_)) {
+        printf("enable response cache failure, errno = %d\n", errno);
+        return false;
+    }
+    HttpConn::cache_ = &cache_;
+    return true;
 }
 
-//处理事件循环中的新连接事件
-bool WebServer::DealClientData()
+/*
+EnablePathCache()
+    扫描器反复请求不存在的路径时,TTL内只stat一次
+*/
+bool WebServer::EnablePathCache(size_t max_entries, int negative_ttl_ms)
 {
-    struct sockaddr_in client_addrss;
-    socklen_t client_addrss_length = sizeof(client_addrss);
+    if (!path_cache_.Init(max_entries, negative_ttl_ms, &dir_watcher_)) {
+        printf("enable path cache failure, errno = %d\n", errno);
+        return false;
+    }
+    HttpConn::path_cache_ = &path_cache_;
+    return true;
+}
+
+/*
+EnableBundle()
+    映射区只读且在fork前建立,多进程模式下各worker共用同一份物理页
+*/
+bool WebServer::EnableBundle(const char* path)
+{
+    if (!bundle_.Load(path)) {
+        printf("enable bundle failure\n");
+        return false;
+    }
+    HttpConn::bundle_ = &bundle_;
+    printf("bundle %s loaded, %d paths\n", path, bundle_.Count());
+    return true;
+}
+
+/*
+EnableRateLimit()
+    新建连接在accept后检查,请求在空闲连接收到数据时检查,都在主线程完成
+*/
+bool WebServer::EnableRateLimit(int connect_rate, int connect_burst, int request_rate, int request_burst)
+{
+    if (!rate_limiter_.Init(connect_rate, connect_burst, request_rate, request_burst)) {
+        printf("enable rate limit failure\n");
+        return false;
+    }
+    return true;
+}
+
+/*
+EnableLoadShedding()
+    过载时与其让请求在队列里排到客户端超时,不如尽早返回503让客户端稍后重试
+*/
+bool WebServer::EnableLoadShedding(int target_ms, int interval_ms, int deadline_ms)
+{
+    if (target_ms <= 0 || interval_ms <= 0 || deadline_ms <= 0) {
+        printf("enable load shedding failure\n");
+        return false;
+    }
+    shed_target_ = target_ms;
+    shed_interval_ = interval_ms;
+    shed_deadline_ = deadline_ms;
+    return true;
+}
+
+/*
+EnableBusyPoll()
+    每个请求都要经过主线程和工作线程两次唤醒,忙等省掉睡眠和调度的开销
+    轮询期间占满一个核,只适合有专用CPU、在意p50延迟的服务;单核机器上轮询会抢走工作线程的CPU,不开启
+*/
+bool WebServer::EnableBusyPoll(int reactor_us, int worker_us)
+{
+    if (reactor_us < 0 || worker_us < 0 || sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+        printf("enable busy poll failure\n");
+        return false;
+    }
+    busy_poll_ = reactor_us;
+    worker_spin_ = worker_us;
+    return true;
+}
+
+void WebServer::SetWriteBudget(long bytes)
+{
+    HttpConn::write_budget_ = bytes > 0 ? bytes : 0;
+}
+
+Listener* WebServer::FindListener(int fd)
+{
+    for (size_t i = 0; i < listeners_.size(); i++) {
+        if (listeners_[i].fd == fd) {
+            return &listeners_[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+处理事件循环中的新连接事件
+    新连接优先于空闲长连接:达到高水位或描述符耗尽时先按LRU淘汰一批空闲连接
+    淘汰不出空间时才拒绝新连接,拒绝的连接立即关闭
+*/
+bool WebServer::DealClientData(const Listener& listener)
+{
+    struct sockaddr_storage client_addrss;
     
     //非阻塞listenfd,连续处理完所有客户端连接事情
     while (1) {
-        int connfd = accept(listenfd_, (struct sockaddr*)&client_addrss, &client_addrss_length);
+        if (HttpConn::user_count_ >= high_water_) {
+            EvictIdle(EVICT_BATCH);
+        }
+        socklen_t client_addrss_length = sizeof(client_addrss);
+        int connfd = accept(listener.fd, (struct sockaddr*)&client_addrss, &client_addrss_length);
         //退处循环,一种是一开始就接受不到连接,另一种是处理完了所有连接
         if (connfd < 0) {
+            //监听套接字是ET模式,描述符耗尽时腾出空间后必须继续accept,否则等待的连接不会再通知
+            if ((errno == EMFILE || errno == ENFILE) && EvictIdle(EVICT_BATCH) > 0) {
+                continue;
+            }
             printf("accept failure and the errno is %d\n", errno);
             return false;
         }
-        else if (HttpConn::user_count_ >= MAX_FD_NUMBER) {
+        else if (HttpConn::user_count_ >= capacity_ || connfd >= MAX_FD_NUMBER) {
             perror("Internal server busy\n");
-            return false;
+            close(connfd);
+            Stats::Add(STAT_REJECTED);
+            continue;
+        }
+        else if (!rate_limiter_.Allow(client_addrss, RATE_CONNECT)) {
+            RejectLimited(connfd, HttpConn::tls_ctx_ == NULL);
+            close(connfd);
+            Stats::Add(STAT_LIMITED_CONNECT);
+            continue;
         }
         else {
+            Stats::Add(STAT_ACCEPTED);
             //初始化客户端信息
-            users_[connfd].Init(connfd, client_addrss);
+            if (!users_built_[connfd]) {
+                new (&users_[connfd]) HttpConn();
+                users_built_[connfd] = true;
+            }
+            users_[connfd].Init(connfd, client_addrss, listener.options.cork);
             SetTimer(connfd, client_addrss);
         }
     }
@@ -140,52 +740,41 @@ SetTimer()
     定时器内有ClientData结构,需要传入connfd client_address来初始化
 
 */
-void WebServer::SetTimer(int connfd, struct sockaddr_in client_address)
+void WebServer::SetTimer(int connfd, const struct sockaddr_storage &client_address)
 {
     users_timer_[connfd].address = client_address;
     users_timer_[connfd].sockfd = connfd;
+    users_timer_[connfd].conn = &users_[connfd];
     
     TimerNode* timer = new TimerNode;
     timer->user_data_ = &users_timer_[connfd];
     timer->cb_func = CbFunc;                    //设置定时器回调函数
-    time_t cur = time(NULL);                    //设置定时事件
-    timer->expire = cur + 3 * TIMESLOT; 
+    timer->expire = users_[connfd].deadline_;   //Init已进入空闲阶段,首次检查时间就是空闲期限
     users_timer_[connfd].timer = timer;         //该连接更新其定时器成员
     timer_manager_->AddTimerNode(timer);        //将该定时器插入定时器管理结构
 }
 
+/*
+DealWithSignal()
+    signalfd是ET模式,读到EAGAIN为止
+*/
 bool WebServer::DealWithSignal()
 {
-    int ret = 0;
-    int sig;
-    char signals[1024];
-    ret = recv(pipefd_[0], signals, sizeof(signals), 0);
-    if (ret == -1) {
-        return false;
-    }
-    else if (ret == 0) {
-        return false;
-    }
-    else {
-        for (int i = 0; i < ret; i++) {
-            switch (signals[i])
-            {
-                case SIGALRM:
-                {
-                    timeout_ = true;
-                    break;
-                }
-                case SIGTERM:
-                {
-                    stop_server_ = true;
-                    break;
-                }
-            }
+    struct signalfd_siginfo info;
+    bool ret = false;
+    while (read(signalfd_, &info, sizeof(info)) == sizeof(info)) {
+        ret = true;
+        if (info.ssi_signo == SIGTERM) {
+            stop_server_ = true;
+        }
+        //make TRACE=1时导出最近请求的追踪数据
+        else if (info.ssi_signo == SIGUSR1) {
+            Trace::DumpRecent();
         }
     }
-
-    return true;
+    return ret;
 }
+
 /*
 AddTimer()
     当有读写事件产生时,该客户端活跃
@@ -193,72 +782,138 @@ AddTimer()
 */
 void WebServer::AddTimer(TimerNode* timer)
 {
-    time_t cur = time(NULL);
-    timer->expire = cur + 3 * TIMESLOT; //增加定时器事件
+    if (timer == NULL) {
+        return;
+    }
+    timer->expire = Clock::Now() + 3 * TIMESLOT * 1000; //增加定时器事件
     timer_manager_->AdjustTimer(timer); //调整定时器链表
 }
 
 void WebServer::DealWithRead(int sockfd)
 {
-    //Reactor:主线程只负责监视,工作线程读写并处理数据
     TimerNode* timer = users_timer_[sockfd].timer;
-    if (timer != NULL) {
+    int phase = users_[sockfd].Phase();
+    //空闲连接上来了数据就是一个新请求;HTTP/2、WebSocket和TLS连接的请求边界主线程看不到,只按连接限流
+    if (phase == HttpConn::PHASE_IDLE && users_[sockfd].PlainHttp() &&
+        !rate_limiter_.Allow(users_timer_[sockfd].address, RATE_REQUEST)) {
+        RejectLimited(sockfd, true);
+        DeleteTimer(timer, sockfd);
+        Stats::Add(STAT_LIMITED_REQUEST);
+        return;
+    }
+    //线程池排队时间持续超标时按CoDel的节奏拒绝新请求
+    bool fresh = phase == HttpConn::PHASE_IDLE && users_[sockfd].PlainHttp();
+    if (fresh && !thread_pool_->Admit()) {
+        users_[sockfd].Shed();
+        DeleteTimer(timer, sockfd);
+        Stats::Add(STAT_SHED_ADMISSION);
+        return;
+    }
+    //会话按最后一次活动计时;HTTP请求从第一个字节起计算请求头期限,之后的读事件不再延长,
+    //逐字节慢慢发送请求头的连接会到期。事件交给工作线程后连接不再空闲,不会被淘汰
+    if (phase == HttpConn::PHASE_SESSION) {
         AddTimer(timer);
     }
+    else if (phase == HttpConn::PHASE_IDLE) {
+        users_[sockfd].SetPhase(HttpConn::PHASE_HEADER, HEADER_TIMEOUT);
+        if (timer != NULL) {
+            timer->expire = users_[sockfd].deadline_;
+            timer_manager_->AdjustTimer(timer);
+        }
+    }
+    //Reactor:主线程只负责监视,工作线程读写并处理数据
     //若监测到读事件，将该事件放入请求队列
-    thread_pool_->Append(&users_[sockfd], 0);
-    while (true)
-    {
-        //完成事件判断
-        if (1 == users_[sockfd].event_finish_) {
-            //长连接和短连接判断
-            if (1 == users_[sockfd].timer_flag_ ) {
-                printf("读取数据失败,处理定时器和fd\n");
-                DeleteTimer(users_timer_[sockfd].timer, sockfd);
-                timer_manager_->DelTimer(users_timer_[sockfd].timer);
-                users_[sockfd].timer_flag_ = 0;
-            }
-            users_[sockfd].event_finish_ = 0; //事件重新标记成未完成
-            break;
+    //任务完成后工作线程自行重新注册事件,需要关闭连接时通过notifyfd_通知;任务结束前主线程不关闭它
+#ifdef USE_TRACE
+    users_[sockfd].TraceQueued();
+#endif
+    users_[sockfd].TaskQueued();
+    if (!thread_pool_->Append(&users_[sockfd], 0)) {
+        printf("请求队列已满,关闭连接%d\n", sockfd);
+        users_[sockfd].TaskDone();
+        if (fresh) {
+            users_[sockfd].Shed();
+            Stats::Add(STAT_SHED_ADMISSION);
         }
+        DeleteTimer(timer, sockfd);
     }
-
 }
 
 void WebServer::DealWithWrite(int sockfd)
 {
     TimerNode* timer = users_timer_[sockfd].timer;
-    if (timer != NULL) {
+    //响应的发送期限由工作线程按进展推迟
+    if (users_[sockfd].Phase() == HttpConn::PHASE_SESSION) {
         AddTimer(timer);
     }
-    thread_pool_->Append(&users_[sockfd], 1);
+#ifdef USE_TRACE
+    users_[sockfd].TraceQueued();
+#endif
+    users_[sockfd].TaskQueued();
+    if (!thread_pool_->Append(&users_[sockfd], 1)) {
+        printf("请求队列已满,关闭连接%d\n", sockfd);
+        users_[sockfd].TaskDone();
+        DeleteTimer(timer, sockfd);
+    }
+}
 
-    //需要先直到是否完成事件,没有完成事件就循环等待
-    //完成事件后再判断是长连接还是短连接,短连接移除定时器关闭连接删除epoll注册对象
-    
-    while (true)
-    {
-        //完成事件判断
-        if (1 == users_[sockfd].event_finish_) {
-            //长连接和短连接判断
-            if (1 == users_[sockfd].timer_flag_) {
-                printf("短链接,关闭定时器\n");
-                DeleteTimer(users_timer_[sockfd].timer, sockfd);
-                users_[sockfd].timer_flag_ = 0;
-            }
-            users_[sockfd].event_finish_ = 0; //事件重新标记成未完成
-            break;
+//TLS连接无法发送明文响应,只能直接关闭
+void WebServer::RejectLimited(int sockfd, bool plain)
+{
+    if (plain) {
+        Utils::Reject(sockfd, TOO_MANY_REQUESTS, sizeof(TOO_MANY_REQUESTS) - 1);
+    }
+}
+
+/*
+DealWithNotify()
+    工作线程处理失败或短连接发送完毕后发来关闭通知
+    连接代数不一致说明该fd已被关闭并分配给了新连接,忽略这条通知
+*/
+void WebServer::DealWithNotify()
+{
+    HttpConn::CloseMsg msg;
+    while (recv(notifyfd_[0], (char*)&msg, sizeof(msg), 0) == sizeof(msg)) {
+        if (users_[msg.sockfd].generation_ != msg.generation) {
+            continue;
+        }
+        TimerNode* timer = users_timer_[msg.sockfd].timer;
+        if (timer != NULL) {
+            DeleteTimer(timer, msg.sockfd);
         }
     }
 }
 
+/*
+DealWithIoDone()
+    与关闭通知一样按代数过滤:预读期间连接可能已经到期关闭,fd又分配给了新连接
+*/
+void WebServer::DealWithIoDone()
+{
+    IoPool::Done done;
+    while (recv(io_pool_->Fd(), (char*)&done, sizeof(done), 0) == sizeof(done)) {
+        if (users_[done.sockfd].generation_ != done.generation || users_timer_[done.sockfd].timer == NULL) {
+            continue;
+        }
+        utils_.ModFd(epollfd_, done.sockfd, EPOLLOUT);
+    }
+}
+
 /*
 DeleteTimer
     调用回调函数,从epoll对象删除注册事件
     在定时器管理容器中删除该定时器
+    工作线程还在处理该连接时只做标记,任务结束时它会发来关闭通知,再回到这里关闭
 */
 void WebServer::DeleteTimer(TimerNode* timer, int sockfd)
 {
+    //定时器为空说明连接已经关闭过了
+    if (timer == NULL) {
+        return;
+    }
+    if (!users_[sockfd].TryClose()) {
+        return;
+    }
     printf("删除定时器, 关闭文件描述符%d\n", sockfd);
     //调用回调函数,从epoll对象删除注册事件
     timer->cb_func(&users_timer_[sockfd]);
@@ -268,11 +923,92 @@ void WebServer::DeleteTimer(TimerNode* timer, int sockfd)
     }
 }
 
+/*
+TimerHandle()
+    每次timerfd触发都关闭已到期的连接,周期性工作仍然每TIMESLOT做一次
+*/
 void WebServer::TimerHandle()
 {
+    int expired[HttpConn::PHASE_NUMBER] = {0};
+    timer_manager_->Tick(expired);
+    for (int i = 0; i < HttpConn::PHASE_NUMBER; i++) {
+        Stats::Add(STAT_EXPIRED_IDLE + i, expired[i]);
+    }
+    if (Clock::Now() < next_tick_) {
+        return;
+    }
+    next_tick_ = Clock::Now() + TIMESLOT * 1000;
     printf("timer tick!\n");
-    timer_manager_->Tick();
-    alarm(TIMESLOT);
+
+    //连接数越多空闲超时越短:expire是最后一次活动加IDLE_TIMEOUT_MAX,提前关闭空闲超过timeout的连接
+    int timeout = IdleTimeout();
+    if (timeout < IDLE_TIMEOUT_MAX) {
+        int count = timer_manager_->EvictIdle(Clock::Now() + (IDLE_TIMEOUT_MAX - timeout) * 1000, MAX_FD_NUMBER);
+        Stats::Add(STAT_IDLE_TIMEOUT, count);
+    }
+    Stats::Set(STAT_IDLE_TIMEOUT_SEC, timeout);
+    //多进程模式下/stats由某一个worker汇总,其他worker的连接数靠这里定期刷新
+    Stats::Set(STAT_CONNECTIONS, HttpConn::user_count_);
+    //令牌已补满的地址从限流表中删除
+    rate_limiter_.Compact();
+    //慢请求的追踪数据写到文件
+    Trace::FlushSlow();
+    //录制的请求写到文件
+    Capture::Flush();
+    //WebSocket连接可能长时间没有请求,定期PING保持定时器活跃,对端失效时队列涨满会被断开
+    for (size_t i = 0; i < hubs_.size(); i++) {
+        hubs_[i]->Ping();
+    }
+}
+
+/*
+ArmTimer()
+    每轮事件循环结束时调用,只有需要更早触发时才重新设置timerfd
+    最早的定时器被删除或推后时不重设,提前触发的那次Tick会重新排队并再设置一次
+*/
+void WebServer::ArmTimer()
+{
+    int64_t next = timer_manager_->NextExpire();
+    if (next < 0 || next > next_tick_) {
+        next = next_tick_;
+    }
+    next += TIMER_SLACK;
+    if (next >= timer_armed_) {
+        return;
+    }
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = next / 1000;
+    its.it_value.tv_nsec = next % 1000 * 1000000;
+    timerfd_settime(timerfd_, TFD_TIMER_ABSTIME, &its, NULL);
+    timer_armed_ = next;
+}
+
+/*
+IdleTimeout()
+    低水位以下使用IDLE_TIMEOUT_MAX,低水位到高水位之间线性缩短到IDLE_TIMEOUT_MIN
+*/
+int WebServer::IdleTimeout()
+{
+    int count = HttpConn::user_count_;
+    if (count <= low_water_) {
+        return IDLE_TIMEOUT_MAX;
+    }
+    if (count >= high_water_) {
+        return IDLE_TIMEOUT_MIN;
+    }
+    return IDLE_TIMEOUT_MAX - (IDLE_TIMEOUT_MAX - IDLE_TIMEOUT_MIN) * (count - low_water_) / (high_water_ - low_water_);
+}
+
+//从最久没有活动的连接开始淘汰空闲长连接
+int WebServer::EvictIdle(int max)
+{
+    int count = timer_manager_->EvictIdle(Clock::Now() + IDLE_TIMEOUT_MAX * 1000, max);
+    if (count > 0) {
+        printf("连接数%d,淘汰空闲连接%d个\n", HttpConn::user_count_, count);
+        Stats::Add(STAT_EVICTED, count);
+    }
+    return count;
 }
 
 /*
@@ -283,18 +1019,34 @@ void WebServer::LoopEvents()
 {
     timeout_ = false;
     stop_server_ = false;
+    int64_t last_event = 0;     //忙等模式下最后一次取到事件的时间(微秒)
 
     while (!stop_server_) {
-        int number = epoll_wait(epollfd_, events_, MAX_EVENT_NUMBER, -1);
+        //忙等模式:距最后一个事件不到busy_poll_微秒时零超时轮询,空轮询直接进入下一轮
+        int timeout = -1;
+        if (busy_poll_ > 0 && Clock::ReadUs() - last_event < busy_poll_) {
+            timeout = 0;
+        }
+        int number = epoll_wait(epollfd_, events_, MAX_EVENT_NUMBER, timeout);
         if (number < 0 && errno != EINTR) { //在非中断的方式下返回值小于0
             printf("epoll failure\n");
         } 
+        if (busy_poll_ > 0) {
+            if (number == 0 && timeout == 0) {
+                CpuRelax();
+                continue;
+            }
+            last_event = Clock::ReadUs();
+        }
+        //本轮所有事件共用一次取到的时间
+        Clock::Update();
         for (int i = 0; i < number; i++) 
         {
             int sockfd = events_[i].data.fd;
+            Listener* listener = FindListener(sockfd);
             //如果监听到新的客户连接
-            if (sockfd == listenfd_) {
-                bool flag = DealClientData();
+            if (listener) {
+                bool flag = DealClientData(*listener);
                 if (false == flag) //false说明处理完了连接
                     continue;
             }
@@ -304,14 +1056,33 @@ void WebServer::LoopEvents()
                 DeleteTimer(timer, sockfd);
                 printf("监听到异常事件,客户端关闭了连接, errno = %d\n", errno);
             }
+            //工作线程的关闭通知
+            else if (sockfd == notifyfd_[0]) {
+                DealWithNotify();
+            }
+            //冷文件预读完成
+            else if (sockfd == io_pool_->Fd()) {
+                DealWithIoDone();
+            }
+            //静态文件变化,使缓存的响应和路径解析结果失效
+            else if (sockfd == dir_watcher_.Fd()) {
+                dir_watcher_.HandleEvents();
+            }
             //如果是信号事件
-            else if ((sockfd == pipefd_[0]) && events_[i].events & EPOLLIN) {
+            else if (sockfd == signalfd_) {
                 bool flag = DealWithSignal();
                 if (false == flag){
                     //错误信息
                     printf("DealWithSignal()信号错误\n");
                 }               
             }
+            //定时器到期,timerfd是一次性的,触发后视为未设置
+            else if (sockfd == timerfd_) {
+                uint64_t count;
+                read(timerfd_, &count, sizeof(count));
+                timer_armed_ = INT64_MAX;
+                timeout_ = true;
+            }
             //如果是客户端的读事件
             else if (events_[i].events & EPOLLIN) {
                 DealWithRead(sockfd);
@@ -327,6 +1098,7 @@ void WebServer::LoopEvents()
             TimerHandle();
             timeout_ = false;
         }
+        ArmTimer();
     }
 }
 
@@ -10,17 +10,79 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
 #include <strings.h>
 #include <assert.h>
 #include <errno.h>
+#include <vector>
+#include <new>
 
 #include "../ThreadPool/ThreadPool.h"
+#include "../ThreadPool/IoPool.h"
 #include "../Timer/Timer.h"
 #include "../Utils/Utils.h"
+#include "../Router/Router.h"
+#include "../UserStore/UserStore.h"
+#include "../WebSocket/WebSocket.h"
+#include "../Tls/Tls.h"
+#include "../Proxy/Proxy.h"
+#include "../Cache/ResponseCache.h"
+#include "../Cache/PathCache.h"
+#include "../Cache/DirWatcher.h"
+#include "../Bundle/AssetBundle.h"
+#include "../Stats/Stats.h"
+#include "../Capture/Capture.h"
+#include "../RateLimit/RateLimiter.h"
 
 const int MAX_EVENT_NUMBER = 10000; //epoll最多注册的事件数量
 const int MAX_FD_NUMBER = 65536;    //最多的文件描述符数量
-const int TIMESLOT = 5;             //每隔5s发送alarm信号
+const int TIMESLOT = 5;             //每隔5s做一次空闲超时、限流表整理等周期性工作
+const int TIMER_SLACK = 10;         //定时器推迟触发的毫秒数,粗粒度时钟比timerfd使用的时钟落后至多一个节拍
+const int IDLE_TIMEOUT_MAX = KEEPALIVE_TIMEOUT;  //连接不紧张时空闲长连接的超时
+const int IDLE_TIMEOUT_MIN = 1;             //连接数达到高水位时的空闲超时
+const int FD_RESERVED = 64;                 //为监听、epoll、上游连接等保留的描述符
+const int EVICT_BATCH = 64;                 //达到高水位时一次淘汰的空闲连接数
+const int SHED_TARGET = 5;                  //负载削减:可接受的排队时间(毫秒)
+const int SHED_INTERVAL = 100;              //排队时间持续超标这么久(毫秒)才开始拒绝新请求
+const int SHED_DEADLINE = 1000;             //排队超过这么久(毫秒)的新请求直接拒绝
+const int BUSY_POLL_REACTOR = 50;           //忙等模式:主线程最后一个事件之后继续轮询的时间(微秒)
+const int BUSY_POLL_WORKER = 50;            //忙等模式:工作线程睡眠前等待任务的时间(微秒)
+
+/*
+监听套接字的选项,默认值与不设置时相同
+    设置在监听套接字上,Linux上accept出的连接继承TCP_NODELAY和缓冲区大小,不用每个连接再调用setsockopt
+    Unix套接字只使用backlog、cork和缓冲区大小
+*/
+struct ListenOptions
+{
+    int backlog;        //listen队列长度
+    bool nodelay;       //TCP_NODELAY,小响应和分片发送的尾部不等待ACK
+    bool cork;          //一个响应分多次写出时先攒满报文段再发,见HttpConn::Writev
+    int defer_accept;   //TCP_DEFER_ACCEPT秒数,连接发来数据后才通知accept,0不开启
+    int fastopen;       //TCP_FASTOPEN队列长度,允许客户端在SYN中携带请求,0不开启
+    int sndbuf;         //SO_SNDBUF字节数,0使用系统默认并自动调节
+    int rcvbuf;         //SO_RCVBUF字节数,0使用系统默认并自动调节
+    int busy_poll;      //SO_BUSY_POLL微秒数,网卡驱动支持时读空接收队列后在设备队列上轮询,超过net.core.busy_read需要CAP_NET_ADMIN
+
+    ListenOptions() : backlog(5), nodelay(false), cork(false), defer_accept(0), fastopen(0), sndbuf(0), rcvbuf(0),
+                      busy_poll(0) {}
+};
+
+/*
+监听地址
+    构造时加入IPv4的port端口,AddListener可以再加IPv6和Unix套接字,各自的fd注册在同一个epoll中
+*/
+struct Listener
+{
+    char spec[108];
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    ListenOptions options;
+    int fd;
+};
 
 class WebServer 
 {
@@ -29,40 +91,106 @@ public:
     ~WebServer();
 
 public:
+    //多进程模式:master监听端口后fork出workers个进程并负责重启,只有worker进程从这里返回true
+    //需在CreateThreadPool()之前调用;用户表和WebSocket频道只在进程内有效,开启了它们时拒绝运行,限流表各进程独立
+    bool Prefork(int workers);
     void CreateThreadPool();        //创建线程池
     void ListenEvents();            //开启事件监听
     void LoopEvents();              //开启事件循环
 
+    //再监听一个地址:"[::]:port"为IPv6(端口与IPv4相同时只接受IPv6,否则双栈),"unix:/path"为Unix套接字
+    //需在ListenEvents()和Prefork()之前调用
+    bool AddListener(const char* spec, const ListenOptions& options = ListenOptions());
+    //修改已添加的监听地址的选项,spec为NULL时修改构造时的IPv4监听
+    bool SetListenOptions(const ListenOptions& options, const char* spec = NULL);
+
+    //注册处理函数,需在LoopEvents()之前调用
+    bool AddRoute(int method, const char* pattern, RouteHandler handler, void* arg = NULL);
+    //开启内置用户表,注册POST /register和POST /login
+    bool EnableUserStore(const char* path);
+    //注册WebSocket路径,返回的频道可在任意线程Publish;handler处理客户端发来的消息,可以为NULL
+    WebSocketHub* AddWebSocket(const char* path, WsHandler handler = NULL, void* arg = NULL);
+    //注册GET path输出统计计数
+    bool EnableStats(const char* path = "/stats");
+    //按请求阶段记录追踪数据,慢请求自动导出,SIGUSR1导出最近的请求;需要make TRACE=1编译
+    bool EnableTrace(const char* dir, int slow_ms = 100);
+    //把每个连接收到的原始请求字节和到达时间录制到path,用capture_replay重放
+    bool EnableCapture(const char* path);
+    //监听端口改为TLS,需要make TLS=1编译
+    bool EnableTls(const char* cert_file, const char* key_file);
+    //把匹配pattern的GET/POST请求转发到上游"host:port"或"unix:/path",超时单位为毫秒
+    bool AddProxy(const char* pattern, const char* upstream, int connect_timeout = 1000, int read_timeout = 10000);
+    //缓存不超过max_file_size字节的静态文件的完整响应,文件变化时自动失效
+    bool EnableResponseCache(size_t max_file_size = CACHE_MAX_FILE_SIZE, size_t max_bytes = CACHE_MAX_BYTES);
+    //缓存URL到文件的解析结果,不存在的路径缓存negative_ttl_ms毫秒,最多max_entries条
+    bool EnablePathCache(size_t max_entries = PATH_CACHE_MAX, int negative_ttl_ms = PATH_NEGATIVE_TTL);
+    //静态文件改由make bundle生成的资源包提供,启动时映射一次;开启后不再查找文件系统,响应缓存也不再使用
+    bool EnableBundle(const char* path);
+    //按客户端地址限制每秒新建连接数和请求数,超出时返回429并关闭连接,rate为0表示该项不限
+    bool EnableRateLimit(int connect_rate, int connect_burst, int request_rate, int request_burst);
+    //按线程池的排队时间拒绝新请求,返回503和Retry-After,需在CreateThreadPool()之前调用
+    bool EnableLoadShedding(int target_ms = SHED_TARGET, int interval_ms = SHED_INTERVAL, int deadline_ms = SHED_DEADLINE);
+    //低延迟忙等模式:主线程以零超时epoll_wait轮询reactor_us微秒无事件后才阻塞,工作线程睡眠前自旋worker_us微秒
+    //用CPU换延迟,需在CreateThreadPool()之前调用
+    bool EnableBusyPoll(int reactor_us = BUSY_POLL_REACTOR, int worker_us = BUSY_POLL_WORKER);
+    //一个连接每次被调度最多发送的字节数,大响应分片发送,避免占住工作线程;0表示不限
+    void SetWriteBudget(long bytes);
+
 public:
     //事件循环针对不同事件的处理函数
-    bool DealClientData();          //处理客户端连接事件
+    Listener* FindListener(int fd);
+    bool DealClientData(const Listener& listener);  //处理客户端连接事件
     bool DealWithSignal();          //处理信号事件
+    void DealWithNotify();          //处理工作线程的关闭连接通知
+    void DealWithIoDone();          //冷文件预读完成,为连接注册写事件
     void DealWithRead(int sockfd);  //处理读事件
     void DealWithWrite(int sockfd); //处理写事件
+    void RejectLimited(int sockfd, bool plain);   //超过速率限制,发送429后关闭
+    void OpenListenSockets();       //创建监听套接字,多进程模式下由master在fork前创建
+    bool SpawnWorker(int index, std::vector<pid_t> &pids, std::vector<int64_t> &started);
 
     //定时器设置函数
-    void SetTimer(int connfd, struct sockaddr_in client_address);
+    void SetTimer(int connfd, const struct sockaddr_storage &client_address);
     void DeleteTimer(TimerNode* timer, int sockfd);
     void TimerHandle();
+    void ArmTimer();                        //把timerfd设置到最早的检查时间
     void AddTimer(TimerNode* timer);
+    int IdleTimeout();                      //按当前连接数计算空闲超时
+    int EvictIdle(int max);                 //按LRU淘汰空闲长连接
 
 public:
-    int listenfd_;      //监听文件描述符
+    std::vector<Listener> listeners_;   //监听地址,第一个是IPv4的port_端口
+    int worker_;        //多进程模式下本进程的worker编号,单进程模式为-1
     int port_;          //端口
     int epollfd_;       //epoll句柄
-    int pipefd_[2];     //发送信号的管道
-    HttpConn* users_;   //各个客户端连接
+    int signalfd_;      //SIGTERM(以及追踪开启时的SIGUSR1)经由signalfd在事件循环中处理
+    int timerfd_;       //按最早的定时器期限触发
+    sigset_t sigmask_;  //由signalfd接收、在所有线程中屏蔽的信号
+    int notifyfd_[2];   //工作线程通知主线程关闭连接的数据报套接字
+    HttpConn* users_;   //各个客户端连接,槽位在对应fd第一次被accept时才构造
+    bool* users_built_; //槽位是否已构造
+    int capacity_;      //连接数上限,取MAX_FD_NUMBER和进程描述符上限中较小者
+    int low_water_;     //连接数超过低水位后空闲超时开始缩短
+    int high_water_;    //连接数达到高水位后接受新连接前先淘汰空闲连接
     bool stop_server_;  //停止服务器的标志
     bool timeout_;      //计时时间标志
+    int64_t timer_armed_;   //timerfd当前设置的触发时间,未设置时为INT64_MAX
+    int64_t next_tick_;     //下一次周期性工作的时间
     
     //epoll_event相关
     epoll_event events_[MAX_EVENT_NUMBER];//储存发生的事件
 
 public:    
     ThreadPool<HttpConn> *thread_pool_;
+    IoPool *io_pool_;       //冷文件预读线程池
 
     int thread_nums_;   //线程池的线程数量
     int max_queue_nums_;//请求队列最多请求数
+    int shed_target_;   //EnableLoadShedding的参数,创建线程池时设置,0表示不开启
+    int shed_interval_;
+    int shed_deadline_;
+    int busy_poll_;     //EnableBusyPoll的参数,主线程轮询时间(微秒),0表示不开启
+    int worker_spin_;   //创建线程池时设置
 
 public:
     ClientData *users_timer_;       //定时器相关数据结构
@@ -70,7 +198,17 @@ public:
 
 public:
     Utils utils_;               //工具类成员,有addfd, addsig等常用函数
-    
+    Router router_;             //路由表,工作线程只读访问
+    UserStore user_store_;      //注册/登录使用的用户表
+    std::vector<WebSocketHub*> hubs_;   //AddWebSocket创建的频道
+    TlsContext tls_ctx_;        //EnableTls成功后所有新连接使用TLS
+    std::vector<Upstream*> upstreams_;  //AddProxy注册的上游
+    DirWatcher dir_watcher_;    //两个缓存共用的目录监视
+    ResponseCache cache_;       //EnableResponseCache成功后静态小文件走缓存
+    PathCache path_cache_;      //EnablePathCache成功后DoRequest先查解析结果
+    AssetBundle bundle_;        //EnableBundle成功后静态文件从资源包发送
+    RateLimiter rate_limiter_;  //EnableRateLimit成功后按客户端地址限流
+
 };
 
 #endif
\ No newline at end of file
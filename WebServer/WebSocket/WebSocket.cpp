@@ -0,0 +1,535 @@
+#include "WebSocket.h"
+#include "../Utils/Hash.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+static const char *WS_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+WsMessage* WsMessage::Frame(int opcode, const void *payload, int len)
+{
+    //服务器发出的帧不带掩码,头部2/4/10字节
+    int header = len < 126 ? 2 : (len < 65536 ? 4 : 10);
+    WsMessage *msg = (WsMessage*)malloc(sizeof(WsMessage) + header + len);
+    if (!msg) {
+        return NULL;
+    }
+    msg->refs = 1;
+    msg->len = header + len;
+
+    unsigned char *p = (unsigned char*)msg->data;
+    p[0] = 0x80 | opcode;
+    if (len < 126) {
+        p[1] = len;
+    }
+    else if (len < 65536) {
+        p[1] = 126;
+        p[2] = (len >> 8) & 0xff;
+        p[3] = len & 0xff;
+    }
+    else {
+        p[1] = 127;
+        for (int i = 0; i < 8; i++) {
+            p[2 + i] = (unsigned char)((uint64_t)len >> (56 - i * 8));
+        }
+    }
+    if (len > 0) {
+        memcpy(p + header, payload, len);
+    }
+    return msg;
+}
+
+WsMessage* WsMessage::Raw(const void *data, int len)
+{
+    WsMessage *msg = (WsMessage*)malloc(sizeof(WsMessage) + len);
+    if (!msg) {
+        return NULL;
+    }
+    msg->refs = 1;
+    msg->len = len;
+    memcpy(msg->data, data, len);
+    return msg;
+}
+
+void WsMessage::Ref()
+{
+    __sync_add_and_fetch(&refs, 1);
+}
+
+void WsMessage::Unref()
+{
+    if (__sync_sub_and_fetch(&refs, 1) == 0) {
+        free(this);
+    }
+}
+
+/*
+WsUnmask()
+    客户端帧的负载必须与4字节掩码循环异或
+    把掩码扩展成16/32字节的向量一次处理整块,剩余部分按8字节和单字节处理
+    每一段的起点都是4的倍数,所以扩展后的掩码不需要错位
+*/
+void WsUnmask(unsigned char *data, size_t len, const unsigned char mask[4])
+{
+    uint32_t m;
+    memcpy(&m, mask, 4);
+    size_t i = 0;
+#ifdef __AVX2__
+    __m256i m256 = _mm256_set1_epi32(m);
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+        _mm256_storeu_si256((__m256i*)(data + i), _mm256_xor_si256(v, m256));
+    }
+#endif
+#ifdef __SSE2__
+    __m128i m128 = _mm_set1_epi32(m);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        _mm_storeu_si128((__m128i*)(data + i), _mm_xor_si128(v, m128));
+    }
+#endif
+    uint64_t m64 = ((uint64_t)m << 32) | m;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v;
+        memcpy(&v, data + i, 8);
+        v ^= m64;
+        memcpy(data + i, &v, 8);
+    }
+    for (; i < len; i++) {
+        data[i] ^= mask[i & 3];
+    }
+}
+
+WsSession::WsSession(HttpConn *conn, WebSocketHub *hub)
+    : conn_(conn), hub_(hub), index_(-1), lock_("ws_session"), queued_bytes_(0), front_sent_(0),
+      busy_(false), rerun_(false), armed_out_(false), closed_(false),
+      message_opcode_(0), closing_(false)
+{
+}
+
+WsSession::~WsSession()
+{
+    ClearQueue();
+}
+
+void WsSession::AcceptKey(const char *key, char *accept)
+{
+    char buf[128];
+    int len = snprintf(buf, sizeof(buf), "%s%s", key, WS_GUID);
+    if (len >= (int)sizeof(buf)) {
+        len = sizeof(buf) - 1;
+    }
+    unsigned char digest[SHA1_DIGEST_SIZE];
+    Sha1(buf, len, digest);
+    Base64Encode(digest, SHA1_DIGEST_SIZE, accept);
+}
+
+/*
+Start()
+    101响应作为第一条消息入队,入队时会注册EPOLLOUT,由工作线程按发送队列的方式发出
+    之后才加入订阅,广播的帧一定排在101之后
+*/
+void WsSession::Start(const char *handshake, int len)
+{
+    WsMessage *msg = WsMessage::Raw(handshake, len);
+    if (msg) {
+        Enqueue(msg);
+        msg->Unref();
+    }
+    hub_->Subscribe(this);
+}
+
+bool WsSession::Send(const char *data, int len, bool binary)
+{
+    return SendFrame(binary ? WS_BINARY : WS_TEXT, data, len);
+}
+
+bool WsSession::SendFrame(int opcode, const char *payload, int len)
+{
+    WsMessage *msg = WsMessage::Frame(opcode, payload, len);
+    if (!msg) {
+        return false;
+    }
+    bool ret = Enqueue(msg);
+    msg->Unref();
+    return ret;
+}
+
+/*
+Enqueue()
+    只增加引用计数,不拷贝消息
+    对端长时间不读会让队列增长,超过上限时直接断开,避免一个卡住的客户端占住大量内存
+*/
+bool WsSession::Enqueue(WsMessage *msg)
+{
+    lock_.Lock();
+    if (closed_) {
+        lock_.UnLock();
+        return false;
+    }
+    if (queued_bytes_ + msg->len > WS_MAX_QUEUED_BYTES || queue_.size() >= WS_MAX_QUEUED_MESSAGES) {
+        closed_ = true;
+        if (!busy_) {
+            ClearQueue();
+        }
+        lock_.UnLock();
+        printf("WebSocket连接%d发送队列已满,断开慢消费者\n", conn_->sockfd_);
+        conn_->CloseConn();
+        return false;
+    }
+    msg->Ref();
+    queue_.push_back(msg);
+    queued_bytes_ += msg->len;
+    //没有工作线程持有该连接时由追加者注册写事件
+    if (!busy_ && !armed_out_) {
+        armed_out_ = true;
+        conn_->utils_.ModFd(HttpConn::epollfd_, conn_->sockfd_, EPOLLIN | EPOLLOUT);
+    }
+    lock_.UnLock();
+    return true;
+}
+
+/*
+OnEvent()
+    读事件时先读入并处理收到的帧,然后发送队列中的数据
+    结束前在锁内根据队列是否为空重新注册事件,与Enqueue的注册不会互相覆盖
+*/
+bool WsSession::OnEvent(bool readable)
+{
+    lock_.Lock();
+    if (busy_) {
+        rerun_ = true;
+        lock_.UnLock();
+        return true;
+    }
+    if (closed_) {
+        lock_.UnLock();
+        return false;
+    }
+    busy_ = true;
+    armed_out_ = false;
+    lock_.UnLock();
+
+    while (true) {
+        bool ok = true;
+        if (readable) {
+            ok = ReadFrames();
+        }
+        int flushed = ok ? Flush() : -1;
+
+        lock_.Lock();
+        if (flushed < 0 || closed_ || (closing_ && flushed == 1)) {
+            busy_ = false;
+            lock_.UnLock();
+            Close();
+            return false;
+        }
+        if (rerun_) {
+            rerun_ = false;
+            readable = true;
+            lock_.UnLock();
+            continue;
+        }
+        busy_ = false;
+        armed_out_ = !queue_.empty();
+        conn_->utils_.ModFd(HttpConn::epollfd_, conn_->sockfd_, armed_out_ ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+        lock_.UnLock();
+        return true;
+    }
+}
+
+/*
+Close()
+    主线程关闭fd、工作线程出错或慢消费者被移出时调用,可以重复调用
+    有工作线程正在发送时不释放队列,由该线程结束时再次调用Close释放
+*/
+void WsSession::Close()
+{
+    hub_->Unsubscribe(this);
+    lock_.Lock();
+    closed_ = true;
+    if (!busy_) {
+        ClearQueue();
+    }
+    lock_.UnLock();
+}
+
+void WsSession::ClearQueue()
+{
+    for (size_t i = 0; i < queue_.size(); i++) {
+        queue_[i]->Unref();
+    }
+    queue_.clear();
+    queued_bytes_ = 0;
+    front_sent_ = 0;
+}
+
+bool WsSession::ReadFrames()
+{
+    char buf[16384];
+    while (!closing_) {
+        int bytes_read = conn_->Recv(buf, sizeof(buf));
+        if (bytes_read < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            return false;
+        }
+        else if (bytes_read == 0) {
+            return false;
+        }
+        in_.append(buf, bytes_read);
+        if (!ParseFrames()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//处理in_中所有完整的帧,不完整的留到下次
+bool WsSession::ParseFrames()
+{
+    size_t pos = 0;
+    while (!closing_ && in_.size() - pos >= 2) {
+        unsigned char *p = (unsigned char*)&in_[pos];
+        size_t avail = in_.size() - pos;
+        bool fin = p[0] & 0x80;
+        int opcode = p[0] & 0x0f;
+        //没有协商扩展,RSV位必须为0;客户端发来的帧必须带掩码
+        if ((p[0] & 0x70) || !(p[1] & 0x80)) {
+            return false;
+        }
+        uint64_t len = p[1] & 0x7f;
+        size_t header = 2;
+        if (len == 126) {
+            if (avail < 4) {
+                break;
+            }
+            len = ((uint64_t)p[2] << 8) | p[3];
+            header = 4;
+        }
+        else if (len == 127) {
+            if (avail < 10) {
+                break;
+            }
+            len = 0;
+            for (int i = 0; i < 8; i++) {
+                len = (len << 8) | p[2 + i];
+            }
+            header = 10;
+        }
+        if (len > (uint64_t)WS_MAX_MESSAGE) {
+            return false;
+        }
+        if (avail < header + 4 + len) {
+            break;
+        }
+        unsigned char *payload = p + header + 4;
+        WsUnmask(payload, len, p + header);
+        if (!HandleFrame(opcode, fin, (const char*)payload, len)) {
+            return false;
+        }
+        pos += header + 4 + len;
+    }
+    in_.erase(0, pos);
+    return true;
+}
+
+bool WsSession::HandleFrame(int opcode, bool fin, const char *payload, int len)
+{
+    //控制帧不能分片,负载不超过125字节
+    if (opcode & 0x8) {
+        if (!fin || len > 125) {
+            return false;
+        }
+        switch (opcode)
+        {
+            case WS_PING:
+                return SendFrame(WS_PONG, payload, len);
+            case WS_PONG:
+                return true;
+            case WS_CLOSE:
+                //回显状态码后关闭,不再处理后续数据
+                closing_ = true;
+                return SendFrame(WS_CLOSE, payload, len >= 2 ? 2 : 0);
+            default:
+                return false;
+        }
+    }
+
+    if (opcode == WS_CONTINUATION) {
+        if (message_opcode_ == 0) {
+            return false;
+        }
+    }
+    else if (opcode == WS_TEXT || opcode == WS_BINARY) {
+        if (message_opcode_ != 0) {
+            return false;
+        }
+        //未分片的消息直接交给处理函数,不经过message_
+        if (fin) {
+            if (hub_->handler_) {
+                hub_->handler_(this, payload, len, opcode == WS_BINARY, hub_->arg_);
+            }
+            return true;
+        }
+        message_opcode_ = opcode;
+    }
+    else {
+        return false;
+    }
+
+    if (message_.size() + len > (size_t)WS_MAX_MESSAGE) {
+        return false;
+    }
+    message_.append(payload, len);
+    if (fin) {
+        if (hub_->handler_) {
+            hub_->handler_(this, message_.data(), message_.size(), message_opcode_ == WS_BINARY, hub_->arg_);
+        }
+        message_.clear();
+        message_opcode_ = 0;
+    }
+    return true;
+}
+
+/*
+Flush()
+    在锁内取出队列前若干条消息组成iovec,锁外writev,再在锁内弹出已发完的消息
+    发送期间只有本线程会弹出消息,Publish只在队尾追加,不影响已取出的指针
+*/
+int WsSession::Flush()
+{
+    while (true) {
+        struct iovec iov[WS_MAX_IOV];
+        int count = 0;
+        lock_.Lock();
+        for (size_t i = 0; i < queue_.size() && count < WS_MAX_IOV; i++) {
+            size_t skip = i == 0 ? front_sent_ : 0;
+            iov[count].iov_base = queue_[i]->data + skip;
+            iov[count].iov_len = queue_[i]->len - skip;
+            count++;
+        }
+        lock_.UnLock();
+        if (count == 0) {
+            return 1;
+        }
+
+        int temp = conn_->Writev(iov, count);
+        if (temp < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+
+        lock_.Lock();
+        size_t bytes = temp;
+        while (bytes > 0) {
+            WsMessage *msg = queue_.front();
+            size_t left = msg->len - front_sent_;
+            if (bytes < left) {
+                front_sent_ += bytes;
+                break;
+            }
+            bytes -= left;
+            front_sent_ = 0;
+            queued_bytes_ -= msg->len;
+            queue_.pop_front();
+            msg->Unref();
+        }
+        lock_.UnLock();
+    }
+}
+
+WebSocketHub::WebSocketHub(WsHandler handler, void *arg)
+    : lock_("ws_hub"), handler_(handler), arg_(arg)
+{
+}
+
+WebSocketHub::~WebSocketHub()
+{
+}
+
+/*
+Publish()
+    消息只编码一次,各连接的发送队列引用同一块内存
+*/
+int WebSocketHub::Publish(const char *data, int len, bool binary)
+{
+    return Broadcast(WsMessage::Frame(binary ? WsSession::WS_BINARY : WsSession::WS_TEXT, data, len));
+}
+
+int WebSocketHub::Ping()
+{
+    return Broadcast(WsMessage::Frame(WsSession::WS_PING, NULL, 0));
+}
+
+int WebSocketHub::Size()
+{
+    lock_.Lock();
+    int size = sessions_.size();
+    lock_.UnLock();
+    return size;
+}
+
+int WebSocketHub::Broadcast(WsMessage *msg)
+{
+    if (!msg) {
+        return 0;
+    }
+    int count = 0;
+    lock_.Lock();
+    for (size_t i = 0; i < sessions_.size(); ) {
+        if (sessions_[i]->Enqueue(msg)) {
+            count++;
+            i++;
+        }
+        else {
+            //已关闭或慢消费者,移出后i处换成了最后一个连接
+            RemoveAt(i);
+        }
+    }
+    lock_.UnLock();
+    msg->Unref();
+    return count;
+}
+
+void WebSocketHub::Subscribe(WsSession *session)
+{
+    lock_.Lock();
+    if (session->index_ < 0) {
+        session->index_ = sessions_.size();
+        sessions_.push_back(session);
+    }
+    lock_.UnLock();
+}
+
+void WebSocketHub::Unsubscribe(WsSession *session)
+{
+    lock_.Lock();
+    if (session->index_ >= 0) {
+        RemoveAt(session->index_);
+    }
+    lock_.UnLock();
+}
+
+//与最后一个交换后删除,O(1)
+void WebSocketHub::RemoveAt(int index)
+{
+    WsSession *removed = sessions_[index];
+    WsSession *last = sessions_.back();
+    sessions_[index] = last;
+    last->index_ = index;
+    sessions_.pop_back();
+    removed->index_ = -1;
+}
+
+HttpConn::HTTP_CODE WebSocketHub::Handshake(HttpRequest &req, HttpResponse &resp, void *arg)
+{
+    return resp.Upgrade((WebSocketHub*)arg);
+}
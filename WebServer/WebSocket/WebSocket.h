@@ -0,0 +1,145 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <stddef.h>
+#include <string>
+#include <deque>
+#include <vector>
+
+#include "../Http/HttpConn.h"
+#include "../Router/Router.h"
+#include "../ThreadPool/Locker.h"
+
+class WsSession;
+class WebSocketHub;
+
+const int WS_MAX_MESSAGE = 65536;               //收到的单条消息(含分片)上限
+const size_t WS_MAX_QUEUED_BYTES = 1 << 20;     //单个连接待发送字节上限,超过视为慢消费者
+const size_t WS_MAX_QUEUED_MESSAGES = 4096;     //单个连接待发送消息条数上限
+const int WS_MAX_IOV = 64;                      //一次writev最多的消息数
+
+/*
+已编码好的帧
+    广播时只序列化一次,所有订阅连接的发送队列共享同一块内存,引用计数归零时释放
+    握手的101响应也以该形式排在队列最前面
+*/
+struct WsMessage
+{
+    int refs;
+    int len;
+    char data[1];
+
+    static WsMessage* Frame(int opcode, const void *payload, int len);
+    static WsMessage* Raw(const void *data, int len);
+    void Ref();
+    void Unref();
+};
+
+//收到完整的文本/二进制消息时在工作线程中调用,data在返回后失效
+typedef void (*WsHandler)(WsSession *session, const char *data, int len, bool binary, void *arg);
+
+//对data原地异或4字节掩码,SSE2/AVX2可用时每次处理16/32字节
+void WsUnmask(unsigned char *data, size_t len, const unsigned char mask[4]);
+
+/*
+一个WebSocket连接
+    握手成功后由会话接管HttpConn的读写,连接不会再回到HTTP
+    发送队列可能被任意线程的Publish追加,而读写由工作线程完成:
+        busy_表示有工作线程正在处理该连接,此时追加的消息由该线程在结束前发出
+        否则追加者负责注册EPOLLOUT,armed_out_避免重复注册
+        EPOLLONESHOT触发后重新注册导致的并发任务通过rerun_合并给正在处理的线程
+*/
+class WsSession
+{
+public:
+    enum OPCODE
+    {
+        WS_CONTINUATION = 0x0,
+        WS_TEXT = 0x1,
+        WS_BINARY = 0x2,
+        WS_CLOSE = 0x8,
+        WS_PING = 0x9,
+        WS_PONG = 0xa
+    };
+
+public:
+    WsSession(HttpConn *conn, WebSocketHub *hub);
+    ~WsSession();
+
+    //由Sec-WebSocket-Key计算Sec-WebSocket-Accept,accept至少29字节
+    static void AcceptKey(const char *key, char *accept);
+
+    void Start(const char *handshake, int len);     //排入101响应并加入订阅
+    bool Send(const char *data, int len, bool binary = false);  //单播
+    bool Enqueue(WsMessage *msg);                   //超过慢消费者限制时返回false并关闭连接
+    bool OnEvent(bool readable);                    //工作线程入口,返回false时关闭连接
+    void Close();                                   //连接已关闭或即将关闭,退订并丢弃队列
+
+    WebSocketHub* Hub() { return hub_; }
+    HttpConn* Conn() { return conn_; }
+
+private:
+    friend class WebSocketHub;
+
+    bool ReadFrames();
+    bool ParseFrames();
+    bool SendFrame(int opcode, const char *payload, int len);
+    bool HandleFrame(int opcode, bool fin, const char *payload, int len);
+    int Flush();    //1:队列已空 0:EAGAIN -1:出错
+    void ClearQueue();
+
+private:
+    HttpConn *conn_;
+    WebSocketHub *hub_;
+    int index_;                     //在hub_->sessions_中的下标,-1表示未订阅,受hub锁保护
+
+    Locker lock_;                   //保护以下发送状态
+    std::deque<WsMessage*> queue_;
+    size_t queued_bytes_;
+    size_t front_sent_;             //队首消息已发送的字节数
+    bool busy_;
+    bool rerun_;
+    bool armed_out_;
+    bool closed_;
+
+    //以下只由持有busy_的工作线程访问
+    std::string in_;                //收到但尚未处理的字节
+    std::string message_;           //正在拼接的分片消息
+    int message_opcode_;            //分片消息的类型,0表示没有
+    bool closing_;                  //已回复CLOSE帧,发送完毕后关闭连接
+};
+
+/*
+广播频道
+    WebServer::AddWebSocket为每个路径创建一个,连接握手后自动订阅
+    Publish可以在任意线程调用,慢消费者被直接移出并关闭,不会拖慢其他连接
+*/
+class WebSocketHub
+{
+public:
+    WebSocketHub(WsHandler handler, void *arg);
+    ~WebSocketHub();
+
+    int Publish(const char *data, int len, bool binary = false);   //返回投递到的连接数
+    int Ping();                     //向所有连接发送PING,用于保活和发现失效连接
+    int Size();
+
+    //路由处理函数,arg为WebSocketHub*
+    static HttpConn::HTTP_CODE Handshake(HttpRequest &req, HttpResponse &resp, void *arg);
+
+private:
+    friend class WsSession;
+
+    int Broadcast(WsMessage *msg);
+    void Subscribe(WsSession *session);
+    void Unsubscribe(WsSession *session);
+    void RemoveAt(int index);
+
+private:
+    Locker lock_;
+    std::vector<WsSession*> sessions_;
+    WsHandler handler_;
+    void *arg_;
+};
+
+#endif
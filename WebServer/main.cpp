@@ -1,5 +1,10 @@
 #include "./WebServer/WebServer.h"
 
+static void Broadcast(WsSession* session, const char* data, int len, bool binary, void* arg)
+{
+    session->Hub()->Publish(data, len, binary);
+}
+
 int main(int argc, char* argv[])
 {
     //暂时未设置命令行解析
@@ -12,6 +17,42 @@ int main(int argc, char* argv[])
     int max_queue_nums = 10000;
 
     WebServer webserver(port, thread_nums, max_queue_nums);
+
+    //./server port cert.pem key.pem 开启TLS
+    if (argc >= 4) {
+        webserver.EnableTls(argv[2], argv[3]);
+    }
+
+    //WORKERS=进程数 时以多进程模式运行;用户表和WebSocket频道只在进程内有效,这时不开启
+    int workers = getenv("WORKERS") ? atoi(getenv("WORKERS")) : 0;
+
+    //注册/登录使用的用户表
+    if (workers <= 0) {
+        webserver.EnableUserStore("./users.log");
+    }
+
+    //GET /stats查看连接和淘汰计数
+    webserver.EnableStats();
+
+    //静态小文件的完整响应缓存在内存中
+    webserver.EnableResponseCache();
+    //URL解析结果和不存在的路径缓存在内存中
+    webserver.EnablePathCache();
+
+    //CAPTURE=文件名 时录制收到的请求,之后用capture_replay重放
+    if (getenv("CAPTURE")) {
+        webserver.EnableCapture(getenv("CAPTURE"));
+    }
+
+    //简单的广播频道:任一客户端发来的消息转发给所有订阅者
+    if (workers <= 0) {
+        webserver.AddWebSocket("/ws", Broadcast);
+    }
+
+    //master在Prefork中等待并重启worker,不会返回;失败时以单进程运行
+    if (workers > 0 && !webserver.Prefork(workers)) {
+        printf("prefork failure, running in a single process\n");
+    }
     
     //创建线程池
     webserver.CreateThreadPool();